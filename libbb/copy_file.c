@@ -173,8 +173,19 @@ int copy_file(const char *source, const char *dest, int flags)
 			goto end;
 		}
 
-		if (copy_file_chunk(sfp, dfp, -1) < 0)
+		/* in-kernel copy first; drop to the buffered loop only
+		 * when the kernel or filesystem cannot do it */
+		switch (copy_fd_fast(fileno(sfp), fileno(dfp))) {
+		case 0:
+			break;
+		case 1:
+			if (copy_file_chunk(sfp, dfp, -1) < 0)
+				status = -1;
+			break;
+		default:
+			perror_msg("unable to copy `%s'", source);
 			status = -1;
+		}
 
 		if (fclose(dfp) < 0) {
 			perror_msg("unable to close `%s'", dest);
@@ -29,6 +29,9 @@
 #include <sys/wait.h>
 
 #include "gzip.h"
+#include "libbb.h"
+
+#define GZIP_RING_BUF	(256 * 1024)
 
 static void to_devnull(int fd)
 {
@@ -41,17 +44,53 @@ static void to_devnull(int fd)
 		close(devnull);
 }
 
+/*
+ * Pick the decompressor from the stream's magic bytes; anything
+ * unrecognized falls through to gzip, preserving the historic
+ * behavior for headerless input.
+ */
+static const char *gzip_sniff_prog(const unsigned char *magic, ssize_t len)
+{
+	if (len >= 6 && memcmp(magic, "\xfd" "7zXZ\x00", 6) == 0)
+		return "xz";
+
+	if (len >= 4 && memcmp(magic, "\x28\xb5\x2f\xfd", 4) == 0)
+		return "zstd";
+
+	return "gzip";
+}
+
 static void *gzip_thread(void *ptr)
 {
 	struct gzip_handle *zh = ptr;
 	char buf[4096];
+	ssize_t limit = zh->input_limit;
+	ssize_t want;
 	int len = 0, ret;
 
+	/* the magic bytes were consumed from the source by the sniff;
+	 * hand them to the child before everything else */
+	if (zh->peek_len > 0) {
+		do {
+			ret = write(zh->wfd, zh->peek, zh->peek_len);
+		} while (ret == -1 && errno == EINTR);
+
+		if (limit) {
+			limit -= zh->peek_len;
+			if (limit <= 0)
+				goto out;
+		}
+	}
+
 	while (1) {
+		want = sizeof(buf);
+		if (limit && limit < want)
+			want = limit;
+
 		if (zh->file)
-			len = fread(buf, 1, sizeof(buf), zh->file);
+			len = fread(buf, 1, want, zh->file);
 		else if (zh->gzip)
-			len = gzip_read(zh->gzip, buf, sizeof(buf));
+			len = gzip_read(zh->gzip, buf, want);
 
 		if (len <= 0)
 			break;
@@ -59,8 +98,15 @@ static void *gzip_thread(void *ptr)
 		do {
 			ret = write(zh->wfd, buf, len);
 		} while (ret == -1 && errno == EINTR);
+
+		if (limit) {
+			limit -= len;
+			if (!limit)
+				break;
+		}
 	}
 
+out:
 	close(zh->wfd);
 	zh->wfd = -1;
 
@@ -72,9 +118,39 @@ int gzip_exec(struct gzip_handle *zh, const char *filename)
 	int rpipe[2] = { -1, -1 }, wpipe[2] = {
 	-1, -1};
 	struct sigaction pipe_sa = {.sa_handler = SIG_IGN };
+	const char *prog;
+	ssize_t want = sizeof(zh->peek);
 
 	zh->rfd = -1;
 	zh->wfd = -1;
+	zh->peek_len = 0;
+
+	/* look at the leading magic bytes to decide which decompressor
+	 * to hand the stream to */
+	if (filename) {
+		FILE *mf = fopen(filename, "r");
+
+		if (mf) {
+			zh->peek_len = fread(zh->peek, 1, want, mf);
+			fclose(mf);
+		}
+
+		prog = gzip_sniff_prog(zh->peek, zh->peek_len);
+		zh->peek_len = 0;	/* the child reads the file itself */
+	} else {
+		if (zh->input_limit && zh->input_limit < want)
+			want = zh->input_limit;
+
+		if (zh->file)
+			zh->peek_len = fread(zh->peek, 1, want, zh->file);
+		else if (zh->gzip)
+			zh->peek_len = gzip_read(zh->gzip, zh->peek, want);
+
+		if (zh->peek_len < 0)
+			zh->peek_len = 0;
+
+		prog = gzip_sniff_prog(zh->peek, zh->peek_len);
+	}
 
 	if (sigaction(SIGPIPE, &pipe_sa, &zh->pipe_sa) < 0)
 		return -1;
@@ -109,7 +185,7 @@ int gzip_exec(struct gzip_handle *zh, const char *filename)
 		close(rpipe[0]);
 		close(rpipe[1]);
 
-		execlp("gzip", "gzip", "-d", "-c", filename, NULL);
+		execlp(prog, prog, "-d", "-c", filename, NULL);
 		exit(-1);
 
 	default:
@@ -130,15 +206,103 @@ int gzip_exec(struct gzip_handle *zh, const char *filename)
 	return 0;
 }
 
-ssize_t gzip_read(struct gzip_handle * zh, void *buf, ssize_t len)
+/*
+ * Read-ahead thread: drains the decompressor's pipe into the ring so
+ * the child keeps inflating while the consumer is busy writing files.
+ * The read() itself runs outside the lock - the head region is free
+ * space no consumer touches - so the mutex only guards the indices.
+ */
+static void *gzip_reader_thread(void *ptr)
 {
-	ssize_t ret;
+	struct gzip_handle *zh = ptr;
+	size_t chunk;
+	ssize_t n;
 
-	do {
-		ret = read(zh->rfd, buf, len);
-	} while (ret == -1 && errno != EINTR);
+	while (1) {
+		pthread_mutex_lock(&zh->ring_lock);
+		while (zh->ring_fill == GZIP_RING_BUF && !zh->ring_closed)
+			pthread_cond_wait(&zh->ring_can_write, &zh->ring_lock);
+		if (zh->ring_closed) {
+			pthread_mutex_unlock(&zh->ring_lock);
+			return NULL;
+		}
+		chunk = GZIP_RING_BUF - zh->ring_fill;
+		if (chunk > GZIP_RING_BUF - zh->ring_head)
+			chunk = GZIP_RING_BUF - zh->ring_head;
+		pthread_mutex_unlock(&zh->ring_lock);
 
-	return ret;
+		do {
+			n = read(zh->rfd, zh->ring + zh->ring_head, chunk);
+		} while (n == -1 && errno == EINTR);
+
+		pthread_mutex_lock(&zh->ring_lock);
+		if (n <= 0) {
+			zh->ring_eof = 1;
+			pthread_cond_signal(&zh->ring_can_read);
+			pthread_mutex_unlock(&zh->ring_lock);
+			return NULL;
+		}
+		zh->ring_head = (zh->ring_head + n) % GZIP_RING_BUF;
+		zh->ring_fill += n;
+		pthread_cond_signal(&zh->ring_can_read);
+		pthread_mutex_unlock(&zh->ring_lock);
+	}
+}
+
+static void gzip_reader_start(struct gzip_handle *zh)
+{
+	zh->ring = xmalloc(GZIP_RING_BUF);
+	zh->ring_head = zh->ring_tail = zh->ring_fill = 0;
+	zh->ring_eof = zh->ring_closed = 0;
+
+	pthread_mutex_init(&zh->ring_lock, NULL);
+	pthread_cond_init(&zh->ring_can_read, NULL);
+	pthread_cond_init(&zh->ring_can_write, NULL);
+
+	if (pthread_create(&zh->rd_thread, NULL, gzip_reader_thread, zh) == 0)
+		zh->rd_started = 1;
+	else
+		zh->ring_eof = 1;	/* consumer falls off at once */
+}
+
+/* decompressed bytes are served out of the read-ahead ring; callers
+ * get full reads (short only at end of stream) */
+ssize_t gzip_read(struct gzip_handle * zh, void *buf, ssize_t len)
+{
+	ssize_t total = 0;
+	size_t chunk;
+
+	if (zh->ring == NULL)
+		gzip_reader_start(zh);
+
+	while (total < len) {
+		pthread_mutex_lock(&zh->ring_lock);
+		while (zh->ring_fill == 0 && !zh->ring_eof)
+			pthread_cond_wait(&zh->ring_can_read, &zh->ring_lock);
+		if (zh->ring_fill == 0) {
+			pthread_mutex_unlock(&zh->ring_lock);
+			break;
+		}
+		chunk = zh->ring_fill;
+		if (chunk > (size_t)(len - total))
+			chunk = len - total;
+		if (chunk > GZIP_RING_BUF - zh->ring_tail)
+			chunk = GZIP_RING_BUF - zh->ring_tail;
+		pthread_mutex_unlock(&zh->ring_lock);
+
+		/* the tail region stays ours until ring_fill is dropped,
+		 * so the copy can run unlocked */
+		memcpy((char *)buf + total, zh->ring + zh->ring_tail, chunk);
+		total += chunk;
+
+		pthread_mutex_lock(&zh->ring_lock);
+		zh->ring_tail = (zh->ring_tail + chunk) % GZIP_RING_BUF;
+		zh->ring_fill -= chunk;
+		pthread_cond_signal(&zh->ring_can_write);
+		pthread_mutex_unlock(&zh->ring_lock);
+	}
+
+	return total;
 }
 
 ssize_t gzip_copy(struct gzip_handle * zh, FILE * out, ssize_t len)
@@ -181,9 +345,6 @@ int gzip_close(struct gzip_handle *zh)
 {
 	int code = -1;
 
-	if (zh->rfd >= 0)
-		close(zh->rfd);
-
 	if (zh->wfd >= 0)
 		close(zh->wfd);
 
@@ -192,12 +353,33 @@ int gzip_close(struct gzip_handle *zh)
 		waitpid(zh->pid, &code, 0);
 	}
 
+	/* the child is gone, so a reader blocked in read() sees EOF; one
+	 * blocked on a full ring still needs a wakeup */
+	if (zh->rd_started) {
+		pthread_mutex_lock(&zh->ring_lock);
+		zh->ring_closed = 1;
+		pthread_cond_signal(&zh->ring_can_write);
+		pthread_mutex_unlock(&zh->ring_lock);
+		pthread_join(zh->rd_thread, NULL);
+
+		pthread_mutex_destroy(&zh->ring_lock);
+		pthread_cond_destroy(&zh->ring_can_read);
+		pthread_cond_destroy(&zh->ring_can_write);
+		zh->rd_started = 0;
+	}
+
+	if (zh->rfd >= 0)
+		close(zh->rfd);
+
 	if (zh->file)
 		fclose(zh->file);
 
 	if (zh->thread)
 		pthread_join(zh->thread, NULL);
 
+	free(zh->ring);
+	zh->ring = NULL;
+
 	sigaction(SIGPIPE, &zh->pipe_sa, NULL);
 
 	return WIFEXITED(code) ? WEXITSTATUS(code) : -1;
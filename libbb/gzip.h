@@ -26,6 +26,27 @@ struct gzip_handle {
 	FILE *file;
 	struct gzip_handle *gzip;
 
+	/* when reading from a parent gzip stream, feed the child at most
+	 * this many bytes (0: unlimited), so the parent stream stays
+	 * positioned right behind the member when we are done with it */
+	ssize_t input_limit;
+
+	/* read-side ring buffer, filled by a read-ahead thread started
+	 * lazily from gzip_read(), so the decompressor keeps running
+	 * while the consumer is busy writing files */
+	char *ring;
+	size_t ring_head, ring_tail, ring_fill;
+	int ring_eof, ring_closed;
+	pthread_mutex_t ring_lock;
+	pthread_cond_t ring_can_read, ring_can_write;
+	pthread_t rd_thread;
+	int rd_started;
+
+	/* bytes sniffed off the source to pick the decompressor; the
+	 * feeder thread replays them to the child before the rest */
+	unsigned char peek[6];
+	ssize_t peek_len;
+
 	pid_t pid;
 	int rfd, wfd;
 	struct sigaction pipe_sa;
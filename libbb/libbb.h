@@ -56,6 +56,7 @@ const char *mode_string(int mode);
 const char *time_string(time_t timeVal);
 
 int copy_file(const char *source, const char *dest, int flags);
+int copy_fd_fast(int src_fd, int dst_fd);
 int copy_file_chunk(FILE * src_file, FILE * dst_file,
 		    unsigned long long chunksize);
 ssize_t safe_read(int fd, void *buf, size_t count);
@@ -73,6 +74,36 @@ extern char *xstrdup(const char *s);
 extern char *xstrndup(const char *s, int n);
 extern char *safe_strncpy(char *dst, const char *src, size_t size);
 
+/* running totals of x*alloc calls and bytes requested */
+extern unsigned long long xalloc_count;
+extern unsigned long long xalloc_bytes;
+
+/*
+ * Per-subsystem allocation accounting. A caller brackets a subsystem's
+ * work with xalloc_tag_set() and every x*alloc on that thread is billed
+ * to the tag; since free() is not funnelled through here the figures
+ * are cumulative bytes requested, which for the load-time structures
+ * (never freed before exit) equals what they hold at peak.
+ */
+enum xalloc_tag {
+	XALLOC_TAG_NONE,
+	XALLOC_TAG_PARSER,
+	XALLOC_TAG_DEPENDS,
+	XALLOC_TAG_FILE_HASH,
+	XALLOC_TAG_DOWNLOAD,
+	__XALLOC_TAG_MAX
+};
+
+struct xalloc_stat {
+	unsigned long long count;
+	unsigned long long bytes;
+};
+
+extern struct xalloc_stat xalloc_stats[__XALLOC_TAG_MAX];
+
+/* returns the previous tag so nested scopes can restore it */
+enum xalloc_tag xalloc_tag_set(enum xalloc_tag tag);
+
 char *xreadlink(const char *path);
 char *concat_path_file(const char *path, const char *filename);
 char *last_char_is(const char *s, int c);
@@ -108,6 +139,17 @@ char *deb_extract(const char *package_filename, FILE * out_stream,
 		  const int extract_function, const char *prefix,
 		  const char *filename, int *err);
 
+/* single-pass walk over a .ipk: open once, visit members in file
+ * order (see unarchive.c) */
+struct deb_session;
+
+struct deb_session *deb_session_open(const char *package_filename);
+int deb_session_member(struct deb_session *s, const char *member);
+char *deb_session_extract(struct deb_session *s, FILE * out_stream,
+			  int extract_function, const char *prefix,
+			  const char *filename, int *err);
+void deb_session_close(struct deb_session *s);
+
 extern int unzip(FILE * l_in_file, FILE * l_out_file);
 extern int gz_close(int gunzip_pid);
 extern FILE *gz_open(FILE * compressed_file, int *pid);
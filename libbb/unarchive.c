@@ -21,24 +21,108 @@
 
 #include <stdio.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <utime.h>
 #include <libgen.h>
 
 #include "libbb.h"
 #include "gzip.h"
+#include "../libopkg/opkg_profile.h"
 
 #define CONFIG_FEATURE_TAR_OLDGNU_COMPATABILITY 1
 #define CONFIG_FEATURE_TAR_GNU_EXTENSIONS
 
 #ifdef CONFIG_FEATURE_TAR_GNU_EXTENSIONS
-static char *longname = NULL;
-static char *linkname = NULL;
+static __thread char *longname = NULL;
+static __thread char *linkname = NULL;
 #endif
 
-off_t archive_offset;
+__thread off_t archive_offset;
+
+/*
+ * Parent-directory fd cache for filesystem extraction. Resolving every
+ * entry's destination from scratch makes the kernel walk the whole
+ * dentry chain per file, which adds up under a long offline-root
+ * prefix. Entries in a tar stream cluster by directory, so a handful
+ * of cached fds turns almost every resolution into a single lookup
+ * relative to an already-open parent. Slots are recycled round-robin;
+ * the cache is per-thread like the rest of the extraction state, and
+ * unarchive() flushes it when the stream ends.
+ */
+#define DIR_FD_CACHE_SIZE 8
+
+static __thread struct {
+	char *path;
+	int fd;
+} dir_fd_cache[DIR_FD_CACHE_SIZE];
+static __thread int dir_fd_cache_next;
+
+static void dir_fd_cache_flush(void)
+{
+	int i;
+
+	for (i = 0; i < DIR_FD_CACHE_SIZE; i++) {
+		if (!dir_fd_cache[i].path)
+			continue;
+		free(dir_fd_cache[i].path);
+		close(dir_fd_cache[i].fd);
+		dir_fd_cache[i].path = NULL;
+	}
+	dir_fd_cache_next = 0;
+}
+
+/* Split full_name into a parent directory fd and the entry's base
+ * name. Whenever a relative lookup is not possible (no parent
+ * component, trailing slash, unopenable parent) it degrades to
+ * (AT_FDCWD, full_name), so the result is always safe to hand to the
+ * *at() family. A cache hit also proves the leading directories
+ * exist. */
+static int dir_fd_cache_resolve(const char *full_name, const char **basep)
+{
+	const char *slash = strrchr(full_name, '/');
+	char *parent;
+	int i, fd;
+
+	*basep = full_name;
+
+	if (!slash || slash[1] == '\0')
+		return AT_FDCWD;
+
+	parent = xstrdup(full_name);
+	if (slash == full_name)
+		strcpy(parent, "/");
+	else
+		parent[slash - full_name] = '\0';
+
+	for (i = 0; i < DIR_FD_CACHE_SIZE; i++) {
+		if (dir_fd_cache[i].path
+		    && strcmp(dir_fd_cache[i].path, parent) == 0) {
+			free(parent);
+			*basep = slash + 1;
+			return dir_fd_cache[i].fd;
+		}
+	}
+
+	fd = open(parent, O_RDONLY | O_DIRECTORY);
+	if (fd < 0) {
+		free(parent);
+		return AT_FDCWD;
+	}
+
+	i = dir_fd_cache_next;
+	dir_fd_cache_next = (dir_fd_cache_next + 1) % DIR_FD_CACHE_SIZE;
+	if (dir_fd_cache[i].path) {
+		free(dir_fd_cache[i].path);
+		close(dir_fd_cache[i].fd);
+	}
+	dir_fd_cache[i].path = parent;
+	dir_fd_cache[i].fd = fd;
+
+	*basep = slash + 1;
+	return fd;
+}
 
 static ssize_t seek_forward(struct gzip_handle *zh, ssize_t len)
 {
@@ -70,7 +154,6 @@ static char *extract_archive(struct gzip_handle *src_stream, FILE * out_stream,
 	char *full_name = NULL;
 	char *full_link_name = NULL;
 	char *buffer = NULL;
-	struct utimbuf t;
 
 	*err = 0;
 
@@ -118,13 +201,18 @@ static char *extract_archive(struct gzip_handle *src_stream, FILE * out_stream,
 		}
 	} else if (function & extract_all_to_fs) {
 		struct stat oldfile;
-		int stat_res;
-		stat_res = lstat(full_name, &oldfile);
+		const char *base_name;
+		int dir_fd, stat_res;
+
+		dir_fd = dir_fd_cache_resolve(full_name, &base_name);
+		stat_res = fstatat(dir_fd, base_name, &oldfile,
+				   AT_SYMLINK_NOFOLLOW);
 		if (stat_res == 0) {	/* The file already exists */
 			if ((function & extract_unconditional)
 			    || (oldfile.st_mtime < file_entry->mtime)) {
 				if (!S_ISDIR(oldfile.st_mode)) {
-					unlink(full_name);	/* Directories might not be empty etc */
+					/* Directories might not be empty etc */
+					unlinkat(dir_fd, base_name, 0);
 				}
 			} else {
 				if ((function & extract_quiet) != extract_quiet) {
@@ -137,7 +225,10 @@ static char *extract_archive(struct gzip_handle *src_stream, FILE * out_stream,
 				goto cleanup;
 			}
 		}
-		if (function & extract_create_leading_dirs) {	/* Create leading directories with default umask */
+		/* Create leading directories with default umask; a cached
+		   parent fd proves they already exist */
+		if (dir_fd == AT_FDCWD
+		    && (function & extract_create_leading_dirs)) {
 			char *buf, *parent;
 			buf = xstrdup(full_name);
 			parent = dirname(buf);
@@ -149,11 +240,13 @@ static char *extract_archive(struct gzip_handle *src_stream, FILE * out_stream,
 				}
 			}
 			free(buf);
+			dir_fd = dir_fd_cache_resolve(full_name, &base_name);
 		}
 		switch (file_entry->mode & S_IFMT) {
 		case S_IFREG:
 			if (file_entry->link_name) {	/* Found a cpio hard link */
-				if (link(full_link_name, full_name) != 0) {
+				if (linkat(AT_FDCWD, full_link_name,
+					   dir_fd, base_name, 0) != 0) {
 					if ((function & extract_quiet) !=
 					    extract_quiet) {
 						*err = -1;
@@ -164,8 +257,16 @@ static char *extract_archive(struct gzip_handle *src_stream, FILE * out_stream,
 					}
 				}
 			} else {
-				if ((dst_stream =
-				     wfopen(full_name, "w")) == NULL) {
+				int out_fd = openat(dir_fd, base_name,
+						    O_WRONLY | O_CREAT
+						    | O_TRUNC, 0666);
+
+				if (out_fd >= 0)
+					dst_stream = fdopen(out_fd, "w");
+				if (dst_stream == NULL) {
+					perror_msg("%s", full_name);
+					if (out_fd >= 0)
+						close(out_fd);
 					*err = -1;
 					seek_forward(src_stream,
 						     file_entry->size);
@@ -180,7 +281,8 @@ static char *extract_archive(struct gzip_handle *src_stream, FILE * out_stream,
 			break;
 		case S_IFDIR:
 			if (stat_res != 0) {
-				if (mkdir(full_name, file_entry->mode) < 0) {
+				if (mkdirat(dir_fd, base_name,
+					    file_entry->mode) < 0) {
 					if ((function & extract_quiet) !=
 					    extract_quiet) {
 						*err = -1;
@@ -191,7 +293,8 @@ static char *extract_archive(struct gzip_handle *src_stream, FILE * out_stream,
 			}
 			break;
 		case S_IFLNK:
-			if (symlink(file_entry->link_name, full_name) < 0) {
+			if (symlinkat(file_entry->link_name,
+				      dir_fd, base_name) < 0) {
 				if ((function & extract_quiet) != extract_quiet) {
 					*err = -1;
 					perror_msg
@@ -206,8 +309,8 @@ static char *extract_archive(struct gzip_handle *src_stream, FILE * out_stream,
 		case S_IFBLK:
 		case S_IFCHR:
 		case S_IFIFO:
-			if (mknod
-			    (full_name, file_entry->mode,
+			if (mknodat
+			    (dir_fd, base_name, file_entry->mode,
 			     file_entry->device) == -1) {
 				if ((function & extract_quiet) != extract_quiet) {
 					*err = -1;
@@ -228,16 +331,21 @@ static char *extract_archive(struct gzip_handle *src_stream, FILE * out_stream,
 		 * does the right thing, but isnt available in older versions of libc */
 		if (S_ISLNK(file_entry->mode)) {
 #if (__GLIBC__ > 2) && (__GLIBC_MINOR__ > 1)
-			lchown(full_name, file_entry->uid, file_entry->gid);
+			fchownat(dir_fd, base_name, file_entry->uid,
+				 file_entry->gid, AT_SYMLINK_NOFOLLOW);
 #endif
 		} else {
 			if (function & extract_preserve_date) {
-				t.actime = file_entry->mtime;
-				t.modtime = file_entry->mtime;
-				utime(full_name, &t);
+				struct timespec ts[2];
+
+				ts[0].tv_sec = file_entry->mtime;
+				ts[0].tv_nsec = 0;
+				ts[1] = ts[0];
+				utimensat(dir_fd, base_name, ts, 0);
 			}
-			chown(full_name, file_entry->uid, file_entry->gid);
-			chmod(full_name, file_entry->mode);
+			fchownat(dir_fd, base_name, file_entry->uid,
+				 file_entry->gid, 0);
+			fchmodat(dir_fd, base_name, file_entry->mode, 0);
 		}
 	} else {
 		/* If we arent extracting data we have to skip it,
@@ -313,6 +421,7 @@ static char *unarchive(struct gzip_handle *src_stream, FILE * out_stream,
 			buffer = extract_archive(src_stream, out_stream,
 						 file_entry, extract_function,
 						 prefix, err);
+			opkg_count_add(OPKG_COUNT_FILES_EXTRACTED, 1);
 			*err = 0;	/* XXX: ignore extraction errors */
 			if (*err) {
 				free_headers(file_entry);
@@ -325,6 +434,8 @@ static char *unarchive(struct gzip_handle *src_stream, FILE * out_stream,
 		free_headers(file_entry);
 	}
 
+	dir_fd_cache_flush();
+
 	return buffer;
 }
 
@@ -518,81 +629,172 @@ static void free_header_tar(file_header_t * tar_entry)
 	free(tar_entry);
 }
 
-char *deb_extract(const char *package_filename, FILE * out_stream,
-		  const int extract_function, const char *prefix,
-		  const char *filename, int *err)
+/*
+ * A single pass over a .ipk: the package is opened (and the outer
+ * archive decompressed) once, and the members are visited strictly in
+ * file order. Feeding the inner decompressor exactly the member's
+ * byte count (via gzip_handle.input_limit) keeps the outer stream
+ * positioned right behind the member, so the walk can continue to the
+ * next one instead of rescanning from the start.
+ */
+struct deb_session {
+	FILE *file;
+	struct gzip_handle outer;
+	struct gzip_handle inner;
+	int in_member;
+	off_t outer_offset;	/* outer position while the inner tar
+				   walk owns archive_offset */
+	off_t member_size;
+};
+
+/* drain and shut down the current member, repositioning the outer walk */
+static void deb_session_member_finish(struct deb_session *s)
 {
-	FILE *deb_stream = NULL;
-	const char **file_list = NULL;
-	char *output_buffer = NULL;
-	char *ared_file = NULL;
-	struct gzip_handle tar_outer = { }, tar_inner = { };
-	file_header_t *tar_header;
+	char buf[4096];
 
-	*err = 0;
+	if (!s->in_member)
+		return;
 
-	if (filename != NULL) {
-		file_list = xmalloc(sizeof(char *) * 2);
-		file_list[0] = filename;
-		file_list[1] = NULL;
-	}
+	/* read to EOF so the bounded feeder reaches the member boundary
+	 * before the decompressor goes away */
+	while (gzip_read(&s->inner, buf, sizeof(buf)) > 0) ;
+	gzip_close(&s->inner);
 
-	if (extract_function & extract_control_tar_gz) {
-		ared_file = "control.tar.gz";
-	} else if (extract_function & extract_data_tar_gz) {
-		ared_file = "data.tar.gz";
-	} else {
-		opkg_msg(ERROR, "Internal error: extract_function=%x\n",
-			 extract_function);
-		*err = -1;
-		goto cleanup;
-	}
+	s->in_member = 0;
+	s->outer_offset += s->member_size;
+	archive_offset = s->outer_offset;
+}
 
-	/* open the debian package to be worked on */
-	deb_stream = wfopen(package_filename, "r");
-	if (deb_stream == NULL) {
-		*err = -1;
-		goto cleanup;
+struct deb_session *deb_session_open(const char *package_filename)
+{
+	struct deb_session *s = xcalloc(1, sizeof(*s));
+
+	s->file = wfopen(package_filename, "r");
+	if (s->file == NULL) {
+		free(s);
+		return NULL;
 	}
 	/* set the buffer size */
-	setvbuf(deb_stream, NULL, _IOFBF, 0x8000);
+	setvbuf(s->file, NULL, _IOFBF, 0x8000);
 
-	tar_outer.file = deb_stream;
-	gzip_exec(&tar_outer, NULL);
+	s->outer.file = s->file;
+	if (gzip_exec(&s->outer, NULL) != 0) {
+		fclose(s->file);
+		free(s);
+		return NULL;
+	}
 
-	/* walk through outer tar file to find ared_file */
-	while ((tar_header = get_header_tar(&tar_outer)) != NULL) {
-		int name_offset = 0;
-		if (strncmp(tar_header->name, "./", 2) == 0)
-			name_offset = 2;
+	archive_offset = 0;
+	return s;
+}
+
+/*
+ * advance (forward only) to the named member; 0 when positioned on it.
+ * The member name is matched up to the compression extension, so
+ * "control.tar" finds control.tar.gz, control.tar.xz and control.tar.zst
+ * alike; the decompressor is picked from the member's magic bytes.
+ */
+int deb_session_member(struct deb_session *s, const char *member)
+{
+	file_header_t *tar_header;
+	size_t member_len = strlen(member);
 
-		if (strcmp(ared_file, tar_header->name + name_offset) == 0) {
-			tar_inner.gzip = &tar_outer;
-			gzip_exec(&tar_inner, NULL);
+	deb_session_member_finish(s);
 
-			archive_offset = 0;
+	while ((tar_header = get_header_tar(&s->outer)) != NULL) {
+		const char *name = tar_header->name;
 
-			output_buffer = unarchive(&tar_inner,
-						  out_stream,
-						  get_header_tar,
-						  free_header_tar,
-						  extract_function,
-						  prefix, file_list, err);
+		if (strncmp(name, "./", 2) == 0)
+			name += 2;
 
+		if (strncmp(member, name, member_len) == 0
+		    && (name[member_len] == '\0' || name[member_len] == '.')
+		    && tar_header->size > 0) {
+			s->member_size = tar_header->size;
+			s->outer_offset = archive_offset;
 			free_header_tar(tar_header);
-			gzip_close(&tar_inner);
-			break;
+
+			memset(&s->inner, 0, sizeof(s->inner));
+			s->inner.gzip = &s->outer;
+			s->inner.input_limit = s->member_size;
+			if (gzip_exec(&s->inner, NULL) != 0)
+				return -1;
+
+			s->in_member = 1;
+			return 0;
 		}
 
-		seek_forward(&tar_outer, tar_header->size);
+		seek_forward(&s->outer, tar_header->size);
 		free_header_tar(tar_header);
 	}
 
-cleanup:
-	gzip_close(&tar_outer);
+	return -1;
+}
+
+/* run one of the extract_functions over the member we are positioned on */
+char *deb_session_extract(struct deb_session *s, FILE * out_stream,
+			  int extract_function, const char *prefix,
+			  const char *filename, int *err)
+{
+	const char *file_list[2] = { filename, NULL };
+	char *output_buffer;
+
+	if (!s->in_member) {
+		*err = -1;
+		return NULL;
+	}
+
+	output_buffer = unarchive(&s->inner, out_stream, get_header_tar,
+				  free_header_tar, extract_function, prefix,
+				  filename ? file_list : NULL, err);
+	deb_session_member_finish(s);
+
+	return output_buffer;
+}
+
+void deb_session_close(struct deb_session *s)
+{
+	if (s == NULL)
+		return;
+
+	deb_session_member_finish(s);
+	gzip_close(&s->outer);	/* also closes the package file */
+	free(s);
+}
+
+char *deb_extract(const char *package_filename, FILE * out_stream,
+		  const int extract_function, const char *prefix,
+		  const char *filename, int *err)
+{
+	struct deb_session *s;
+	char *output_buffer = NULL;
+	const char *ared_file;
+
+	*err = 0;
+
+	if (extract_function & extract_control_tar_gz) {
+		ared_file = "control.tar";
+	} else if (extract_function & extract_data_tar_gz) {
+		ared_file = "data.tar";
+	} else {
+		opkg_msg(ERROR, "Internal error: extract_function=%x\n",
+			 extract_function);
+		*err = -1;
+		return NULL;
+	}
+
+	s = deb_session_open(package_filename);
+	if (s == NULL) {
+		*err = -1;
+		return NULL;
+	}
+
+	if (deb_session_member(s, ared_file) == 0)
+		output_buffer = deb_session_extract(s, out_stream,
+						    extract_function,
+						    prefix, filename, err);
 
-	if (file_list)
-		free(file_list);
+	deb_session_close(s);
 
 	return output_buffer;
 }
@@ -25,11 +25,42 @@
 #include <unistd.h>
 #include "libbb.h"
 
+/* allocation counters reported by the stats sub-command */
+unsigned long long xalloc_count;
+unsigned long long xalloc_bytes;
+
+/* per-subsystem accounting: the tag is per-thread, the totals are
+ * shared and updated with relaxed atomics like the other telemetry */
+struct xalloc_stat xalloc_stats[__XALLOC_TAG_MAX];
+static __thread enum xalloc_tag cur_tag;
+
+enum xalloc_tag xalloc_tag_set(enum xalloc_tag tag)
+{
+	enum xalloc_tag old = cur_tag;
+
+	cur_tag = tag;
+	return old;
+}
+
+static void xalloc_account(size_t size)
+{
+	__atomic_fetch_add(&xalloc_count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&xalloc_bytes, size, __ATOMIC_RELAXED);
+
+	if (cur_tag != XALLOC_TAG_NONE) {
+		__atomic_fetch_add(&xalloc_stats[cur_tag].count, 1,
+				   __ATOMIC_RELAXED);
+		__atomic_fetch_add(&xalloc_stats[cur_tag].bytes, size,
+				   __ATOMIC_RELAXED);
+	}
+}
+
 extern void *xmalloc(size_t size)
 {
 	void *ptr = malloc(size);
 	if (ptr == NULL && size != 0)
 		perror_msg_and_die("malloc");
+	xalloc_account(size);
 	return ptr;
 }
 
@@ -38,6 +69,7 @@ extern void *xrealloc(void *ptr, size_t size)
 	ptr = realloc(ptr, size);
 	if (ptr == NULL && size != 0)
 		perror_msg_and_die("realloc");
+	xalloc_account(size);
 	return ptr;
 }
 
@@ -46,6 +78,7 @@ extern void *xcalloc(size_t nmemb, size_t size)
 	void *ptr = calloc(nmemb, size);
 	if (ptr == NULL && nmemb != 0 && size != 0)
 		perror_msg_and_die("calloc");
+	xalloc_account(nmemb * size);
 	return ptr;
 }
 
@@ -61,6 +94,7 @@ extern char *xstrdup(const char *s)
 	if (t == NULL)
 		perror_msg_and_die("strdup");
 
+	xalloc_account(strlen(t) + 1);
 	return t;
 }
 
@@ -0,0 +1,93 @@
+/* arena.c - the opkg package management system
+
+   Copyright (C) 2009 Ubiq Technologies <graham.gower@gmail.com>
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "opkg_message.h"
+#include "libbb/libbb.h"
+
+#define ARENA_ALIGN	(sizeof(void *))
+
+void arena_init(arena_t * arena, const char *name, size_t slab_size)
+{
+	arena->name = name;
+	arena->slabs = NULL;
+	arena->slab_size = slab_size;
+	arena->total = 0;
+}
+
+void arena_deinit(arena_t * arena)
+{
+	struct arena_slab *slab, *next;
+
+	opkg_msg(DEBUG, "Arena %s used %zu bytes.\n", arena->name,
+		 arena->total);
+
+	for (slab = arena->slabs; slab; slab = next) {
+		next = slab->next;
+		free(slab);
+	}
+
+	arena->slabs = NULL;
+	arena->total = 0;
+}
+
+void *arena_alloc(arena_t * arena, size_t size)
+{
+	struct arena_slab *slab = arena->slabs;
+	size_t slab_size;
+	char *p;
+
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+	if (!slab || slab->size - slab->used < size) {
+		slab_size = arena->slab_size;
+		if (slab_size < size)
+			slab_size = size;
+
+		slab = xmalloc(sizeof(*slab) + slab_size);
+		slab->next = arena->slabs;
+		slab->used = 0;
+		slab->size = slab_size;
+		arena->slabs = slab;
+	}
+
+	p = (char *)(slab + 1) + slab->used;
+	slab->used += size;
+	arena->total += size;
+
+	return p;
+}
+
+void *arena_calloc(arena_t * arena, size_t size)
+{
+	void *p = arena_alloc(arena, size);
+
+	memset(p, 0, size);
+
+	return p;
+}
+
+char *arena_strndup(arena_t * arena, const char *s, size_t len)
+{
+	char *p = arena_alloc(arena, len + 1);
+
+	memcpy(p, s, len);
+	p[len] = '\0';
+
+	return p;
+}
@@ -0,0 +1,48 @@
+/* arena.h - the opkg package management system
+
+   Copyright (C) 2009 Ubiq Technologies <graham.gower@gmail.com>
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+ * Simple slab/bump allocator for allocations that share one lifetime,
+ * such as the pkg_t structs created while loading feeds. Individual
+ * allocations cannot be freed; everything goes away in O(1) when the
+ * arena is deinitialized.
+ */
+
+struct arena_slab {
+	struct arena_slab *next;
+	size_t used;
+	size_t size;
+	/* data follows */
+};
+
+typedef struct arena {
+	const char *name;
+	struct arena_slab *slabs;
+	size_t slab_size;
+	size_t total;
+} arena_t;
+
+void arena_init(arena_t * arena, const char *name, size_t slab_size);
+void arena_deinit(arena_t * arena);
+void *arena_alloc(arena_t * arena, size_t size);
+void *arena_calloc(arena_t * arena, size_t size);
+char *arena_strndup(arena_t * arena, const char *s, size_t len);
+
+#endif
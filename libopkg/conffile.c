@@ -17,6 +17,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 
 #include "opkg_message.h"
 #include "conffile.h"
@@ -27,12 +29,14 @@
 int conffile_init(conffile_t * conffile, const char *file_name,
 		  const char *md5sum)
 {
-	return nv_pair_init(conffile, file_name, md5sum);
+	conffile->mtime = 0;
+	conffile->size = 0;
+	return nv_pair_init((nv_pair_t *) conffile, file_name, md5sum);
 }
 
 void conffile_deinit(conffile_t * conffile)
 {
-	nv_pair_deinit(conffile);
+	nv_pair_deinit((nv_pair_t *) conffile);
 }
 
 int conffile_has_been_modified(conffile_t * conffile)
@@ -40,6 +44,7 @@ int conffile_has_been_modified(conffile_t * conffile)
 	char *chksum;
 	char *filename = conffile->name;
 	char *root_filename;
+	struct stat st;
 	int ret = 1;
 
 	if (conffile->value == NULL) {
@@ -50,6 +55,17 @@ int conffile_has_been_modified(conffile_t * conffile)
 
 	root_filename = root_filename_alloc(filename);
 
+	/* the cached stat from the status data identifies a file that
+	   was already verified against the checksum; while it still
+	   matches, the hash pass is skipped */
+	if (conffile->mtime && conffile->size
+	    && stat(root_filename, &st) == 0
+	    && (unsigned long)st.st_mtime == conffile->mtime
+	    && (unsigned long)st.st_size == conffile->size) {
+		free(root_filename);
+		return 0;
+	}
+
 	if (conffile->value && strlen(conffile->value) > 33) {
 		chksum = file_sha256sum_alloc(root_filename);
 	} else {
@@ -61,6 +77,13 @@ int conffile_has_been_modified(conffile_t * conffile)
 			 conffile->name, chksum, conffile->value);
 	}
 
+	/* prime the cache for an unmodified file; it rides along the
+	   next time the status data is written anyway */
+	if (chksum && ret == 0 && stat(root_filename, &st) == 0) {
+		conffile->mtime = st.st_mtime;
+		conffile->size = st.st_size;
+	}
+
 	free(root_filename);
 	if (chksum)
 		free(chksum);
@@ -19,7 +19,19 @@
 #define CONFFILE_H
 
 #include "nv_pair.h"
-typedef struct nv_pair conffile_t;
+
+/*
+ * Lays out name/value like struct nv_pair so the nv_pair based list
+ * machinery can handle it. mtime/size cache the stat of a file known
+ * to match the stored checksum: when both still match on disk, the
+ * modification check is a stat instead of a full hash pass.
+ */
+typedef struct conffile {
+	char *name;
+	char *value;
+	unsigned long mtime;
+	unsigned long size;
+} conffile_t;
 
 int conffile_init(conffile_t * conffile, const char *file_name,
 		  const char *md5sum);
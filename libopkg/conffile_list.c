@@ -16,19 +16,68 @@
 */
 
 #include "conffile_list.h"
+#include "libbb/libbb.h"
+
+/* below this the linear scan wins over building an index */
+#define CONFFILE_LIST_INDEX_MIN 16
 
 void conffile_list_init(conffile_list_t * list)
 {
-	nv_pair_list_init(list);
+	nv_pair_list_init(&list->list);
+	memset(&list->idx, 0, sizeof(list->idx));
+	list->n = 0;
 }
 
 void conffile_list_deinit(conffile_list_t * list)
 {
-	nv_pair_list_deinit(list);
+	if (list->idx.entries)
+		hash_table_deinit(&list->idx);
+	nv_pair_list_deinit(&list->list);
+	list->n = 0;
 }
 
 conffile_t *conffile_list_append(conffile_list_t * list, const char *file_name,
 				 const char *md5sum)
 {
-	return nv_pair_list_append(list, file_name, md5sum);
+	/* freed in nv_pair_list_deinit; conffile_t leads with the
+	 * nv_pair members, so the generic cleanup handles it */
+	conffile_t *conffile = xcalloc(1, sizeof(conffile_t));
+	conffile_init(conffile, file_name, md5sum);
+	void_list_append((void_list_t *) & list->list, conffile);
+	list->n++;
+
+	if (list->idx.entries)
+		hash_table_insert(&list->idx, conffile->name, conffile);
+
+	return conffile;
+}
+
+conffile_t *conffile_list_lookup(conffile_list_t * list, const char *name)
+{
+	conffile_list_elt_t *iter;
+	conffile_t *conffile;
+
+	if (list->n >= CONFFILE_LIST_INDEX_MIN) {
+		if (!list->idx.entries) {
+			hash_table_init("conffile-idx", &list->idx, list->n);
+			for (iter = conffile_list_first(list); iter;
+			     iter = conffile_list_next(list, iter)) {
+				conffile = (conffile_t *) iter->data;
+				hash_table_insert(&list->idx, conffile->name,
+						  conffile);
+			}
+		}
+
+		return hash_table_get(&list->idx, name);
+	}
+
+	for (iter = conffile_list_first(list); iter;
+	     iter = conffile_list_next(list, iter)) {
+		conffile = (conffile_t *) iter->data;
+
+		if (strcmp(conffile->name, name) == 0)
+			return conffile;
+	}
+
+	return NULL;
 }
@@ -19,9 +19,22 @@
 #define CONFFILE_LIST_H
 
 #include "nv_pair_list.h"
+#include "hash_table.h"
 
 typedef nv_pair_list_elt_t conffile_list_elt_t;
-typedef nv_pair_list_t conffile_list_t;
+
+/*
+ * Most packages carry a handful of conffiles, so the list stays a
+ * plain nv_pair list. Past CONFFILE_LIST_INDEX_MIN entries a lazily
+ * built hash sidecar backs conffile_list_lookup(), keeping the
+ * per-file conffile check during the removal of a large package O(1)
+ * instead of O(conffiles).
+ */
+typedef struct conffile_list {
+	nv_pair_list_t list;
+	hash_table_t idx;	/* name -> conffile_t, built on demand */
+	unsigned int n;
+} conffile_list_t;
 
 #include "conffile.h"
 
@@ -30,5 +43,23 @@ void conffile_list_deinit(conffile_list_t * list);
 
 conffile_t *conffile_list_append(conffile_list_t * list, const char *name,
 				 const char *root_dir);
+conffile_t *conffile_list_lookup(conffile_list_t * list, const char *name);
+
+static inline conffile_list_elt_t *conffile_list_first(conffile_list_t * list)
+{
+	return nv_pair_list_first(&list->list);
+}
+
+static inline conffile_list_elt_t *conffile_list_next(conffile_list_t * list,
+						      conffile_list_elt_t *
+						      node)
+{
+	return nv_pair_list_next(&list->list, node);
+}
+
+static inline int conffile_list_empty(conffile_list_t * list)
+{
+	return nv_pair_list_empty(&list->list);
+}
 
 #endif
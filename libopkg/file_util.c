@@ -19,7 +19,9 @@
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <ctype.h>
 
@@ -30,6 +32,73 @@
 
 #include "sha256.h"
 
+/* Map a regular file into memory for in-place parsing. The mapping is
+   private, so parsers may scribble NUL terminators into it without
+   touching the file. Returns 0 on success; an empty file yields a
+   NULL base with len 0. */
+int file_map_open(struct file_map *fmap, const char *file_name)
+{
+	struct stat st;
+	int fd;
+
+	fmap->base = NULL;
+	fmap->len = 0;
+
+	fd = open(file_name, O_RDONLY);
+	if (fd == -1)
+		return -1;
+
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	if (st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+
+	fmap->base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+			  MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (fmap->base == MAP_FAILED) {
+		fmap->base = NULL;
+		return -1;
+	}
+
+	/* every user walks the mapping front to back exactly once */
+	madvise(fmap->base, st.st_size, MADV_SEQUENTIAL);
+
+	fmap->len = st.st_size;
+	return 0;
+}
+
+void file_map_close(struct file_map *fmap)
+{
+	if (fmap->base)
+		munmap(fmap->base, fmap->len);
+
+	fmap->base = NULL;
+	fmap->len = 0;
+}
+
+/* Sync a directory so a just-renamed or just-created entry survives a
+   power cut. */
+int file_fsync_dir(const char *dir)
+{
+	int fd, err;
+
+	fd = open(dir, O_RDONLY | O_DIRECTORY);
+	if (fd == -1)
+		return -1;
+
+	err = fsync(fd);
+	close(fd);
+
+	return err;
+}
+
 int file_exists(const char *file_name)
 {
 	struct stat st;
@@ -109,6 +178,31 @@ int file_move(const char *src, const char *dest)
 	return err;
 }
 
+/*
+ * Compare two files byte for byte via private mappings.
+ */
+int file_identical(const char *a, const char *b)
+{
+	struct file_map ma, mb;
+	int same = 0;
+
+	if (file_map_open(&ma, a))
+		return 0;
+
+	if (file_map_open(&mb, b)) {
+		file_map_close(&ma);
+		return 0;
+	}
+
+	same = ma.len == mb.len &&
+	    (ma.len == 0 || memcmp(ma.base, mb.base, ma.len) == 0);
+
+	file_map_close(&ma);
+	file_map_close(&mb);
+
+	return same;
+}
+
 int file_copy(const char *src, const char *dest)
 {
 	int err;
@@ -120,6 +214,23 @@ int file_copy(const char *src, const char *dest)
 	return err;
 }
 
+/*
+ * Make dest another name for src, falling back to a byte copy when
+ * the two live on different file systems (or linking is forbidden).
+ */
+int file_link(const char *src, const char *dest)
+{
+	if (unlink(dest) == -1 && errno != ENOENT) {
+		opkg_perror(ERROR, "Failed to unlink %s", dest);
+		return -1;
+	}
+
+	if (link(src, dest) == 0)
+		return 0;
+
+	return file_copy(src, dest);
+}
+
 int file_mkdir_hier(const char *path, long mode)
 {
 	return make_directory(path, mode, FILEUTILS_RECUR);
@@ -153,12 +264,26 @@ char *file_md5sum_alloc(const char *file_name)
 	int i, len;
 	char *md5sum_hex;
 	unsigned char md5sum_bin[md5sum_bin_len];
-
-	len = md5sum(file_name, md5sum_bin);
-
-	if (len) {
-		opkg_msg(ERROR, "Could't compute md5sum for %s.\n", file_name);
-		return NULL;
+	struct file_map fmap;
+
+	/* hash straight out of the page cache when the file maps;
+	   fall back to the buffered loop for anything unmappable */
+	if (file_map_open(&fmap, file_name) == 0) {
+		md5_ctx_t ctx;
+
+		md5_begin(&ctx);
+		if (fmap.len)
+			md5_hash(fmap.base, fmap.len, &ctx);
+		md5_end(md5sum_bin, &ctx);
+		file_map_close(&fmap);
+	} else {
+		len = md5sum(file_name, md5sum_bin);
+
+		if (len) {
+			opkg_msg(ERROR, "Could't compute md5sum for %s.\n",
+				 file_name);
+			return NULL;
+		}
 	}
 
 	md5sum_hex = xcalloc(1, md5sum_hex_len + 1);
@@ -182,27 +307,33 @@ char *file_sha256sum_alloc(const char *file_name)
 	FILE *file;
 	char *sha256sum_hex;
 	unsigned char sha256sum_bin[sha256sum_bin_len];
+	struct file_map fmap;
 
 	sha256sum_hex = xcalloc(1, sha256sum_hex_len + 1);
 
-	file = fopen(file_name, "r");
-	if (file == NULL) {
-		opkg_perror(ERROR, "Failed to open file %s", file_name);
-		free(sha256sum_hex);
-		return NULL;
-	}
+	if (file_map_open(&fmap, file_name) == 0) {
+		sha256_buffer(fmap.base, fmap.len, sha256sum_bin);
+		file_map_close(&fmap);
+	} else {
+		file = fopen(file_name, "r");
+		if (file == NULL) {
+			opkg_perror(ERROR, "Failed to open file %s", file_name);
+			free(sha256sum_hex);
+			return NULL;
+		}
+
+		err = sha256_stream(file, sha256sum_bin);
+		if (err) {
+			opkg_msg(ERROR, "Could't compute sha256sum for %s.\n",
+				 file_name);
+			fclose(file);
+			free(sha256sum_hex);
+			return NULL;
+		}
 
-	err = sha256_stream(file, sha256sum_bin);
-	if (err) {
-		opkg_msg(ERROR, "Could't compute sha256sum for %s.\n",
-			 file_name);
 		fclose(file);
-		free(sha256sum_hex);
-		return NULL;
 	}
 
-	fclose(file);
-
 	for (i = 0; i < sha256sum_bin_len; i++) {
 		sha256sum_hex[i * 2] = bin2hex[sha256sum_bin[i] >> 4];
 		sha256sum_hex[i * 2 + 1] = bin2hex[sha256sum_bin[i] & 0xf];
@@ -216,7 +347,7 @@ char *file_sha256sum_alloc(const char *file_name)
 char *checksum_bin2hex(const char *src, size_t len)
 {
 	unsigned char *p;
-	static unsigned char buf[65];
+	static __thread unsigned char buf[65];
 	const unsigned char *s = (unsigned char *)src;
 	if (!s || len > 32)
 		return NULL;
@@ -236,7 +367,7 @@ char *checksum_hex2bin(const char *src, size_t *len)
 	size_t slen;
 	unsigned char *p;
 	const unsigned char *s;
-	static unsigned char buf[32];
+	static __thread unsigned char buf[32];
 
 	if (!src) {
 		*len = 0;
@@ -18,11 +18,25 @@
 #ifndef FILE_UTIL_H
 #define FILE_UTIL_H
 
+#include <stddef.h>
+
+/* A private, writable memory mapping of a regular file. */
+struct file_map {
+	char *base;
+	size_t len;
+};
+
+int file_map_open(struct file_map *fmap, const char *file_name);
+void file_map_close(struct file_map *fmap);
+
+int file_fsync_dir(const char *dir);
 int file_exists(const char *file_name);
 int file_is_dir(const char *file_name);
 char *file_read_line_alloc(FILE * file);
 int file_move(const char *src, const char *dest);
 int file_copy(const char *src, const char *dest);
+int file_link(const char *src, const char *dest);
+int file_identical(const char *a, const char *b);
 int file_mkdir_hier(const char *path, long mode);
 char *file_md5sum_alloc(const char *file_name);
 char *file_sha256sum_alloc(const char *file_name);
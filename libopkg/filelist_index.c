@@ -0,0 +1,433 @@
+/* filelist_index.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "filelist_index.h"
+#include "opkg_conf.h"
+#include "opkg_message.h"
+#include "pkg.h"
+#include "pkg_hash.h"
+#include "sprintf_alloc.h"
+#include "libbb/libbb.h"
+
+struct filelist_entry {
+	const char *path;
+	pkg_t *pkg;
+};
+
+struct filelist_gather {
+	pkg_dest_t *dest;
+	struct filelist_entry *entries;
+	uint32_t n_entries, n_alloc;
+};
+
+static char *filelist_index_file(pkg_dest_t * dest)
+{
+	char *idx_file;
+
+	sprintf_alloc(&idx_file, "%s/%s", dest->opkg_dir, FILELIST_INDEX_FILE);
+	return idx_file;
+}
+
+static void filelist_gather_helper(const char *key, void *entry, void *data)
+{
+	struct filelist_gather *gather = data;
+	pkg_t *pkg = entry;
+
+	if (pkg->dest != gather->dest)
+		return;
+
+	if (gather->n_entries == gather->n_alloc) {
+		gather->n_alloc = gather->n_alloc ? gather->n_alloc * 2 : 1024;
+		gather->entries = xrealloc(gather->entries,
+					   gather->n_alloc *
+					   sizeof(gather->entries[0]));
+	}
+
+	gather->entries[gather->n_entries].path = key;
+	gather->entries[gather->n_entries].pkg = pkg;
+	gather->n_entries++;
+}
+
+static int filelist_entry_cmp(const void *a, const void *b)
+{
+	const struct filelist_entry *ea = a, *eb = b;
+
+	return strcmp(ea->path, eb->path);
+}
+
+static uint32_t data_append(char **data, size_t *len, size_t *cap,
+			    const char *str)
+{
+	size_t n = strlen(str) + 1;
+	uint32_t off = *len;
+
+	if (*len + n > *cap) {
+		if (*cap == 0)
+			*cap = 65536;
+		while (*len + n > *cap)
+			*cap *= 2;
+		*data = xrealloc(*data, *cap);
+	}
+
+	memcpy(*data + *len, str, n);
+	*len += n;
+
+	return off;
+}
+
+/*
+ * Write the ownership index for one destination from the populated
+ * file hash and move it into place atomically, so readers only ever
+ * see a complete index. The caller must have scanned every installed
+ * package of this destination into the file hash first.
+ */
+int filelist_index_write(pkg_dest_t * dest)
+{
+	struct filelist_index_header hdr;
+	struct filelist_gather gather;
+	struct filelist_index_record *records;
+	struct filelist_index_pkg *pkg_records;
+	struct {
+		pkg_t *pkg;
+		uint32_t off;
+		uint32_t n_files;
+	} *names;
+	struct stat st;
+	char *idx_file, *tmp_file, *data = NULL;
+	size_t data_len = 0, data_cap = 0;
+	uint32_t i, j, n_names = 0;
+	uint32_t *rec_owner, *file_idx, *cursor;
+	FILE *fp;
+	int ret = -1;
+
+	if (stat(dest->status_file_name, &st) == -1)
+		return -1;
+
+	memset(&gather, 0, sizeof(gather));
+	gather.dest = dest;
+	hash_table_foreach(&conf->file_hash, filelist_gather_helper, &gather);
+
+	qsort(gather.entries, gather.n_entries, sizeof(gather.entries[0]),
+	      filelist_entry_cmp);
+
+	records = xcalloc(gather.n_entries ? gather.n_entries : 1,
+			  sizeof(records[0]));
+	names = xcalloc(gather.n_entries ? gather.n_entries : 1,
+			sizeof(names[0]));
+	rec_owner = xcalloc(gather.n_entries ? gather.n_entries : 1,
+			    sizeof(rec_owner[0]));
+
+	for (i = 0; i < gather.n_entries; i++) {
+		pkg_t *pkg = gather.entries[i].pkg;
+
+		/* write each owning package name once; owners repeat
+		 * across consecutive paths, so the linear cache scan
+		 * stays bounded by the installed package count */
+		for (j = 0; j < n_names; j++)
+			if (names[j].pkg == pkg)
+				break;
+		if (j == n_names) {
+			names[j].pkg = pkg;
+			names[j].off = data_append(&data, &data_len, &data_cap,
+						   pkg->name);
+			n_names++;
+		}
+		names[j].n_files++;
+		rec_owner[i] = j;
+
+		records[i].path_off = data_append(&data, &data_len, &data_cap,
+						  gather.entries[i].path);
+		records[i].name_off = names[j].off;
+	}
+
+	/* group the path-sorted records per package: each package entry
+	 * covers a contiguous run of the file index array, so one
+	 * package's file list is a single sequential walk */
+	pkg_records = xcalloc(n_names ? n_names : 1, sizeof(pkg_records[0]));
+	file_idx = xcalloc(gather.n_entries ? gather.n_entries : 1,
+			   sizeof(file_idx[0]));
+	cursor = xcalloc(n_names ? n_names : 1, sizeof(cursor[0]));
+
+	for (i = 0, j = 0; j < n_names; j++) {
+		pkg_records[j].name_off = names[j].off;
+		pkg_records[j].file_off = i;
+		pkg_records[j].n_files = names[j].n_files;
+		i += names[j].n_files;
+	}
+	for (i = 0; i < gather.n_entries; i++) {
+		j = rec_owner[i];
+		file_idx[pkg_records[j].file_off + cursor[j]++] = i;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = FILELIST_INDEX_MAGIC;
+	hdr.version = FILELIST_INDEX_VERSION;
+	hdr.status_size = st.st_size;
+	hdr.status_mtime = st.st_mtime;
+	hdr.n_records = gather.n_entries;
+	hdr.n_pkgs = n_names;
+
+	idx_file = filelist_index_file(dest);
+	sprintf_alloc(&tmp_file, "%s.tmp", idx_file);
+
+	fp = fopen(tmp_file, "w");
+	if (fp == NULL) {
+		opkg_perror(DEBUG, "Failed to open %s", tmp_file);
+		goto out;
+	}
+
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    (gather.n_entries &&
+	     fwrite(records, sizeof(records[0]), gather.n_entries, fp)
+	     != gather.n_entries)
+	    || (n_names &&
+		fwrite(pkg_records, sizeof(pkg_records[0]), n_names, fp)
+		!= n_names)
+	    || (gather.n_entries &&
+		fwrite(file_idx, sizeof(file_idx[0]), gather.n_entries, fp)
+		!= gather.n_entries)
+	    || (data_len && fwrite(data, 1, data_len, fp) != data_len)
+	    || fclose(fp) == EOF) {
+		opkg_perror(ERROR, "Failed to write %s", tmp_file);
+		unlink(tmp_file);
+		goto out;
+	}
+
+	if (rename(tmp_file, idx_file) == -1) {
+		opkg_perror(ERROR, "Failed to rename %s to %s", tmp_file,
+			    idx_file);
+		unlink(tmp_file);
+		goto out;
+	}
+
+	opkg_msg(DEBUG, "Wrote file ownership index %s (%u files).\n",
+		 idx_file, gather.n_entries);
+	ret = 0;
+
+out:
+	free(idx_file);
+	free(tmp_file);
+	free(gather.entries);
+	free(records);
+	free(pkg_records);
+	free(file_idx);
+	free(cursor);
+	free(rec_owner);
+	free(names);
+	free(data);
+	return ret;
+}
+
+/*
+ * Map and validate the ownership index of a destination. Returns
+ * nonzero when the index is missing, stale or malformed, in which case
+ * the caller should fall back to scanning the .list files.
+ */
+int filelist_index_open(struct filelist_index *idx, pkg_dest_t * dest)
+{
+	struct stat st;
+	char *idx_file;
+	size_t min_len;
+	uint32_t i;
+	int err;
+
+	memset(idx, 0, sizeof(*idx));
+
+	if (stat(dest->status_file_name, &st) == -1)
+		return -1;
+
+	idx_file = filelist_index_file(dest);
+	err = file_map_open(&idx->map, idx_file);
+	free(idx_file);
+
+	if (err || idx->map.len < sizeof(struct filelist_index_header)) {
+		file_map_close(&idx->map);
+		return -1;
+	}
+
+	idx->hdr = (struct filelist_index_header *)idx->map.base;
+
+	if (idx->hdr->magic != FILELIST_INDEX_MAGIC ||
+	    idx->hdr->version != FILELIST_INDEX_VERSION ||
+	    idx->hdr->status_size != (uint64_t) st.st_size ||
+	    idx->hdr->status_mtime != (uint64_t) st.st_mtime)
+		goto stale;
+
+	min_len = sizeof(struct filelist_index_header) +
+	    (size_t) idx->hdr->n_records *
+	    sizeof(struct filelist_index_record) +
+	    (size_t) idx->hdr->n_pkgs * sizeof(struct filelist_index_pkg) +
+	    (size_t) idx->hdr->n_records * sizeof(uint32_t);
+	if (idx->map.len < min_len)
+		goto stale;
+
+	idx->records = (struct filelist_index_record *)
+	    (idx->map.base + sizeof(struct filelist_index_header));
+	idx->pkgs = (struct filelist_index_pkg *)
+	    (idx->records + idx->hdr->n_records);
+	idx->file_idx = (uint32_t *) (idx->pkgs + idx->hdr->n_pkgs);
+	idx->data = idx->map.base + min_len;
+	idx->data_len = idx->map.len - min_len;
+
+	if (idx->hdr->n_records &&
+	    (idx->data_len == 0 || idx->data[idx->data_len - 1] != '\0'))
+		goto stale;
+
+	for (i = 0; i < idx->hdr->n_records; i++) {
+		struct filelist_index_record *rec = &idx->records[i];
+
+		if ((size_t) rec->path_off >= idx->data_len ||
+		    (size_t) rec->name_off >= idx->data_len)
+			goto stale;
+
+		if (idx->file_idx[i] >= idx->hdr->n_records)
+			goto stale;
+	}
+
+	for (i = 0; i < idx->hdr->n_pkgs; i++) {
+		struct filelist_index_pkg *prec = &idx->pkgs[i];
+
+		if ((size_t) prec->name_off >= idx->data_len ||
+		    prec->n_files > idx->hdr->n_records ||
+		    prec->file_off > idx->hdr->n_records - prec->n_files)
+			goto stale;
+	}
+
+	return 0;
+
+stale:
+	opkg_msg(DEBUG, "File ownership index for dest %s is stale or "
+		 "corrupt, falling back to .list scanning.\n", dest->name);
+	file_map_close(&idx->map);
+	memset(idx, 0, sizeof(*idx));
+	return -1;
+}
+
+void filelist_index_close(struct filelist_index *idx)
+{
+	file_map_close(&idx->map);
+	memset(idx, 0, sizeof(*idx));
+}
+
+/*
+ * Populate the global file hash for one destination from its on-disk
+ * index instead of reading every installed package's .list file.
+ * Returns nonzero when no fresh index exists and the caller must scan
+ * the .list files.
+ */
+int filelist_index_load(pkg_dest_t * dest)
+{
+	struct filelist_index idx;
+	pkg_t *pkg = NULL;
+	const char *name, *last_name = NULL;
+	uint32_t i;
+
+	if (filelist_index_open(&idx, dest))
+		return -1;
+
+	for (i = 0; i < idx.hdr->n_records; i++) {
+		name = idx.data + idx.records[i].name_off;
+
+		/* records are sorted by path, so owners repeat in runs */
+		if (!last_name || strcmp(name, last_name)) {
+			pkg = pkg_hash_fetch_installed_by_name_dest(name, dest);
+			last_name = name;
+		}
+
+		if (!pkg) {
+			/* index disagrees with the package database;
+			 * treat it as stale and rescan */
+			filelist_index_close(&idx);
+			return -1;
+		}
+
+		file_hash_set_file_owner(idx.data + idx.records[i].path_off,
+					 pkg);
+	}
+
+	opkg_msg(DEBUG, "Loaded file ownership index for dest %s "
+		 "(%u files).\n", dest->name, idx.hdr->n_records);
+	filelist_index_close(&idx);
+	return 0;
+}
+
+/*
+ * Append the installed files of one package from the consolidated
+ * index. The index of the last used destination stays mapped for the
+ * lifetime of the process, so fetching many packages' file lists in a
+ * row touches one mapping instead of opening one .list file each.
+ * Returns nonzero when no fresh index exists or the package is not in
+ * it, in which case the caller should read the .list file.
+ */
+int filelist_index_pkg_files(pkg_t * pkg, str_vec_t * files)
+{
+	static __thread struct {
+		pkg_dest_t *dest;
+		struct filelist_index idx;
+		int err;
+	} cache;
+	struct filelist_index *idx = &cache.idx;
+	struct filelist_index_pkg *prec = NULL;
+	unsigned int rootdirlen = 0;
+	uint32_t i;
+
+	if (cache.dest != pkg->dest) {
+		if (cache.dest)
+			filelist_index_close(idx);
+		cache.dest = pkg->dest;
+		cache.err = filelist_index_open(idx, pkg->dest);
+	}
+
+	if (cache.err)
+		return -1;
+
+	/* one entry per installed package, so a linear scan is cheap */
+	for (i = 0; i < idx->hdr->n_pkgs; i++) {
+		if (strcmp(idx->data + idx->pkgs[i].name_off, pkg->name) == 0) {
+			prec = &idx->pkgs[i];
+			break;
+		}
+	}
+
+	if (!prec)
+		return -1;
+
+	if (conf->offline_root)
+		rootdirlen = strlen(conf->offline_root);
+
+	for (i = 0; i < prec->n_files; i++) {
+		uint32_t rec = idx->file_idx[prec->file_off + i];
+		const char *path = idx->data + idx->records[rec].path_off;
+
+		/* same offline root fixup as the .list file reader */
+		if (conf->offline_root &&
+		    strncmp(conf->offline_root, path, rootdirlen)) {
+			char *installed_file_name;
+
+			sprintf_alloc(&installed_file_name, "%s%s",
+				      conf->offline_root, path);
+			str_vec_append(files, installed_file_name);
+			free(installed_file_name);
+		} else {
+			str_vec_append(files, path);
+		}
+	}
+
+	return 0;
+}
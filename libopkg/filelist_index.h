@@ -0,0 +1,81 @@
+/* filelist_index.h - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef FILELIST_INDEX_H
+#define FILELIST_INDEX_H
+
+#include <stdint.h>
+
+#include "file_util.h"
+#include "pkg_dest.h"
+
+/*
+ * Consolidated file-ownership index, one per destination, kept next to
+ * the status file. It maps every installed file path to the owning
+ * package name, sorted by path, so ownership scans (conflict detection
+ * before installs, `opkg search`) read one mmapped file instead of
+ * every package's .list file. A per-package table groups the records
+ * by owner, so the file list of a single package can be fetched from
+ * the same mapping without opening its .list file. Staleness is keyed
+ * on the status file: any install, remove or upgrade rewrites it,
+ * which invalidates the index and triggers a rebuild on the next
+ * ownership scan.
+ */
+
+#define FILELIST_INDEX_MAGIC	0x666c694f	/* "Oilf" */
+#define FILELIST_INDEX_VERSION	2
+#define FILELIST_INDEX_FILE	"fileowners.idx"
+
+struct filelist_index_header {
+	uint32_t magic;
+	uint32_t version;
+	/* size/mtime of the status file this index was built from,
+	 * used to detect staleness */
+	uint64_t status_size;
+	uint64_t status_mtime;
+	uint32_t n_records;
+	uint32_t n_pkgs;
+};
+
+struct filelist_index_record {
+	uint32_t path_off;	/* NUL-terminated path in the data area */
+	uint32_t name_off;	/* NUL-terminated owning package name */
+};
+
+struct filelist_index_pkg {
+	uint32_t name_off;	/* NUL-terminated package name */
+	uint32_t file_off;	/* first entry in the file index array */
+	uint32_t n_files;
+};
+
+struct filelist_index {
+	struct file_map map;
+	struct filelist_index_header *hdr;
+	struct filelist_index_record *records;
+	struct filelist_index_pkg *pkgs;
+	/* record numbers grouped per package, n_records entries */
+	uint32_t *file_idx;
+	char *data;
+	size_t data_len;
+};
+
+struct pkg;
+struct str_vec;
+
+int filelist_index_write(pkg_dest_t * dest);
+int filelist_index_open(struct filelist_index *idx, pkg_dest_t * dest);
+void filelist_index_close(struct filelist_index *idx);
+int filelist_index_load(pkg_dest_t * dest);
+int filelist_index_pkg_files(struct pkg *pkg, struct str_vec *files);
+
+#endif
@@ -20,24 +20,236 @@
 #include <string.h>
 #include "hash_table.h"
 #include "opkg_message.h"
+#include "opkg_profile.h"
 #include "libbb/libbb.h"
 
-static unsigned long djb2_hash(const unsigned char *str)
+/* grow when the table is three quarters full */
+#define HASH_TABLE_MAX_LOAD(n)	((n) / 4 * 3)
+
+/*
+ * Final avalanche mix. FNV-1a mainly stirs the low byte per step, so
+ * without this, similar keys (sequential package names, sibling file
+ * paths) cluster badly under the power-of-two slot mask.
+ */
+static unsigned long hash_mix(unsigned long hash)
 {
-	unsigned long hash = 5381;
-	int c;
-	while ((c = *str++))
-		hash = ((hash << 5) + hash) + c;	/* hash * 33 + c */
+	hash ^= hash >> 16;
+	hash *= 0x45d9f3bUL;
+	hash ^= hash >> 16;
 	return hash;
 }
 
-static int hash_index(hash_table_t * hash, const char *key)
+/* FNV-1a; one xor and one multiply per byte, measurably cheaper than
+ * djb2's dependent shift-add chain on in-order cores */
+static unsigned long fnv1a_hash(const unsigned char *str)
+{
+	unsigned long hash = 2166136261UL;
+	int c;
+	while ((c = *str++)) {
+		hash ^= c;
+		hash *= 16777619UL;
+	}
+	return hash_mix(hash);
+}
+
+unsigned long hash_table_string_hash(const char *key)
+{
+	return fnv1a_hash((const unsigned char *)key);
+}
+
+unsigned long hash_table_string_hash_len(const char *key, size_t len)
+{
+	unsigned long hash = 2166136261UL;
+	while (len--) {
+		hash ^= (unsigned char)*key++;
+		hash *= 16777619UL;
+	}
+	return hash_mix(hash);
+}
+
+/* 8-bit tag compared before any slot memory is touched; never 0, which
+ * marks an empty slot */
+static unsigned char hash_tag(unsigned long h)
+{
+	unsigned char tag = h >> 24;
+
+	return tag ? tag : 1;
+}
+
+/*
+ * Two bloom bit positions derived from one key hash. The second probe
+ * remixes the hash so the bits fail independently.
+ */
+static unsigned long bloom_bit1(hash_table_t * hash, unsigned long h)
+{
+	return h & hash->bloom_mask;
+}
+
+static unsigned long bloom_bit2(hash_table_t * hash, unsigned long h)
+{
+	return (h * 2654435761UL) & hash->bloom_mask;
+}
+
+static int bloom_test(hash_table_t * hash, unsigned long h)
+{
+	unsigned long b1 = bloom_bit1(hash, h), b2 = bloom_bit2(hash, h);
+
+	return (hash->bloom[b1 >> 3] & (1 << (b1 & 7))) &&
+	       (hash->bloom[b2 >> 3] & (1 << (b2 & 7)));
+}
+
+static void bloom_set(hash_table_t * hash, unsigned long h)
+{
+	unsigned long b1 = bloom_bit1(hash, h), b2 = bloom_bit2(hash, h);
+
+	hash->bloom[b1 >> 3] |= 1 << (b1 & 7);
+	hash->bloom[b2 >> 3] |= 1 << (b2 & 7);
+}
+
+static void bloom_alloc(hash_table_t * hash)
+{
+	/* ~16 bloom bits per expected element, rounded up to a power
+	 * of two so probes are a mask instead of a division */
+	hash->bloom_mask = 1;
+	while (hash->bloom_mask < (unsigned long)hash->n_buckets * 16)
+		hash->bloom_mask <<= 1;
+	hash->bloom = xcalloc(hash->bloom_mask / 8, 1);
+	hash->bloom_mask -= 1;
+}
+
+static void mru_remember(hash_table_t * hash, unsigned long h,
+			 hash_entry_t * entry)
+{
+	memmove(&hash->mru[1], &hash->mru[0],
+		(HASH_TABLE_N_MRU - 1) * sizeof(hash->mru[0]));
+	hash->mru[0].hash = h;
+	hash->mru[0].entry = entry;
+}
+
+/*
+ * Place an entry whose key is known not to be in the table yet. Plain
+ * linear probing; the caller accounts for n_elements.
+ */
+static void hash_place_entry(hash_table_t * hash, unsigned long h,
+			     char *key, void *data)
+{
+	unsigned int i = h & (hash->n_buckets - 1);
+	unsigned int probe_len = 0;
+
+	while (hash->tags[i]) {
+		i = (i + 1) & (hash->n_buckets - 1);
+		probe_len++;
+	}
+
+	if (probe_len) {
+		hash->n_collisions++;
+		if (probe_len > hash->max_probe_len)
+			hash->max_probe_len = probe_len;
+	}
+
+	hash->tags[i] = hash_tag(h);
+	hash->entries[i].hash = h;
+	hash->entries[i].key = key;
+	hash->entries[i].data = data;
+}
+
+/*
+ * Double the slot array and redistribute all entries using their
+ * cached hashes, so probe sequences stay short no matter how many
+ * feeds get loaded on top of the fixed initial sizing.
+ */
+static void hash_table_grow(hash_table_t * hash)
+{
+	hash_entry_t *old_entries = hash->entries;
+	unsigned char *old_tags = hash->tags;
+	unsigned int old_n_buckets = hash->n_buckets;
+	unsigned int i;
+
+	hash->n_buckets = old_n_buckets * 2;
+	hash->entries = xcalloc(hash->n_buckets, sizeof(hash_entry_t));
+	hash->tags = xcalloc(hash->n_buckets, 1);
+
+	free(hash->bloom);
+	bloom_alloc(hash);
+
+	/* entry addresses change below */
+	memset(hash->mru, 0, sizeof(hash->mru));
+
+	for (i = 0; i < old_n_buckets; i++) {
+		if (!old_tags[i])
+			continue;
+
+		bloom_set(hash, old_entries[i].hash);
+		hash_place_entry(hash, old_entries[i].hash,
+				 old_entries[i].key, old_entries[i].data);
+	}
+
+	free(old_entries);
+	free(old_tags);
+
+	opkg_msg(DEBUG, "Grew hash table %s to %u buckets (%u elements).\n",
+		 hash->name, hash->n_buckets, hash->n_elements);
+}
+
+/*
+ * Find the slot holding key, or NULL. The 8-bit tag and the cached
+ * hash reject mismatching slots without touching the key bytes.
+ */
+static hash_entry_t *hash_find_slot(hash_table_t * hash, unsigned long h,
+				    const char *key)
+{
+	unsigned int i = h & (hash->n_buckets - 1);
+	unsigned char tag = hash_tag(h);
+
+	while (hash->tags[i]) {
+		if (hash->tags[i] == tag && hash->entries[i].hash == h &&
+		    strcmp(key, hash->entries[i].key) == 0)
+			return &hash->entries[i];
+		i = (i + 1) & (hash->n_buckets - 1);
+	}
+
+	return NULL;
+}
+
+/*
+ * Return the canonical (interned) copy of the first len bytes of key,
+ * inserting it if the table has not seen the string yet. The returned
+ * atom stays valid until the table is deinitialized, so callers can
+ * share it freely instead of keeping private copies.
+ */
+const char *hash_table_intern_key_len(hash_table_t * hash, const char *key,
+				      size_t len)
 {
-	return djb2_hash((const unsigned char *)key) % hash->n_buckets;
+	unsigned long h = hash_table_string_hash_len(key, len);
+	unsigned char tag = hash_tag(h);
+	unsigned int i;
+	char *atom;
+
+	if (hash->n_elements >= HASH_TABLE_MAX_LOAD(hash->n_buckets))
+		hash_table_grow(hash);
+
+	i = h & (hash->n_buckets - 1);
+	while (hash->tags[i]) {
+		if (hash->tags[i] == tag && hash->entries[i].hash == h &&
+		    strncmp(hash->entries[i].key, key, len) == 0 &&
+		    hash->entries[i].key[len] == '\0') {
+			hash->n_hits++;
+			return hash->entries[i].key;
+		}
+		i = (i + 1) & (hash->n_buckets - 1);
+	}
+
+	atom = xstrndup(key, len);
+	bloom_set(hash, h);
+	hash_place_entry(hash, h, atom, atom);
+	hash->n_elements++;
+	hash->n_misses++;
+
+	return atom;
 }
 
 /*
- * this is an open table keyed by strings
+ * this is an open-addressing table keyed by strings
  */
 void hash_table_init(const char *name, hash_table_t * hash, int len)
 {
@@ -49,159 +261,161 @@ void hash_table_init(const char *name, hash_table_t * hash, int len)
 	memset(hash, 0, sizeof(hash_table_t));
 
 	hash->name = name;
-	hash->n_buckets = len;
+	hash->n_buckets = 1;
+	while (hash->n_buckets < (unsigned int)len)
+		hash->n_buckets <<= 1;
 	hash->entries = xcalloc(hash->n_buckets, sizeof(hash_entry_t));
+	hash->tags = xcalloc(hash->n_buckets, 1);
+	bloom_alloc(hash);
 }
 
 void hash_print_stats(hash_table_t * hash)
 {
 	printf("hash_table: %s, %d bytes\n"
 	       "\tn_buckets=%d, n_elements=%d, n_collisions=%d\n"
-	       "\tmax_bucket_len=%d, n_used_buckets=%d, ave_bucket_len=%.2f\n"
-	       "\tn_hits=%d, n_misses=%d\n",
+	       "\tmax_probe_len=%d, load=%.2f\n"
+	       "\tn_hits=%d, n_misses=%d, n_fast_hits=%d, n_fast_misses=%d\n",
 	       hash->name,
-	       hash->n_buckets * (int)sizeof(hash_entry_t),
+	       hash->n_buckets * (int)(sizeof(hash_entry_t) + 1),
 	       hash->n_buckets,
 	       hash->n_elements,
 	       hash->n_collisions,
-	       hash->max_bucket_len,
-	       hash->n_used_buckets,
-	       (hash->n_used_buckets ?
-		((float)hash->n_elements) / hash->n_used_buckets : 0.0f),
-	       hash->n_hits, hash->n_misses);
+	       hash->max_probe_len,
+	       (float)hash->n_elements / hash->n_buckets,
+	       hash->n_hits, hash->n_misses,
+	       hash->n_fast_hits, hash->n_fast_misses);
 }
 
 void hash_table_deinit(hash_table_t * hash)
 {
-	int i;
+	unsigned int i;
 	if (!hash)
 		return;
 
-	/* free the reminaing entries */
-	for (i = 0; i < hash->n_buckets; i++) {
-		hash_entry_t *hash_entry = (hash->entries + i);
-		free(hash_entry->key);
-		/* skip the first entry as this is part of the array */
-		hash_entry = hash_entry->next;
-		while (hash_entry) {
-			hash_entry_t *old = hash_entry;
-			hash_entry = hash_entry->next;
-			free(old->key);
-			free(old);
-		}
-	}
+	for (i = 0; i < hash->n_buckets; i++)
+		if (hash->tags[i])
+			free(hash->entries[i].key);
 
 	free(hash->entries);
+	free(hash->tags);
+	free(hash->bloom);
 
 	hash->entries = NULL;
+	hash->tags = NULL;
+	hash->bloom = NULL;
 	hash->n_buckets = 0;
 }
 
 void *hash_table_get(hash_table_t * hash, const char *key)
 {
-	int ndx = hash_index(hash, key);
-	hash_entry_t *hash_entry = hash->entries + ndx;
-	while (hash_entry) {
-		if (hash_entry->key) {
-			if (strcmp(key, hash_entry->key) == 0) {
-				hash->n_hits++;
-				return hash_entry->data;
-			}
+	unsigned long h = fnv1a_hash((const unsigned char *)key);
+	hash_entry_t *hash_entry;
+	int i;
+
+	opkg_count_add(OPKG_COUNT_HASH_PROBES, 1);
+
+	for (i = 0; i < HASH_TABLE_N_MRU; i++) {
+		hash_entry = hash->mru[i].entry;
+		if (hash_entry && hash->mru[i].hash == h &&
+		    strcmp(key, hash_entry->key) == 0) {
+			hash->n_fast_hits++;
+			return hash_entry->data;
 		}
-		hash_entry = hash_entry->next;
 	}
+
+	if (!bloom_test(hash, h)) {
+		hash->n_fast_misses++;
+		return NULL;
+	}
+
+	hash_entry = hash_find_slot(hash, h, key);
+	if (hash_entry) {
+		hash->n_hits++;
+		mru_remember(hash, h, hash_entry);
+		return hash_entry->data;
+	}
+
 	hash->n_misses++;
 	return NULL;
 }
 
 int hash_table_insert(hash_table_t * hash, const char *key, void *value)
 {
-	int bucket_len = 0;
-	int ndx = hash_index(hash, key);
-	hash_entry_t *hash_entry = hash->entries + ndx;
-	if (hash_entry->key) {
-		if (strcmp(hash_entry->key, key) == 0) {
-			/* alread in table, update the value */
-			hash_entry->data = value;
-			return 0;
-		} else {
-			/*
-			 * if this is a collision, we have to go to the end of the ll,
-			 * then add a new entry
-			 * before we can hook up the value
-			 */
-			while (hash_entry->next) {
-				hash_entry = hash_entry->next;
-				if (strcmp(hash_entry->key, key) == 0) {
-					hash_entry->data = value;
-					return 0;
-				}
-				bucket_len++;
-			}
-			hash_entry->next = xcalloc(1, sizeof(hash_entry_t));
-			hash_entry = hash_entry->next;
-			hash_entry->next = NULL;
-
-			hash->n_collisions++;
-			if (++bucket_len > hash->max_bucket_len)
-				hash->max_bucket_len = bucket_len;
-		}
-	} else
-		hash->n_used_buckets++;
+	unsigned long h = fnv1a_hash((const unsigned char *)key);
+	hash_entry_t *hash_entry;
+
+	if (hash->n_elements >= HASH_TABLE_MAX_LOAD(hash->n_buckets))
+		hash_table_grow(hash);
 
+	hash_entry = hash_find_slot(hash, h, key);
+	if (hash_entry) {
+		/* already in table, update the value */
+		hash_entry->data = value;
+		return 0;
+	}
+
+	bloom_set(hash, h);
+	hash_place_entry(hash, h, xstrdup(key), value);
 	hash->n_elements++;
-	hash_entry->key = xstrdup(key);
-	hash_entry->data = value;
 
 	return 0;
 }
 
 int hash_table_remove(hash_table_t * hash, const char *key)
 {
-	int ndx = hash_index(hash, key);
-	hash_entry_t *hash_entry = hash->entries + ndx;
-	hash_entry_t *next_entry = NULL, *last_entry = NULL;
-	while (hash_entry) {
-		if (hash_entry->key) {
-			if (strcmp(key, hash_entry->key) == 0) {
-				free(hash_entry->key);
-				if (last_entry) {
-					last_entry->next = hash_entry->next;
-					free(hash_entry);
-				} else {
-					next_entry = hash_entry->next;
-					if (next_entry) {
-						memmove(hash_entry, next_entry,
-							sizeof(hash_entry_t));
-						free(next_entry);
-					} else {
-						memset(hash_entry, 0,
-						       sizeof(hash_entry_t));
-					}
-				}
-				return 1;
-			}
-		}
-		last_entry = hash_entry;
-		hash_entry = hash_entry->next;
+	unsigned long h = fnv1a_hash((const unsigned char *)key);
+	unsigned int mask = hash->n_buckets - 1;
+	unsigned int i, j, ideal;
+	hash_entry_t *hash_entry;
+
+	hash_entry = hash_find_slot(hash, h, key);
+	if (!hash_entry)
+		return 0;
+
+	/* slots may shift below; stale bloom bits are harmless but
+	 * stale MRU pointers are not */
+	memset(hash->mru, 0, sizeof(hash->mru));
+
+	free(hash_entry->key);
+	i = hash_entry - hash->entries;
+
+	/* backward-shift deletion keeps probe sequences unbroken
+	 * without leaving tombstones. An entry may fill the hole only
+	 * if its ideal slot lies cyclically at or before the hole;
+	 * entries probing from beyond the hole must stay put, but the
+	 * scan has to continue past them, since a movable entry can
+	 * still follow. */
+	j = i;
+	while (1) {
+		j = (j + 1) & mask;
+		if (!hash->tags[j])
+			break;
+
+		ideal = hash->entries[j].hash & mask;
+		if (((j - ideal) & mask) < ((j - i) & mask))
+			continue;
+
+		hash->tags[i] = hash->tags[j];
+		hash->entries[i] = hash->entries[j];
+		i = j;
 	}
-	return 0;
+
+	hash->tags[i] = 0;
+	memset(&hash->entries[i], 0, sizeof(hash->entries[i]));
+	hash->n_elements--;
+
+	return 1;
 }
 
 void hash_table_foreach(hash_table_t * hash,
 			void (*f) (const char *key, void *entry, void *data),
 			void *data)
 {
-	int i;
+	unsigned int i;
 	if (!hash || !f)
 		return;
 
-	for (i = 0; i < hash->n_buckets; i++) {
-		hash_entry_t *hash_entry = (hash->entries + i);
-		do {
-			if (hash_entry->key) {
-				f(hash_entry->key, hash_entry->data, data);
-			}
-		} while ((hash_entry = hash_entry->next));
-	}
+	for (i = 0; i < hash->n_buckets; i++)
+		if (hash->tags[i])
+			f(hash->entries[i].key, hash->entries[i].data, data);
 }
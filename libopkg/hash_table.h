@@ -18,28 +18,54 @@
 #ifndef _HASH_TABLE_H_
 #define _HASH_TABLE_H_
 
+#include <stddef.h>
+
 typedef struct hash_entry hash_entry_t;
 typedef struct hash_table hash_table_t;
 
+/* recently hit entries remembered per table */
+#define HASH_TABLE_N_MRU 4
+
+/*
+ * One slot of the flat, linearly probed table. Slots with a NULL key
+ * are empty. The full key hash is cached so probing and growing never
+ * re-walk key bytes.
+ */
 struct hash_entry {
+	unsigned long hash;
 	char *key;
 	void *data;
-	struct hash_entry *next;
 };
 
 struct hash_table {
 	const char *name;
-	hash_entry_t *entries;
+	hash_entry_t *entries;	/* power-of-two sized flat array */
+	unsigned char *tags;	/* 8-bit hash tags, 0 = empty slot */
 	unsigned int n_buckets;
 	unsigned int n_elements;
 
+	/* bloom bitmap over the inserted keys; rejects most lookups of
+	 * unknown names without probing the table */
+	unsigned char *bloom;
+	unsigned long bloom_mask;
+
+	/* MRU cache for the hottest keys */
+	struct {
+		unsigned long hash;
+		hash_entry_t *entry;
+	} mru[HASH_TABLE_N_MRU];
+
 	/* useful stats */
-	unsigned int n_used_buckets;
 	unsigned int n_collisions;
-	unsigned int max_bucket_len;
+	unsigned int max_probe_len;
 	unsigned int n_hits, n_misses;
+	unsigned int n_fast_hits, n_fast_misses;
 };
 
+unsigned long hash_table_string_hash(const char *key);
+unsigned long hash_table_string_hash_len(const char *key, size_t len);
+const char *hash_table_intern_key_len(hash_table_t * hash, const char *key,
+				      size_t len);
 void hash_table_init(const char *name, hash_table_t * hash, int len);
 void hash_table_deinit(hash_table_t * hash);
 void hash_print_stats(hash_table_t * hash);
@@ -50,4 +76,4 @@ void hash_table_foreach(hash_table_t * hash,
 			void (*f) (const char *key, void *entry, void *data),
 			void *data);
 
-#endif /* _HASH_TABLE_H_ */
+#endif				/* _HASH_TABLE_H_ */
@@ -0,0 +1,788 @@
+/* http_client.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+/*
+ * Minimal in-process HTTP/1.1 client with persistent connections.
+ * Fetching many small files from one mirror used to fork a wget per
+ * file, paying a process spawn and a fresh TCP handshake every time;
+ * here the connection to each host is kept open across downloads
+ * within one opkg run. Plain http:// only — https, ftp and proxied
+ * downloads still go through wget in opkg_download().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netdb.h>
+
+#include "http_client.h"
+#include "opkg_conf.h"
+#include "opkg_message.h"
+#include "opkg_profile.h"
+#include "sprintf_alloc.h"
+#include "file_util.h"
+#include "sha256.h"
+#include "libbb/libbb.h"
+#include "libbb/gzip.h"
+
+#define HTTP_MAX_CONNS		4
+#define HTTP_MAX_REDIRECTS	5
+#define HTTP_MAX_ATTEMPTS	4
+#define HTTP_DEFAULT_TIMEOUT	30
+
+struct http_conn {
+	char *host;
+	int port;
+	int fd;
+	FILE *in;		/* buffered read side of fd */
+};
+
+static __thread struct http_conn conns[HTTP_MAX_CONNS];
+
+/* set while downloading a file that may legitimately not exist, so
+ * failures are reported at INFO instead of ERROR */
+static __thread int http_quiet;
+
+/*
+ * When the caller asked for a digest, body bytes are fed into this
+ * context as they are written out, so the file never has to be read
+ * back just to checksum it. The client is single-threaded, like the
+ * connection cache above.
+ */
+static __thread struct sha256_ctx body_hash;
+static __thread int body_hashing;
+
+/*
+ * Byte-level transfer accounting. The hot path only bumps a counter;
+ * the observer is invoked every XFER_REPORT_STEP bytes of decoded
+ * output, so instrumentation stays off the per-read path.
+ */
+#define XFER_REPORT_STEP	(64 * 1024)
+
+static __thread http_progress_cb xfer_cb;
+static __thread void *xfer_cb_data;
+static __thread unsigned long long xfer_done, xfer_total, xfer_reported;
+
+void http_client_set_progress(http_progress_cb cb, void *data)
+{
+	xfer_cb = cb;
+	xfer_cb_data = data;
+}
+
+static void xfer_account(size_t n)
+{
+	opkg_count_add(OPKG_COUNT_DOWNLOAD_BYTES, n);
+
+	if (!xfer_cb)
+		return;
+
+	xfer_done += n;
+
+	if (xfer_done - xfer_reported >= XFER_REPORT_STEP
+	    || (xfer_total && xfer_done >= xfer_total)) {
+		xfer_reported = xfer_done;
+		xfer_cb(xfer_done, xfer_total, xfer_cb_data);
+	}
+}
+
+static void http_hash_reset(void)
+{
+	if (body_hashing)
+		sha256_init_ctx(&body_hash);
+}
+
+static void http_hash_bytes(const void *buf, size_t len)
+{
+	if (body_hashing && len)
+		sha256_process_bytes(buf, len, &body_hash);
+}
+
+static int http_timeout(void)
+{
+	int t;
+
+	if (!conf->http_timeout)
+		return HTTP_DEFAULT_TIMEOUT;
+
+	t = atoi(conf->http_timeout);
+
+	return t > 0 ? t : HTTP_DEFAULT_TIMEOUT;
+}
+
+/*
+ * Split an http:// url into host, port and path. Returns 0 on
+ * success; host is malloc'd, path points into url.
+ */
+static int http_parse_url(const char *url, char **hostp, int *portp,
+			  const char **pathp)
+{
+	const char *host, *p;
+	size_t host_len;
+
+	if (strncmp(url, "http://", 7) != 0)
+		return -1;
+
+	host = url + 7;
+	host_len = strcspn(host, ":/");
+
+	if (!host_len)
+		return -1;
+
+	*portp = 80;
+	p = host + host_len;
+
+	if (*p == ':') {
+		*portp = atoi(p + 1);
+		if (*portp <= 0)
+			return -1;
+		p += strcspn(p, "/");
+	}
+
+	*pathp = *p ? p : "/";
+	*hostp = xstrndup(host, host_len);
+
+	return 0;
+}
+
+static void http_conn_close(struct http_conn *conn)
+{
+	if (!conn->host)
+		return;
+
+	free(conn->host);
+	conn->host = NULL;
+
+	/* closes the underlying fd too */
+	if (conn->in)
+		fclose(conn->in);
+	else
+		close(conn->fd);
+
+	conn->in = NULL;
+	conn->fd = -1;
+}
+
+/*
+ * Connect with a timeout: plain connect() can hang far longer than
+ * any transfer on a dead route.
+ */
+static int http_connect_fd(const char *host, int port)
+{
+	struct addrinfo hints, *res, *ai;
+	struct pollfd pfd;
+	char port_str[8];
+	int fd = -1, flags, soerr;
+	socklen_t solen = sizeof(soerr);
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf(port_str, sizeof(port_str), "%d", port);
+
+	if (getaddrinfo(host, port_str, &hints, &res)) {
+		opkg_msg(ERROR, "Failed to resolve host %s.\n", host);
+		return -1;
+	}
+
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd == -1)
+			continue;
+
+		flags = fcntl(fd, F_GETFL, 0);
+		fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+			break;
+
+		if (errno == EINPROGRESS) {
+			pfd.fd = fd;
+			pfd.events = POLLOUT;
+
+			if (poll(&pfd, 1, http_timeout() * 1000) == 1
+			    && getsockopt(fd, SOL_SOCKET, SO_ERROR, &soerr,
+					  &solen) == 0 && soerr == 0)
+				break;
+		}
+
+		close(fd);
+		fd = -1;
+	}
+
+	freeaddrinfo(res);
+
+	if (fd == -1) {
+		opkg_msg(ERROR, "Failed to connect to %s:%d.\n", host, port);
+		return -1;
+	}
+
+	fcntl(fd, F_SETFL, flags);
+
+	return fd;
+}
+
+/*
+ * Get an open connection to host:port, reusing a cached one when
+ * possible. *reused tells the caller whether a request failure may
+ * just mean the server timed the idle connection out.
+ */
+static struct http_conn *http_conn_get(const char *host, int port, int *reused)
+{
+	struct http_conn *conn = NULL;
+	struct timeval tv = { .tv_sec = http_timeout() };
+	int i, fd;
+
+	for (i = 0; i < HTTP_MAX_CONNS; i++) {
+		if (conns[i].host && conns[i].port == port
+		    && strcmp(conns[i].host, host) == 0) {
+			*reused = 1;
+			return &conns[i];
+		}
+		if (!conn && !conns[i].host)
+			conn = &conns[i];
+	}
+
+	/* all slots taken by other hosts: evict the first */
+	if (!conn) {
+		conn = &conns[0];
+		http_conn_close(conn);
+	}
+
+	fd = http_connect_fd(host, port);
+	if (fd == -1)
+		return NULL;
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	conn->host = xstrdup(host);
+	conn->port = port;
+	conn->fd = fd;
+	conn->in = fdopen(fd, "r");
+	*reused = 0;
+
+	return conn;
+}
+
+static int http_send_request(struct http_conn *conn, const char *path,
+			     unsigned long long offset)
+{
+	char *request, range[64] = "";
+	size_t len, off = 0;
+	ssize_t n;
+	int ret = 0;
+
+	/* ranges are byte-exact over the identity coding, so a resumed
+	 * request must not also negotiate a compressed transfer */
+	if (offset)
+		snprintf(range, sizeof(range), "Range: bytes=%llu-\r\n",
+			 offset);
+
+	sprintf_alloc(&request,
+		      "GET %s HTTP/1.1\r\n"
+		      "Host: %s\r\n"
+		      "User-Agent: opkg/" VERSION "\r\n"
+		      "Connection: keep-alive\r\n"
+		      "%s"
+		      "\r\n", path, conn->host,
+		      offset ? range : "Accept-Encoding: gzip\r\n");
+
+	len = strlen(request);
+	while (off < len) {
+		n = send(conn->fd, request + off, len - off, MSG_NOSIGNAL);
+		if (n <= 0) {
+			ret = -1;
+			break;
+		}
+		off += n;
+	}
+
+	free(request);
+
+	return ret;
+}
+
+/*
+ * Copy n bytes of body from the connection to out (out may be NULL to
+ * discard, e.g. redirect bodies). Returns 0 on success.
+ */
+static int http_copy_body(struct http_conn *conn, FILE * out,
+			  unsigned long long n)
+{
+	char buf[8192];
+	size_t chunk;
+
+	while (n > 0) {
+		chunk = n < sizeof(buf) ? (size_t)n : sizeof(buf);
+		chunk = fread(buf, 1, chunk, conn->in);
+
+		if (chunk == 0)
+			return -1;
+		if (out) {
+			if (fwrite(buf, 1, chunk, out) != chunk)
+				return -1;
+			http_hash_bytes(buf, chunk);
+			xfer_account(chunk);
+		}
+
+		n -= chunk;
+	}
+
+	return 0;
+}
+
+static int http_copy_chunked(struct http_conn *conn, FILE * out)
+{
+	char line[256];
+	unsigned long long chunk_len;
+
+	for (;;) {
+		if (!fgets(line, sizeof(line), conn->in))
+			return -1;
+
+		chunk_len = strtoull(line, NULL, 16);
+
+		if (chunk_len == 0)
+			break;
+
+		if (http_copy_body(conn, out, chunk_len))
+			return -1;
+
+		/* chunk trailer CRLF */
+		if (!fgets(line, sizeof(line), conn->in))
+			return -1;
+	}
+
+	/* trailing headers up to the blank line */
+	while (fgets(line, sizeof(line), conn->in))
+		if (line[0] == '\r' || line[0] == '\n')
+			return 0;
+
+	return -1;
+}
+
+/*
+ * Read one response. On 2xx the body goes to out; a plain 200 to a
+ * ranged request means the server ignored the range, so the partial
+ * file is truncated and written from the start. On 3xx the body is
+ * discarded and *redirect is set to the malloc'd Location value.
+ * Returns the HTTP status, or -1 on transport errors. *keep tells
+ * whether the connection can be reused afterwards.
+ */
+static int http_read_response(struct http_conn *conn, FILE * out,
+			      unsigned long long offset,
+			      char **redirect, int *keep)
+{
+	char line[1024];
+	FILE *body_out, *ztmp = NULL;
+	unsigned long long content_length = 0;
+	int status, have_length = 0, chunked = 0, encoded = 0, body_err;
+	int hash_save;
+
+	*keep = 0;
+	*redirect = NULL;
+
+	if (!fgets(line, sizeof(line), conn->in))
+		return -1;
+
+	if (strncmp(line, "HTTP/1.", 7) != 0)
+		return -1;
+
+	status = atoi(line + 8);
+
+	/* servers may keep 1.0 connections open, but don't count on it */
+	*keep = line[7] == '1';
+
+	for (;;) {
+		if (!fgets(line, sizeof(line), conn->in))
+			return -1;
+
+		if (line[0] == '\r' || line[0] == '\n')
+			break;
+
+		if (strncasecmp(line, "Content-Length:", 15) == 0) {
+			content_length = strtoull(line + 15, NULL, 10);
+			have_length = 1;
+		} else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+			if (strstr(line + 18, "chunked"))
+				chunked = 1;
+		} else if (strncasecmp(line, "Content-Encoding:", 17) == 0) {
+			if (strstr(line + 17, "gzip"))
+				encoded = 1;
+		} else if (strncasecmp(line, "Connection:", 11) == 0) {
+			if (strstr(line + 11, "close"))
+				*keep = 0;
+		} else if (strncasecmp(line, "Location:", 9) == 0) {
+			char *loc = line + 9;
+			loc += strspn(loc, " \t");
+			loc[strcspn(loc, "\r\n")] = '\0';
+			free(*redirect);
+			*redirect = xstrdup(loc);
+		}
+	}
+
+	if (status / 100 != 2)
+		out = NULL;
+
+	if (out && status == 200 && offset) {
+		rewind(out);
+		if (ftruncate(fileno(out), 0) != 0)
+			return -1;
+		/* the hashed partial prefix went with the truncation */
+		http_hash_reset();
+	}
+
+	/* 204/304 and friends carry no body */
+	if (status == 204 || status == 304)
+		return status;
+
+	/* with a ranged response content_length covers the remainder
+	 * only; for encoded bodies it is the compressed size, which is
+	 * also what gets counted on the wire */
+	if (out)
+		xfer_total = have_length ? offset + content_length : 0;
+
+	body_out = out;
+	if (out && encoded) {
+		/* spool the compressed body and inflate it afterwards;
+		 * decoding straight off the socket would fight the
+		 * keep-alive framing */
+		ztmp = tmpfile();
+		if (!ztmp) {
+			*keep = 0;
+			return -1;
+		}
+		body_out = ztmp;
+	}
+
+	/* the digest covers the decoded file, not the wire bytes */
+	hash_save = body_hashing;
+	if (ztmp)
+		body_hashing = 0;
+
+	if (chunked)
+		body_err = http_copy_chunked(conn, body_out);
+	else if (have_length)
+		body_err = http_copy_body(conn, body_out, content_length);
+	else {
+		/* no framing: read to EOF, connection is done */
+		char buf[8192];
+		size_t n;
+
+		*keep = 0;
+		body_err = 0;
+		while ((n = fread(buf, 1, sizeof(buf), conn->in)) > 0) {
+			if (!body_out)
+				continue;
+			if (fwrite(buf, 1, n, body_out) != n) {
+				body_err = -1;
+				break;
+			}
+			http_hash_bytes(buf, n);
+			xfer_account(n);
+		}
+	}
+
+	body_hashing = hash_save;
+
+	if (ztmp && !body_err) {
+		struct gzip_handle zh;
+		char buf[8192];
+		ssize_t n;
+
+		rewind(ztmp);
+		memset(&zh, 0, sizeof(zh));
+		zh.file = ztmp;
+
+		if (gzip_exec(&zh, NULL) == 0) {
+			while ((n = gzip_read(&zh, buf, sizeof(buf))) > 0) {
+				if (fwrite(buf, 1, n, out) != (size_t)n) {
+					body_err = -1;
+					break;
+				}
+				http_hash_bytes(buf, n);
+			}
+			if (n < 0)
+				body_err = -1;
+		} else
+			body_err = -1;
+
+		/* also closes ztmp */
+		gzip_close(&zh);
+		ztmp = NULL;
+
+		if (body_err) {
+			/* a half-decoded file must not be resumed */
+			rewind(out);
+			if (ftruncate(fileno(out), 0) == 0)
+				http_hash_reset();
+		}
+	}
+
+	if (ztmp)
+		fclose(ztmp);
+
+	return body_err ? -1 : status;
+}
+
+/*
+ * One fetch attempt: follow redirects, write the body at the current
+ * position of out (offset bytes in, requested with a Range header when
+ * nonzero). Returns the final HTTP status, or -1 on transport errors.
+ */
+static int http_fetch_url(const char *url, FILE * out,
+			  unsigned long long offset)
+{
+	struct http_conn *conn;
+	char *host, *redirect, *next_url = NULL;
+	const char *path;
+	int port, status, reused, keep, tries;
+	int redirects = 0;
+
+	for (;;) {
+		if (http_parse_url(url, &host, &port, &path)) {
+			opkg_msg(DEBUG, "Cannot handle url %s.\n", url);
+			status = -1;
+			break;
+		}
+
+		status = -1;
+		redirect = NULL;
+
+		/* an idle keep-alive connection may have been dropped by
+		 * the server; retry once on a fresh one, but only while
+		 * no body bytes have arrived */
+		for (tries = 0; tries < 2; tries++) {
+			conn = http_conn_get(host, port, &reused);
+			if (!conn)
+				break;
+
+			if (http_send_request(conn, path, offset) == 0) {
+				status = http_read_response(conn, out, offset,
+							    &redirect, &keep);
+				if (!keep)
+					http_conn_close(conn);
+				if (status >= 0)
+					break;
+			} else {
+				http_conn_close(conn);
+			}
+
+			free(redirect);
+			redirect = NULL;
+
+			fflush(out);
+			if (!reused || (unsigned long long)ftello(out) != offset)
+				break;
+		}
+
+		free(host);
+
+		if (status < 0)
+			break;
+
+		if (status / 100 == 3 && redirect) {
+			free(next_url);
+			next_url = redirect;
+			url = next_url;
+
+			if (++redirects > HTTP_MAX_REDIRECTS) {
+				opkg_msg(ERROR, "Too many redirects for %s.\n",
+					 url);
+				status = -1;
+				break;
+			}
+			continue;
+		}
+
+		free(redirect);
+		break;
+	}
+
+	free(next_url);
+
+	return status;
+}
+
+/* feed the current file content into the digest before resuming */
+static void http_hash_prefix(FILE * out)
+{
+	char buf[8192];
+	size_t n;
+
+	http_hash_reset();
+	rewind(out);
+
+	while ((n = fread(buf, 1, sizeof(buf), out)) > 0)
+		http_hash_bytes(buf, n);
+}
+
+int http_client_download(const char *url, const char *dest_file_name,
+			 char **sha256p, int quiet)
+{
+	FILE *out;
+	unsigned long long offset;
+	int attempt, status = -1, server_says_no = 0;
+
+	if (sha256p)
+		*sha256p = NULL;
+	body_hashing = sha256p != NULL;
+	http_quiet = quiet;
+
+	/* reopen an earlier partial transfer so it continues where it
+	 * stopped instead of starting over */
+	out = fopen(dest_file_name, "r+");
+	if (!out)
+		out = fopen(dest_file_name, "w");
+	if (!out) {
+		opkg_perror(ERROR, "Failed to open %s", dest_file_name);
+		return -1;
+	}
+
+	for (attempt = 0; attempt < HTTP_MAX_ATTEMPTS; attempt++) {
+		if (body_hashing)
+			http_hash_prefix(out);
+
+		fseeko(out, 0, SEEK_END);
+		offset = ftello(out);
+
+		xfer_done = xfer_reported = offset;
+		xfer_total = 0;
+
+		status = http_fetch_url(url, out, offset);
+		fflush(out);
+
+		if (status == 200 || status == 206)
+			break;
+
+		if (status == 416) {
+			/* the partial is as large as (or larger than) the
+			 * remote file, so it cannot be trusted: restart */
+			rewind(out);
+			if (ftruncate(fileno(out), 0) != 0)
+				break;
+			continue;
+		}
+
+		if (status > 0) {
+			message_level_t lvl = http_quiet ? INFO : ERROR;
+
+			opkg_msg(lvl, "Failed to download %s, server "
+				 "returned %d.\n", url, status);
+			server_says_no = 1;
+			break;
+		}
+
+		/* transport error: whatever arrived stays in the file
+		 * and the next attempt resumes behind it */
+		if ((unsigned long long)ftello(out) > offset)
+			opkg_msg(NOTICE, "Download of %s interrupted, "
+				 "resuming at %llu bytes.\n", url,
+				 (unsigned long long)ftello(out));
+	}
+
+	if (fclose(out) && status / 100 == 2) {
+		opkg_perror(ERROR, "Failed to write %s", dest_file_name);
+		status = -1;
+	}
+
+	if (status == 200 || status == 206) {
+		if (body_hashing) {
+			unsigned char bin[32];
+
+			sha256_finish_ctx(&body_hash, bin);
+			*sha256p = xstrdup(checksum_bin2hex((char *)bin,
+							    sizeof(bin)));
+			body_hashing = 0;
+		}
+		return 0;
+	}
+
+	body_hashing = 0;
+
+	/* a definite server answer means the partial has no future;
+	 * after transport errors it is kept for the next attempt */
+	if (server_says_no) {
+		unlink(dest_file_name);
+		return status;
+	}
+
+	return -1;
+}
+
+/*
+ * Measure the TCP connect latency to the host serving url, in
+ * milliseconds. Local urls cost nothing; -1 means the host could not
+ * be resolved or connected to. https hosts are probed with a plain
+ * connect to their port even though the transfer itself goes through
+ * wget; the handshake cost still tells mirrors apart.
+ */
+long http_probe_latency(const char *url)
+{
+	struct timespec t0, t1;
+	char *host;
+	const char *rest;
+	size_t host_len;
+	int port, fd;
+
+	if (strncmp(url, "file:", 5) == 0)
+		return 0;
+
+	if (strncmp(url, "http://", 7) == 0) {
+		rest = url + 7;
+		port = 80;
+	} else if (strncmp(url, "https://", 8) == 0) {
+		rest = url + 8;
+		port = 443;
+	} else
+		return -1;
+
+	host_len = strcspn(rest, ":/");
+	if (!host_len)
+		return -1;
+
+	if (rest[host_len] == ':') {
+		port = atoi(rest + host_len + 1);
+		if (port <= 0)
+			return -1;
+	}
+
+	host = xstrndup(rest, host_len);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	fd = http_connect_fd(host, port);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	free(host);
+
+	if (fd == -1)
+		return -1;
+	close(fd);
+
+	return (t1.tv_sec - t0.tv_sec) * 1000
+	    + (t1.tv_nsec - t0.tv_nsec) / 1000000;
+}
+
+void http_client_deinit(void)
+{
+	int i;
+
+	for (i = 0; i < HTTP_MAX_CONNS; i++)
+		http_conn_close(&conns[i]);
+}
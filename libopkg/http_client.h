@@ -0,0 +1,39 @@
+/* http_client.h - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef HTTP_CLIENT_H
+#define HTTP_CLIENT_H
+
+/*
+ * Fetch url into dest_file_name. When sha256p is non-NULL it receives
+ * the malloc'd hex sha256 of the downloaded file, computed from the
+ * bytes as they arrived (NULL if the download failed). quiet demotes
+ * failure messages to INFO, for probing files that may well not exist.
+ * Returns 0 on success, -1 on transport failure, or the positive HTTP
+ * status when the server definitely refused the request.
+ */
+int http_client_download(const char *url, const char *dest_file_name,
+                         char **sha256p, int quiet);
+long http_probe_latency(const char *url);
+
+/*
+ * Observer for transfer progress: wire bytes received so far and the
+ * expected total (0 when the server sent no length). Invoked from the
+ * download loop at coarse intervals; pass NULL to uninstall.
+ */
+typedef void (*http_progress_cb) (unsigned long long transferred,
+                                  unsigned long long total, void *data);
+void http_client_set_progress(http_progress_cb cb, void *data);
+void http_client_deinit(void);
+
+#endif
@@ -17,7 +17,10 @@
 
 #include <stdio.h>
 #include <unistd.h>
+#include <ctype.h>
 #include <fnmatch.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "opkg.h"
 #include "opkg_conf.h"
@@ -25,11 +28,13 @@
 #include "opkg_install.h"
 #include "opkg_configure.h"
 #include "opkg_download.h"
+#include "http_client.h"
 #include "opkg_remove.h"
 #include "opkg_upgrade.h"
 
 #include "sprintf_alloc.h"
 #include "file_util.h"
+#include "pkg_index.h"
 
 #include <libbb/libbb.h>
 
@@ -41,6 +46,74 @@
 
 /** Private Functions ***/
 
+/*
+ * Bridge between the byte counters of the download loop and the
+ * coarse phase callback: fills the transfer fields of the progress
+ * data and re-invokes the caller's callback on every tick, with an
+ * instantaneous rate measured between consecutive ticks.
+ */
+struct xfer_progress_ctx {
+	opkg_progress_data_t *pdata;
+	opkg_progress_callback_t callback;
+	void *user_data;
+	struct timespec last;
+	unsigned long long last_bytes;
+};
+
+static void xfer_progress_bridge(unsigned long long transferred,
+				 unsigned long long total, void *data)
+{
+	struct xfer_progress_ctx *ctx = data;
+	struct timespec now;
+	long long elapsed_ms;
+
+	ctx->pdata->bytes_transferred = transferred;
+	ctx->pdata->bytes_total = total;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (ctx->last.tv_sec || ctx->last.tv_nsec) {
+		elapsed_ms = (now.tv_sec - ctx->last.tv_sec) * 1000
+		    + (now.tv_nsec - ctx->last.tv_nsec) / 1000000;
+		if (elapsed_ms > 0 && transferred > ctx->last_bytes)
+			ctx->pdata->bytes_per_sec =
+			    (transferred - ctx->last_bytes) * 1000
+			    / elapsed_ms;
+	}
+	ctx->last = now;
+	ctx->last_bytes = transferred;
+
+	ctx->callback(ctx->pdata, ctx->user_data);
+}
+
+static void xfer_progress_attach(struct xfer_progress_ctx *ctx,
+				 opkg_progress_data_t *pdata,
+				 opkg_progress_callback_t callback,
+				 void *user_data)
+{
+	if (!callback)
+		return;
+
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->pdata = pdata;
+	ctx->callback = callback;
+	ctx->user_data = user_data;
+
+	pdata->bytes_transferred = 0;
+	pdata->bytes_total = 0;
+	pdata->bytes_per_sec = 0;
+
+	http_client_set_progress(xfer_progress_bridge, ctx);
+}
+
+static void xfer_progress_detach(opkg_progress_data_t *pdata)
+{
+	http_client_set_progress(NULL, NULL);
+
+	pdata->bytes_transferred = 0;
+	pdata->bytes_total = 0;
+	pdata->bytes_per_sec = 0;
+}
+
 static int opkg_configure_packages(char *pkg_name)
 {
 	pkg_vec_t *all;
@@ -60,9 +133,10 @@ static int opkg_configure_packages(char *pkg_name)
 		if (pkg->state_status == SS_UNPACKED) {
 			r = opkg_configure(pkg);
 			if (r == 0) {
-				pkg->state_status = SS_INSTALLED;
+				pkg_set_state_status(pkg, SS_INSTALLED);
 				pkg->parent->state_status = SS_INSTALLED;
 				pkg->state_flag &= ~SF_PREFER;
+				opkg_status_mark_dirty(pkg);
 			} else {
 				if (!err)
 					err = r;
@@ -74,12 +148,93 @@ static int opkg_configure_packages(char *pkg_name)
 	return err;
 }
 
-static struct opkg_conf saved_conf;
+static __thread struct opkg_conf saved_conf;
+
+extern opkg_option_t options[];
+
+/* rebase an options[] value slot onto an arbitrary conf struct */
+static void *option_value_in(struct opkg_conf *c, const opkg_option_t *o)
+{
+	return (char *)c + ((char *)o->value - (char *)opkg_conf_builtin());
+}
+
+/*
+ * saved_conf must outlive opkg_free(), which releases every string the
+ * live conf owns, so the saved copy duplicates them; the non-option
+ * string members that opkg_conf_deinit() frees are covered too.
+ */
+static void conf_dup_strings(struct opkg_conf *c)
+{
+	char **slot;
+	int i;
+
+	for (i = 0; options[i].name; i++) {
+		if (options[i].type != OPKG_OPT_TYPE_STRING)
+			continue;
+		slot = option_value_in(c, &options[i]);
+		if (*slot)
+			*slot = xstrdup(*slot);
+	}
+
+	if (c->conf_file)
+		c->conf_file = xstrdup(c->conf_file);
+	if (c->dest_str)
+		c->dest_str = xstrdup(c->dest_str);
+	if (c->lists_dir)
+		c->lists_dir = xstrdup(c->lists_dir);
+	if (c->fields)
+		c->fields = xstrdup(c->fields);
+}
+
+static void conf_free_strings(struct opkg_conf *c)
+{
+	char **slot;
+	int i;
+
+	for (i = 0; options[i].name; i++) {
+		if (options[i].type != OPKG_OPT_TYPE_STRING)
+			continue;
+		slot = option_value_in(c, &options[i]);
+		free(*slot);
+		*slot = NULL;
+	}
+
+	free(c->conf_file);
+	free(c->dest_str);
+	free(c->lists_dir);
+	free(c->fields);
+	memset(c, 0, sizeof(*c));
+}
+
 /*** Public API ***/
 
+struct opkg_ctx {
+	opkg_conf_t conf;
+};
+
+opkg_ctx_t *opkg_ctx_new(void)
+{
+	return xcalloc(1, sizeof(struct opkg_ctx));
+}
+
+/* Bind ctx to the calling thread; all libopkg state is thread-local,
+ * so this is the only hand-off independent contexts need. */
+void opkg_ctx_use(opkg_ctx_t *ctx)
+{
+	conf = ctx ? &ctx->conf : opkg_conf_builtin();
+}
+
+void opkg_ctx_free(opkg_ctx_t *ctx)
+{
+	if (conf == &ctx->conf)
+		conf = opkg_conf_builtin();
+	free(ctx);
+}
+
 int opkg_new()
 {
 	saved_conf = *conf;
+	conf_dup_strings(&saved_conf);
 
 	if (opkg_conf_init())
 		goto err0;
@@ -105,12 +260,17 @@ err0:
 void opkg_free(void)
 {
 	opkg_conf_deinit();
+	conf_free_strings(&saved_conf);
 }
 
 int opkg_re_read_config_files(void)
 {
+	struct opkg_conf restored = saved_conf;
+
+	/* opkg_free() releases the saved set, so restore from a copy */
+	conf_dup_strings(&restored);
 	opkg_free();
-	*conf = saved_conf;
+	*conf = restored;
 	return opkg_new();
 }
 
@@ -129,18 +289,18 @@ void opkg_get_option(char *option, void **value)
 		}
 	}
 
-	/* get the option */
+	/* get the option from the bound context */
 	switch (options[i].type) {
 	case OPKG_OPT_TYPE_BOOL:
-		*((int *)value) = *((int *)options[i].value);
+		*((int *)value) = *(int *)opkg_option_value(&options[i]);
 		return;
 
 	case OPKG_OPT_TYPE_INT:
-		*((int *)value) = *((int *)options[i].value);
+		*((int *)value) = *(int *)opkg_option_value(&options[i]);
 		return;
 
 	case OPKG_OPT_TYPE_STRING:
-		*((char **)value) = xstrdup(options[i].value);
+		*((char **)value) = xstrdup(opkg_option_value(&options[i]));
 		return;
 	}
 
@@ -170,21 +330,21 @@ void opkg_set_option(char *option, void *value)
 		return;
 	}
 
-	/* set the option */
+	/* set the option in the bound context */
 	switch (options[i].type) {
 	case OPKG_OPT_TYPE_BOOL:
 		if (*((int *)value) == 0)
-			*((int *)options[i].value) = 0;
+			*(int *)opkg_option_value(&options[i]) = 0;
 		else
-			*((int *)options[i].value) = 1;
+			*(int *)opkg_option_value(&options[i]) = 1;
 		return;
 
 	case OPKG_OPT_TYPE_INT:
-		*((int *)options[i].value) = *((int *)value);
+		*(int *)opkg_option_value(&options[i]) = *((int *)value);
 		return;
 
 	case OPKG_OPT_TYPE_STRING:
-		*((char **)options[i].value) = xstrdup(value);
+		*(char **)opkg_option_value(&options[i]) = xstrdup(value);
 		return;
 	}
 
@@ -203,6 +363,7 @@ opkg_install_package(const char *package_name,
 	int err;
 	char *stripped_filename, *local_filename;
 	opkg_progress_data_t pdata;
+	struct xfer_progress_ctx xctx;
 	pkg_t *old, *new;
 	pkg_vec_t *deps, *all;
 	int i;
@@ -257,6 +418,8 @@ opkg_install_package(const char *package_name,
 	/* insert the package we are installing so that we download it */
 	pkg_vec_insert(deps, new);
 
+	xfer_progress_attach(&xctx, &pdata, progress_callback, user_data);
+
 	/* download package and dependencies */
 	for (i = 0; i < deps->len; i++) {
 		pkg_t *pkg;
@@ -294,11 +457,13 @@ opkg_install_package(const char *package_name,
 		free(url);
 
 		if (err) {
+			xfer_progress_detach(&pdata);
 			pkg_vec_free(deps);
 			return -1;
 		}
 
 	}
+	xfer_progress_detach(&pdata);
 	pkg_vec_free(deps);
 
 	/* clear depenacy checked marks, left by pkg_hash_fetch_unsatisfied_dependencies */
@@ -389,6 +554,7 @@ opkg_upgrade_package(const char *package_name,
 	int err;
 	pkg_t *pkg;
 	opkg_progress_data_t pdata;
+	struct xfer_progress_ctx xctx;
 
 	opkg_assert(package_name != NULL);
 
@@ -410,7 +576,9 @@ opkg_upgrade_package(const char *package_name,
 	pdata.pkg = pkg;
 	progress(pdata, 0);
 
+	xfer_progress_attach(&xctx, &pdata, progress_callback, user_data);
 	err = opkg_upgrade_pkg(pkg);
+	xfer_progress_detach(&pdata);
 	if (err) {
 		return -1;
 	}
@@ -437,6 +605,7 @@ opkg_upgrade_all(opkg_progress_callback_t progress_callback, void *user_data)
 	int i;
 	pkg_t *pkg;
 	opkg_progress_data_t pdata;
+	struct xfer_progress_ctx xctx;
 
 	pdata.action = OPKG_INSTALL;
 	pdata.pkg = NULL;
@@ -446,6 +615,8 @@ opkg_upgrade_all(opkg_progress_callback_t progress_callback, void *user_data)
 	installed = pkg_vec_alloc();
 	pkg_info_preinstall_check();
 
+	xfer_progress_attach(&xctx, &pdata, progress_callback, user_data);
+
 	pkg_hash_fetch_all_installed(installed);
 	for (i = 0; i < installed->len; i++) {
 		pkg = installed->pkgs[i];
@@ -455,6 +626,7 @@ opkg_upgrade_all(opkg_progress_callback_t progress_callback, void *user_data)
 
 		err += opkg_upgrade_pkg(pkg);
 	}
+	xfer_progress_detach(&pdata);
 	pkg_vec_free(installed);
 
 	if (err)
@@ -484,17 +656,21 @@ opkg_update_package_lists(opkg_progress_callback_t progress_callback,
 	pkg_src_t *src;
 	int sources_list_count, sources_done;
 	opkg_progress_data_t pdata;
+	struct xfer_progress_ctx xctx;
 
 	pdata.action = OPKG_DOWNLOAD;
 	pdata.pkg = NULL;
 	progress(pdata, 0);
 
+	xfer_progress_attach(&xctx, &pdata, progress_callback, user_data);
+
 	sprintf_alloc(&lists_dir, "%s", (conf->restrict_to_default_dest)
 		      ? conf->default_dest->lists_dir : conf->lists_dir);
 
 	if (!file_is_dir(lists_dir)) {
 		if (file_exists(lists_dir)) {
 			opkg_msg(ERROR, "%s is not a directory\n", lists_dir);
+			xfer_progress_detach(&pdata);
 			free(lists_dir);
 			return 1;
 		}
@@ -503,6 +679,7 @@ opkg_update_package_lists(opkg_progress_callback_t progress_callback,
 		if (err) {
 			opkg_msg(ERROR, "Couldn't create lists_dir %s\n",
 				 lists_dir);
+			xfer_progress_detach(&pdata);
 			free(lists_dir);
 			return 1;
 		}
@@ -512,6 +689,7 @@ opkg_update_package_lists(opkg_progress_callback_t progress_callback,
 	if (mkdtemp(tmp) == NULL) {
 		opkg_perror(ERROR, "Coundn't create temporary directory %s",
 			    tmp);
+		xfer_progress_detach(&pdata);
 		free(lists_dir);
 		free(tmp);
 		return 1;
@@ -599,12 +777,128 @@ opkg_update_package_lists(opkg_progress_callback_t progress_callback,
 	free(tmp);
 	free(lists_dir);
 
+	xfer_progress_detach(&pdata);
+
 	/* Now re-read the package lists to update package hash tables. */
 	opkg_re_read_config_files();
 
 	return result;
 }
 
+/*
+ * Async operations: the whole session (context bind, load, operation,
+ * teardown) runs on an internal worker thread, and completion is
+ * signalled through a pipe so an event loop can poll for it instead
+ * of blocking or forking per operation.
+ */
+struct opkg_async_op {
+	opkg_ctx_t *ctx;
+	char *package_name;
+	opkg_progress_callback_t progress;
+	void *user_data;
+	int is_update;
+	int pipefd[2];
+	int result;
+	pthread_t thread;
+};
+
+static void *async_op_thread(void *data)
+{
+	struct opkg_async_op *op = data;
+	ssize_t n;
+
+	opkg_ctx_use(op->ctx);
+
+	if (opkg_new())
+		op->result = -1;
+	else {
+		if (op->is_update)
+			op->result = opkg_update_package_lists(op->progress,
+							       op->user_data);
+		else
+			op->result = opkg_install_package(op->package_name,
+							  op->progress,
+							  op->user_data);
+		opkg_free();
+	}
+
+	n = write(op->pipefd[1], "", 1);
+	(void)n;
+	return NULL;
+}
+
+static opkg_async_op_t *async_op_start(opkg_ctx_t *ctx,
+				       const char *package_name, int is_update,
+				       opkg_progress_callback_t progress,
+				       void *user_data)
+{
+	struct opkg_async_op *op = xcalloc(1, sizeof(*op));
+
+	op->ctx = ctx;
+	op->package_name = package_name ? xstrdup(package_name) : NULL;
+	op->progress = progress;
+	op->user_data = user_data;
+	op->is_update = is_update;
+
+	if (pipe(op->pipefd)) {
+		free(op->package_name);
+		free(op);
+		return NULL;
+	}
+
+	if (pthread_create(&op->thread, NULL, async_op_thread, op)) {
+		close(op->pipefd[0]);
+		close(op->pipefd[1]);
+		free(op->package_name);
+		free(op);
+		return NULL;
+	}
+
+	return op;
+}
+
+opkg_async_op_t *opkg_install_package_async(opkg_ctx_t *ctx,
+					    const char *package_name,
+					    opkg_progress_callback_t progress,
+					    void *user_data)
+{
+	opkg_assert(package_name != NULL);
+	return async_op_start(ctx, package_name, 0, progress, user_data);
+}
+
+opkg_async_op_t *opkg_update_package_lists_async(opkg_ctx_t *ctx,
+						 opkg_progress_callback_t
+						 progress, void *user_data)
+{
+	return async_op_start(ctx, NULL, 1, progress, user_data);
+}
+
+int opkg_async_fd(opkg_async_op_t *op)
+{
+	return op->pipefd[0];
+}
+
+int opkg_async_finish(opkg_async_op_t *op)
+{
+	char byte;
+	ssize_t n;
+	int result;
+
+	/* blocks only if called before the fd signalled readiness */
+	n = read(op->pipefd[0], &byte, 1);
+	(void)n;
+	pthread_join(op->thread, NULL);
+
+	result = op->result;
+	close(op->pipefd[0]);
+	close(op->pipefd[1]);
+	opkg_ctx_free(op->ctx);
+	free(op->package_name);
+	free(op);
+
+	return result;
+}
+
 static int pkg_compare_names_and_version(const void *a0, const void *b0)
 {
 	const pkg_t *a = *(const pkg_t **)a0;
@@ -644,6 +938,143 @@ int opkg_list_packages(opkg_package_callback_t callback, void *user_data)
 	return 0;
 }
 
+/* find one field's value in a stanza and return it as a trimmed slice */
+static const char *stanza_field_slice(const char *stanza, const char *end,
+				      const char *field, size_t *lenp)
+{
+	size_t field_len = strlen(field);
+	const char *p = stanza, *nl, *s, *e;
+
+	while (p < end) {
+		nl = memchr(p, '\n', end - p);
+		if (!nl)
+			nl = end;
+
+		if ((size_t) (nl - p) > field_len && p[field_len] == ':' &&
+		    strncmp(p, field, field_len) == 0) {
+			s = p + field_len + 1;
+			while (s < nl && isspace(*s))
+				s++;
+			e = nl;
+			while (e > s && isspace(e[-1]))
+				e--;
+			*lenp = e - s;
+			return s;
+		}
+
+		p = nl + 1;
+	}
+
+	*lenp = 0;
+	return NULL;
+}
+
+static void enumerate_stanza(const char *name, const char *stanza,
+			     const char *end, const char *repo,
+			     opkg_package_view_callback_t callback,
+			     void *user_data)
+{
+	struct opkg_package_view view;
+
+	view.name = name;
+	view.version = stanza_field_slice(stanza, end, "Version",
+					  &view.version_len);
+	view.architecture = stanza_field_slice(stanza, end, "Architecture",
+					       &view.architecture_len);
+	view.repository = repo;
+
+	callback(&view, user_data);
+}
+
+static void enumerate_list(const char *list_file, pkg_src_t * src,
+			   const char *repo,
+			   opkg_package_view_callback_t callback,
+			   void *user_data)
+{
+	struct pkg_index idx;
+	struct pkg_index_record *rec;
+	char *text, namebuf[256];
+	const char *p, *end, *stanza, *name;
+	size_t text_len, name_len;
+	uint32_t i;
+
+	if (pkg_index_open(&idx, list_file) == 0) {
+		for (i = 0; i < idx.hdr->n_records; i++) {
+			rec = &idx.records[i];
+			enumerate_stanza(idx.data + rec->name_off,
+					 idx.data + rec->stanza_off,
+					 idx.data + rec->stanza_off +
+					 rec->stanza_len, repo, callback,
+					 user_data);
+		}
+		pkg_index_close(&idx);
+		return;
+	}
+
+	/* no usable index; scan the text, which still costs no field
+	 * parsing beyond the three slices */
+	text = pkg_index_read_list(list_file, src, &text_len);
+	if (text == NULL)
+		return;
+
+	p = text;
+	end = text + text_len;
+	while ((stanza = pkg_index_next_stanza(&p, end)) != NULL) {
+		name = pkg_index_stanza_name(stanza, p, &name_len);
+		if (name == NULL || name_len == 0
+		    || name_len >= sizeof(namebuf))
+			continue;
+		memcpy(namebuf, name, name_len);
+		namebuf[name_len] = '\0';
+		enumerate_stanza(namebuf, stanza, p, repo, callback,
+				 user_data);
+	}
+	free(text);
+}
+
+/*
+ * Lightweight enumeration: walk the mmapped binary feed and status
+ * indexes and hand the callback read-only field views, without
+ * constructing pkg_t objects, loading details or touching the package
+ * hash. Records come out in feed order, one view per stanza; versions
+ * of the same package are not merged or sorted.
+ */
+int opkg_enumerate_packages(opkg_package_view_callback_t callback,
+			    void *user_data)
+{
+	pkg_src_list_elt_t *iter;
+	pkg_dest_list_elt_t *dest_iter;
+	pkg_src_t *src;
+	pkg_dest_t *dest;
+	char *lists_dir, *list_file;
+
+	opkg_assert(callback);
+
+	lists_dir = conf->restrict_to_default_dest ?
+	    conf->default_dest->lists_dir : conf->lists_dir;
+
+	for (iter = void_list_first(&conf->pkg_src_list); iter;
+	     iter = void_list_next(&conf->pkg_src_list, iter)) {
+		src = (pkg_src_t *) iter->data;
+
+		sprintf_alloc(&list_file, "%s/%s", lists_dir, src->name);
+		if (file_exists(list_file))
+			enumerate_list(list_file, src, src->name, callback,
+				       user_data);
+		free(list_file);
+	}
+
+	list_for_each_entry(dest_iter, &conf->pkg_dest_list.head, node) {
+		dest = (pkg_dest_t *) dest_iter->data;
+
+		if (file_exists(dest->status_file_name))
+			enumerate_list(dest->status_file_name, NULL,
+				       dest->name, callback, user_data);
+	}
+
+	return 0;
+}
+
 int
 opkg_list_upgradable_packages(opkg_package_callback_t callback, void *user_data)
 {
@@ -37,8 +37,34 @@ struct _opkg_progress_data_t {
 	int percentage;
 	int action;
 	pkg_t *pkg;
+
+	/* transfer state, valid while action is a downloading phase:
+	 * bytes_total is 0 when the server did not announce a length,
+	 * bytes_per_sec is the rate measured between the two most
+	 * recent updates (0 until there are two) */
+	unsigned long long bytes_transferred;
+	unsigned long long bytes_total;
+	unsigned long long bytes_per_sec;
 };
 
+/*
+ * Explicit library context. Each context carries its own configuration,
+ * package hash and transaction state, so independent contexts on
+ * separate threads never interfere — one thread per offline root, say.
+ *
+ * A thread binds a context with opkg_ctx_use() and then calls the rest
+ * of the API as before; opkg_new()/opkg_free() initialize and tear down
+ * whatever context the calling thread has bound. A context must not be
+ * used from two threads at once, and opkg_ctx_free() expects
+ * opkg_free() to have run against it first. Passing NULL to
+ * opkg_ctx_use() rebinds the built-in context the CLI uses.
+ */
+typedef struct opkg_ctx opkg_ctx_t;
+
+opkg_ctx_t *opkg_ctx_new(void);
+void opkg_ctx_use(opkg_ctx_t *ctx);
+void opkg_ctx_free(opkg_ctx_t *ctx);
+
 int opkg_new(void);
 void opkg_free(void);
 int opkg_re_read_config_files(void);
@@ -55,7 +81,49 @@ int opkg_upgrade_all(opkg_progress_callback_t callback, void *user_data);
 int opkg_update_package_lists(opkg_progress_callback_t callback,
 			      void *user_data);
 
+/*
+ * Non-blocking variants for event-loop daemons. The operation runs the
+ * whole session — bind ctx, load, operate, tear down — on an internal
+ * worker thread: pass a freshly created context (config fields may be
+ * assigned, but do not bind or opkg_new() it yourself). The fd from
+ * opkg_async_fd() becomes readable on completion; opkg_async_finish()
+ * then returns the operation's result and frees both the op and its
+ * context. Progress callbacks are invoked on the worker thread.
+ */
+typedef struct opkg_async_op opkg_async_op_t;
+
+opkg_async_op_t *opkg_install_package_async(opkg_ctx_t *ctx,
+					    const char *package_name,
+					    opkg_progress_callback_t callback,
+					    void *user_data);
+opkg_async_op_t *opkg_update_package_lists_async(opkg_ctx_t *ctx,
+						 opkg_progress_callback_t
+						 callback, void *user_data);
+int opkg_async_fd(opkg_async_op_t *op);
+int opkg_async_finish(opkg_async_op_t *op);
+
+/*
+ * Read-only view of one package record, valid only for the duration of
+ * the enumeration callback. The name and repository are NUL-terminated;
+ * version and architecture are unterminated slices into the mmapped
+ * index, so consumers that need only a few fields can list very large
+ * feeds without any per-package parsing or allocation.
+ */
+struct opkg_package_view {
+	const char *name;
+	const char *version;
+	size_t version_len;
+	const char *architecture;
+	size_t architecture_len;
+	const char *repository;
+};
+
+typedef void (*opkg_package_view_callback_t) (const struct opkg_package_view *
+					      view, void *user_data);
+
 int opkg_list_packages(opkg_package_callback_t callback, void *user_data);
+int opkg_enumerate_packages(opkg_package_view_callback_t callback,
+			    void *user_data);
 int opkg_list_upgradable_packages(opkg_package_callback_t callback,
 				  void *user_data);
 pkg_t *opkg_find_package(const char *name, const char *version,
@@ -15,12 +15,15 @@
    General Public License for more details.
 */
 
+#define _GNU_SOURCE	/* syncfs */
 #include <stdio.h>
 #include <dirent.h>
 #include <glob.h>
 #include <fnmatch.h>
 #include <signal.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
 
 #include "opkg_conf.h"
 #include "opkg_cmd.h"
@@ -28,6 +31,12 @@
 #include "pkg.h"
 #include "pkg_dest.h"
 #include "pkg_parse.h"
+#include "pkg_index.h"
+#include "filelist_index.h"
+#include "str_vec.h"
+#include "opkg_journal.h"
+#include "opkg_profile.h"
+#include "pkg_order.h"
 #include "sprintf_alloc.h"
 #include "pkg.h"
 #include "file_util.h"
@@ -43,7 +52,8 @@
 
 static void print_pkg(pkg_t * pkg)
 {
-	char *version = pkg_version_str_alloc(pkg);
+	char vbuf[PKG_VERSION_STR_MAX];
+	char *version = pkg_version_str_r(pkg, vbuf, sizeof(vbuf));
 	char *description = pkg_get_string(pkg, PKG_DESCRIPTION);
 	printf("%s - %s", pkg->name, version);
 	if (conf->size)
@@ -51,17 +61,251 @@ static void print_pkg(pkg_t * pkg)
 	if (description)
 		printf(" - %s", description);
 	printf("\n");
-	free(version);
+}
+
+/*
+ * --json output for the query commands. Each selected field is rendered
+ * straight into the output buffer; --fields narrows the selection so
+ * only the requested data is fetched and escaped.
+ */
+#define JSON_F_NAME		(1 << 0)
+#define JSON_F_VERSION		(1 << 1)
+#define JSON_F_ARCHITECTURE	(1 << 2)
+#define JSON_F_SECTION		(1 << 3)
+#define JSON_F_DESCRIPTION	(1 << 4)
+#define JSON_F_FILENAME		(1 << 5)
+#define JSON_F_SIZE		(1 << 6)
+#define JSON_F_INSTALLED_SIZE	(1 << 7)
+#define JSON_F_STATUS		(1 << 8)
+#define JSON_F_ALL		(~0U)
+
+static unsigned int json_field_mask(void)
+{
+	static const struct {
+		const char *name;
+		unsigned int bit;
+	} fields[] = {
+		{"name", JSON_F_NAME},
+		{"version", JSON_F_VERSION},
+		{"architecture", JSON_F_ARCHITECTURE},
+		{"section", JSON_F_SECTION},
+		{"description", JSON_F_DESCRIPTION},
+		{"filename", JSON_F_FILENAME},
+		{"size", JSON_F_SIZE},
+		{"installed_size", JSON_F_INSTALLED_SIZE},
+		{"status", JSON_F_STATUS},
+	};
+	unsigned int mask = 0;
+	char *list, *item, *tok;
+	int i, known;
+
+	if (!conf->fields)
+		return JSON_F_ALL;
+
+	list = xstrdup(conf->fields);
+	for (item = strtok_r(list, ", ", &tok); item;
+	     item = strtok_r(NULL, ", ", &tok)) {
+		known = 0;
+		for (i = 0; i < ARRAY_SIZE(fields); i++) {
+			if (strcmp(item, fields[i].name) == 0) {
+				mask |= fields[i].bit;
+				known = 1;
+				break;
+			}
+		}
+		if (!known)
+			opkg_msg(ERROR, "Ignoring unknown field %s.\n", item);
+	}
+	free(list);
+
+	return mask ? mask : JSON_F_ALL;
+}
+
+static void json_append_escaped(struct strbuf *sb, const char *str)
+{
+	const char *s;
+
+	strbuf_printf(sb, "\"");
+	for (s = str; *s; s++) {
+		switch (*s) {
+		case '"':
+			strbuf_printf(sb, "\\\"");
+			break;
+		case '\\':
+			strbuf_printf(sb, "\\\\");
+			break;
+		case '\n':
+			strbuf_printf(sb, "\\n");
+			break;
+		case '\r':
+			strbuf_printf(sb, "\\r");
+			break;
+		case '\t':
+			strbuf_printf(sb, "\\t");
+			break;
+		default:
+			if ((unsigned char)*s < 0x20)
+				strbuf_printf(sb, "\\u%04x",
+					      (unsigned char)*s);
+			else
+				strbuf_printf(sb, "%c", *s);
+		}
+	}
+	strbuf_printf(sb, "\"");
+}
+
+static void json_append_str_member(struct strbuf *sb, int *n, const char *key,
+				   const char *value)
+{
+	if (!value)
+		return;
+	strbuf_printf(sb, "%s\"%s\":", (*n)++ ? "," : "", key);
+	json_append_escaped(sb, value);
+}
+
+static void json_append_int_member(struct strbuf *sb, int *n, const char *key,
+				   unsigned long value)
+{
+	strbuf_printf(sb, "%s\"%s\":%lu", (*n)++ ? "," : "", key, value);
+}
+
+static void pkg_json_append(struct strbuf *sb, pkg_t * pkg, unsigned int mask)
+{
+	int n = 0;
+	char vbuf[PKG_VERSION_STR_MAX];
+	char *version;
+
+	strbuf_printf(sb, "{");
+	if (mask & JSON_F_NAME)
+		json_append_str_member(sb, &n, "name", pkg->name);
+	if (mask & JSON_F_VERSION) {
+		version = pkg_version_str_r(pkg, vbuf, sizeof(vbuf));
+		json_append_str_member(sb, &n, "version", version);
+	}
+	if (mask & JSON_F_ARCHITECTURE)
+		json_append_str_member(sb, &n, "architecture",
+				       pkg_get_architecture(pkg));
+	if (mask & JSON_F_SECTION)
+		json_append_str_member(sb, &n, "section",
+				       pkg_get_string(pkg, PKG_SECTION));
+	if (mask & JSON_F_DESCRIPTION)
+		json_append_str_member(sb, &n, "description",
+				       pkg_get_string(pkg, PKG_DESCRIPTION));
+	if (mask & JSON_F_FILENAME)
+		json_append_str_member(sb, &n, "filename",
+				       pkg_get_string(pkg, PKG_FILENAME));
+	if (mask & JSON_F_SIZE)
+		json_append_int_member(sb, &n, "size",
+				       (unsigned long) pkg_get_int(pkg,
+								   PKG_SIZE));
+	if (mask & JSON_F_INSTALLED_SIZE)
+		json_append_int_member(sb, &n, "installed_size",
+				       (unsigned long) pkg_get_int(pkg,
+								   PKG_INSTALLED_SIZE));
+	if (mask & JSON_F_STATUS)
+		json_append_str_member(sb, &n, "status",
+				       pkg_state_status_to_str(pkg->
+							       state_status));
+	strbuf_printf(sb, "}");
+}
+
+/* listing context: the lines accumulate in a buffer that is flushed
+ * in large chunks, while output still streams as it is produced */
+#define PKG_LIST_BUF_FLUSH	(64 * 1024)
+
+struct pkg_list_ctx {
+	const char *pkg_name;
+	struct glob_query query;
+	int use_desc;
+	int installed_only;
+	unsigned int json_mask;
+	int json_count;
+	struct strbuf sb;
+};
+
+static void list_pkg_helper(pkg_t * pkg, void *data)
+{
+	struct pkg_list_ctx *ctx = data;
+	char vbuf[PKG_VERSION_STR_MAX];
+	char *version;
+	const char *description;
+
+	if (ctx->installed_only && pkg->state_status != SS_INSTALLED
+	    && pkg->state_status != SS_UNPACKED)
+		return;
+
+	description = pkg_get_string(pkg, PKG_DESCRIPTION);
+
+	/* if we have package name or pattern and pkg does not match, then skip it */
+	if (ctx->pkg_name && !glob_query_match(&ctx->query, pkg->name)
+	    && (!ctx->use_desc || !description
+		|| !glob_query_match(&ctx->query, description)))
+		return;
+
+	if (conf->json) {
+		if (ctx->json_count++)
+			strbuf_printf(&ctx->sb, ",");
+		pkg_json_append(&ctx->sb, pkg, ctx->json_mask);
+	} else {
+		version = pkg_version_str_r(pkg, vbuf, sizeof(vbuf));
+		strbuf_printf(&ctx->sb, "%s - %s", pkg->name, version);
+		if (conf->size)
+			strbuf_printf(&ctx->sb, " - %lu",
+				      (unsigned long) pkg_get_int(pkg,
+								  PKG_SIZE));
+		if (description)
+			strbuf_printf(&ctx->sb, " - %s", description);
+		strbuf_printf(&ctx->sb, "\n");
+	}
+
+	if (ctx->sb.len >= PKG_LIST_BUF_FLUSH) {
+		fwrite(ctx->sb.buf, 1, ctx->sb.len, stdout);
+		ctx->sb.len = 0;
+	}
 }
 
 int opkg_state_changed;
 
+/*
+ * Flush everything the transaction wrote in one go. Data files,
+ * control files and the status database are written without per-file
+ * sync; one syncfs() per destination root at commit time gives the
+ * same crash safety at a fraction of the cost on flash filesystems,
+ * where per-file durability dominates install time.
+ */
+static void sync_dest_filesystems(void)
+{
+	pkg_dest_list_elt_t *iter;
+	pkg_dest_t *dest;
+	int fd;
+
+	list_for_each_entry(iter, &conf->pkg_dest_list.head, node) {
+		dest = (pkg_dest_t *) iter->data;
+
+		fd = open(dest->root_dir, O_RDONLY | O_DIRECTORY);
+		if (fd < 0) {
+			opkg_perror(ERROR, "Failed to open %s for sync",
+				    dest->root_dir);
+			continue;
+		}
+
+		if (syncfs(fd) < 0)
+			opkg_perror(ERROR, "Failed to sync %s",
+				    dest->root_dir);
+		close(fd);
+	}
+}
+
 static void write_status_files_if_changed(void)
 {
 	if (opkg_state_changed && !conf->noaction) {
 		opkg_msg(INFO, "Writing status file.\n");
 		opkg_conf_write_status_files();
 		pkg_write_changed_filelists();
+		/* the new state is recorded; rollback data is obsolete */
+		opkg_journal_commit();
+		if (conf->transaction_sync)
+			sync_dest_filesystems();
 	} else {
 		opkg_msg(DEBUG, "Nothing to be done.\n");
 	}
@@ -84,6 +328,15 @@ static int opkg_update_cmd(int argc, char **argv)
 	char *lists_dir;
 	pkg_src_list_elt_t *iter;
 	pkg_src_t *src;
+#if defined(HAVE_USIGN)
+	/* verifications started during the loop, collected after it */
+	struct sig_check {
+		int handle;
+		char *list_file;
+		char *sig_file;
+	} *sig_checks = NULL;
+	int i, n_sig_checks = 0;
+#endif
 
 	sprintf_alloc(&lists_dir, "%s",
 		      conf->restrict_to_default_dest ? conf->default_dest->
@@ -113,37 +366,67 @@ static int opkg_update_cmd(int argc, char **argv)
 
 	for (iter = void_list_first(&conf->pkg_src_list); iter;
 	     iter = void_list_next(&conf->pkg_src_list, iter)) {
-		char *url, *list_file_name;
+		char *url, *list_file_name, *new_file_name;
+		int pkglist_changed = 0;
 
 		src = (pkg_src_t *) iter->data;
 
+		int mirror_tries;
+
 		if (src->extra_data && strcmp(src->extra_data, "__dummy__ "))
 			continue;
 
-		if (src->extra_data)	/* debian style? */
-			sprintf_alloc(&url, "%s/%s/%s", src->value,
-				      src->extra_data,
-				      src->gzip ? "Packages.gz" : "Packages");
-		else
-			sprintf_alloc(&url, "%s/%s", src->value,
-				      src->gzip ? "Packages.gz" : "Packages");
+		pkg_src_probe_mirrors(src);
 
 		sprintf_alloc(&list_file_name, "%s/%s", lists_dir, src->name);
+		sprintf_alloc(&new_file_name, "%s/%s", tmp, src->name);
 		pkglist_dl_error = 0;
-		if (opkg_download(url, list_file_name, 0)) {
+
+		for (mirror_tries = src->n_mirrors; mirror_tries > 0;
+		     mirror_tries--) {
+			if (src->extra_data)	/* debian style? */
+				sprintf_alloc(&url, "%s/%s/%s", src->value,
+					      src->extra_data,
+					      src->gzip ? "Packages.gz" : "Packages");
+			else
+				sprintf_alloc(&url, "%s/%s", src->value,
+					      src->gzip ? "Packages.gz" : "Packages");
+
+			pkglist_dl_error =
+			    opkg_download(url, new_file_name, 0) ? 1 : 0;
+			if (!pkglist_dl_error || mirror_tries == 1)
+				break;
+
+			free(url);
+			pkg_src_next_mirror(src);
+		}
+
+		if (pkglist_dl_error) {
 			failures++;
-			pkglist_dl_error = 1;
 			opkg_msg(NOTICE,
 				 "*** Failed to download the package list from %s\n\n",
 				 url);
+		} else if (file_exists(list_file_name) &&
+			   file_identical(list_file_name, new_file_name)) {
+			/* unchanged list: keep the old file along with its
+			 * already verified signature and binary index */
+			opkg_msg(NOTICE,
+				 "Package list %s is unchanged.\n",
+				 list_file_name);
+			unlink(new_file_name);
+		} else if (file_move(new_file_name, list_file_name)) {
+			failures++;
+			pkglist_dl_error = 1;
 		} else {
+			pkglist_changed = 1;
 			opkg_msg(NOTICE,
 				 "Updated list of available packages in %s\n",
 				 list_file_name);
 		}
 		free(url);
+		free(new_file_name);
 #if defined(HAVE_USIGN)
-		if (pkglist_dl_error == 0 && conf->check_signature) {
+		if (pkglist_changed && conf->check_signature) {
 			/* download detached signitures to verify the package lists */
 			/* get the url for the sig file */
 			if (src->extra_data)	/* debian style? */
@@ -165,34 +448,80 @@ static int opkg_update_cmd(int argc, char **argv)
 				failures++;
 				opkg_msg(NOTICE,
 					 "Signature file download failed.\n");
-			} else {
-				err =
-				    opkg_verify_file(list_file_name,
-						     tmp_file_name);
-				if (err == 0)
+				if (!conf->force_signature) {
+					/* The signature was wrong so delete it */
 					opkg_msg(NOTICE,
-						 "Signature check passed.\n");
-				else
-					opkg_msg(NOTICE,
-						 "Signature check failed.\n");
-			}
-			if (err && !conf->force_signature) {
-				/* The signature was wrong so delete it */
-				opkg_msg(NOTICE,
-					 "Remove wrong Signature file.\n");
-				unlink(tmp_file_name);
-				unlink(list_file_name);
+						 "Remove wrong Signature file.\n");
+					unlink(tmp_file_name);
+					unlink(list_file_name);
+				}
+				free(tmp_file_name);
+			} else {
+				/* start the check now, collect it after the
+				 * loop so it overlaps the remaining feed
+				 * downloads */
+				sig_checks = xrealloc(sig_checks,
+						      (n_sig_checks + 1)
+						      * sizeof(sig_checks[0]));
+				sig_checks[n_sig_checks].handle =
+				    opkg_verify_file_start(list_file_name,
+							   tmp_file_name);
+				sig_checks[n_sig_checks].list_file =
+				    xstrdup(list_file_name);
+				sig_checks[n_sig_checks].sig_file =
+				    tmp_file_name;
+				n_sig_checks++;
 			}
-			/* We shouldn't unlink the signature ! */
-			// unlink (tmp_file_name);
-			free(tmp_file_name);
 			free(url);
 		}
 #else
 		// Do nothing
 #endif
+		/* Pre-parse the fresh list into a binary index so later
+		 * invocations can mmap it instead of re-parsing the text.
+		 */
+		if (pkglist_dl_error == 0 && file_exists(list_file_name)) {
+			struct pkg_index idx;
+
+			if (pkglist_changed ||
+			    pkg_index_open(&idx, list_file_name))
+				pkg_index_write(list_file_name, src);
+			else
+				pkg_index_close(&idx);
+		}
+
 		free(list_file_name);
 	}
+
+#if defined(HAVE_USIGN)
+	for (i = 0; i < n_sig_checks; i++) {
+		err = opkg_verify_file_finish(sig_checks[i].handle);
+		if (err == 0)
+			opkg_msg(NOTICE, "Signature check passed for %s.\n",
+				 sig_checks[i].list_file);
+		else
+			opkg_msg(NOTICE, "Signature check failed for %s.\n",
+				 sig_checks[i].list_file);
+		if (err && !conf->force_signature) {
+			char *idx_file;
+
+			/* The signature was wrong so delete it, along with
+			 * the list and the index built from it above */
+			opkg_msg(NOTICE, "Remove wrong Signature file.\n");
+			sprintf_alloc(&idx_file, "%s%s",
+				      sig_checks[i].list_file,
+				      PKG_INDEX_SUFFIX);
+			unlink(sig_checks[i].sig_file);
+			unlink(sig_checks[i].list_file);
+			unlink(idx_file);
+			free(idx_file);
+		}
+		free(sig_checks[i].list_file);
+		free(sig_checks[i].sig_file);
+	}
+	free(sig_checks);
+#endif
+
 	rmdir(tmp);
 	free(tmp);
 	free(lists_dir);
@@ -240,10 +569,40 @@ static opkg_intercept_t opkg_prep_intercepts(void)
 	return ctx;
 }
 
+/*
+ * Rough ranking of the stock intercept stubs, most expensive first.
+ * The triggers are independent of each other, so starting the longest
+ * one before the rest maximizes the overlap when they run in parallel;
+ * anything unknown keeps directory order at the tail.
+ */
+static int intercept_cost(const char *name)
+{
+	static const char *expensive[] = {
+		"depmod", "ldconfig", "update-modules", "gtk-update-icon-cache"
+	};
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(expensive); i++)
+		if (!strcmp(name, expensive[i]))
+			return i;
+
+	return ARRAY_SIZE(expensive);
+}
+
+static int intercept_cost_cmp(const void *a, const void *b)
+{
+	const char *const *pa = a, *const *pb = b;
+
+	return intercept_cost(*pa) - intercept_cost(*pb);
+}
+
 static int opkg_finalize_intercepts(opkg_intercept_t ctx)
 {
 	DIR *dir;
-	int err = 0;
+	char **triggers = NULL;
+	pid_t *pids;
+	int n_triggers = 0, in_flight = 0, oldest = 0;
+	int i, limit, err = 0;
 
 	if (ctx->oldpath) {
 		setenv("PATH", ctx->oldpath, 1);
@@ -253,131 +612,77 @@ static int opkg_finalize_intercepts(opkg_intercept_t ctx)
 		unsetenv("PATH");
 	}
 
+	/* each intercepted command leaves exactly one state file named
+	 * after itself, so a 100-package transaction's worth of repeated
+	 * depmod calls already collapsed into a single trigger here */
 	dir = opendir(ctx->statedir);
 	if (dir) {
 		struct dirent *de;
 		while (de = readdir(dir), de != NULL) {
-			char *path;
-
 			if (de->d_name[0] == '.')
 				continue;
 
-			sprintf_alloc(&path, "%s/%s", ctx->statedir,
-				      de->d_name);
-			if (access(path, X_OK) == 0) {
-				const char *argv[] = { "/bin/sh", "-c", path, NULL };
-				xsystem(argv);
-			}
-			free(path);
+			triggers = xrealloc(triggers, (n_triggers + 1)
+					    * sizeof(triggers[0]));
+			triggers[n_triggers++] = xstrdup(de->d_name);
 		}
 		closedir(dir);
 	} else
 		opkg_perror(ERROR, "Failed to open dir %s", ctx->statedir);
 
-	rm_r(ctx->statedir);
-	free(ctx->statedir);
-	free(ctx);
+	qsort(triggers, n_triggers, sizeof(triggers[0]), intercept_cost_cmp);
 
-	return err;
-}
+	limit = sysconf(_SC_NPROCESSORS_ONLN);
+	if (limit < 1)
+		limit = 1;
+	if (limit > 4)
+		limit = 4;
 
-/* For package pkg do the following: If it is already visited, return. If not,
-   add it in visited list and recurse to its deps. Finally, add it to ordered
-   list.
-   pkg_vec all contains all available packages in repos.
-   pkg_vec visited contains packages already visited by this function, and is
-   used to end recursion and avoid an infinite loop on graph cycles.
-   pkg_vec ordered will finally contain the ordered set of packages.
-*/
-static int
-opkg_recurse_pkgs_in_order(pkg_t * pkg, pkg_vec_t * all,
-			   pkg_vec_t * visited, pkg_vec_t * ordered)
-{
-	int j, k, l, m;
-	pkg_t *dep;
-	compound_depend_t *compound_depend;
-	depend_t **possible_satisfiers;
-	abstract_pkg_t *abpkg;
-	abstract_pkg_t **dependents;
-
-	/* If it's just an available package, that is, not installed and not even
-	   unpacked, skip it */
-	/* XXX: This is probably an overkill, since a state_status != SS_UNPACKED
-	   would do here. However, if there is an intermediate node (pkg) that is
-	   configured and installed between two unpacked packages, the latter
-	   won't be properly reordered, unless all installed/unpacked pkgs are
-	   checked */
-	if (pkg->state_status == SS_NOT_INSTALLED)
-		return 0;
+	pids = xcalloc(n_triggers ? n_triggers : 1, sizeof(pids[0]));
 
-	/* If the  package has already been visited (by this function), skip it */
-	for (j = 0; j < visited->len; j++)
-		if (!strcmp(visited->pkgs[j]->name, pkg->name)) {
-			opkg_msg(DEBUG, "pkg %s already visited, skipping.\n",
-				 pkg->name);
-			return 0;
-		}
+	for (i = 0; i < n_triggers; i++) {
+		char *path;
 
-	pkg_vec_insert(visited, pkg);
-
-	opkg_msg(DEBUG, "pkg %s.\n", pkg->name);
-
-	/* Iterate over all the dependencies of pkg. For each one, find a package
-	   that is either installed or unpacked and satisfies this dependency.
-	   (there should only be one such package per dependency installed or
-	   unpacked). Then recurse to the dependency package */
-	for (compound_depend = pkg_get_ptr(pkg, PKG_DEPENDS); compound_depend && compound_depend->type; compound_depend++) {
-		possible_satisfiers = compound_depend->possibilities;
-		for (k = 0; k < compound_depend->possibility_count; k++) {
-			abpkg = possible_satisfiers[k]->pkg;
-			dependents = abpkg->provided_by->pkgs;
-			l = 0;
-			if (dependents != NULL)
-				while (l < abpkg->provided_by->len
-				       && dependents[l] != NULL) {
-					opkg_msg(DEBUG,
-						 "Descending on pkg %s.\n",
-						 dependents[l]->name);
-
-					/* find whether dependent l is installed or unpacked,
-					 * and then find which package in the list satisfies it */
-					for (m = 0; m < all->len; m++) {
-						dep = all->pkgs[m];
-						if (dep->state_status !=
-						    SS_NOT_INSTALLED)
-							if (!strcmp
-							    (dep->name,
-							     dependents[l]->
-							     name)) {
-								opkg_recurse_pkgs_in_order
-								    (dep, all,
-								     visited,
-								     ordered);
-								/* Stop the outer loop */
-								l = abpkg->
-								    provided_by->
-								    len;
-								/* break from the inner loop */
-								break;
-							}
-					}
-					l++;
-				}
+		sprintf_alloc(&path, "%s/%s", ctx->statedir, triggers[i]);
+		if (access(path, X_OK) == 0) {
+			const char *argv[] = { "/bin/sh", "-c", path, NULL };
+
+			if (in_flight >= limit) {
+				while (pids[oldest] <= 0)
+					oldest++;
+				xspawn_wait(pids[oldest], triggers[oldest]);
+				oldest++;
+				in_flight--;
+			}
+
+			pids[i] = xspawn(argv);
+			if (pids[i] > 0)
+				in_flight++;
 		}
+		free(path);
 	}
 
-	/* When all recursions from this node down, are over, and all
-	   dependencies have been added in proper order in the ordered array, add
-	   also the package pkg to ordered array */
-	pkg_vec_insert(ordered, pkg);
+	while (oldest < n_triggers) {
+		if (pids[oldest] > 0)
+			xspawn_wait(pids[oldest], triggers[oldest]);
+		oldest++;
+	}
 
-	return 0;
+	for (i = 0; i < n_triggers; i++)
+		free(triggers[i]);
+	free(triggers);
+	free(pids);
+
+	rm_r(ctx->statedir);
+	free(ctx->statedir);
+	free(ctx);
 
+	return err;
 }
 
 static int opkg_configure_packages(char *pkg_name)
 {
-	pkg_vec_t *all, *ordered, *visited;
+	pkg_vec_t *all, *ordered;
 	int i;
 	pkg_t *pkg;
 	opkg_intercept_t ic;
@@ -393,11 +698,7 @@ static int opkg_configure_packages(char *pkg_name)
 	   order */
 	opkg_msg(INFO, "Reordering packages before configuring them...\n");
 	ordered = pkg_vec_alloc();
-	visited = pkg_vec_alloc();
-	for (i = 0; i < all->len; i++) {
-		pkg = all->pkgs[i];
-		opkg_recurse_pkgs_in_order(pkg, all, visited, ordered);
-	}
+	pkg_vec_order_by_depends(all, ordered);
 
 	ic = opkg_prep_intercepts();
 	if (ic == NULL) {
@@ -415,10 +716,11 @@ static int opkg_configure_packages(char *pkg_name)
 			opkg_msg(NOTICE, "Configuring %s.\n", pkg->name);
 			r = opkg_configure(pkg);
 			if (r == 0) {
-				pkg->state_status = SS_INSTALLED;
+				pkg_set_state_status(pkg, SS_INSTALLED);
 				pkg->parent->state_status = SS_INSTALLED;
 				pkg->state_flag &= ~SF_PREFER;
 				opkg_state_changed++;
+				opkg_status_mark_dirty(pkg);
 			} else {
 				err = -1;
 			}
@@ -431,7 +733,6 @@ static int opkg_configure_packages(char *pkg_name)
 error:
 	pkg_vec_free(all);
 	pkg_vec_free(ordered);
-	pkg_vec_free(visited);
 
 	return err;
 }
@@ -470,11 +771,19 @@ static int opkg_install_cmd(int argc, char **argv)
 
 	pkg_info_preinstall_check();
 
-	for (i = 0; i < argc; i++) {
-		arg = argv[i];
-		if (opkg_install_by_name(arg)) {
-			opkg_msg(ERROR, "Cannot install package %s.\n", arg);
-			err = -1;
+	if (argc > 1) {
+		/* several packages form one transaction: resolve and
+		 * order the whole set up front so shared dependencies
+		 * are only visited once */
+		err = opkg_install_multiple_by_name(argc, argv);
+	} else {
+		for (i = 0; i < argc; i++) {
+			arg = argv[i];
+			if (opkg_install_by_name(arg)) {
+				opkg_msg(ERROR, "Cannot install package %s.\n",
+					 arg);
+				err = -1;
+			}
 		}
 	}
 
@@ -571,29 +880,30 @@ static int opkg_download_cmd(int argc, char **argv)
 
 static int opkg_list_find_cmd(int argc, char **argv, int use_desc)
 {
-	int i;
-	pkg_vec_t *available;
-	pkg_t *pkg;
-	char *pkg_name = NULL;
-	char *description;
+	struct pkg_list_ctx ctx;
 
+	memset(&ctx, 0, sizeof(ctx));
 	if (argc > 0) {
-		pkg_name = argv[0];
+		ctx.pkg_name = argv[0];
+		glob_query_compile(&ctx.query, ctx.pkg_name, conf->nocase);
 	}
-	available = pkg_vec_alloc();
-	pkg_hash_fetch_available(available);
-	pkg_vec_sort(available, pkg_compare_names);
-	for (i = 0; i < available->len; i++) {
-		pkg = available->pkgs[i];
-		description = use_desc ? pkg_get_string(pkg, PKG_DESCRIPTION) : NULL;
-		/* if we have package name or pattern and pkg does not match, then skip it */
-		if (pkg_name && fnmatch(pkg_name, pkg->name, conf->nocase) &&
-		    (!use_desc || !description
-		     || fnmatch(pkg_name, description, conf->nocase)))
-			continue;
-		print_pkg(pkg);
+	ctx.use_desc = use_desc;
+	if (conf->json) {
+		ctx.json_mask = json_field_mask();
+		strbuf_printf(&ctx.sb, "[");
 	}
-	pkg_vec_free(available);
+
+	/* stream the (per-name bucketed) hash in sorted name order
+	 * instead of materializing and sorting every package version */
+	pkg_hash_foreach_by_name(list_pkg_helper, &ctx);
+
+	if (conf->json)
+		strbuf_printf(&ctx.sb, "]\n");
+	if (ctx.sb.len)
+		fwrite(ctx.sb.buf, 1, ctx.sb.len, stdout);
+	strbuf_free(&ctx.sb);
+	if (ctx.pkg_name)
+		glob_query_free(&ctx.query);
 
 	return 0;
 }
@@ -610,27 +920,130 @@ static int opkg_find_cmd(int argc, char **argv)
 
 static int opkg_list_installed_cmd(int argc, char **argv)
 {
-	int i;
-	pkg_vec_t *available;
-	pkg_t *pkg;
-	char *pkg_name = NULL;
+	struct pkg_list_ctx ctx;
 
+	memset(&ctx, 0, sizeof(ctx));
 	if (argc > 0) {
-		pkg_name = argv[0];
+		ctx.pkg_name = argv[0];
+		glob_query_compile(&ctx.query, ctx.pkg_name, conf->nocase);
 	}
-	available = pkg_vec_alloc();
-	pkg_hash_fetch_all_installed(available);
-	pkg_vec_sort(available, pkg_compare_names);
-	for (i = 0; i < available->len; i++) {
-		pkg = available->pkgs[i];
-		/* if we have package name or pattern and pkg does not match, then skip it */
-		if (pkg_name && fnmatch(pkg_name, pkg->name, conf->nocase))
+	ctx.installed_only = 1;
+	if (conf->json) {
+		ctx.json_mask = json_field_mask();
+		strbuf_printf(&ctx.sb, "[");
+	}
+
+	pkg_hash_foreach_by_name(list_pkg_helper, &ctx);
+
+	if (conf->json)
+		strbuf_printf(&ctx.sb, "]\n");
+	if (ctx.sb.len)
+		fwrite(ctx.sb.buf, 1, ctx.sb.len, stdout);
+	strbuf_free(&ctx.sb);
+	if (ctx.pkg_name)
+		glob_query_free(&ctx.query);
+
+	return 0;
+}
+
+static void complete_emit(const char *name, void *data)
+{
+	str_vec_append((str_vec_t *) data, name);
+}
+
+/*
+ * Collect the package names with the given prefix from one list. The
+ * sorted name table of the binary index answers without parsing; a
+ * missing or stale index degrades to scanning the stanza names out of
+ * the text, which still skips all field and dependency parsing.
+ */
+static void complete_from_list(const char *list_file, pkg_src_t * src,
+			       const char *prefix, str_vec_t * names)
+{
+	struct pkg_index idx;
+	char *text, *copy;
+	const char *p, *end, *stanza, *name;
+	size_t text_len, name_len, plen = strlen(prefix);
+
+	if (pkg_index_open(&idx, list_file) == 0) {
+		pkg_index_complete(&idx, prefix, complete_emit, names);
+		pkg_index_close(&idx);
+		return;
+	}
+
+	text = pkg_index_read_list(list_file, src, &text_len);
+	if (text == NULL)
+		return;
+
+	p = text;
+	end = text + text_len;
+	while ((stanza = pkg_index_next_stanza(&p, end)) != NULL) {
+		name = pkg_index_stanza_name(stanza, p, &name_len);
+		if (name == NULL || name_len < plen)
+			continue;
+		if (strncmp(name, prefix, plen) != 0)
 			continue;
-		print_pkg(pkg);
+		copy = xstrndup(name, name_len);
+		str_vec_append(names, copy);
+		free(copy);
 	}
+	free(text);
+}
 
-	pkg_vec_free(available);
+static int complete_name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+/*
+ * Shell completion backend. Answers name-prefix queries straight from
+ * the binary feed and status indexes; no package objects are built and
+ * no stanzas are parsed, so the latency is dominated by a handful of
+ * mmaps. main() skips the usual feed and status loading for this
+ * command.
+ */
+static int opkg_complete_cmd(int argc, char **argv)
+{
+	const char *prefix = argc > 0 ? argv[0] : "";
+	str_vec_t *names = str_vec_alloc();
+	pkg_src_list_elt_t *iter;
+	pkg_dest_list_elt_t *dest_iter;
+	pkg_src_t *src;
+	pkg_dest_t *dest;
+	char *lists_dir, *list_file;
+	unsigned int i;
+
+	lists_dir = conf->restrict_to_default_dest ?
+	    conf->default_dest->lists_dir : conf->lists_dir;
+
+	for (iter = void_list_first(&conf->pkg_src_list); iter;
+	     iter = void_list_next(&conf->pkg_src_list, iter)) {
+		src = (pkg_src_t *) iter->data;
+
+		sprintf_alloc(&list_file, "%s/%s", lists_dir, src->name);
+		if (file_exists(list_file))
+			complete_from_list(list_file, src, prefix, names);
+		free(list_file);
+	}
+
+	list_for_each_entry(dest_iter, &conf->pkg_dest_list.head, node) {
+		dest = (pkg_dest_t *) dest_iter->data;
 
+		if (file_exists(dest->status_file_name))
+			complete_from_list(dest->status_file_name, NULL,
+					   prefix, names);
+	}
+
+	qsort(names->strs, names->len, sizeof(names->strs[0]),
+	      complete_name_cmp);
+
+	for (i = 0; i < names->len; i++) {
+		if (i && strcmp(names->strs[i], names->strs[i - 1]) == 0)
+			continue;
+		printf("%s\n", names->strs[i]);
+	}
+
+	str_vec_free(names);
 	return 0;
 }
 
@@ -647,8 +1060,7 @@ static int opkg_list_changed_conffiles_cmd(int argc, char **argv)
 	if (argc > 0) {
 		pkg_name = argv[0];
 	}
-	available = pkg_vec_alloc();
-	pkg_hash_fetch_all_installed(available);
+	available = pkg_hash_fetch_all_installed_cached();
 	pkg_vec_sort(available, pkg_compare_names);
 	for (i = 0; i < available->len; i++) {
 		pkg = available->pkgs[i];
@@ -656,17 +1068,16 @@ static int opkg_list_changed_conffiles_cmd(int argc, char **argv)
 		/* if we have package name or pattern and pkg does not match, then skip it */
 		if (pkg_name && fnmatch(pkg_name, pkg->name, conf->nocase))
 			continue;
-		if (!cl || nv_pair_list_empty(cl))
+		if (!cl || conffile_list_empty(cl))
 			continue;
-		for (iter = nv_pair_list_first(cl); iter;
-		     iter = nv_pair_list_next(cl, iter)) {
+		for (iter = conffile_list_first(cl); iter;
+		     iter = conffile_list_next(cl, iter)) {
 			cf = (conffile_t *) iter->data;
 			if (cf->name && cf->value
 			    && conffile_has_been_modified(cf))
 				printf("%s\n", cf->name);
 		}
 	}
-	pkg_vec_free(available);
 	return 0;
 }
 
@@ -701,16 +1112,23 @@ static int opkg_info_status_cmd(int argc, char **argv, int installed_only)
 	pkg_t *pkg;
 	char *pkg_name = NULL;
 	conffile_list_t *cl;
+	unsigned int json_mask = 0;
+	int json_count = 0;
+	struct strbuf sb = { NULL, 0, 0 };
 
 	if (argc > 0) {
 		pkg_name = argv[0];
 	}
 
-	available = pkg_vec_alloc();
+	if (conf->json) {
+		json_mask = json_field_mask();
+		strbuf_printf(&sb, "[");
+	}
+
 	if (installed_only)
-		pkg_hash_fetch_all_installed(available);
+		available = pkg_hash_fetch_all_installed_cached();
 	else
-		pkg_hash_fetch_available(available);
+		available = pkg_hash_fetch_available_cached();
 
 	for (i = 0; i < available->len; i++) {
 		pkg = available->pkgs[i];
@@ -718,14 +1136,21 @@ static int opkg_info_status_cmd(int argc, char **argv, int installed_only)
 			continue;
 		}
 
+		if (conf->json) {
+			if (json_count++)
+				strbuf_printf(&sb, ",");
+			pkg_json_append(&sb, pkg, json_mask);
+			continue;
+		}
+
 		pkg_formatted_info(stdout, pkg);
 
 		cl = pkg_get_ptr(pkg, PKG_CONFFILES);
 
 		if (conf->verbosity >= NOTICE && cl) {
 			conffile_list_elt_t *iter;
-			for (iter = nv_pair_list_first(cl); iter;
-			     iter = nv_pair_list_next(cl, iter)) {
+			for (iter = conffile_list_first(cl); iter;
+			     iter = conffile_list_next(cl, iter)) {
 				conffile_t *cf = (conffile_t *) iter->data;
 				int modified = conffile_has_been_modified(cf);
 				if (cf->value)
@@ -735,7 +1160,12 @@ static int opkg_info_status_cmd(int argc, char **argv, int installed_only)
 			}
 		}
 	}
-	pkg_vec_free(available);
+
+	if (conf->json) {
+		strbuf_printf(&sb, "]\n");
+		fwrite(sb.buf, 1, sb.len, stdout);
+	}
+	strbuf_free(&sb);
 
 	return 0;
 }
@@ -861,10 +1291,12 @@ static int opkg_flag_cmd(int argc, char **argv)
 		 */
 		if ((strcmp(flags, "installed") == 0)
 		    || (strcmp(flags, "unpacked") == 0)) {
-			pkg->state_status = pkg_state_status_from_str(flags);
+			pkg_set_state_status(pkg,
+					     pkg_state_status_from_str(flags));
 		}
 
 		opkg_state_changed++;
+		opkg_status_mark_dirty(pkg);
 		opkg_msg(NOTICE, "Setting flags for package %s to %s.\n",
 			 pkg->name, flags);
 	}
@@ -876,8 +1308,8 @@ static int opkg_flag_cmd(int argc, char **argv)
 static int opkg_files_cmd(int argc, char **argv)
 {
 	pkg_t *pkg;
-	str_list_t *files;
-	str_list_elt_t *iter;
+	str_vec_t *files;
+	unsigned int f;
 	char *pkg_version;
 
 	if (argc < 1) {
@@ -897,9 +1329,8 @@ static int opkg_files_cmd(int argc, char **argv)
 	    ("Package %s (%s) is installed on %s and has the following files:\n",
 	     pkg->name, pkg_version, pkg->dest->name);
 
-	for (iter = str_list_first(files); iter;
-	     iter = str_list_next(files, iter))
-		printf("%s\n", (char *)iter->data);
+	for (f = 0; f < files->len; f++)
+		printf("%s\n", files->strs[f]);
 
 	free(pkg_version);
 	pkg_free_installed_files(pkg);
@@ -917,11 +1348,10 @@ static int opkg_depends_cmd(int argc, char **argv)
 
 	pkg_info_preinstall_check();
 
-	available_pkgs = pkg_vec_alloc();
 	if (conf->query_all)
-		pkg_hash_fetch_available(available_pkgs);
+		available_pkgs = pkg_hash_fetch_available_cached();
 	else
-		pkg_hash_fetch_all_installed(available_pkgs);
+		available_pkgs = pkg_hash_fetch_all_installed_cached();
 
 	for (i = 0; i < argc; i++) {
 		for (j = 0; j < available_pkgs->len; j++) {
@@ -944,7 +1374,6 @@ static int opkg_depends_cmd(int argc, char **argv)
 		}
 	}
 
-	pkg_vec_free(available_pkgs);
 	return 0;
 }
 
@@ -978,12 +1407,24 @@ opkg_what_depends_conflicts_cmd(enum depend_type what_field_type, int recursive,
 	depend_t *possibility;
 	compound_depend_t *cdep, *deps;
 	pkg_vec_t *available_pkgs;
+	abstract_pkg_vec_t *frontier = NULL, *next_frontier = NULL;
+	abstract_pkg_vec_t *candidates = NULL, *swap;
+	abstract_pkg_t **provider;
 	pkg_t *pkg;
 	int i, j, l;
 	int changed;
+	int use_reverse;
 	const char *rel_str = NULL;
+	char vbuf[PKG_VERSION_STR_MAX];
 	char *ver;
 
+	/* the reverse graph built by buildDependedUponBy() covers
+	 * depends and recommends edges, so those queries only need to
+	 * visit the dependers of packages marked in the last round
+	 * instead of rescanning every package's dependency array */
+	use_reverse = (what_field_type == DEPEND
+		       || what_field_type == RECOMMEND);
+
 	switch (what_field_type) {
 	case DEPEND:
 		rel_str = "depends on";
@@ -1001,12 +1442,10 @@ opkg_what_depends_conflicts_cmd(enum depend_type what_field_type, int recursive,
 		return -1;
 	}
 
-	available_pkgs = pkg_vec_alloc();
-
 	if (conf->query_all)
-		pkg_hash_fetch_available(available_pkgs);
+		available_pkgs = pkg_hash_fetch_available_cached();
 	else
-		pkg_hash_fetch_all_installed(available_pkgs);
+		available_pkgs = pkg_hash_fetch_all_installed_cached();
 
 	/* mark the root set */
 	pkg_vec_clear_marks(available_pkgs);
@@ -1014,12 +1453,27 @@ opkg_what_depends_conflicts_cmd(enum depend_type what_field_type, int recursive,
 	for (i = 0; i < argc; i++)
 		pkg_vec_mark_if_matches(available_pkgs, argv[i]);
 
+	if (use_reverse) {
+		frontier = abstract_pkg_vec_alloc();
+		next_frontier = abstract_pkg_vec_alloc();
+		candidates = abstract_pkg_vec_alloc();
+	}
+
 	for (i = 0; i < available_pkgs->len; i++) {
 		pkg = available_pkgs->pkgs[i];
 		if (pkg->state_flag & SF_MARKED) {
 			/* mark the parent (abstract) package */
 			pkg_mark_provides(pkg);
 			opkg_msg(NOTICE, "  %s\n", pkg->name);
+
+			if (use_reverse) {
+				abstract_pkg_vec_insert_sorted(frontier,
+							       pkg->parent);
+				provider = pkg_get_ptr(pkg, PKG_PROVIDES);
+				while (provider && *provider)
+					abstract_pkg_vec_insert_sorted(
+						frontier, *provider++);
+			}
 		}
 	}
 
@@ -1027,6 +1481,22 @@ opkg_what_depends_conflicts_cmd(enum depend_type what_field_type, int recursive,
 	do {
 		changed = 0;
 
+		if (use_reverse) {
+			candidates->len = 0;
+			for (i = 0; i < frontier->len; i++) {
+				abstract_pkg_vec_t *dependers =
+				    frontier->pkgs[i]->depended_upon_by;
+
+				if (!dependers)
+					continue;
+
+				for (l = 0; l < dependers->len; l++)
+					abstract_pkg_vec_insert_sorted(
+						candidates, dependers->pkgs[l]);
+			}
+			next_frontier->len = 0;
+		}
+
 		for (j = 0; j < available_pkgs->len; j++) {
 
 			pkg = available_pkgs->pkgs[j];
@@ -1042,6 +1512,11 @@ opkg_what_depends_conflicts_cmd(enum depend_type what_field_type, int recursive,
 			if (pkg->parent->state_flag & SF_MARKED)
 				continue;
 
+			/* nothing it depends on was marked last round */
+			if (use_reverse &&
+			    !abstract_pkg_vec_contains(candidates, pkg->parent))
+				continue;
+
 			deps = pkg_get_ptr(pkg, (what_field_type == CONFLICTS) ? PKG_CONFLICTS : PKG_DEPENDS);
 
 			for (cdep = deps; cdep && cdep->type; cdep++) {
@@ -1062,13 +1537,25 @@ opkg_what_depends_conflicts_cmd(enum depend_type what_field_type, int recursive,
 					pkg_mark_provides(pkg);
 					changed++;
 
-					ver = pkg_version_str_alloc(pkg);
+					if (use_reverse) {
+						abstract_pkg_vec_insert_sorted(
+							next_frontier,
+							pkg->parent);
+						provider = pkg_get_ptr(pkg,
+							PKG_PROVIDES);
+						while (provider && *provider)
+							abstract_pkg_vec_insert_sorted(
+								next_frontier,
+								*provider++);
+					}
+
+					ver = pkg_version_str_r(pkg, vbuf,
+								sizeof(vbuf));
 					opkg_msg(NOTICE, "\t%s %s\t%s %s",
 						 pkg->name,
 						 ver,
 						 rel_str,
 						 possibility->pkg->name);
-					free(ver);
 					if (possibility->version) {
 						opkg_msg(NOTICE, " (%s%s)",
 							 constraint_to_str
@@ -1087,9 +1574,19 @@ opkg_what_depends_conflicts_cmd(enum depend_type what_field_type, int recursive,
 next_package:
 			;
 		}
+
+		if (use_reverse) {
+			swap = frontier;
+			frontier = next_frontier;
+			next_frontier = swap;
+		}
 	} while (changed && recursive);
 
-	pkg_vec_free(available_pkgs);
+	if (use_reverse) {
+		abstract_pkg_vec_free(frontier);
+		abstract_pkg_vec_free(next_frontier);
+		abstract_pkg_vec_free(candidates);
+	}
 
 	return 0;
 }
@@ -1119,6 +1616,44 @@ static int opkg_whatconflicts_cmd(int argc, char **argv)
 	return opkg_what_depends_conflicts_cmd(CONFLICTS, 0, argc, argv);
 }
 
+/*
+ * Answer an exact-name whatprovides query from the provided_by vector
+ * of the target's abstract package instead of scanning every known
+ * package. Only usable for literal case-sensitive targets; the
+ * replaced_by vector is not a complete replaces index, so whatreplaces
+ * always takes the scan path.
+ */
+static void opkg_what_provides_indexed(const char *target)
+{
+	abstract_pkg_t *apkg, *ab;
+	pkg_t *pkg;
+	int j, k;
+
+	apkg = abstract_pkg_fetch_by_name(target);
+	if (!apkg || !apkg->provided_by)
+		return;
+
+	for (j = 0; j < apkg->provided_by->len; j++) {
+		ab = apkg->provided_by->pkgs[j];
+		if (!ab->pkgs)
+			continue;
+
+		for (k = 0; k < ab->pkgs->len; k++) {
+			pkg = ab->pkgs->pkgs[k];
+			if (!conf->query_all
+			    && pkg->state_status != SS_INSTALLED
+			    && pkg->state_status != SS_UNPACKED)
+				continue;
+			/* provided_by is merged over all versions of a
+			 * name; recheck the individual package */
+			if (!pkg_provides_abstract(pkg, apkg))
+				continue;
+			opkg_msg(NOTICE, "    %s", pkg->name);
+			opkg_message(NOTICE, "\n");
+		}
+	}
+}
+
 static int
 opkg_what_provides_replaces_cmd(enum what_field_type what_field_type, int argc,
 				char **argv)
@@ -1126,7 +1661,7 @@ opkg_what_provides_replaces_cmd(enum what_field_type what_field_type, int argc,
 	abstract_pkg_t *apkg, **abpkgs;
 
 	if (argc > 0) {
-		pkg_vec_t *available_pkgs = pkg_vec_alloc();
+		pkg_vec_t *available_pkgs;
 		const char *rel_str =
 		    (what_field_type == WHATPROVIDES ? "provides" : "replaces");
 		int i;
@@ -1134,14 +1669,21 @@ opkg_what_provides_replaces_cmd(enum what_field_type what_field_type, int argc,
 		pkg_info_preinstall_check();
 
 		if (conf->query_all)
-			pkg_hash_fetch_available(available_pkgs);
+			available_pkgs = pkg_hash_fetch_available_cached();
 		else
-			pkg_hash_fetch_all_installed(available_pkgs);
+			available_pkgs = pkg_hash_fetch_all_installed_cached();
 		for (i = 0; i < argc; i++) {
 			const char *target = argv[i];
 			int j;
 
 			opkg_msg(NOTICE, "What %s %s\n", rel_str, target);
+
+			if (what_field_type == WHATPROVIDES && !conf->nocase
+			    && !strpbrk(target, "*?[")) {
+				opkg_what_provides_indexed(target);
+				continue;
+			}
+
 			for (j = 0; j < available_pkgs->len; j++) {
 				pkg_t *pkg = available_pkgs->pkgs[j];
 				abpkgs = pkg_get_ptr(pkg, (what_field_type == WHATPROVIDES) ? PKG_PROVIDES : PKG_REPLACES);
@@ -1162,7 +1704,6 @@ opkg_what_provides_replaces_cmd(enum what_field_type what_field_type, int argc,
 				}
 			}
 		}
-		pkg_vec_free(available_pkgs);
 	}
 	return 0;
 }
@@ -1177,40 +1718,154 @@ static int opkg_whatreplaces_cmd(int argc, char **argv)
 	return opkg_what_provides_replaces_cmd(WHATREPLACES, argc, argv);
 }
 
+struct search_record {
+	const char *path;
+	const char *name;
+};
+
+static int search_record_cmp(const void *a, const void *b)
+{
+	const struct search_record *ra = a, *rb = b;
+	int cmp = strcmp(ra->name, rb->name);
+
+	if (cmp)
+		return cmp;
+
+	return strcmp(ra->path, rb->path);
+}
+
+/*
+ * Answer a search from the per-destination file ownership indexes.
+ * Returns nonzero when any destination lacks a fresh index, in which
+ * case the caller falls back to reading every .list file. All indexes
+ * are opened up front so a partial set never produces partial output.
+ */
+static int opkg_search_indexed(const char *pattern)
+{
+	pkg_dest_list_elt_t *iter;
+	pkg_dest_t *dest;
+	struct filelist_index *idxs;
+	struct search_record *records;
+	struct glob_query query;
+	pkg_t *pkg = NULL;
+	const char *last_name;
+	char *full_path;
+	uint32_t i, n;
+	int n_dests = 0, d, match, ret = -1;
+
+	glob_query_compile(&query, pattern, conf->nocase);
+
+	list_for_each_entry(iter, &conf->pkg_dest_list.head, node)
+	    n_dests++;
+
+	idxs = xcalloc(n_dests ? n_dests : 1, sizeof(idxs[0]));
+
+	d = 0;
+	list_for_each_entry(iter, &conf->pkg_dest_list.head, node) {
+		dest = (pkg_dest_t *) iter->data;
+		if (filelist_index_open(&idxs[d], dest))
+			goto out;
+		d++;
+	}
+
+	d = 0;
+	list_for_each_entry(iter, &conf->pkg_dest_list.head, node) {
+		dest = (pkg_dest_t *) iter->data;
+		n = idxs[d].hdr->n_records;
+
+		records = xcalloc(n ? n : 1, sizeof(records[0]));
+		for (i = 0; i < n; i++) {
+			records[i].path =
+			    idxs[d].data + idxs[d].records[i].path_off;
+			records[i].name =
+			    idxs[d].data + idxs[d].records[i].name_off;
+		}
+
+		/* match in package name order, like the .list scan */
+		qsort(records, n, sizeof(records[0]), search_record_cmp);
+
+		last_name = NULL;
+		for (i = 0; i < n; i++) {
+			/* the index stores paths with the offline root
+			 * stripped, like the file hash; put it back so
+			 * patterns match what pkg_get_installed_files()
+			 * reports */
+			if (conf->offline_root) {
+				sprintf_alloc(&full_path, "%s%s",
+					      conf->offline_root,
+					      records[i].path);
+				match = glob_query_match(&query, full_path);
+				free(full_path);
+			} else {
+				match = glob_query_match(&query,
+							 records[i].path);
+			}
+
+			if (!match)
+				continue;
+
+			if (!last_name || strcmp(records[i].name, last_name)) {
+				pkg = pkg_hash_fetch_installed_by_name_dest(
+				    records[i].name, dest);
+				last_name = records[i].name;
+			}
+
+			if (pkg)
+				print_pkg(pkg);
+		}
+
+		free(records);
+		d++;
+	}
+
+	ret = 0;
+
+out:
+	while (d-- > 0)
+		filelist_index_close(&idxs[d]);
+	free(idxs);
+	glob_query_free(&query);
+	return ret;
+}
+
 static int opkg_search_cmd(int argc, char **argv)
 {
 	int i;
 
 	pkg_vec_t *installed;
 	pkg_t *pkg;
-	str_list_t *installed_files;
-	str_list_elt_t *iter;
+	str_vec_t *installed_files;
+	struct glob_query query;
+	unsigned int f;
 	char *installed_file;
 
 	if (argc < 1) {
 		return -1;
 	}
 
-	installed = pkg_vec_alloc();
-	pkg_hash_fetch_all_installed(installed);
+	if (opkg_search_indexed(argv[0]) == 0)
+		return 0;
+
+	installed = pkg_hash_fetch_all_installed_cached();
 	pkg_vec_sort(installed, pkg_compare_names);
 
+	glob_query_compile(&query, argv[0], conf->nocase);
+
 	for (i = 0; i < installed->len; i++) {
 		pkg = installed->pkgs[i];
 
 		installed_files = pkg_get_installed_files(pkg);
 
-		for (iter = str_list_first(installed_files); iter;
-		     iter = str_list_next(installed_files, iter)) {
-			installed_file = (char *)iter->data;
-			if (fnmatch(argv[0], installed_file, conf->nocase) == 0)
+		for (f = 0; f < installed_files->len; f++) {
+			installed_file = installed_files->strs[f];
+			if (glob_query_match(&query, installed_file))
 				print_pkg(pkg);
 		}
 
 		pkg_free_installed_files(pkg);
 	}
 
-	pkg_vec_free(installed);
+	glob_query_free(&query);
 
 	return 0;
 }
@@ -1242,12 +1897,49 @@ static int opkg_compare_versions_cmd(int argc, char **argv)
 
 static int opkg_print_architecture_cmd(int argc, char **argv)
 {
-	nv_pair_list_elt_t *l;
+	int n;
+
+	for (n = 1; n <= conf->n_arches; n++)
+		printf("arch %s %d\n", conf->arch_names[n],
+		       conf->arch_priorities[n]);
+	return 0;
+}
+
+/*
+ * Dump the runtime counters that matter for sizing hash tables and
+ * feeds: per-table occupancy and probe behaviour, allocator traffic,
+ * control-file bytes parsed and peak RSS.
+ */
+static int opkg_stats_cmd(int argc, char **argv)
+{
+	static const char *tag_names[__XALLOC_TAG_MAX] = {
+		"untagged", "parser", "depends", "file-hash", "download",
+	};
+	struct rusage ru;
+	int i;
+
+	hash_print_stats(&conf->pkg_hash);
+	hash_print_stats(&conf->file_hash);
+	hash_print_stats(&conf->obs_file_hash);
+	hash_print_stats(&conf->str_hash);
+
+	printf("allocator: %llu x*alloc calls, %llu bytes requested\n",
+	       xalloc_count, xalloc_bytes);
+	for (i = XALLOC_TAG_NONE + 1; i < __XALLOC_TAG_MAX; i++)
+		printf("allocator[%s]: %llu calls, %llu bytes\n", tag_names[i],
+		       xalloc_stats[i].count, xalloc_stats[i].bytes);
+	printf("parser: %llu control-file bytes parsed\n", pkg_parse_bytes);
+
+	printf("counters: %llu bytes downloaded, %llu files extracted, "
+	       "%llu hash probes, %llu stanzas parsed\n",
+	       opkg_count_get(OPKG_COUNT_DOWNLOAD_BYTES),
+	       opkg_count_get(OPKG_COUNT_FILES_EXTRACTED),
+	       opkg_count_get(OPKG_COUNT_HASH_PROBES),
+	       opkg_count_get(OPKG_COUNT_STANZAS_PARSED));
+
+	if (getrusage(RUSAGE_SELF, &ru) == 0)
+		printf("peak RSS: %ld KiB\n", ru.ru_maxrss);
 
-	list_for_each_entry(l, &conf->arch_list.head, node) {
-		nv_pair_t *nv = (nv_pair_t *) l->data;
-		printf("arch %s %s\n", nv->name, nv->value);
-	}
 	return 0;
 }
 
@@ -1255,42 +1947,44 @@ static int opkg_print_architecture_cmd(int argc, char **argv)
    array for easier maintenance */
 static opkg_cmd_t cmds[] = {
 	{"update", 0, (opkg_cmd_fun_t) opkg_update_cmd,
-	 PFM_DESCRIPTION | PFM_SOURCE},
+	 PFM_DESCRIPTION | PFM_SOURCE, 1},
 	{"upgrade", 1, (opkg_cmd_fun_t) opkg_upgrade_cmd,
-	 PFM_DESCRIPTION | PFM_SOURCE},
-	{"list", 0, (opkg_cmd_fun_t) opkg_list_cmd, PFM_SOURCE},
+	 PFM_DESCRIPTION | PFM_SOURCE, 1},
+	{"list", 0, (opkg_cmd_fun_t) opkg_list_cmd, PFM_SOURCE | PFM_DEPS},
 	{"list_installed", 0, (opkg_cmd_fun_t) opkg_list_installed_cmd,
-	 PFM_SOURCE},
+	 PFM_SOURCE | PFM_DEPS},
 	{"list-installed", 0, (opkg_cmd_fun_t) opkg_list_installed_cmd,
-	 PFM_SOURCE},
+	 PFM_SOURCE | PFM_DEPS},
 	{"list_upgradable", 0, (opkg_cmd_fun_t) opkg_list_upgradable_cmd,
 	 PFM_SOURCE},
 	{"list-upgradable", 0, (opkg_cmd_fun_t) opkg_list_upgradable_cmd,
 	 PFM_SOURCE},
+	{"complete", 0, (opkg_cmd_fun_t) opkg_complete_cmd, 0},
 	{"list_changed_conffiles", 0,
-	 (opkg_cmd_fun_t) opkg_list_changed_conffiles_cmd, PFM_SOURCE},
+	 (opkg_cmd_fun_t) opkg_list_changed_conffiles_cmd, PFM_SOURCE | PFM_DEPS},
 	{"list-changed-conffiles", 0,
-	 (opkg_cmd_fun_t) opkg_list_changed_conffiles_cmd, PFM_SOURCE},
+	 (opkg_cmd_fun_t) opkg_list_changed_conffiles_cmd, PFM_SOURCE | PFM_DEPS},
 	{"info", 0, (opkg_cmd_fun_t) opkg_info_cmd, 0},
 	{"flag", 1, (opkg_cmd_fun_t) opkg_flag_cmd,
-	 PFM_DESCRIPTION | PFM_SOURCE},
+	 PFM_DESCRIPTION | PFM_SOURCE, 1},
 	{"status", 0, (opkg_cmd_fun_t) opkg_status_cmd,
 	 PFM_DESCRIPTION | PFM_SOURCE},
 	{"install", 1, (opkg_cmd_fun_t) opkg_install_cmd,
-	 PFM_DESCRIPTION | PFM_SOURCE},
+	 PFM_DESCRIPTION | PFM_SOURCE, 1},
 	{"remove", 1, (opkg_cmd_fun_t) opkg_remove_cmd,
-	 PFM_DESCRIPTION | PFM_SOURCE},
+	 PFM_DESCRIPTION | PFM_SOURCE, 1},
 	{"configure", 0, (opkg_cmd_fun_t) opkg_configure_cmd,
-	 PFM_DESCRIPTION | PFM_SOURCE},
+	 PFM_DESCRIPTION | PFM_SOURCE, 1},
 	{"files", 1, (opkg_cmd_fun_t) opkg_files_cmd,
-	 PFM_DESCRIPTION | PFM_SOURCE},
+	 PFM_DESCRIPTION | PFM_SOURCE | PFM_DEPS},
 	{"search", 1, (opkg_cmd_fun_t) opkg_search_cmd,
-	 PFM_DESCRIPTION | PFM_SOURCE},
-	{"find", 1, (opkg_cmd_fun_t) opkg_find_cmd, PFM_SOURCE},
+	 PFM_DESCRIPTION | PFM_SOURCE | PFM_DEPS},
+	{"find", 1, (opkg_cmd_fun_t) opkg_find_cmd, PFM_SOURCE | PFM_DEPS},
 	{"download", 1, (opkg_cmd_fun_t) opkg_download_cmd,
-	 PFM_DESCRIPTION | PFM_SOURCE},
+	 PFM_DESCRIPTION | PFM_SOURCE, 1},
 	{"compare_versions", 1, (opkg_cmd_fun_t) opkg_compare_versions_cmd, 0},
 	{"compare-versions", 1, (opkg_cmd_fun_t) opkg_compare_versions_cmd, 0},
+	{"stats", 0, (opkg_cmd_fun_t) opkg_stats_cmd, PFM_SOURCE | PFM_DEPS},
 	{"print-architecture", 0, (opkg_cmd_fun_t) opkg_print_architecture_cmd,
 	 PFM_DESCRIPTION | PFM_SOURCE},
 	{"print_architecture", 0, (opkg_cmd_fun_t) opkg_print_architecture_cmd,
@@ -25,6 +25,7 @@ struct opkg_cmd {
 	int requires_args;
 	opkg_cmd_fun_t fun;
 	unsigned int pfm;	/* package field mask */
+	int write_lock;		/* mutates package state; lock exclusively */
 };
 typedef struct opkg_cmd opkg_cmd_t;
 
@@ -22,22 +22,33 @@
 #include <fcntl.h>
 #include <glob.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include "opkg_conf.h"
+#include "http_client.h"
 #include "pkg_vec.h"
 #include "pkg.h"
 #include "xregex.h"
+#include "xsystem.h"
 #include "sprintf_alloc.h"
 #include "opkg_message.h"
+#include "opkg_journal.h"
+#include "opkg_profile.h"
+#include "pkg_index.h"
 #include "file_util.h"
 #include "opkg_defines.h"
 #include "libbb/libbb.h"
 
-static int lock_fd;
-static char *lock_file = NULL;
+static __thread int lock_fd;
+static __thread char *lock_file = NULL;
 
 static opkg_conf_t _conf;
-opkg_conf_t *conf = &_conf;
+__thread opkg_conf_t *conf = &_conf;
+
+opkg_conf_t *opkg_conf_builtin(void)
+{
+	return &_conf;
+}
 
 /*
  * Config file options
@@ -55,9 +66,12 @@ opkg_option_t options[] = {
 	{"force_checksum", OPKG_OPT_TYPE_BOOL, &_conf.force_checksum},
 	{"check_signature", OPKG_OPT_TYPE_BOOL, &_conf.check_signature},
 	{"no_check_certificate", OPKG_OPT_TYPE_BOOL, &_conf.no_check_certificate},
+	{"dedupe", OPKG_OPT_TYPE_BOOL, &_conf.dedupe},
 	{"ftp_proxy", OPKG_OPT_TYPE_STRING, &_conf.ftp_proxy},
 	{"http_proxy", OPKG_OPT_TYPE_STRING, &_conf.http_proxy},
 	{"http_timeout", OPKG_OPT_TYPE_STRING, &_conf.http_timeout},
+	{"lowmem", OPKG_OPT_TYPE_BOOL, &_conf.lowmem},
+	{"parallel_downloads", OPKG_OPT_TYPE_INT, &_conf.parallel_downloads},
 	{"no_proxy", OPKG_OPT_TYPE_STRING, &_conf.no_proxy},
 	{"test", OPKG_OPT_TYPE_BOOL, &_conf.noaction},
 	{"noaction", OPKG_OPT_TYPE_BOOL, &_conf.noaction},
@@ -65,12 +79,15 @@ opkg_option_t options[] = {
 	{"nodeps", OPKG_OPT_TYPE_BOOL, &_conf.nodeps},
 	{"nocase", OPKG_OPT_TYPE_BOOL, &_conf.nocase},
 	{"offline_root", OPKG_OPT_TYPE_STRING, &_conf.offline_root},
+	{"parallel_feed_load", OPKG_OPT_TYPE_BOOL, &_conf.parallel_feed_load},
 	{"overlay_root", OPKG_OPT_TYPE_STRING, &_conf.overlay_root},
 	{"proxy_passwd", OPKG_OPT_TYPE_STRING, &_conf.proxy_passwd},
 	{"proxy_user", OPKG_OPT_TYPE_STRING, &_conf.proxy_user},
 	{"query-all", OPKG_OPT_TYPE_BOOL, &_conf.query_all},
 	{"size", OPKG_OPT_TYPE_BOOL, &_conf.size},
+	{"status_journal", OPKG_OPT_TYPE_BOOL, &_conf.status_journal},
 	{"tmp_dir", OPKG_OPT_TYPE_STRING, &_conf.tmp_dir},
+	{"transaction_sync", OPKG_OPT_TYPE_BOOL, &_conf.transaction_sync},
 	{"verbosity", OPKG_OPT_TYPE_INT, &_conf.verbosity},
 	{NULL, 0, NULL}
 };
@@ -115,69 +132,74 @@ static int resolve_pkg_dest_list(void)
 	return 0;
 }
 
+/* options[] indexed by name, built on the first config line */
+static __thread hash_table_t option_hash;
+
+/* options[] points into the built-in context; rebase a record's value
+ * slot onto whichever context the calling thread has bound */
+void *opkg_option_value(const opkg_option_t *o)
+{
+	return (char *)conf + ((char *)o->value - (char *)&_conf);
+}
+
 static int opkg_conf_set_option(const char *name, const char *value)
 {
-	int i = 0;
+	opkg_option_t *o;
+	void *val;
+	int i;
 
-	while (options[i].name) {
-		if (strcmp(options[i].name, name) == 0) {
-			switch (options[i].type) {
-			case OPKG_OPT_TYPE_BOOL:
-				if (*(int *)options[i].value) {
-					opkg_msg(ERROR,
-						 "Duplicate boolean option %s, "
-						 "leaving this option on.\n",
-						 name);
-					return 0;
-				}
-				*((int *const)options[i].value) = 1;
-				return 0;
-			case OPKG_OPT_TYPE_INT:
-				if (value) {
-					if (*(int *)options[i].value) {
-						opkg_msg(ERROR,
-							 "Duplicate option %s, "
-							 "using first seen value \"%d\".\n",
-							 name,
-							 *((int *)options[i].
-							   value));
-						return 0;
-					}
-					*((int *const)options[i].value) =
-					    atoi(value);
-					return 0;
-				} else {
-					opkg_msg(ERROR,
-						 "Option %s needs an argument\n",
-						 name);
-					return -1;
-				}
-			case OPKG_OPT_TYPE_STRING:
-				if (value) {
-					if (*(char **)options[i].value) {
-						opkg_msg(ERROR,
-							 "Duplicate option %s, "
-							 "using first seen value \"%s\".\n",
-							 name,
-							 *((char **)options[i].
-							   value));
-						return 0;
-					}
-					*((char **const)options[i].value) =
-					    xstrdup(value);
-					return 0;
-				} else {
-					opkg_msg(ERROR,
-						 "Option %s needs an argument\n",
-						 name);
-					return -1;
-				}
-			}
+	if (!option_hash.entries) {
+		hash_table_init("option-hash", &option_hash, 64);
+		for (i = 0; options[i].name; i++)
+			hash_table_insert(&option_hash, options[i].name,
+					  &options[i]);
+	}
+
+	o = hash_table_get(&option_hash, name);
+	if (!o) {
+		opkg_msg(ERROR, "Unrecognized option: %s=%s\n", name, value);
+		return -1;
+	}
+
+	val = opkg_option_value(o);
+
+	switch (o->type) {
+	case OPKG_OPT_TYPE_BOOL:
+		if (*(int *)val) {
+			opkg_msg(ERROR, "Duplicate boolean option %s, "
+				 "leaving this option on.\n", name);
+			return 0;
+		}
+		*(int *)val = 1;
+		return 0;
+	case OPKG_OPT_TYPE_INT:
+		if (!value) {
+			opkg_msg(ERROR, "Option %s needs an argument\n", name);
+			return -1;
+		}
+		if (*(int *)val) {
+			opkg_msg(ERROR, "Duplicate option %s, "
+				 "using first seen value \"%d\".\n",
+				 name, *(int *)val);
+			return 0;
+		}
+		*(int *)val = atoi(value);
+		return 0;
+	case OPKG_OPT_TYPE_STRING:
+		if (!value) {
+			opkg_msg(ERROR, "Option %s needs an argument\n", name);
+			return -1;
 		}
-		i++;
+		if (*(char **)val) {
+			opkg_msg(ERROR, "Duplicate option %s, "
+				 "using first seen value \"%s\".\n",
+				 name, *(char **)val);
+			return 0;
+		}
+		*(char **)val = xstrdup(value);
+		return 0;
 	}
 
-	opkg_msg(ERROR, "Unrecognized option: %s=%s\n", name, value);
 	return -1;
 }
 
@@ -311,21 +333,28 @@ opkg_conf_parse_file(const char *filename,
 						 "Skipping.\n", name, value);
 				}
 			} else if (strcmp(type, "src") == 0) {
-				if (!nv_pair_list_find
-				    ((nv_pair_list_t *) pkg_src_list, name)) {
+				pkg_src_t *s =
+				    pkg_src_list_find(pkg_src_list, name);
+
+				/* a repeated feed name adds a mirror for
+				 * the same feed; only a repeated url is a
+				 * real duplicate */
+				if (!s) {
 					pkg_src_list_append(pkg_src_list, name,
 							    value, extra, 0);
-				} else {
+				} else if (pkg_src_add_mirror(s, value)) {
 					opkg_msg(ERROR,
 						 "Duplicate src declaration (%s %s). "
 						 "Skipping.\n", name, value);
 				}
 			} else if (strcmp(type, "src/gz") == 0) {
-				if (!nv_pair_list_find
-				    ((nv_pair_list_t *) pkg_src_list, name)) {
+				pkg_src_t *s =
+				    pkg_src_list_find(pkg_src_list, name);
+
+				if (!s) {
 					pkg_src_list_append(pkg_src_list, name,
 							    value, extra, 1);
-				} else {
+				} else if (pkg_src_add_mirror(s, value)) {
 					opkg_msg(ERROR,
 						 "Duplicate src declaration (%s %s). "
 						 "Skipping.\n", name, value);
@@ -377,26 +406,189 @@ err0:
 	return err;
 }
 
-int opkg_conf_write_status_files(void)
+/*
+ * Packages whose stanza changed since the last status write. With
+ * status_journal enabled these are appended to a per-dest journal
+ * instead of re-serializing every installed package; the journal is
+ * folded into the main status file once it grows past the cap (or
+ * whenever a full rewrite happens anyway).
+ */
+#define STATUS_JOURNAL_MAX	(64 * 1024)
+
+static __thread pkg_vec_t *status_dirty;
+
+void opkg_status_mark_dirty(struct pkg *pkg)
+{
+	if (status_dirty == NULL)
+		status_dirty = pkg_vec_alloc();
+
+	if (!pkg_vec_contains(status_dirty, pkg))
+		pkg_vec_insert(status_dirty, pkg);
+}
+
+/*
+ * Append the dirty stanzas to their dests' journals. Returns non-zero
+ * when the caller should fall back to a full rewrite instead: a dirty
+ * package without a dest, an unwritable journal, or a journal past the
+ * size cap (time to compact).
+ */
+static int status_journal_append(void)
+{
+	char *journal_name;
+	FILE *fp;
+	pkg_t *pkg;
+	unsigned int i;
+	int ret = 0;
+
+	for (i = 0; i < status_dirty->len; i++)
+		if (status_dirty->pkgs[i]->dest == NULL)
+			return -1;
+
+	for (i = 0; i < status_dirty->len && !ret; i++) {
+		pkg = status_dirty->pkgs[i];
+
+		sprintf_alloc(&journal_name, "%s.journal",
+			      pkg->dest->status_file_name);
+		fp = fopen(journal_name, "a");
+		free(journal_name);
+		if (fp == NULL)
+			return -1;
+
+		/* a package that dropped out of the status set (removal,
+		 * replaced version) is appended as it stands; its
+		 * not-installed state makes the stanza a tombstone that
+		 * the replay merge applies and the next compaction drops */
+		pkg_print_status(pkg, fp);
+
+		if (ftell(fp) > STATUS_JOURNAL_MAX)
+			ret = 1;
+		/* an append that only reached the page cache is no
+		 * record at all after a power cut */
+		if (fflush(fp) == EOF || fsync(fileno(fp)) == -1)
+			ret = -1;
+		if (fclose(fp) == EOF)
+			ret = -1;
+	}
+
+	return ret;
+}
+
+/*
+ * Commit one destination's rewritten status file: flush, fsync, rename
+ * into place and rebuild the binary index beside it. Destinations are
+ * independent filesystems, so when there is more than one these run on
+ * worker threads and their fsync stalls overlap.
+ */
+static int status_commit_dest(pkg_dest_t *dest)
+{
+	char *tmp_name, *journal_name;
+	int werr, ret = 0;
+
+	if (dest->status_fp) {
+		sprintf_alloc(&tmp_name, "%s.tmp", dest->status_file_name);
+		/* one sync for the whole rewrite, so the rename below
+		 * never publishes data the disk hasn't seen yet */
+		werr = fflush(dest->status_fp) == EOF
+		    || fsync(fileno(dest->status_fp)) == -1;
+		if (fclose(dest->status_fp) == EOF || werr) {
+			opkg_perror(ERROR, "Couldn't write %s", tmp_name);
+			unlink(tmp_name);
+			ret = -1;
+		} else if (rename(tmp_name, dest->status_file_name) == -1) {
+			opkg_perror(ERROR, "Couldn't rename %s to %s",
+				    tmp_name, dest->status_file_name);
+			unlink(tmp_name);
+			ret = -1;
+		} else {
+			/* and persist the rename itself */
+			file_fsync_dir(dest->opkg_dir);
+			/* refresh the binary index beside the
+			 * rewritten text */
+			pkg_index_write(dest->status_file_name, NULL);
+		}
+		dest->status_fp = NULL;
+		free(tmp_name);
+	}
+
+	/* the rewrite holds everything; drop any journal */
+	sprintf_alloc(&journal_name, "%s.journal", dest->status_file_name);
+	unlink(journal_name);
+	free(journal_name);
+
+	return ret;
+}
+
+struct status_commit_queue {
+	pkg_dest_t **dests;
+	int n_dests;
+	int next;
+	int ret;
+	pthread_mutex_t lock;
+	opkg_conf_t *owner;
+};
+
+static void *status_commit_worker(void *data)
+{
+	struct status_commit_queue *queue = data;
+	pkg_dest_t *dest;
+
+	/* inherit the spawning thread's context binding */
+	conf = queue->owner;
+
+	while (1) {
+		pthread_mutex_lock(&queue->lock);
+		if (queue->next >= queue->n_dests) {
+			pthread_mutex_unlock(&queue->lock);
+			break;
+		}
+		dest = queue->dests[queue->next++];
+		pthread_mutex_unlock(&queue->lock);
+
+		if (status_commit_dest(dest)) {
+			pthread_mutex_lock(&queue->lock);
+			queue->ret = -1;
+			pthread_mutex_unlock(&queue->lock);
+		}
+	}
+
+	return NULL;
+}
+
+static int opkg_conf_write_status_files_real(void)
 {
 	pkg_dest_list_elt_t *iter;
 	pkg_dest_t *dest;
 	pkg_vec_t *all;
 	pkg_t *pkg;
+	struct status_commit_queue queue;
 	int i, ret = 0;
 
 	if (conf->noaction)
 		return 0;
 
+	if (conf->status_journal && status_dirty && status_dirty->len) {
+		if (status_journal_append() == 0) {
+			status_dirty->len = 0;
+			return 0;
+		}
+		/* fall through and compact */
+	}
+
 	list_for_each_entry(iter, &conf->pkg_dest_list.head, node) {
+		char *tmp_name;
+
 		dest = (pkg_dest_t *) iter->data;
 
-		dest->status_fp = fopen(dest->status_file_name, "w");
+		/* write to the side and rename into place below, so a
+		 * crash mid-rewrite never leaves a truncated status file */
+		sprintf_alloc(&tmp_name, "%s.tmp", dest->status_file_name);
+		dest->status_fp = fopen(tmp_name, "w");
 		if (dest->status_fp == NULL && errno != EROFS) {
 			opkg_perror(ERROR, "Can't open status file %s",
 				    dest->status_file_name);
 			ret = -1;
 		}
+		free(tmp_name);
 	}
 
 	all = pkg_vec_alloc();
@@ -424,15 +616,57 @@ int opkg_conf_write_status_files(void)
 
 	pkg_vec_free(all);
 
+	memset(&queue, 0, sizeof(queue));
+	pthread_mutex_init(&queue.lock, NULL);
+	queue.owner = conf;
+
 	list_for_each_entry(iter, &conf->pkg_dest_list.head, node) {
-		dest = (pkg_dest_t *) iter->data;
-		if (dest->status_fp && fclose(dest->status_fp) == EOF) {
-			opkg_perror(ERROR, "Couldn't close %s",
-				    dest->status_file_name);
-			ret = -1;
-		}
+		queue.dests = xrealloc(queue.dests, (queue.n_dests + 1)
+				       * sizeof(queue.dests[0]));
+		queue.dests[queue.n_dests++] = (pkg_dest_t *) iter->data;
+	}
+
+	if (queue.n_dests > 1) {
+		pthread_t threads[4];
+		int n_threads;
+
+		n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (n_threads > queue.n_dests)
+			n_threads = queue.n_dests;
+		if (n_threads > 4)
+			n_threads = 4;
+
+		for (i = 0; i < n_threads; i++)
+			pthread_create(&threads[i], NULL,
+				       status_commit_worker, &queue);
+		for (i = 0; i < n_threads; i++)
+			pthread_join(threads[i], NULL);
+	} else {
+		for (i = 0; i < queue.n_dests; i++)
+			if (status_commit_dest(queue.dests[i]))
+				queue.ret = -1;
 	}
 
+	if (queue.ret)
+		ret = -1;
+
+	pthread_mutex_destroy(&queue.lock);
+	free(queue.dests);
+
+	if (status_dirty)
+		status_dirty->len = 0;
+
+	return ret;
+}
+
+int opkg_conf_write_status_files(void)
+{
+	int ret;
+
+	opkg_profile_begin(PROFILE_STATUS_WRITE);
+	ret = opkg_conf_write_status_files_real();
+	opkg_profile_end(PROFILE_STATUS_WRITE);
+
 	return ret;
 }
 
@@ -465,12 +699,41 @@ int opkg_conf_init(void)
 	return 0;
 }
 
+/*
+ * Flatten the arch list so pkg_get_arch_priority() and friends index
+ * an array instead of walking it once per candidate. Runs as part of
+ * opkg_conf_load(); callers that populate arch_list by hand (the
+ * benchmarks) must call it themselves, and it may be called again
+ * after arch_list changes.
+ */
+void opkg_conf_flatten_arch_list(void)
+{
+	nv_pair_list_elt_t *iter;
+
+	conf->n_arches = 0;
+
+	list_for_each_entry(iter, &conf->arch_list.head, node) {
+		nv_pair_t *nv = (nv_pair_t *) iter->data;
+
+		if (conf->n_arches >= OPKG_CONF_MAX_ARCHES) {
+			opkg_msg(ERROR, "Ignoring surplus arch %s.\n",
+				 nv->name);
+			break;
+		}
+
+		conf->arch_names[++conf->n_arches] = nv->name;
+		conf->arch_priorities[conf->n_arches] =
+		    strtol(nv->value, NULL, 0);
+	}
+}
+
 int opkg_conf_load(void)
 {
 	int i, glob_ret;
 	char *tmp, *tmp_dir_base, **tmp_val;
 	glob_t globbuf;
 	char *etc_opkg_conf_pattern;
+	struct flock fl;
 
 	conf->restrict_to_default_dest = 0;
 	conf->default_dest = NULL;
@@ -532,13 +795,22 @@ int opkg_conf_load(void)
 	else
 		sprintf_alloc(&lock_file, "%s", OPKGLOCKFILE);
 
-	lock_fd = creat(lock_file, S_IRUSR | S_IWUSR | S_IRGRP);
+	/* read-only commands take the lock shared, so any number of
+	 * queries run concurrently while still excluding a mutating
+	 * command mid-transaction; opened read-write because F_RDLCK
+	 * needs a readable descriptor */
+	lock_fd = open(lock_file, O_CREAT | O_RDWR,
+		       S_IRUSR | S_IWUSR | S_IRGRP);
 	if (lock_fd == -1) {
 		opkg_perror(ERROR, "Could not create lock file %s", lock_file);
 		goto err2;
 	}
 
-	if (lockf(lock_fd, F_TLOCK, (off_t) 0) == -1) {
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = conf->lock_shared ? F_RDLCK : F_WRLCK;
+	fl.l_whence = SEEK_SET;
+
+	if (fcntl(lock_fd, F_SETLK, &fl) == -1) {
 		opkg_perror(ERROR, "Could not lock %s", lock_file);
 		if (close(lock_fd) == -1)
 			opkg_perror(ERROR, "Couldn't close descriptor %d (%s)",
@@ -568,6 +840,8 @@ int opkg_conf_load(void)
 			OPKG_CONF_DEFAULT_HASH_LEN);
 	hash_table_init("obs-file-hash", &conf->obs_file_hash,
 			OPKG_CONF_DEFAULT_HASH_LEN / 16);
+	hash_table_init("str-intern-hash", &conf->str_hash,
+			OPKG_CONF_DEFAULT_HASH_LEN);
 
 	if (conf->lists_dir == NULL)
 		conf->lists_dir = xstrdup(OPKG_CONF_LISTS_DIR);
@@ -586,6 +860,8 @@ int opkg_conf_load(void)
 		nv_pair_list_append(&conf->arch_list, HOST_CPU_STR, "10");
 	}
 
+	opkg_conf_flatten_arch_list();
+
 	/* Even if there is no conf file, we'll need at least one dest. */
 	if (nv_pair_list_empty(&conf->tmp_dest_list)) {
 		nv_pair_list_append(&conf->tmp_dest_list,
@@ -596,6 +872,10 @@ int opkg_conf_load(void)
 	if (resolve_pkg_dest_list())
 		goto err4;
 
+	/* the lock is held and the dests are known; now is the time to
+	   clean up after any interrupted transaction */
+	opkg_journal_recover();
+
 	nv_pair_list_deinit(&conf->tmp_dest_list);
 
 	return 0;
@@ -606,6 +886,8 @@ err4:
 	pkg_hash_deinit();
 	hash_table_deinit(&conf->file_hash);
 	hash_table_deinit(&conf->obs_file_hash);
+	/* pkgs reference interned strings, so the atoms go last */
+	hash_table_deinit(&conf->str_hash);
 
 	if (rmdir(conf->tmp_dir) == -1)
 		opkg_perror(ERROR, "Couldn't remove dir %s", conf->tmp_dir);
@@ -616,7 +898,8 @@ err3:
 	if (close(lock_fd) == -1)
 		opkg_perror(ERROR, "Couldn't close descriptor %d (%s)",
 			    lock_fd, lock_file);
-	if (unlink(lock_file) == -1)
+	/* other readers may still hold the lock file */
+	if (!conf->lock_shared && unlink(lock_file) == -1)
 		opkg_perror(ERROR, "Couldn't unlink %s", lock_file);
 err2:
 	if (lock_file) {
@@ -631,7 +914,7 @@ err1:
 
 	for (i = 0; options[i].name; i++) {
 		if (options[i].type == OPKG_OPT_TYPE_STRING) {
-			tmp_val = (char **)options[i].value;
+			tmp_val = opkg_option_value(&options[i]);
 			if (*tmp_val) {
 				free(*tmp_val);
 				*tmp_val = NULL;
@@ -653,6 +936,9 @@ void opkg_conf_deinit(void)
 	int i;
 	char **tmp;
 
+	http_client_deinit();
+	xsystem_shell_close();
+
 	if (conf->tmp_dir)
 		rm_r(conf->tmp_dir);
 
@@ -665,14 +951,24 @@ void opkg_conf_deinit(void)
 	if (conf->conf_file)
 		free(conf->conf_file);
 
+	if (conf->fields)
+		free(conf->fields);
+
 	pkg_src_list_deinit(&conf->pkg_src_list);
 	pkg_src_list_deinit(&conf->dist_src_list);
 	pkg_dest_list_deinit(&conf->pkg_dest_list);
 	nv_pair_list_deinit(&conf->arch_list);
 
+	/* the flat arch table borrowed its names from arch_list */
+	memset(conf->arch_names, 0, sizeof(conf->arch_names));
+	conf->n_arches = 0;
+
+	if (option_hash.entries)
+		hash_table_deinit(&option_hash);
+
 	for (i = 0; options[i].name; i++) {
 		if (options[i].type == OPKG_OPT_TYPE_STRING) {
-			tmp = (char **)options[i].value;
+			tmp = opkg_option_value(&options[i]);
 			if (*tmp) {
 				free(*tmp);
 				*tmp = NULL;
@@ -684,11 +980,14 @@ void opkg_conf_deinit(void)
 		hash_print_stats(&conf->pkg_hash);
 		hash_print_stats(&conf->file_hash);
 		hash_print_stats(&conf->obs_file_hash);
+		hash_print_stats(&conf->str_hash);
 	}
 
 	pkg_hash_deinit();
 	hash_table_deinit(&conf->file_hash);
 	hash_table_deinit(&conf->obs_file_hash);
+	/* pkgs reference interned strings, so the atoms go last */
+	hash_table_deinit(&conf->str_hash);
 
 	if (lock_fd != -1) {
 		if (lockf(lock_fd, F_ULOCK, (off_t) 0) == -1)
@@ -701,7 +1000,8 @@ void opkg_conf_deinit(void)
 	}
 
 	if (lock_file) {
-		if (unlink(lock_file) == -1)
+		/* other readers may still hold the lock file */
+		if (!conf->lock_shared && unlink(lock_file) == -1)
 			opkg_perror(ERROR, "Couldn't unlink %s", lock_file);
 
 		free(lock_file);
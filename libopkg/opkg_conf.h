@@ -19,7 +19,11 @@
 #define OPKG_CONF_H
 
 typedef struct opkg_conf opkg_conf_t;
-extern opkg_conf_t *conf;
+
+/* Per-thread context binding: the CLI and any other single-threaded
+ * user just sees the built-in context, while library threads rebind
+ * the pointer through opkg_ctx_use() in opkg.h. */
+extern __thread opkg_conf_t *conf;
 
 #include <stdarg.h>
 #include <fnmatch.h>		/* FNM_CASEFOLD */
@@ -41,6 +45,9 @@ extern opkg_conf_t *conf;
 
 #define OPKG_CONF_DEFAULT_HASH_LEN 1024
 
+/* pkg_t carries its architecture as a 3-bit index into arch_list */
+#define OPKG_CONF_MAX_ARCHES 8
+
 struct opkg_conf {
 	pkg_src_list_t pkg_src_list;
 	pkg_src_list_t dist_src_list;
@@ -48,6 +55,14 @@ struct opkg_conf {
 	pkg_dest_list_t tmp_dest_list;
 	nv_pair_list_t arch_list;
 
+	/* arch_list flattened after the config is read, so the
+	 * per-candidate priority lookups in the resolver index an
+	 * array instead of walking the list. Slot 0 is the "unknown
+	 * architecture" sentinel; names are borrowed from arch_list. */
+	int n_arches;
+	char *arch_names[1 + OPKG_CONF_MAX_ARCHES];
+	int arch_priorities[1 + OPKG_CONF_MAX_ARCHES];
+
 	int restrict_to_default_dest;
 	pkg_dest_t *default_dest;
 	char *dest_str;
@@ -58,6 +73,7 @@ struct opkg_conf {
 	char *lists_dir;
 
 	unsigned int pfm;	/* package field mask */
+	int lock_shared;	/* read-only command: take the opkg lock shared */
 
 	/* For libopkg users to capture messages. */
 	void (*opkg_vmessage) (int, const char *fmt, va_list ap);
@@ -81,18 +97,27 @@ struct opkg_conf {
 	int no_check_certificate;
 	int nodeps;		/* do not follow dependencies */
 	int nocase;		/* perform case insensitive matching */
+	int parallel_feed_load;	/* stage package feeds with worker threads */
+	int transaction_sync;	/* one syncfs() per dest at commit time */
+	int dedupe;		/* hardlink identical files across packages */
+	int status_journal;	/* append changed stanzas, compact lazily */
 	char *offline_root;
 	char *overlay_root;
 	int query_all;
 	int verbosity;
 	int noaction;
 	int size;
+	int json;		/* query commands emit a JSON array */
+	char *fields;		/* comma list restricting --json fields */
+	int profile;		/* phase timing summary; 2 = json variant */
 	int download_only;
+	int lowmem;		/* drop non-transaction pkgs after resolution */
 	char *cache;
 
 	/* proxy options */
 	char *http_proxy;
 	char *http_timeout;
+	int parallel_downloads;	/* concurrent fetches per transaction */
 	char *ftp_proxy;
 	char *no_proxy;
 	char *proxy_user;
@@ -104,6 +129,7 @@ struct opkg_conf {
 	hash_table_t pkg_hash;
 	hash_table_t file_hash;
 	hash_table_t obs_file_hash;
+	hash_table_t str_hash;	/* interned atoms for repeated pkg fields */
 };
 
 enum opkg_option_type {
@@ -120,11 +146,18 @@ struct opkg_option {
 	void *const value;
 };
 
+struct pkg;
+
+opkg_conf_t *opkg_conf_builtin(void);
+void *opkg_option_value(const struct opkg_option *o);
+
 int opkg_conf_init(void);
 int opkg_conf_load(void);
+void opkg_conf_flatten_arch_list(void);
 void opkg_conf_deinit(void);
 
 int opkg_conf_write_status_files(void);
+void opkg_status_mark_dirty(struct pkg *pkg);
 char *root_filename_alloc(char *filename);
 
 #endif
@@ -0,0 +1,311 @@
+/* vi: set noexpandtab sw=4 sts=4: */
+/* opkg_delta.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "opkg_delta.h"
+#include "opkg_message.h"
+#include "libbb/libbb.h"
+
+#define DELTA_MAGIC	"OPKGDELTA1\n"
+#define DELTA_MAGIC_LEN	(sizeof(DELTA_MAGIC) - 1)
+
+/* granularity of the match index; matches shorter than this are not
+ * worth a copy record */
+#define DELTA_BLOCK	64
+
+static int write_u64(FILE * f, unsigned long long v)
+{
+	unsigned char b[8];
+	int i;
+
+	for (i = 7; i >= 0; i--) {
+		b[i] = v & 0xff;
+		v >>= 8;
+	}
+
+	return fwrite(b, 1, sizeof(b), f) == sizeof(b) ? 0 : -1;
+}
+
+static int read_u64(FILE * f, unsigned long long *v)
+{
+	unsigned char b[8];
+	int i;
+
+	if (fread(b, 1, sizeof(b), f) != sizeof(b))
+		return -1;
+
+	*v = 0;
+	for (i = 0; i < 8; i++)
+		*v = (*v << 8) | b[i];
+
+	return 0;
+}
+
+static char *slurp(const char *file_name, size_t * lenp)
+{
+	struct stat st;
+	char *buf;
+	FILE *f;
+
+	f = fopen(file_name, "r");
+	if (!f) {
+		opkg_perror(ERROR, "Failed to open %s", file_name);
+		return NULL;
+	}
+
+	if (fstat(fileno(f), &st)) {
+		opkg_perror(ERROR, "Failed to stat %s", file_name);
+		fclose(f);
+		return NULL;
+	}
+
+	buf = xmalloc(st.st_size ? st.st_size : 1);
+	if (fread(buf, 1, st.st_size, f) != (size_t) st.st_size) {
+		opkg_msg(ERROR, "Short read on %s.\n", file_name);
+		fclose(f);
+		free(buf);
+		return NULL;
+	}
+
+	fclose(f);
+	*lenp = st.st_size;
+	return buf;
+}
+
+static unsigned int block_hash(const char *p)
+{
+	unsigned int h = 2166136261u;
+	int i;
+
+	for (i = 0; i < DELTA_BLOCK; i++) {
+		h ^= (unsigned char)p[i];
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+static int emit_literal(FILE * df, const char *data, size_t len)
+{
+	if (len == 0)
+		return 0;
+	if (fputc('A', df) == EOF || write_u64(df, len))
+		return -1;
+	return fwrite(data, 1, len, df) == len ? 0 : -1;
+}
+
+/*
+ * Write a delta turning base_file into new_file. The matcher indexes
+ * the base at DELTA_BLOCK granularity and greedily extends hits, so it
+ * finds the long unchanged runs typical of rebuilt archives without
+ * needing suffix structures; both files are held in memory, which is
+ * fine for package-sized inputs on the build host.
+ */
+int
+opkg_delta_make(const char *base_file, const char *new_file,
+		const char *delta_file)
+{
+	char *base = NULL, *new = NULL;
+	size_t base_len, new_len, n_slots, slot;
+	size_t *index = NULL;
+	size_t i, lit_start, off, match, back;
+	FILE *df = NULL;
+	int err = -1;
+
+	base = slurp(base_file, &base_len);
+	if (!base)
+		goto out;
+	new = slurp(new_file, &new_len);
+	if (!new)
+		goto out;
+
+	df = fopen(delta_file, "w");
+	if (!df) {
+		opkg_perror(ERROR, "Failed to open %s", delta_file);
+		goto out;
+	}
+
+	if (fwrite(DELTA_MAGIC, 1, DELTA_MAGIC_LEN, df) != DELTA_MAGIC_LEN)
+		goto out;
+
+	/* open-addressed table of base block offsets, first writer wins;
+	 * zero means empty, so offsets are stored off by one */
+	n_slots = 16;
+	while (n_slots < 2 * (base_len / DELTA_BLOCK + 1))
+		n_slots <<= 1;
+	index = xcalloc(n_slots, sizeof(index[0]));
+
+	for (off = 0; off + DELTA_BLOCK <= base_len; off += DELTA_BLOCK) {
+		slot = block_hash(base + off) & (n_slots - 1);
+		while (index[slot]) {
+			slot = (slot + 1) & (n_slots - 1);
+		}
+		index[slot] = off + 1;
+	}
+
+	lit_start = 0;
+	i = 0;
+	while (i + DELTA_BLOCK <= new_len) {
+		size_t probes = 0;
+
+		slot = block_hash(new + i) & (n_slots - 1);
+		match = 0;
+		while (index[slot] && probes++ < 8) {
+			off = index[slot] - 1;
+			if (memcmp(base + off, new + i, DELTA_BLOCK) == 0) {
+				match = DELTA_BLOCK;
+				break;
+			}
+			slot = (slot + 1) & (n_slots - 1);
+		}
+
+		if (!match) {
+			i++;
+			continue;
+		}
+
+		/* grow the hit forward, and backward into the pending
+		 * literal, to cover the whole unchanged run */
+		while (off + match < base_len && i + match < new_len
+		       && base[off + match] == new[i + match])
+			match++;
+		back = 0;
+		while (off > back && i - back > lit_start
+		       && base[off - back - 1] == new[i - back - 1])
+			back++;
+		off -= back;
+		i -= back;
+		match += back;
+
+		if (emit_literal(df, new + lit_start, i - lit_start))
+			goto out;
+		if (fputc('C', df) == EOF || write_u64(df, off)
+		    || write_u64(df, match))
+			goto out;
+
+		i += match;
+		lit_start = i;
+	}
+
+	if (emit_literal(df, new + lit_start, new_len - lit_start))
+		goto out;
+	if (fputc('E', df) == EOF)
+		goto out;
+
+	err = 0;
+out:
+	if (df && fclose(df) == EOF)
+		err = -1;
+	if (err)
+		(void)unlink(delta_file);
+	free(index);
+	free(base);
+	free(new);
+	return err;
+}
+
+/*
+ * Reconstruct dest_file from base_file and delta_file. Returns 0 on
+ * success; on any malformed input the partial output is removed. The
+ * result is NOT verified here - the caller must check it against the
+ * feed checksum before trusting it.
+ */
+int
+opkg_delta_apply(const char *base_file, const char *delta_file,
+		 const char *dest_file)
+{
+	char magic[DELTA_MAGIC_LEN], buf[4096];
+	FILE *bf = NULL, *df = NULL, *of = NULL;
+	unsigned long long off, len, chunk;
+	int c, done = 0, err = -1;
+
+	bf = fopen(base_file, "r");
+	if (!bf) {
+		opkg_perror(ERROR, "Failed to open %s", base_file);
+		goto out;
+	}
+	df = fopen(delta_file, "r");
+	if (!df) {
+		opkg_perror(ERROR, "Failed to open %s", delta_file);
+		goto out;
+	}
+	of = fopen(dest_file, "w");
+	if (!of) {
+		opkg_perror(ERROR, "Failed to open %s", dest_file);
+		goto out;
+	}
+
+	if (fread(magic, 1, sizeof(magic), df) != sizeof(magic)
+	    || memcmp(magic, DELTA_MAGIC, sizeof(magic))) {
+		opkg_msg(ERROR, "%s is not an opkg delta.\n", delta_file);
+		goto out;
+	}
+
+	while (!done) {
+		c = getc(df);
+		switch (c) {
+		case 'C':
+			if (read_u64(df, &off) || read_u64(df, &len))
+				goto malformed;
+			if (fseeko(bf, off, SEEK_SET))
+				goto malformed;
+			while (len) {
+				chunk = len < sizeof(buf) ? len : sizeof(buf);
+				if (fread(buf, 1, chunk, bf) != chunk)
+					goto malformed;
+				if (fwrite(buf, 1, chunk, of) != chunk)
+					goto out;
+				len -= chunk;
+			}
+			break;
+		case 'A':
+			if (read_u64(df, &len))
+				goto malformed;
+			while (len) {
+				chunk = len < sizeof(buf) ? len : sizeof(buf);
+				if (fread(buf, 1, chunk, df) != chunk)
+					goto malformed;
+				if (fwrite(buf, 1, chunk, of) != chunk)
+					goto out;
+				len -= chunk;
+			}
+			break;
+		case 'E':
+			done = 1;
+			break;
+		default:
+			goto malformed;
+		}
+	}
+
+	err = 0;
+	goto out;
+
+malformed:
+	opkg_msg(ERROR, "Malformed delta %s.\n", delta_file);
+out:
+	if (of && fclose(of) == EOF)
+		err = -1;
+	if (df)
+		fclose(df);
+	if (bf)
+		fclose(bf);
+	if (err)
+		(void)unlink(dest_file);
+	return err;
+}
@@ -0,0 +1,38 @@
+/* opkg_delta.h - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef OPKG_DELTA_H
+#define OPKG_DELTA_H
+
+/*
+ * Binary deltas between two package archives, used to upgrade without
+ * re-transferring the bytes the device already holds.
+ *
+ * The format is deliberately minimal so that feed-side tooling can be
+ * a few lines of code: an "OPKGDELTA1\n" magic followed by records
+ *
+ *   'C' <offset:u64be> <length:u64be>   copy from the base archive
+ *   'A' <length:u64be> <bytes>          append literal bytes
+ *   'E'                                 end of delta
+ *
+ * The delta carries no checksums of its own; callers are expected to
+ * verify the reconstructed archive against the feed's SHA256sum, just
+ * like a fully downloaded one.
+ */
+
+int opkg_delta_make(const char *base_file, const char *new_file,
+		    const char *delta_file);
+int opkg_delta_apply(const char *base_file, const char *delta_file,
+		     const char *dest_file);
+
+#endif
@@ -18,12 +18,17 @@
 */
 
 #include <sys/wait.h>
+#include <dirent.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <libgen.h>
 
 #include "opkg_download.h"
 #include "opkg_message.h"
+#include "http_client.h"
+#include "opkg_delta.h"
+#include "pkg_hash.h"
+#include "opkg_profile.h"
 
 #include "sprintf_alloc.h"
 #include "xsystem.h"
@@ -36,17 +41,28 @@ static int str_starts_with(const char *str, const char *prefix)
 	return (strncmp(str, prefix, strlen(prefix)) == 0);
 }
 
-int
-opkg_download(const char *src, const char *dest_file_name,
-              const short hide_error)
+/*
+ * Like opkg_download(), but when sha256p is non-NULL and the built-in
+ * http client handled the transfer, *sha256p receives the malloc'd hex
+ * sha256 of the file, computed while the bytes arrived. It stays NULL
+ * for the file: and wget paths, where the caller must hash the result
+ * itself if it needs to.
+ */
+static int
+opkg_download_sum_real(const char *src, const char *dest_file_name,
+		       const short hide_error, char **sha256p)
 {
 	int err = 0;
+	message_level_t lvl = hide_error ? INFO : NOTICE;
 
 	char *src_basec = xstrdup(src);
 	char *src_base = basename(src_basec);
 	char *tmp_file_location;
 
-	opkg_msg(NOTICE, "Downloading %s\n", src);
+	if (sha256p)
+		*sha256p = NULL;
+
+	opkg_msg(lvl, "Downloading %s\n", src);
 
 	if (str_starts_with(src, "file:")) {
 		char *file_src = urldecode_path(src + 5);
@@ -67,6 +83,40 @@ opkg_download(const char *src, const char *dest_file_name,
 		return -1;
 	}
 
+	/* plain http without a proxy goes through the built-in client,
+	 * which keeps the connection to the mirror open across the
+	 * downloads of one run; anything else still forks wget */
+	if (str_starts_with(src, "http://") && !conf->http_proxy) {
+		char *part_file;
+		int derr;
+
+		/* stage next to the destination rather than in the per-run
+		 * tmp dir (which is wiped on exit), so an interrupted
+		 * transfer into a persistent cache directory resumes on
+		 * the next run */
+		sprintf_alloc(&part_file, "%s.part", dest_file_name);
+
+		derr = http_client_download(src, part_file, sha256p,
+					    hide_error);
+		if (derr == 0) {
+			err = file_move(part_file, dest_file_name);
+			free(part_file);
+			free(tmp_file_location);
+			return err;
+		}
+		free(part_file);
+
+		/* the server answered and said no; wget would only be
+		 * told the same thing again */
+		if (derr > 0) {
+			free(tmp_file_location);
+			return -1;
+		}
+
+		opkg_msg(INFO, "Built-in download of %s failed, "
+			 "retrying with wget.\n", src);
+	}
+
 	if (conf->http_proxy) {
 		opkg_msg(DEBUG,
 			 "Setting environment variable: http_proxy = %s.\n",
@@ -111,10 +161,11 @@ opkg_download(const char *src, const char *dest_file_name,
 		res = xsystem(argv);
 
 		if (res) {
-			opkg_msg(ERROR,
+			lvl = hide_error ? INFO : ERROR;
+			opkg_msg(lvl,
 				 "Failed to download %s, wget returned %d.\n",
 				 src, res);
-			if (res == 4)
+			if (res == 4 && !hide_error)
 				opkg_msg(ERROR,
 					 "Check your network settings and connectivity.\n\n");
 			free(tmp_file_location);
@@ -130,14 +181,59 @@ opkg_download(const char *src, const char *dest_file_name,
 }
 
 static int
-opkg_download_cache(const char *src, const char *dest_file_name)
+opkg_download_sum(const char *src, const char *dest_file_name,
+		  const short hide_error, char **sha256p)
+{
+	int err;
+	enum xalloc_tag old_tag;
+
+	opkg_profile_begin(PROFILE_DOWNLOAD);
+	old_tag = xalloc_tag_set(XALLOC_TAG_DOWNLOAD);
+	err = opkg_download_sum_real(src, dest_file_name, hide_error, sha256p);
+	xalloc_tag_set(old_tag);
+	opkg_profile_end(PROFILE_DOWNLOAD);
+
+	return err;
+}
+
+int
+opkg_download(const char *src, const char *dest_file_name,
+              const short hide_error)
+{
+	return opkg_download_sum(src, dest_file_name, hide_error, NULL);
+}
+
+/*
+ * Download src to dest_file_name through the cache directory, when one
+ * is configured. Entries whose feed advertises a sha256 are stored
+ * under that checksum, so identical packages from any number of feeds
+ * or offline roots share one cache file; checksum-less entries keep
+ * the old URL-derived names. sha256 may be NULL.
+ *
+ * When verifiedp is non-NULL, *verifiedp tells the caller whether the
+ * delivered file is already known to match sha256 (hashed while the
+ * bytes arrived, or taken from a checksum-named cache entry that was
+ * verified on admission), so it need not be read back and hashed again.
+ */
+static int
+opkg_download_cache(const char *src, const char *dest_file_name,
+		    const char *sha256_hint, int *verifiedp)
 {
 	char *cache_name = xstrdup(src);
-	char *cache_location, *p;
+	char *cache_location, *p, *sum = NULL;
+	/* copied because callers pass pkg_get_sha256()'s static buffer,
+	 * which any later checksum_bin2hex() call would clobber */
+	char *sha256 = sha256_hint ? xstrdup(sha256_hint) : NULL;
 	int err = 0;
 
+	if (verifiedp)
+		*verifiedp = 0;
+
 	if (!conf->cache || str_starts_with(src, "file:")) {
-		err = opkg_download(src, dest_file_name, 0);
+		err = opkg_download_sum(src, dest_file_name, 0,
+					sha256 ? &sum : NULL);
+		if (!err && verifiedp && sum && !strcmp(sum, sha256))
+			*verifiedp = 1;
 		goto out1;
 	}
 
@@ -147,6 +243,17 @@ opkg_download_cache(const char *src, const char *dest_file_name)
 		goto out1;
 	}
 
+	if (sha256) {
+		sprintf_alloc(&cache_location, "%s/%s", conf->cache, sha256);
+		if (file_exists(cache_location)) {
+			opkg_msg(NOTICE, "Linking %s.\n", cache_location);
+			if (verifiedp)
+				*verifiedp = 1;
+			goto promote;
+		}
+		free(cache_location);
+	}
+
 	for (p = cache_name; *p; p++)
 		if (*p == '/')
 			*p = ',';	/* looks nicer than | or # */
@@ -168,28 +275,67 @@ opkg_download_cache(const char *src, const char *dest_file_name)
 		if (file_exists(cache_location))
 			opkg_msg(NOTICE, "Copying %s.\n", cache_location);
 		else {
-			err = opkg_download(src, cache_location, 0);
+			if (sha256) {
+				/* fresh download of a checksummed package:
+				 * store it under the checksum, but only
+				 * after the content actually matches, so a
+				 * corrupt transfer cannot poison every
+				 * later hit */
+				free(cache_location);
+				sprintf_alloc(&cache_location, "%s/%s",
+					      conf->cache, sha256);
+			}
+
+			err = opkg_download_sum(src, cache_location, 0,
+						sha256 ? &sum : NULL);
 			if (err) {
 				(void)unlink(cache_location);
 				goto out2;
 			}
+
+			if (sha256) {
+				/* the wget fallback cannot hash in flight,
+				 * so read the file back in that case */
+				if (!sum)
+					sum = file_sha256sum_alloc
+					    (cache_location);
+
+				if (!sum || strcmp(sum, sha256)) {
+					opkg_msg(ERROR,
+						 "Checksum mismatch for %s.\n",
+						 src);
+					(void)unlink(cache_location);
+					err = -1;
+					goto out2;
+				}
+				if (verifiedp)
+					*verifiedp = 1;
+			}
 		}
 	}
 
-	err = file_copy(cache_location, dest_file_name);
+promote:
+	/* a hardlink makes the hit free; crossing file systems degrades
+	 * to the old byte copy */
+	err = file_link(cache_location, dest_file_name);
 
 out2:
 	free(cache_location);
 out1:
 	free(cache_name);
+	free(sha256);
+	free(sum);
 	return err;
 }
 
-int opkg_download_pkg(pkg_t * pkg, const char *dir)
+/*
+ * Work out the source url and the local file name a package download
+ * would use. Both are malloc'd on success (return 0).
+ */
+static int
+opkg_download_pkg_urls(pkg_t * pkg, const char *dir, char **urlp,
+		       char **local_filenamep)
 {
-	int err;
-	char *url;
-	char *local_filename;
 	char *stripped_filename;
 	char *urlencoded_path;
 	char *filename;
@@ -211,7 +357,7 @@ int opkg_download_pkg(pkg_t * pkg, const char *dir)
 	}
 
 	urlencoded_path = urlencode_path(filename);
-	sprintf_alloc(&url, "%s/%s", pkg->src->value, urlencoded_path);
+	sprintf_alloc(urlp, "%s/%s", pkg->src->value, urlencoded_path);
 	free(urlencoded_path);
 
 	/* The filename might be something like
@@ -223,15 +369,313 @@ int opkg_download_pkg(pkg_t * pkg, const char *dir)
 	if (!stripped_filename)
 		stripped_filename = filename;
 
-	sprintf_alloc(&local_filename, "%s/%s", dir, stripped_filename);
-	pkg_set_string(pkg, PKG_LOCAL_FILENAME, local_filename);
+	sprintf_alloc(local_filenamep, "%s/%s", dir, stripped_filename);
+
+	return 0;
+}
+
+/*
+ * Try to produce local_filename by fetching a binary delta against the
+ * version of pkg that is currently installed and patching the cached
+ * copy of that version's archive. Deltas live next to the full archive
+ * on the feed as "<filename>.delta-<installed version>"; a feed that
+ * carries none simply answers 404 and the caller falls back to the
+ * full download. The reconstructed archive must match the feed's
+ * SHA256sum before it is admitted to the cache and delivered, so a
+ * stale or corrupt delta can never install bad bytes.
+ */
+static int opkg_download_pkg_delta(pkg_t * pkg, const char *local_filename)
+{
+	pkg_t *old;
+	char *filename, *stripped_filename, *old_version = NULL;
+	char *sha256 = NULL, *sum = NULL;
+	char *base_file = NULL, *delta_name = NULL, *encoded, *url = NULL;
+	char *delta_file = NULL, *patched = NULL, *cache_location = NULL;
+	int err = -1;
+
+	if (!conf->cache || !pkg->src || !pkg_get_sha256(pkg))
+		return -1;
+
+	filename = pkg_get_string(pkg, PKG_FILENAME);
+	if (!filename)
+		return -1;
+
+	old = pkg_hash_fetch_installed_by_name(pkg->name);
+	if (!old || pkg_compare_versions(old, pkg) == 0)
+		return -1;
 
-	err = opkg_download_cache(url, local_filename);
+	/* copied because pkg_get_sha256() hands out a static buffer */
+	sha256 = xstrdup(pkg_get_sha256(pkg));
+	old_version = pkg_version_str_alloc(old);
+
+	/* the installed version's archive is the patch base; without a
+	 * cached copy of it there is nothing to patch */
+	if (pkg_get_sha256(old))
+		sprintf_alloc(&base_file, "%s/%s", conf->cache,
+			      pkg_get_sha256(old));
+	if (!base_file || !file_exists(base_file)) {
+		free(base_file);
+		sprintf_alloc(&base_file, "%s/%s_%s_%s.ipk", conf->cache,
+			      pkg->name, old_version,
+			      pkg_get_architecture(old));
+		if (!file_exists(base_file))
+			goto out;
+	}
+
+	sprintf_alloc(&delta_name, "%s.delta-%s", filename, old_version);
+	encoded = urlencode_path(delta_name);
+	sprintf_alloc(&url, "%s/%s", pkg->src->value, encoded);
+	free(encoded);
+
+	stripped_filename = strrchr(delta_name, '/');
+	stripped_filename = stripped_filename ?
+	    stripped_filename + 1 : delta_name;
+	sprintf_alloc(&delta_file, "%s/%s", conf->tmp_dir, stripped_filename);
+
+	if (opkg_download(url, delta_file, 1))
+		goto out;
+
+	sprintf_alloc(&patched, "%s.patched", delta_file);
+	if (opkg_delta_apply(base_file, delta_file, patched))
+		goto out;
+
+	sum = file_sha256sum_alloc(patched);
+	if (!sum || strcmp(sum, sha256)) {
+		opkg_msg(ERROR, "Checksum mismatch after patching %s "
+			 "with %s, falling back to full download.\n",
+			 pkg->name, url);
+		(void)unlink(patched);
+		goto out;
+	}
+
+	/* the result is verified, so it may take the content-addressed
+	 * cache slot of a full download */
+	sprintf_alloc(&cache_location, "%s/%s", conf->cache, sha256);
+	err = file_move(patched, cache_location);
+	if (!err)
+		err = file_link(cache_location, local_filename);
+	if (!err)
+		opkg_msg(NOTICE, "Patched %s %s from installed %s.\n",
+			 pkg->name, filename, old_version);
+
+out:
+	if (delta_file)
+		(void)unlink(delta_file);
+	free(cache_location);
+	free(patched);
+	free(delta_file);
 	free(url);
+	free(delta_name);
+	free(base_file);
+	free(old_version);
+	free(sum);
+	free(sha256);
+	return err;
+}
+
+int opkg_download_pkg(pkg_t * pkg, const char *dir)
+{
+	int err = -1, verified = 0;
+	unsigned int tries, max_tries = 1;
+	char *url;
+	char *local_filename;
+
+	if (pkg->src) {
+		pkg_src_probe_mirrors(pkg->src);
+		if (pkg->src->n_mirrors > 1)
+			max_tries = pkg->src->n_mirrors;
+	}
+
+	/* an upgrade whose old archive is still cached may only need a
+	 * small delta instead of the whole new archive */
+	if (opkg_download_pkg_urls(pkg, dir, &url, &local_filename) == 0) {
+		err = opkg_download_pkg_delta(pkg, local_filename);
+		if (!err) {
+			pkg_set_string(pkg, PKG_LOCAL_FILENAME,
+				       local_filename);
+			pkg->checksum_verified = 1;
+		}
+		free(url);
+		free(local_filename);
+		if (!err)
+			return 0;
+	}
+
+	/* every mirror of the feed gets one shot before giving up */
+	for (tries = 0; tries < max_tries; tries++) {
+		if (tries)
+			pkg_src_next_mirror(pkg->src);
+
+		if (opkg_download_pkg_urls(pkg, dir, &url, &local_filename))
+			return -1;
+
+		pkg_set_string(pkg, PKG_LOCAL_FILENAME, local_filename);
+
+		err = opkg_download_cache(url, local_filename,
+					  pkg_get_sha256(pkg), &verified);
+		free(url);
+		free(local_filename);
+
+		if (!err)
+			break;
+	}
+
+	if (!err && verified)
+		pkg->checksum_verified = 1;
 
 	return err;
 }
 
+/*
+ * Fetch every package of the set that still needs its archive, with up
+ * to conf->parallel_downloads transfers in flight at once. Each
+ * transfer runs in a forked child so the cache, proxy and wget
+ * fallback behavior is exactly that of a serial download; the child
+ * drops inherited keep-alive connections first since sharing a socket
+ * between processes would interleave requests. Failures are left for
+ * the install phase, which retries serially and reports them.
+ *
+ * pkg_ready (may be NULL) is invoked in the parent exactly once per
+ * member of pkgs, as soon as that package needs no further transfer:
+ * immediately for packages with nothing to fetch, otherwise when their
+ * transfer finishes, whether it succeeded or not. This lets the caller
+ * overlap work on early packages with the remaining downloads.
+ */
+int opkg_download_pkgs_parallel(pkg_vec_t * pkgs,
+				void (*pkg_ready) (pkg_t * pkg))
+{
+	struct fetch_job {
+		pkg_t *pkg;
+		char *url;
+		char *local_filename;
+		pid_t pid;
+	} *jobs;
+	pkg_t *pkg;
+	pid_t pid;
+	unsigned int i;
+	int n_jobs = 0, n_active = 0, n_done = 0, n_failed = 0;
+	int status;
+
+	jobs = xcalloc(pkgs->len ? pkgs->len : 1, sizeof(jobs[0]));
+
+	for (i = 0; i < pkgs->len; i++) {
+		pkg = pkgs->pkgs[i];
+
+		if (pkg->state_status != SS_INSTALLED
+		    && pkg->state_status != SS_UNPACKED
+		    && !pkg_get_string(pkg, PKG_LOCAL_FILENAME)
+		    && pkg->src != NULL
+		    && pkg_get_string(pkg, PKG_FILENAME) != NULL) {
+			pkg_src_probe_mirrors(pkg->src);
+			jobs[n_jobs].pkg = pkg;
+			if (opkg_download_pkg_urls(pkg, conf->tmp_dir,
+						   &jobs[n_jobs].url,
+						   &jobs[n_jobs].local_filename)
+			    == 0) {
+				n_jobs++;
+				continue;
+			}
+		}
+
+		/* nothing to transfer for this one */
+		if (pkg_ready)
+			pkg_ready(pkg);
+	}
+
+	/* the fetch workers are separate processes, so their transfer
+	 * time never reaches our counters; bill the whole batch here */
+	opkg_profile_begin(PROFILE_DOWNLOAD);
+
+	while (n_done < n_jobs) {
+		for (i = 0; (int)i < n_jobs
+		     && n_active < conf->parallel_downloads; i++) {
+			if (jobs[i].pid)
+				continue;
+
+			pid = fork();
+			if (pid == 0) {
+				int verified;
+
+				http_client_deinit();
+				/* exit code carries the verification bit
+				 * back to the parent: 0 downloaded and
+				 * checksum known good, 2 downloaded only */
+				if (opkg_download_cache(jobs[i].url,
+							jobs[i].local_filename,
+							pkg_get_sha256(jobs[i].pkg),
+							&verified))
+					_exit(1);
+				_exit(verified ? 0 : 2);
+			}
+
+			if (pid < 0) {
+				int verified;
+
+				/* out of processes: just fetch it here */
+				status = opkg_download_cache(jobs[i].url,
+							     jobs[i].local_filename,
+							     pkg_get_sha256(jobs[i].pkg),
+							     &verified);
+				jobs[i].pid = -1;
+				n_done++;
+				if (status)
+					n_failed++;
+				else {
+					pkg_set_string(jobs[i].pkg,
+						       PKG_LOCAL_FILENAME,
+						       jobs[i].local_filename);
+					if (verified)
+						jobs[i].pkg->checksum_verified = 1;
+				}
+				if (pkg_ready)
+					pkg_ready(jobs[i].pkg);
+				continue;
+			}
+
+			jobs[i].pid = pid;
+			n_active++;
+		}
+
+		if (n_active == 0)
+			continue;
+
+		pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (i = 0; (int)i < n_jobs; i++) {
+			if (jobs[i].pid != pid)
+				continue;
+
+			n_active--;
+			n_done++;
+			if (WIFEXITED(status) && WEXITSTATUS(status) != 1) {
+				pkg_set_string(jobs[i].pkg, PKG_LOCAL_FILENAME,
+					       jobs[i].local_filename);
+				if (WEXITSTATUS(status) == 0)
+					jobs[i].pkg->checksum_verified = 1;
+			} else
+				n_failed++;
+			if (pkg_ready)
+				pkg_ready(jobs[i].pkg);
+			break;
+		}
+	}
+
+	opkg_profile_end(PROFILE_DOWNLOAD);
+
+	for (i = 0; (int)i < n_jobs; i++) {
+		free(jobs[i].url);
+		free(jobs[i].local_filename);
+	}
+	free(jobs);
+
+	return n_failed;
+}
+
 /*
  * Downloads file from url, installs in package database, return package name.
  */
@@ -296,37 +740,250 @@ int opkg_prepare_url_for_install(const char *url, char **namep)
 	return 0;
 }
 
-int opkg_verify_file(char *text_file, char *sig_file)
-{
 #if defined HAVE_USIGN
-	int status = -1;
-	int pid;
+/*
+ * Trusted keys under <root>/etc/opkg/keys are named after the hex
+ * keynum embedded in every usign signature, so the right key for a
+ * signature can be picked without help. The directory is scanned once
+ * per run; each verification then hands usign its exact key file,
+ * skipping both the opkg-key shell wrapper and usign's own per-call
+ * walk of the key directory. Signatures whose key is not in the cache
+ * fall back to opkg-key, which also produces the proper failure
+ * message for genuinely untrusted keys.
+ */
+static __thread struct {
+	char *dir;
+	char **names;
+	int n;
+	int scanned;
+} trusted_keys;
+
+static int b64_val(int c)
+{
+	if (c >= 'A' && c <= 'Z')
+		return c - 'A';
+	if (c >= 'a' && c <= 'z')
+		return c - 'a' + 26;
+	if (c >= '0' && c <= '9')
+		return c - '0' + 52;
+	if (c == '+')
+		return 62;
+	if (c == '/')
+		return 63;
+	return -1;
+}
 
-	if (conf->check_signature == 0)
-		return 0;
+/* The signature blob is pkalg[2] ("Ed"), keynum[8], sig[64]; only the
+   first twelve bytes (sixteen base64 chars) are needed to learn which
+   key signed it. fp must hold 17 bytes. */
+static int sig_fingerprint(const char *sig_file, char *fp)
+{
+	FILE *f;
+	char line[160];
+	unsigned char raw[12];
+	int i, j, v;
+	unsigned int acc;
+
+	f = fopen(sig_file, "r");
+	if (!f)
+		return -1;
 
-	pid = fork();
-	if (pid < 0) {
-		opkg_perror(ERROR, "Failed to fork opkg-key process");
+	/* the "untrusted comment:" line precedes the blob */
+	if (!fgets(line, sizeof(line), f) || !fgets(line, sizeof(line), f)) {
+		fclose(f);
 		return -1;
 	}
+	fclose(f);
 
-	if (!pid) {
-		execl("/usr/sbin/opkg-key", "opkg-key", "verify", sig_file,
-		      text_file, NULL);
-		exit(255);
+	for (i = 0, j = 0; j < sizeof(raw); i += 4, j += 3) {
+		acc = 0;
+		for (v = 0; v < 4; v++) {
+			int b = b64_val((unsigned char)line[i + v]);
+
+			if (b < 0)
+				return -1;
+			acc = (acc << 6) | b;
+		}
+		raw[j] = acc >> 16;
+		raw[j + 1] = acc >> 8;
+		raw[j + 2] = acc;
 	}
 
-	waitpid(pid, &status, 0);
-	if (!WIFEXITED(status) || WEXITSTATUS(status))
+	if (raw[0] != 'E' || raw[1] != 'd')
 		return -1;
 
+	for (i = 0; i < 8; i++)
+		sprintf(&fp[i * 2], "%02x", raw[2 + i]);
+
 	return 0;
+}
+
+static char *trusted_key_lookup(const char *sig_file)
+{
+	char fp[17];
+	char *path;
+	int i;
+
+	if (!trusted_keys.scanned) {
+		DIR *dir;
+		struct dirent *de;
+
+		trusted_keys.scanned = 1;
+		sprintf_alloc(&trusted_keys.dir, "%s/etc/opkg/keys",
+			      conf->offline_root ? conf->offline_root : "");
+
+		dir = opendir(trusted_keys.dir);
+		if (dir) {
+			while ((de = readdir(dir))) {
+				if (de->d_name[0] == '.')
+					continue;
+				trusted_keys.names =
+				    xrealloc(trusted_keys.names,
+					     (trusted_keys.n + 1)
+					     * sizeof(trusted_keys.names[0]));
+				trusted_keys.names[trusted_keys.n++] =
+				    xstrdup(de->d_name);
+			}
+			closedir(dir);
+		}
+	}
+
+	if (sig_fingerprint(sig_file, fp))
+		return NULL;
+
+	for (i = 0; i < trusted_keys.n; i++) {
+		if (!strcmp(trusted_keys.names[i], fp)) {
+			sprintf_alloc(&path, "%s/%s", trusted_keys.dir, fp);
+			return path;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Signature checks run as detached verifier children collected through
+ * the returned handle, so a caller with many files (opkg update with a
+ * dozen signed feeds) can overlap the verifications with its remaining
+ * downloads instead of paying for each one serially. In-flight children
+ * are bounded by core count; once the bound is hit the oldest pending
+ * job is reaped before the next is spawned.
+ */
+struct verify_job {
+	pid_t pid;
+	int done;
+	int result;
+};
+
+static __thread struct verify_job *verify_jobs;
+static __thread int verify_n_jobs, verify_n_pending;
+
+static void verify_job_reap(struct verify_job *job)
+{
+	int status = -1;
+
+	waitpid(job->pid, &status, 0);
+	job->result = (!WIFEXITED(status) || WEXITSTATUS(status)) ? -1 : 0;
+	job->done = 1;
+	verify_n_pending--;
+}
+
+int opkg_verify_file_start(const char *text_file, const char *sig_file)
+{
+	struct verify_job *job;
+	int i, limit;
+	pid_t pid;
+
+	/* all handles collected: recycle the table */
+	if (verify_n_jobs && !verify_n_pending)
+		verify_n_jobs = 0;
+
+	verify_jobs = xrealloc(verify_jobs, (verify_n_jobs + 1)
+			       * sizeof(verify_jobs[0]));
+	job = &verify_jobs[verify_n_jobs];
+	memset(job, 0, sizeof(*job));
+
+	if (conf->check_signature == 0) {
+		job->done = 1;
+		return verify_n_jobs++;
+	}
+
+	limit = sysconf(_SC_NPROCESSORS_ONLN);
+	if (limit < 1)
+		limit = 1;
+	if (limit > 8)
+		limit = 8;
+
+	if (verify_n_pending >= limit)
+		for (i = 0; i < verify_n_jobs; i++)
+			if (!verify_jobs[i].done) {
+				verify_job_reap(&verify_jobs[i]);
+				break;
+			}
+
+	{
+		char *keyfile = trusted_key_lookup(sig_file);
+
+		if (keyfile) {
+			const char *argv[] = { "usign", "-V", "-q",
+				"-p", keyfile, "-m", text_file,
+				"-x", sig_file, NULL
+			};
+
+			pid = xspawn(argv);
+			free(keyfile);
+		} else {
+			const char *argv[] = { "/usr/sbin/opkg-key", "verify",
+				sig_file, text_file, NULL
+			};
+
+			pid = xspawn(argv);
+		}
+	}
+	if (pid < 0)
+		return -1;
+
+	job->pid = pid;
+	verify_n_pending++;
+	return verify_n_jobs++;
+}
+
+int opkg_verify_file_finish(int handle)
+{
+	struct verify_job *job;
+
+	if (handle < 0 || handle >= verify_n_jobs)
+		return -1;
+
+	job = &verify_jobs[handle];
+	if (!job->done)
+		verify_job_reap(job);
+
+	return job->result;
+}
 #else
+int opkg_verify_file_start(const char *text_file, const char *sig_file)
+{
 	/* mute `unused variable' warnings. */
 	(void)sig_file;
 	(void)text_file;
 	(void)conf;
 	return 0;
+}
+
+int opkg_verify_file_finish(int handle)
+{
+	(void)handle;
+	return 0;
+}
 #endif
+
+int opkg_verify_file(char *text_file, char *sig_file)
+{
+	int handle = opkg_verify_file_start(text_file, sig_file);
+
+	if (handle < 0)
+		return -1;
+
+	return opkg_verify_file_finish(handle);
 }
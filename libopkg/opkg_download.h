@@ -23,10 +23,17 @@
 int opkg_download(const char *src, const char *dest_file_name,
                   const short hide_error);
 int opkg_download_pkg(pkg_t * pkg, const char *dir);
+int opkg_download_pkgs_parallel(pkg_vec_t * pkgs,
+                                void (*pkg_ready) (pkg_t * pkg));
 /*
  * Downloads file from url, installs in package database, return package name.
  */
 int opkg_prepare_url_for_install(const char *url, char **namep);
 
 int opkg_verify_file(char *text_file, char *sig_file);
+
+/* detached verification: start returns a handle whose result is
+ * collected later, letting checks overlap other work */
+int opkg_verify_file_start(const char *text_file, const char *sig_file);
+int opkg_verify_file_finish(int handle);
 #endif
@@ -16,9 +16,12 @@
 */
 
 #include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <time.h>
 #include <signal.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
 #include "pkg.h"
@@ -27,6 +30,7 @@
 
 #include "opkg_install.h"
 #include "opkg_configure.h"
+#include "pkg_order.h"
 #include "opkg_download.h"
 #include "opkg_remove.h"
 
@@ -37,7 +41,10 @@
 
 #include "sprintf_alloc.h"
 #include "file_util.h"
+#include "sha256.h"
 #include "xsystem.h"
+#include "opkg_journal.h"
+#include "opkg_profile.h"
 #include "libbb/libbb.h"
 
 static int satisfy_dependencies_for(pkg_t * pkg)
@@ -146,17 +153,15 @@ static int check_conflicts_for(pkg_t * pkg)
 
 static int update_file_ownership(pkg_t * new_pkg, pkg_t * old_pkg)
 {
-	str_list_t *new_list, *old_list;
-	str_list_elt_t *iter, *niter;
+	str_vec_t *new_list, *old_list;
+	unsigned int i;
 
 	new_list = pkg_get_installed_files(new_pkg);
 	if (new_list == NULL)
 		return -1;
 
-	for (iter = str_list_first(new_list), niter =
-	     str_list_next(new_list, iter); iter;
-	     iter = niter, niter = str_list_next(new_list, niter)) {
-		char *new_file = (char *)iter->data;
+	for (i = 0; i < new_list->len; i++) {
+		char *new_file = new_list->strs[i];
 		pkg_t *owner = file_hash_get_file_owner(new_file);
 		pkg_t *obs = hash_table_get(&conf->obs_file_hash, new_file);
 
@@ -176,10 +181,8 @@ static int update_file_ownership(pkg_t * new_pkg, pkg_t * old_pkg)
 			return -1;
 		}
 
-		for (iter = str_list_first(old_list), niter =
-		     str_list_next(old_list, iter); iter;
-		     iter = niter, niter = str_list_next(old_list, niter)) {
-			char *old_file = (char *)iter->data;
+		for (i = 0; i < old_list->len; i++) {
+			char *old_file = old_list->strs[i];
 			pkg_t *owner = file_hash_get_file_owner(old_file);
 			if (!owner || (owner == old_pkg)) {
 				/* obsolete */
@@ -230,6 +233,131 @@ static int verify_pkg_installable(pkg_t * pkg)
 	return 0;
 }
 
+/*
+ * Transaction space preflight. The per-package check above can fail at
+ * package 40 of a 50-package transaction, minutes of work and flash
+ * writes too late. Before any download or unpack starts, the summed
+ * Installed-Size of everything headed for each destination is checked
+ * against that filesystem once, and the summed archive sizes against
+ * the download directory; the download total is then briefly reserved
+ * with posix_fallocate() to catch filesystems whose statvfs numbers
+ * are not backed by real blocks (quota, thin provisioning). While a
+ * vetted transaction runs, the per-package check stands down.
+ */
+static __thread int preflight_passed;
+
+static int install_preflight_space(pkg_vec_t * ordered)
+{
+	struct preflight_dest {
+		char *dir;
+		unsigned long kbs;
+	} *dests = NULL;
+	unsigned long long dl_bytes = 0;
+	unsigned long installed_size, kbs_available;
+	unsigned int w;
+	int i, n_dests = 0;
+	struct stat s;
+	pkg_t *pkg;
+
+	if (conf->force_space || conf->noaction || conf->download_only)
+		return 0;
+
+	for (w = 0; w < ordered->len; w++) {
+		char *root_dir = NULL;
+
+		pkg = ordered->pkgs[w];
+
+		if (pkg->state_status == SS_INSTALLED
+		    || pkg->state_status == SS_UNPACKED)
+			continue;
+
+		if (!pkg_get_string(pkg, PKG_LOCAL_FILENAME))
+			dl_bytes +=
+			    (unsigned long long)pkg_get_int(pkg, PKG_SIZE);
+
+		installed_size =
+		    (unsigned long)pkg_get_int(pkg, PKG_INSTALLED_SIZE);
+		if (installed_size == 0)
+			continue;
+
+		if (pkg->dest) {
+			if (!strcmp(pkg->dest->name, "root")
+			    && conf->overlay_root
+			    && !stat(conf->overlay_root, &s)
+			    && (s.st_mode & S_IFDIR))
+				root_dir = conf->overlay_root;
+			else
+				root_dir = pkg->dest->root_dir;
+		}
+		if (!root_dir)
+			root_dir = conf->default_dest->root_dir;
+
+		for (i = 0; i < n_dests; i++)
+			if (!strcmp(dests[i].dir, root_dir))
+				break;
+		if (i == n_dests) {
+			dests = xrealloc(dests,
+					 (n_dests + 1) * sizeof(dests[0]));
+			dests[n_dests].dir = root_dir;
+			dests[n_dests].kbs = 0;
+			n_dests++;
+		}
+		dests[i].kbs += (installed_size + 1023) / 1024;
+	}
+
+	for (i = 0; i < n_dests; i++) {
+		kbs_available = get_available_kbytes(dests[i].dir);
+		if (dests[i].kbs >= kbs_available) {
+			opkg_msg(ERROR,
+				 "Only have %ldkb available on filesystem "
+				 "%s, transaction needs %ld\n",
+				 kbs_available, dests[i].dir, dests[i].kbs);
+			free(dests);
+			return -1;
+		}
+	}
+	free(dests);
+
+	if (dl_bytes) {
+		char *dl_dir = conf->cache ? conf->cache : conf->tmp_dir;
+		char *probe;
+		int fd;
+
+		kbs_available = get_available_kbytes(dl_dir);
+		if (dl_bytes / 1024 >= kbs_available) {
+			opkg_msg(ERROR,
+				 "Only have %ldkb available in %s, "
+				 "transaction downloads need %lldkb\n",
+				 kbs_available, dl_dir, dl_bytes / 1024);
+			return -1;
+		}
+
+		sprintf_alloc(&probe, "%s/opkg-preflight.XXXXXX", dl_dir);
+		fd = mkstemp(probe);
+		if (fd >= 0) {
+			int perr;
+
+			unlink(probe);
+			perr = posix_fallocate(fd, 0, dl_bytes);
+			close(fd);
+			if (perr == ENOSPC || perr == EDQUOT) {
+				opkg_msg(ERROR,
+					 "Cannot reserve %lldkb in %s for "
+					 "transaction downloads.\n",
+					 dl_bytes / 1024, dl_dir);
+				free(probe);
+				return -1;
+			}
+			/* other errors (e.g. the filesystem does not
+			   support preallocation) prove nothing */
+		}
+		free(probe);
+	}
+
+	preflight_passed = 1;
+	return 0;
+}
+
 static int unpack_pkg_control_files(pkg_t * pkg)
 {
 	int err;
@@ -262,7 +390,7 @@ static int unpack_pkg_control_files(pkg_t * pkg)
 
 	/* Don't need to re-read conffiles if we already have it */
 	cl = pkg_get_ptr(pkg, PKG_CONFFILES);
-	if (cl && !nv_pair_list_empty(cl)) {
+	if (cl && !conffile_list_empty(cl)) {
 		return 0;
 	}
 
@@ -657,7 +785,18 @@ static int backup_make_backup(const char *file_name)
 	char *backup;
 
 	backup = backup_filename_alloc(file_name);
-	err = file_copy(file_name, backup);
+
+	/* journal first, backup second: recovery only restores backups
+	   it finds recorded */
+	opkg_journal_record(file_name);
+
+	/* extraction unlinks the original before rewriting it, so a
+	   hard link keeps the old inode alive for rollback at the cost
+	   of a directory entry instead of a full data copy */
+	unlink(backup);
+	err = link(file_name, backup);
+	if (err)
+		err = file_copy(file_name, backup);
 	if (err) {
 		opkg_msg(ERROR, "Failed to copy %s to %s\n", file_name, backup);
 	}
@@ -706,8 +845,8 @@ static int backup_modified_conffiles(pkg_t * pkg, pkg_t * old_pkg)
 	if (old_pkg) {
 		cl = pkg_get_ptr(old_pkg, PKG_CONFFILES);
 
-		for (iter = cl ? nv_pair_list_first(cl) : NULL; iter;
-		     iter = nv_pair_list_next(cl, iter)) {
+		for (iter = cl ? conffile_list_first(cl) : NULL; iter;
+		     iter = conffile_list_next(cl, iter)) {
 			char *cf_name;
 
 			cf = iter->data;
@@ -728,8 +867,8 @@ static int backup_modified_conffiles(pkg_t * pkg, pkg_t * old_pkg)
 	/* Backup all conffiles that were not conffiles in old_pkg */
 	cl = pkg_get_ptr(pkg, PKG_CONFFILES);
 
-	for (iter = cl ? nv_pair_list_first(cl) : NULL; iter;
-	     iter = nv_pair_list_next(cl, iter)) {
+	for (iter = cl ? conffile_list_first(cl) : NULL; iter;
+	     iter = conffile_list_next(cl, iter)) {
 		char *cf_name;
 		cf = (conffile_t *) iter->data;
 		cf_name = root_filename_alloc(cf->name);
@@ -758,16 +897,16 @@ static int backup_modified_conffiles_unwind(pkg_t * pkg, pkg_t * old_pkg)
 	if (old_pkg) {
 		cl = pkg_get_ptr(old_pkg, PKG_CONFFILES);
 
-		for (iter = cl ? nv_pair_list_first(cl) : NULL; iter;
-		     iter = nv_pair_list_next(cl, iter)) {
+		for (iter = cl ? conffile_list_first(cl) : NULL; iter;
+		     iter = conffile_list_next(cl, iter)) {
 			backup_remove(((nv_pair_t *) iter->data)->name);
 		}
 	}
 
 	cl = pkg_get_ptr(pkg, PKG_CONFFILES);
 
-	for (iter = cl ? nv_pair_list_first(cl) : NULL; iter;
-	     iter = nv_pair_list_next(cl, iter)) {
+	for (iter = cl ? conffile_list_first(cl) : NULL; iter;
+	     iter = conffile_list_next(cl, iter)) {
 		backup_remove(((nv_pair_t *) iter->data)->name);
 	}
 
@@ -789,8 +928,8 @@ static int check_data_file_clashes(pkg_t * pkg, pkg_t * old_pkg)
 	   packages involved in the clash has the potential to break the
 	   other package.
 	 */
-	str_list_t *files_list;
-	str_list_elt_t *iter, *niter;
+	str_vec_t *files_list;
+	unsigned int i;
 	char *filename;
 	int clashes = 0;
 
@@ -798,10 +937,8 @@ static int check_data_file_clashes(pkg_t * pkg, pkg_t * old_pkg)
 	if (files_list == NULL)
 		return -1;
 
-	for (iter = str_list_first(files_list), niter =
-	     str_list_next(files_list, iter); iter;
-	     iter = niter, niter = str_list_next(files_list, iter)) {
-		filename = (char *)iter->data;
+	for (i = 0; i < files_list->len; i++) {
+		filename = files_list->strs[i];
 		if (file_exists(filename) && (!file_is_dir(filename))) {
 			pkg_t *owner;
 			pkg_t *obs;
@@ -885,17 +1022,15 @@ static int check_data_file_clashes_change(pkg_t * pkg, pkg_t * old_pkg)
 	   Only the action that are needed to change name should be considered.
 	   @@@ To change after 1.0 release.
 	 */
-	str_list_t *files_list;
-	str_list_elt_t *iter, *niter;
+	str_vec_t *files_list;
+	unsigned int i;
 
 	files_list = pkg_get_installed_files(pkg);
 	if (files_list == NULL)
 		return -1;
 
-	for (iter = str_list_first(files_list), niter =
-	     str_list_next(files_list, iter); iter;
-	     iter = niter, niter = str_list_next(files_list, niter)) {
-		char *filename = (char *)iter->data;
+	for (i = 0; i < files_list->len; i++) {
+		char *filename = files_list->strs[i];
 		if (file_exists(filename) && (!file_is_dir(filename))) {
 			pkg_t *owner;
 
@@ -976,10 +1111,9 @@ static int postrm_upgrade_old_pkg_unwind(pkg_t * pkg, pkg_t * old_pkg)
 static int remove_obsolesced_files(pkg_t * pkg, pkg_t * old_pkg)
 {
 	int err = 0;
-	str_list_t *old_files;
-	str_list_elt_t *of;
-	str_list_t *new_files;
-	str_list_elt_t *nf;
+	str_vec_t *old_files;
+	str_vec_t *new_files;
+	unsigned int i;
 	hash_table_t new_files_table;
 
 	old_files = pkg_get_installed_files(old_pkg);
@@ -994,17 +1128,14 @@ static int remove_obsolesced_files(pkg_t * pkg, pkg_t * old_pkg)
 
 	new_files_table.entries = NULL;
 	hash_table_init("new_files", &new_files_table, 20);
-	for (nf = str_list_first(new_files); nf;
-	     nf = str_list_next(new_files, nf)) {
-		if (nf && nf->data)
-			hash_table_insert(&new_files_table, nf->data, nf->data);
-	}
+	for (i = 0; i < new_files->len; i++)
+		hash_table_insert(&new_files_table, new_files->strs[i],
+				  new_files->strs[i]);
 
-	for (of = str_list_first(old_files); of;
-	     of = str_list_next(old_files, of)) {
+	for (i = 0; i < old_files->len; i++) {
 		pkg_t *owner;
 		char *old, *new;
-		old = (char *)of->data;
+		old = old_files->strs[i];
 		new = (char *)hash_table_get(&new_files_table, old);
 		if (new)
 			continue;
@@ -1035,15 +1166,15 @@ static int remove_obsolesced_files(pkg_t * pkg, pkg_t * old_pkg)
 	return err;
 }
 
-static int install_maintainer_scripts(pkg_t * pkg, pkg_t * old_pkg)
+static int install_maintainer_scripts(pkg_t * pkg, pkg_t * old_pkg,
+				      struct deb_session *es)
 {
 	int ret;
 	char *prefix;
 
 	sprintf_alloc(&prefix, "%s.", pkg->name);
-	ret = pkg_extract_control_files_to_dir_with_prefix(pkg,
-							   pkg->dest->info_dir,
-							   prefix);
+	ret = pkg_extract_session_control_files(es, pkg->dest->info_dir,
+						prefix);
 	free(prefix);
 	return ret;
 }
@@ -1068,7 +1199,80 @@ static int remove_disappeared(pkg_t * pkg)
 	return 0;
 }
 
-static int install_data_files(pkg_t * pkg)
+/*
+ * Opt-in dedup: packages often ship byte-identical files (licenses,
+ * locale stubs, the same .so across variant builds). Content hashes of
+ * the files installed during this run are tracked in a table; when a
+ * fresh file matches one already seen, it is replaced with a hardlink
+ * to the earlier copy, so the duplicate bytes never reach flash.
+ * Hardlinks share their inode metadata, so a link is only made when
+ * device, mode and ownership agree as well.
+ */
+static __thread hash_table_t dedupe_table;
+
+static void dedupe_pkg_files(pkg_t * pkg)
+{
+	str_vec_t *files;
+	struct stat st, canon_st;
+	unsigned int i;
+	char *sum, *canonical, *tmp;
+
+	if (!dedupe_table.entries)
+		hash_table_init("dedupe", &dedupe_table, 256);
+
+	files = pkg_get_installed_files(pkg);
+	if (files == NULL)
+		return;
+
+	for (i = 0; i < files->len; i++) {
+		const char *path = files->strs[i];
+
+		if (lstat(path, &st))
+			continue;
+		if (!S_ISREG(st.st_mode) || st.st_size == 0
+		    || st.st_nlink > 1)
+			continue;
+
+		sum = file_sha256sum_alloc(path);
+		if (sum == NULL)
+			continue;
+
+		canonical = hash_table_get(&dedupe_table, sum);
+		if (canonical == NULL) {
+			hash_table_insert(&dedupe_table, sum, xstrdup(path));
+			free(sum);
+			continue;
+		}
+		free(sum);
+
+		if (lstat(canonical, &canon_st)
+		    || !S_ISREG(canon_st.st_mode)
+		    || canon_st.st_dev != st.st_dev
+		    || canon_st.st_size != st.st_size
+		    || canon_st.st_mode != st.st_mode
+		    || canon_st.st_uid != st.st_uid
+		    || canon_st.st_gid != st.st_gid
+		    || canon_st.st_ino == st.st_ino)
+			continue;
+
+		/* link beside the file and rename over it, so a failure
+		   at any point leaves the written copy in place */
+		sprintf_alloc(&tmp, "%s-opkg.dedupe", path);
+		unlink(tmp);
+		if (link(canonical, tmp) == 0) {
+			if (rename(tmp, path) == 0)
+				opkg_msg(DEBUG, "Hardlinked %s to %s.\n",
+					 path, canonical);
+			else
+				unlink(tmp);
+		}
+		free(tmp);
+	}
+
+	pkg_free_installed_files(pkg);
+}
+
+static int install_data_files(pkg_t * pkg, struct deb_session *es)
 {
 	int err;
 
@@ -1078,11 +1282,16 @@ static int install_data_files(pkg_t * pkg)
 	   check_data_file_clashes() for more details. */
 
 	opkg_msg(INFO, "Extracting data files to %s.\n", pkg->dest->root_dir);
-	err = pkg_extract_data_files_to_dir(pkg, pkg->dest->root_dir);
+	opkg_profile_begin(PROFILE_EXTRACT);
+	err = pkg_extract_session_data_files(es, pkg->dest->root_dir);
+	opkg_profile_end(PROFILE_EXTRACT);
 	if (err) {
 		return err;
 	}
 
+	if (conf->dedupe)
+		dedupe_pkg_files(pkg);
+
 	opkg_msg(DEBUG, "Calling pkg_write_filelist.\n");
 	err = pkg_write_filelist(pkg);
 	if (err)
@@ -1115,15 +1324,24 @@ static int resolve_conffiles(pkg_t * pkg)
 
 	cl = pkg_get_ptr(pkg, PKG_CONFFILES);
 
-	for (iter = cl ? nv_pair_list_first(cl) : NULL; iter;
-	     iter = nv_pair_list_next(cl, iter)) {
+	for (iter = cl ? conffile_list_first(cl) : NULL; iter;
+	     iter = conffile_list_next(cl, iter)) {
 		char *root_filename;
+		struct stat cf_st;
+
 		cf = (conffile_t *) iter->data;
 		root_filename = root_filename_alloc(cf->name);
 
 		/* Might need to initialize the md5sum for each conffile */
 		if (cf->value == NULL) {
 			cf->value = file_sha256sum_alloc(root_filename);
+			/* the freshly extracted file matches its own
+			   checksum; remember its stat so later checks
+			   need no hash pass */
+			if (cf->value && stat(root_filename, &cf_st) == 0) {
+				cf->mtime = cf_st.st_mtime;
+				cf->size = cf_st.st_size;
+			}
 		}
 
 		if (!file_exists(root_filename)) {
@@ -1173,12 +1391,21 @@ static int resolve_conffiles(pkg_t * pkg)
 	return 0;
 }
 
-int opkg_install_by_name(const char *pkg_name)
+/*
+ * Resolve pkg_name to the candidate that should be installed, applying
+ * the usual up-to-date and no-downgrade policy against any installed
+ * version. Returns the candidate ready for opkg_install_pkg(), or NULL
+ * with *errp set to -1 for an unknown package and to 0 when there is
+ * simply nothing to do.
+ */
+static pkg_t *opkg_install_resolve_by_name(const char *pkg_name, int *errp)
 {
 	int cmp;
 	pkg_t *old, *new;
 	char *old_version, *new_version;
 
+	*errp = 0;
+
 	old = pkg_hash_fetch_installed_by_name(pkg_name);
 	if (old)
 		opkg_msg(DEBUG2, "Old versions from pkg_hash_fetch %s.\n",
@@ -1187,7 +1414,8 @@ int opkg_install_by_name(const char *pkg_name)
 	new = pkg_hash_fetch_best_installation_candidate_by_name(pkg_name);
 	if (new == NULL) {
 		opkg_msg(NOTICE, "Unknown package '%s'.\n", pkg_name);
-		return -1;
+		*errp = -1;
+		return NULL;
 	}
 
 	opkg_msg(DEBUG2, "Versions from pkg_hash_fetch:");
@@ -1218,7 +1446,7 @@ int opkg_install_by_name(const char *pkg_name)
 				 old->name, old_version, old->dest->name);
 			free(old_version);
 			free(new_version);
-			return 0;
+			return NULL;
 		} else if (cmp > 0) {
 			opkg_msg(NOTICE,
 				 "Not downgrading package %s on %s from %s to %s.\n",
@@ -1226,7 +1454,7 @@ int opkg_install_by_name(const char *pkg_name)
 				 new_version);
 			free(old_version);
 			free(new_version);
-			return 0;
+			return NULL;
 		} else if (cmp < 0) {
 			new->dest = old->dest;
 			old->state_want = SW_DEINSTALL;
@@ -1235,10 +1463,403 @@ int opkg_install_by_name(const char *pkg_name)
 		free(new_version);
 	}
 
+	return new;
+}
+
+int opkg_install_by_name(const char *pkg_name)
+{
+	int err;
+	pkg_t *new = opkg_install_resolve_by_name(pkg_name, &err);
+
+	if (new == NULL)
+		return err;
+
 	opkg_msg(DEBUG2, "Calling opkg_install_pkg.\n");
 	return opkg_install_pkg(new, 0);
 }
 
+/*
+ * Install a whole set of packages as one transaction: resolve every
+ * requested name, expand the set with an explicit worklist over
+ * unsatisfied dependencies and execute the installs with dependencies
+ * ordered first. opkg_install_pkg() still performs every step with all
+ * its checks, but by the time it runs for a package everything that
+ * package needs is already unpacked, so the recursive descent through
+ * satisfy_dependencies_for() never goes more than one level deep.
+ */
+/*
+ * Shared state between opkg_install_multiple_by_name and the download
+ * completion callback below. Packages are installed in the dependency
+ * order of `ordered`; `next` is the frontier up to which everything
+ * has been handed to opkg_install_pkg already.
+ */
+static __thread struct {
+	pkg_vec_t *ordered;
+	char *fetched;		/* one flag per position in ordered */
+	unsigned int next;
+	int err;
+} install_pipeline;
+
+/*
+ * Called by the download engine each time a package needs no further
+ * transfer. Installs the longest fully-fetched prefix of the order, so
+ * unpacking of early packages overlaps the remaining downloads.
+ */
+static void opkg_install_pipeline_ready(pkg_t * pkg)
+{
+	pkg_vec_t *ordered = install_pipeline.ordered;
+	unsigned int i;
+
+	for (i = install_pipeline.next; i < ordered->len; i++)
+		if (ordered->pkgs[i] == pkg) {
+			install_pipeline.fetched[i] = 1;
+			break;
+		}
+
+	while (install_pipeline.next < ordered->len
+	       && install_pipeline.fetched[install_pipeline.next]) {
+		pkg = ordered->pkgs[install_pipeline.next++];
+
+		/* an earlier member of the transaction may have pulled
+		 * this one in already */
+		if (pkg->state_status == SS_INSTALLED
+		    || pkg->state_status == SS_UNPACKED)
+			continue;
+
+		opkg_msg(DEBUG2, "Calling opkg_install_pkg.\n");
+		if (opkg_install_pkg(pkg, 0)) {
+			opkg_msg(ERROR, "Cannot install package %s.\n",
+				 pkg->name);
+			install_pipeline.err = -1;
+		}
+		if (!(pkg->state_flag & SF_USER))
+			pkg->auto_installed = 1;
+	}
+}
+
+/*
+ * Archive checksums are the per-package independent part of a
+ * transaction: each one reads a single file and touches nothing
+ * shared. Verify them on a small worker pool before the install walk,
+ * so the serial loop can skip the read-back. Extraction and maintainer
+ * scripts stay serial on purpose: every unpack updates the shared
+ * file-owner hash and the status database.
+ */
+struct preverify_queue {
+	pthread_mutex_t lock;
+	pkg_vec_t *pkgs;
+	unsigned int next;
+};
+
+static void preverify_sha256_hex(const unsigned char *bin, char *hex)
+{
+	static const char digits[] = "0123456789abcdef";
+	int i;
+
+	for (i = 0; i < 32; i++) {
+		hex[i * 2] = digits[bin[i] >> 4];
+		hex[i * 2 + 1] = digits[bin[i] & 0xf];
+	}
+	hex[64] = '\0';
+}
+
+static void *preverify_worker(void *arg)
+{
+	struct preverify_queue *q = (struct preverify_queue *)arg;
+	pkg_t *batch[SHA256_MULTI_LANES];
+	struct file_map maps[SHA256_MULTI_LANES];
+	const char *bufs[SHA256_MULTI_LANES];
+	size_t lens[SHA256_MULTI_LANES];
+	unsigned char digests[SHA256_MULTI_LANES][32];
+	int oks[SHA256_MULTI_LANES], idx[SHA256_MULTI_LANES];
+	char hex[65];
+	const char *filename;
+	char *want, *got;
+	pkg_t *pkg;
+	int i, j, n, nmap;
+
+	for (;;) {
+		pthread_mutex_lock(&q->lock);
+		n = q->pkgs->len - q->next;
+		if (n <= 0) {
+			pthread_mutex_unlock(&q->lock);
+			break;
+		}
+		if (n > SHA256_MULTI_LANES)
+			n = SHA256_MULTI_LANES;
+		for (i = 0; i < n; i++)
+			batch[i] = q->pkgs->pkgs[q->next++];
+		pthread_mutex_unlock(&q->lock);
+
+		/* mapped archives are sha256-hashed as one multi-buffer
+		 * batch below; md5 sums and unmappable files go the
+		 * one-at-a-time route */
+		nmap = 0;
+		for (i = 0; i < n; i++) {
+			pkg = batch[i];
+			filename = pkg_get_string(pkg, PKG_LOCAL_FILENAME);
+			oks[i] = 1;
+
+			want = pkg_get_md5(pkg);
+			if (want) {
+				got = file_md5sum_alloc(filename);
+				if (!got || strcmp(got, want))
+					oks[i] = 0;
+				free(got);
+			}
+
+			want = pkg_get_sha256(pkg);
+			if (!want)
+				continue;
+
+			if (file_map_open(&maps[nmap], filename) == 0) {
+				bufs[nmap] = maps[nmap].base;
+				lens[nmap] = maps[nmap].len;
+				idx[nmap] = i;
+				nmap++;
+			} else {
+				got = file_sha256sum_alloc(filename);
+				if (!got || strcmp(got, want))
+					oks[i] = 0;
+				free(got);
+			}
+		}
+
+		sha256_buffer_multi(bufs, lens, nmap, digests);
+
+		for (j = 0; j < nmap; j++) {
+			preverify_sha256_hex(digests[j], hex);
+			if (strcmp(hex, pkg_get_sha256(batch[idx[j]])))
+				oks[idx[j]] = 0;
+			file_map_close(&maps[j]);
+		}
+
+		/* on a mismatch the flag stays clear and the install walk
+		 * recomputes the sum, reporting the failure with the usual
+		 * force_checksum handling */
+		for (i = 0; i < n; i++)
+			if (oks[i])
+				batch[i]->checksum_verified = 1;
+	}
+
+	return NULL;
+}
+
+static void install_preverify_archives(pkg_vec_t * ordered)
+{
+	struct preverify_queue queue;
+	pthread_t threads[4];
+	unsigned int w;
+	int i, n_threads;
+	pkg_t *pkg;
+
+	queue.pkgs = pkg_vec_alloc();
+
+	for (w = 0; w < ordered->len; w++) {
+		pkg = ordered->pkgs[w];
+
+		if (pkg->state_status == SS_INSTALLED
+		    || pkg->state_status == SS_UNPACKED
+		    || pkg->checksum_verified)
+			continue;
+		if (!pkg_get_string(pkg, PKG_LOCAL_FILENAME))
+			continue;
+		if (!pkg_get_md5(pkg) && !pkg_get_sha256(pkg))
+			continue;
+
+		pkg_vec_insert(queue.pkgs, pkg);
+	}
+
+	n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n_threads > (int)queue.pkgs->len)
+		n_threads = queue.pkgs->len;
+	if (n_threads > 4)
+		n_threads = 4;
+
+	if (queue.pkgs->len) {
+		pthread_mutex_init(&queue.lock, NULL);
+		queue.next = 0;
+
+		if (n_threads > 1) {
+			for (i = 0; i < n_threads; i++)
+				pthread_create(&threads[i], NULL,
+					       preverify_worker, &queue);
+			for (i = 0; i < n_threads; i++)
+				pthread_join(threads[i], NULL);
+		} else {
+			/* multi-buffer batching pays off even with a
+			 * lone worker */
+			preverify_worker(&queue);
+		}
+
+		pthread_mutex_destroy(&queue.lock);
+	}
+
+	pkg_vec_free(queue.pkgs);
+}
+
+int opkg_install_multiple_by_name(int num_pkgs, char **pkg_names)
+{
+	int i, resolve_err, err = 0;
+	unsigned int w;
+	pkg_t *pkg, *dep;
+	pkg_vec_t *closure, *depends, *ordered;
+	char **tmp, **unresolved, *prev;
+
+	closure = pkg_vec_alloc();
+
+	for (i = 0; i < num_pkgs; i++) {
+		pkg = opkg_install_resolve_by_name(pkg_names[i], &resolve_err);
+		if (pkg == NULL) {
+			if (resolve_err) {
+				opkg_msg(ERROR, "Cannot install package %s.\n",
+					 pkg_names[i]);
+				err = -1;
+			}
+			continue;
+		}
+		if (!pkg_vec_contains(closure, pkg))
+			pkg_vec_insert(closure, pkg);
+	}
+
+	/* Worklist expansion: every entry's unsatisfied dependencies
+	 * join the closure and are expanded in turn. Entries appended
+	 * during the walk are picked up because closure->len grows. */
+	for (w = 0; w < closure->len; w++) {
+		pkg = closure->pkgs[w];
+
+		depends = pkg_vec_alloc();
+		unresolved = NULL;
+		pkg_hash_fetch_unsatisfied_dependencies(pkg, depends,
+							&unresolved);
+
+		if (unresolved) {
+			opkg_msg(ERROR,
+				 "Cannot satisfy the following dependencies for %s:\n",
+				 pkg->name);
+			prev = NULL;
+			for (tmp = unresolved; *tmp; tmp++) {
+				if (!prev || strcmp(*tmp, prev))
+					opkg_message(ERROR, "\t%s\n", *tmp);
+				prev = *tmp;
+			}
+			for (tmp = unresolved; *tmp; tmp++)
+				free(*tmp);
+			free(unresolved);
+
+			if (!conf->force_depends) {
+				opkg_msg(INFO,
+					 "This could mean that your package list is out of date or that the packages\n"
+					 "mentioned above do not yet exist (try 'opkg update'). To proceed in spite\n"
+					 "of this problem try again with the '-force-depends' option.\n");
+				/* drop the broken entry; anything pulled
+				 * in only by it is skipped as well since
+				 * it is discovered through this walk */
+				pkg_vec_free(depends);
+				opkg_msg(ERROR, "Cannot install package %s.\n",
+					 pkg->name);
+				memmove(&closure->pkgs[w],
+					&closure->pkgs[w + 1],
+					(closure->len - w - 1) *
+					sizeof(closure->pkgs[0]));
+				closure->len--;
+				w--;
+				err = -1;
+				continue;
+			}
+		}
+
+		for (i = 0; i < depends->len; i++) {
+			dep = depends->pkgs[i];
+			if (pkg_vec_contains(closure, dep))
+				continue;
+			/* Dependencies go to the same place as pkg */
+			if (dep->dest == NULL)
+				dep->dest = pkg->dest;
+			dep->state_want = SW_INSTALL;
+			pkg_vec_insert(closure, dep);
+		}
+
+		pkg_vec_free(depends);
+	}
+
+	ordered = pkg_vec_alloc();
+	pkg_vec_order_all_by_depends(closure, ordered);
+
+	/* from here on only the transaction's packages matter; in
+	 * low-memory mode give the rest of the feed metadata back
+	 * before the I/O-heavy phases start competing for page cache */
+	if (conf->lowmem)
+		pkg_hash_prune_to_transaction(ordered);
+
+	/* reject a transaction that cannot fit before any download or
+	 * flash write happens */
+	if (install_preflight_space(ordered)) {
+		pkg_vec_free(ordered);
+		pkg_vec_free(closure);
+		return -1;
+	}
+
+	/* archives already on disk (local installs, cache hits) can have
+	 * their checksums verified concurrently before the serial walk */
+	install_preverify_archives(ordered);
+
+	w = 0;
+
+	/* the install set is known, so the archives can be fetched
+	 * concurrently; the completion callback unpacks each package as
+	 * soon as it and everything before it in the order is on disk,
+	 * overlapping install work with the remaining transfers */
+	if (conf->parallel_downloads > 1 && !conf->noaction) {
+		install_pipeline.ordered = ordered;
+		install_pipeline.fetched =
+		    xcalloc(ordered->len ? ordered->len : 1, 1);
+		install_pipeline.next = 0;
+		install_pipeline.err = 0;
+
+		opkg_download_pkgs_parallel(ordered,
+					    opkg_install_pipeline_ready);
+
+		if (install_pipeline.err)
+			err = -1;
+
+		/* anything past the frontier missed its completion
+		 * callback (e.g. waitpid trouble); the serial loop
+		 * below picks it up */
+		w = install_pipeline.next;
+
+		free(install_pipeline.fetched);
+		install_pipeline.ordered = NULL;
+		install_pipeline.fetched = NULL;
+	}
+
+	for (; w < ordered->len; w++) {
+		pkg = ordered->pkgs[w];
+
+		/* an earlier member of the transaction may have pulled
+		 * this one in already */
+		if (pkg->state_status == SS_INSTALLED
+		    || pkg->state_status == SS_UNPACKED)
+			continue;
+
+		opkg_msg(DEBUG2, "Calling opkg_install_pkg.\n");
+		if (opkg_install_pkg(pkg, 0)) {
+			opkg_msg(ERROR, "Cannot install package %s.\n",
+				 pkg->name);
+			err = -1;
+		}
+		if (!(pkg->state_flag & SF_USER))
+			pkg->auto_installed = 1;
+	}
+
+	pkg_vec_free(ordered);
+	pkg_vec_free(closure);
+
+	preflight_passed = 0;
+
+	return err;
+}
+
 /**
  *  @brief Really install a pkg_t
  */
@@ -1256,6 +1877,7 @@ int opkg_install_pkg(pkg_t * pkg, int from_upgrade)
 	const char *local_filename;
 	long long int pkg_expected_size;
 	struct stat pkg_stat;
+	struct deb_session *extract_session;
 	time_t now;
 
 	if (from_upgrade)
@@ -1305,9 +1927,12 @@ int opkg_install_pkg(pkg_t * pkg, int from_upgrade)
 	if (pkg->state_status == SS_INSTALLED)
 		return 0;
 
-	err = verify_pkg_installable(pkg);
-	if (err)
-		return -1;
+	/* the transaction preflight already vouched for the summed size */
+	if (!preflight_passed) {
+		err = verify_pkg_installable(pkg);
+		if (err)
+			return -1;
+	}
 
 	local_filename = pkg_get_string(pkg, PKG_LOCAL_FILENAME);
 
@@ -1393,7 +2018,9 @@ int opkg_install_pkg(pkg_t * pkg, int from_upgrade)
 
 	/* Check for md5 values */
 	pkg_md5 = pkg_get_md5(pkg);
-	if (pkg_md5) {
+	/* skip the read-back when the download path already matched the
+	 * archive against the feed's sha256 while the bytes arrived */
+	if (pkg_md5 && !pkg->checksum_verified) {
 		file_md5 = file_md5sum_alloc(local_filename);
 		if (file_md5 && strcmp(file_md5, pkg_md5)) {
 			if (!conf->force_checksum) {
@@ -1414,7 +2041,7 @@ int opkg_install_pkg(pkg_t * pkg, int from_upgrade)
 
 	/* Check for sha256 value */
 	pkg_sha256 = pkg_get_sha256(pkg);
-	if (pkg_sha256) {
+	if (pkg_sha256 && !pkg->checksum_verified) {
 		file_sha256 = file_sha256sum_alloc(local_filename);
 		if (file_sha256 && strcmp(file_sha256, pkg_sha256)) {
 			if (!conf->force_checksum) {
@@ -1475,6 +2102,9 @@ int opkg_install_pkg(pkg_t * pkg, int from_upgrade)
 	sigprocmask(SIG_BLOCK, &newset, &oldset);
 
 	opkg_state_changed++;
+	opkg_status_mark_dirty(pkg);
+	if (old_pkg)
+		opkg_status_mark_dirty(old_pkg);
 	pkg->state_flag |= SF_FILELIST_CHANGED;
 
 	if (old_pkg) {
@@ -1538,11 +2168,21 @@ int opkg_install_pkg(pkg_t * pkg, int from_upgrade)
 		remove_maintainer_scripts(old_pkg);
 	}
 
+	/* maintainer scripts and data files stream out of one pass over
+	 * the archive, instead of decompressing it once per member */
+	extract_session = pkg_extract_begin(pkg);
+	if (extract_session == NULL) {
+		opkg_msg(ERROR, "Failed to open archive of %s."
+			 " Package debris may remain!\n", pkg->name);
+		goto pkg_is_hosed;
+	}
+
 	opkg_msg(INFO, "%s maintainer scripts.\n",
 		 (pkg->is_upgrade) ? ("Upgrading") : ("Installing"));
-	if (install_maintainer_scripts(pkg, old_pkg)) {
+	if (install_maintainer_scripts(pkg, old_pkg, extract_session)) {
 		opkg_msg(ERROR, "Failed to extract maintainer scripts for %s."
 			 " Package debris may remain!\n", pkg->name);
+		pkg_extract_end(extract_session);
 		goto pkg_is_hosed;
 	}
 
@@ -1551,12 +2191,15 @@ int opkg_install_pkg(pkg_t * pkg, int from_upgrade)
 
 	opkg_msg(INFO, "Installing data files for %s.\n", pkg->name);
 
-	if (install_data_files(pkg)) {
+	if (install_data_files(pkg, extract_session)) {
 		opkg_msg(ERROR, "Failed to extract data files for %s. "
 			 "Package debris may remain!\n", pkg->name);
+		pkg_extract_end(extract_session);
 		goto pkg_is_hosed;
 	}
 
+	pkg_extract_end(extract_session);
+
 	err = check_data_file_clashes_change(pkg, old_pkg);
 	if (err) {
 		opkg_msg(ERROR, "check_data_file_clashes_change() failed for "
@@ -1566,14 +2209,19 @@ int opkg_install_pkg(pkg_t * pkg, int from_upgrade)
 	opkg_msg(INFO, "Resolving conf files for %s\n", pkg->name);
 	resolve_conffiles(pkg);
 
-	pkg->state_status = SS_UNPACKED;
+	pkg_set_state_status(pkg, SS_UNPACKED);
 	old_state_flag = pkg->state_flag;
 	pkg->state_flag &= ~SF_PREFER;
 	opkg_msg(DEBUG, "pkg=%s old_state_flag=%x state_flag=%x\n",
 		 pkg->name, old_state_flag, pkg->state_flag);
 
-	if (old_pkg)
-		old_pkg->state_status = SS_NOT_INSTALLED;
+	if (old_pkg) {
+		pkg_set_state_status(old_pkg, SS_NOT_INSTALLED);
+
+		/* the replaced version may have satisfied dependencies
+		 * the new one does not */
+		pkg_depends_state_flush();
+	}
 
 	now = time(NULL);
 	pkg_set_int(pkg, PKG_INSTALLED_TIME, now);
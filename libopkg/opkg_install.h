@@ -22,6 +22,7 @@
 #include "opkg_conf.h"
 
 int opkg_install_by_name(const char *pkg_name);
+int opkg_install_multiple_by_name(int num_pkgs, char **pkg_names);
 int opkg_install_pkg(pkg_t * pkg, int from_upgrading);
 
 #endif
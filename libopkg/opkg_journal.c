@@ -0,0 +1,118 @@
+/* opkg_journal.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "opkg_journal.h"
+#include "opkg_conf.h"
+#include "opkg_message.h"
+#include "opkg_defines.h"
+#include "file_util.h"
+#include "sprintf_alloc.h"
+#include "libbb/libbb.h"
+
+/* One path per line; the backup lives at the recorded path plus
+   OPKG_BACKUP_SUFFIX, so nothing else needs to be stored. */
+
+static __thread FILE *journal_fp;
+
+static char *journal_filename_alloc(void)
+{
+	char *filename;
+
+	sprintf_alloc(&filename, "%s/journal", conf->default_dest->opkg_dir);
+
+	return filename;
+}
+
+int opkg_journal_record(const char *file_name)
+{
+	if (journal_fp == NULL) {
+		char *filename = journal_filename_alloc();
+
+		journal_fp = fopen(filename, "a");
+		if (journal_fp == NULL)
+			opkg_perror(ERROR, "Failed to open journal %s",
+				    filename);
+		free(filename);
+
+		if (journal_fp == NULL)
+			return -1;
+	}
+
+	/* the record must be durable before the backup it covers
+	   starts to matter */
+	fprintf(journal_fp, "%s\n", file_name);
+	fflush(journal_fp);
+	fsync(fileno(journal_fp));
+
+	return 0;
+}
+
+void opkg_journal_commit(void)
+{
+	char *filename;
+
+	if (journal_fp) {
+		fclose(journal_fp);
+		journal_fp = NULL;
+	}
+
+	filename = journal_filename_alloc();
+	unlink(filename);
+	free(filename);
+}
+
+void opkg_journal_recover(void)
+{
+	char *filename = journal_filename_alloc();
+	char *line, *backup;
+	FILE *fp;
+
+	fp = fopen(filename, "r");
+	if (fp == NULL) {
+		free(filename);
+		return;
+	}
+
+	if (conf->noaction) {
+		opkg_msg(NOTICE, "Journal of an interrupted transaction "
+			 "found at %s, not recovering (noaction).\n", filename);
+		fclose(fp);
+		free(filename);
+		return;
+	}
+
+	opkg_msg(NOTICE, "Recovering from an interrupted transaction.\n");
+
+	while ((line = file_read_line_alloc(fp)) != NULL) {
+		sprintf_alloc(&backup, "%s%s", line, OPKG_BACKUP_SUFFIX);
+
+		/* a missing backup just means that file made it all the
+		   way through resolve_conffiles() before the crash */
+		if (file_exists(backup)) {
+			opkg_msg(NOTICE, "Restoring %s.\n", line);
+			if (rename(backup, line) == -1)
+				opkg_perror(ERROR, "Failed to restore %s",
+					    line);
+		}
+
+		free(backup);
+		free(line);
+	}
+
+	fclose(fp);
+	unlink(filename);
+	free(filename);
+}
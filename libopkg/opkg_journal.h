@@ -0,0 +1,32 @@
+/* opkg_journal.h - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef OPKG_JOURNAL_H
+#define OPKG_JOURNAL_H
+
+/* Write-ahead journal for the per-transaction conffile backups. Every
+   file that gets a backup is recorded before the backup is created;
+   if opkg dies mid-transaction, the next invocation finds the journal
+   and puts the surviving backups back in place, so an interrupted
+   install recovers without leaving half-written conffiles behind. */
+
+/* Note intent to back file_name up, before the backup exists. */
+int opkg_journal_record(const char *file_name);
+
+/* The transaction committed; its rollback state is obsolete. */
+void opkg_journal_commit(void);
+
+/* Replay and remove a journal left by an interrupted transaction. */
+void opkg_journal_recover(void);
+
+#endif
@@ -25,7 +25,7 @@ struct errlist {
 	struct errlist *next;
 };
 
-static struct errlist *error_list_head, *error_list_tail;
+static __thread struct errlist *error_list_head, *error_list_tail;
 
 static void push_error_list(char *msg)
 {
@@ -0,0 +1,150 @@
+/* opkg_profile.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include <stdio.h>
+#include <time.h>
+
+#include "opkg_conf.h"
+#include "opkg_profile.h"
+
+static const char *phase_names[PROFILE_PHASE_COUNT] = {
+	"conf-load",
+	"feed-load",
+	"status-load",
+	"depends-build",
+	"resolve",
+	"download",
+	"extract",
+	"scripts",
+	"status-write",
+};
+
+struct phase_stat {
+	long long ns;
+	long long begin_ns;
+	unsigned int count;
+	unsigned int depth;	/* re-entered phases bill the outer span */
+};
+
+static __thread struct phase_stat stats[PROFILE_PHASE_COUNT];
+static __thread long long first_ns;
+
+static const char *counter_names[OPKG_COUNTER_COUNT] = {
+	"download-bytes",
+	"files-extracted",
+	"hash-probes",
+	"stanzas-parsed",
+};
+
+/* shared across every thread and context; relaxed ordering is plenty
+ * for statistics nobody reads until the work is done */
+static unsigned long long counters[OPKG_COUNTER_COUNT];
+
+void opkg_count_add(enum opkg_counter c, unsigned long long n)
+{
+	__atomic_fetch_add(&counters[c], n, __ATOMIC_RELAXED);
+}
+
+unsigned long long opkg_count_get(enum opkg_counter c)
+{
+	return __atomic_load_n(&counters[c], __ATOMIC_RELAXED);
+}
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void opkg_profile_begin(enum profile_phase phase)
+{
+	if (!conf->profile)
+		return;
+
+	if (stats[phase].depth++)
+		return;
+
+	stats[phase].begin_ns = now_ns();
+	if (!first_ns)
+		first_ns = stats[phase].begin_ns;
+}
+
+void opkg_profile_end(enum profile_phase phase)
+{
+	if (!conf->profile)
+		return;
+
+	if (--stats[phase].depth)
+		return;
+
+	stats[phase].ns += now_ns() - stats[phase].begin_ns;
+	stats[phase].count++;
+}
+
+/*
+ * The summary goes to stderr so it never mixes with command output.
+ * --profile=json emits one object on a single line for telemetry
+ * collectors; the plain variant prints an aligned table. Phases can
+ * nest (depends-build runs inside the loads), so the phases do not
+ * sum to "elapsed", which is wall time since the first phase began.
+ */
+void opkg_profile_print(void)
+{
+	long long elapsed_ns;
+	int i, first = 1;
+
+	if (!conf->profile)
+		return;
+
+	elapsed_ns = first_ns ? now_ns() - first_ns : 0;
+
+	if (conf->profile == 2) {
+		fprintf(stderr, "{");
+		for (i = 0; i < PROFILE_PHASE_COUNT; i++) {
+			if (!stats[i].count)
+				continue;
+			fprintf(stderr, "%s\"%s\":{\"calls\":%u,\"us\":%lld}",
+				first ? "" : ",", phase_names[i],
+				stats[i].count, stats[i].ns / 1000);
+			first = 0;
+		}
+		fprintf(stderr, "%s\"elapsed_us\":%lld,\"counters\":{",
+			first ? "" : ",", elapsed_ns / 1000);
+		for (i = 0; i < OPKG_COUNTER_COUNT; i++)
+			fprintf(stderr, "%s\"%s\":%llu", i ? "," : "",
+				counter_names[i], opkg_count_get(i));
+		fprintf(stderr, "}}\n");
+		return;
+	}
+
+	fprintf(stderr, "%-14s %6s %12s\n", "Phase", "Calls", "Time");
+	for (i = 0; i < PROFILE_PHASE_COUNT; i++) {
+		if (!stats[i].count)
+			continue;
+		fprintf(stderr, "%-14s %6u %9lld.%03lldms\n", phase_names[i],
+			stats[i].count, stats[i].ns / 1000000,
+			(stats[i].ns / 1000) % 1000);
+	}
+	fprintf(stderr, "%-14s %6s %9lld.%03lldms\n", "elapsed", "",
+		elapsed_ns / 1000000, (elapsed_ns / 1000) % 1000);
+
+	for (i = 0; i < OPKG_COUNTER_COUNT; i++) {
+		unsigned long long v = opkg_count_get(i);
+
+		if (!v)
+			continue;
+		fprintf(stderr, "%-15s %19llu\n", counter_names[i], v);
+	}
+}
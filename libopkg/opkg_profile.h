@@ -0,0 +1,58 @@
+/* opkg_profile.h - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef OPKG_PROFILE_H
+#define OPKG_PROFILE_H
+
+/*
+ * Phase timing instrumentation, enabled with --profile. Each phase
+ * accumulates wall time from the monotonic clock across however many
+ * times it runs; the summary is printed to stderr when the command
+ * finishes. All calls are no-ops unless profiling is on.
+ */
+
+enum profile_phase {
+	PROFILE_CONF_LOAD,
+	PROFILE_FEED_LOAD,
+	PROFILE_STATUS_LOAD,
+	PROFILE_DEPENDS_BUILD,
+	PROFILE_RESOLVE,
+	PROFILE_DOWNLOAD,
+	PROFILE_EXTRACT,
+	PROFILE_SCRIPTS,
+	PROFILE_STATUS_WRITE,
+	PROFILE_PHASE_COUNT
+};
+
+void opkg_profile_begin(enum profile_phase phase);
+void opkg_profile_end(enum profile_phase phase);
+void opkg_profile_print(void);
+
+/*
+ * Telemetry counters on hot paths. Unlike the phase timers these are
+ * shared across threads and always on: a relaxed atomic add is cheap
+ * enough to keep enabled in production builds. `opkg stats` prints
+ * them, and --profile appends them to the timing summary.
+ */
+enum opkg_counter {
+	OPKG_COUNT_DOWNLOAD_BYTES,
+	OPKG_COUNT_FILES_EXTRACTED,
+	OPKG_COUNT_HASH_PROBES,
+	OPKG_COUNT_STANZAS_PARSED,
+	OPKG_COUNTER_COUNT
+};
+
+void opkg_count_add(enum opkg_counter c, unsigned long long n);
+unsigned long long opkg_count_get(enum opkg_counter c);
+
+#endif
@@ -16,11 +16,15 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <glob.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 #include "opkg_message.h"
 #include "opkg_remove.h"
+#include "pkg_order.h"
 #include "opkg_cmd.h"
 #include "pkg_alternatives.h"
 #include "file_util.h"
@@ -34,17 +38,18 @@
 int pkg_has_installed_dependents(pkg_t * pkg, abstract_pkg_t *** pdependents)
 {
 	abstract_pkg_t **provider, **provides = pkg_get_ptr(pkg, PKG_PROVIDES);
-	unsigned int i, n_installed_dependents = 0;
+	unsigned int i, d, n_installed_dependents = 0;
 
 	provider = provides;
 
 	while (provider && *provider) {
 		abstract_pkg_t *providee = *provider++;
-		abstract_pkg_t **dependers = providee->depended_upon_by;
+		abstract_pkg_vec_t *dependers = providee->depended_upon_by;
 		abstract_pkg_t *dep_ab_pkg;
 		if (dependers == NULL)
 			continue;
-		while ((dep_ab_pkg = *dependers++) != NULL) {
+		for (d = 0; d < dependers->len; d++) {
+			dep_ab_pkg = dependers->pkgs[d];
 			if (dep_ab_pkg->state_status == SS_INSTALLED) {
 				n_installed_dependents++;
 			}
@@ -63,11 +68,12 @@ int pkg_has_installed_dependents(pkg_t * pkg, abstract_pkg_t *** pdependents)
 
 		while (provider && *provider) {
 			abstract_pkg_t *providee = *provider++;
-			abstract_pkg_t **dependers = providee->depended_upon_by;
+			abstract_pkg_vec_t *dependers = providee->depended_upon_by;
 			abstract_pkg_t *dep_ab_pkg;
 			if (dependers == NULL)
 				continue;
-			while ((dep_ab_pkg = *dependers++) != NULL) {
+			for (d = 0; d < dependers->len; d++) {
+				dep_ab_pkg = dependers->pkgs[d];
 				if (dep_ab_pkg->state_status == SS_INSTALLED
 				    && !(dep_ab_pkg->state_flag & SF_MARKED)) {
 					dependents[p++] = dep_ab_pkg;
@@ -90,7 +96,7 @@ static int opkg_remove_dependent_pkgs(pkg_t * pkg, abstract_pkg_t ** dependents)
 	int i;
 	int a;
 	int count;
-	pkg_vec_t *dependent_pkgs;
+	pkg_vec_t *dependent_pkgs, *ordered_pkgs;
 	abstract_pkg_t *ab_pkg;
 
 	if ((ab_pkg = pkg->parent) == NULL) {
@@ -138,13 +144,19 @@ static int opkg_remove_dependent_pkgs(pkg_t * pkg, abstract_pkg_t ** dependents)
 		return 0;
 	}
 
+	/* remove dependents before the packages they depend on, so prerm
+	 * scripts always run against a complete set of dependencies */
+	ordered_pkgs = pkg_vec_alloc();
+	pkg_vec_order_by_depends(dependent_pkgs, ordered_pkgs);
+
 	int err = 0;
-	for (i = 0; i < dependent_pkgs->len; i++) {
-		err = opkg_remove_pkg(dependent_pkgs->pkgs[i], 0);
+	for (i = ordered_pkgs->len - 1; i >= 0; i--) {
+		err = opkg_remove_pkg(ordered_pkgs->pkgs[i], 0);
 		if (err) {
 			break;
 		}
 	}
+	pkg_vec_free(ordered_pkgs);
 	pkg_vec_free(dependent_pkgs);
 	return err;
 }
@@ -289,6 +301,7 @@ int opkg_remove_pkg(pkg_t * pkg, int from_upgrade)
 
 	pkg->state_want = SW_DEINSTALL;
 	opkg_state_changed++;
+	opkg_status_mark_dirty(pkg);
 
 	if (pkg_run_script(pkg, "prerm", "remove") != 0) {
 		if (!conf->force_remove) {
@@ -312,7 +325,10 @@ int opkg_remove_pkg(pkg_t * pkg, int from_upgrade)
 	err = pkg_run_script(pkg, "postrm", "remove");
 
 	remove_maintainer_scripts(pkg);
-	pkg->state_status = SS_NOT_INSTALLED;
+	pkg_set_state_status(pkg, SS_NOT_INSTALLED);
+
+	/* removal can unsatisfy dependencies proven satisfied earlier */
+	pkg_depends_state_flush();
 	pkg_alternatives_update(pkg);
 
 	if (parent_pkg)
@@ -327,16 +343,29 @@ int opkg_remove_pkg(pkg_t * pkg, int from_upgrade)
 	return err;
 }
 
+static int path_cmp(const void *a, const void *b)
+{
+	return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+static int path_cmp_desc(const void *a, const void *b)
+{
+	return path_cmp(b, a);
+}
+
 void remove_data_files_and_list(pkg_t * pkg)
 {
-	str_list_t installed_dirs;
-	str_list_t *installed_files;
-	str_list_elt_t *iter;
+	str_vec_t *installed_files;
+	char **files, **dirs;
+	unsigned int n_files = 0, n_dirs = 0;
+	unsigned int f;
 	char *file_name;
+	const char *held_dir = NULL;
+	size_t held_len = 0;
 	conffile_t *conffile;
-	int removed_a_dir;
 	pkg_t *owner;
 	int rootdirlen = 0;
+	int dfd = -1;
 
 	installed_files = pkg_get_installed_files(pkg);
 	if (installed_files == NULL) {
@@ -345,15 +374,17 @@ void remove_data_files_and_list(pkg_t * pkg)
 		return;
 	}
 
-	str_list_init(&installed_dirs);
+	files = xcalloc(installed_files->len ? installed_files->len : 1,
+			sizeof(files[0]));
+	dirs = xcalloc(installed_files->len ? installed_files->len : 1,
+		       sizeof(dirs[0]));
 
 	/* don't include trailing slash */
 	if (conf->offline_root)
 		rootdirlen = strlen(conf->offline_root);
 
-	for (iter = str_list_first(installed_files); iter;
-	     iter = str_list_next(installed_files, iter)) {
-		file_name = (char *)iter->data;
+	for (f = 0; f < installed_files->len; f++) {
+		file_name = installed_files->strs[f];
 
 		owner = file_hash_get_file_owner(file_name);
 		if (owner != pkg)
@@ -361,7 +392,7 @@ void remove_data_files_and_list(pkg_t * pkg)
 			continue;
 
 		if (file_is_dir(file_name)) {
-			str_list_append(&installed_dirs, file_name);
+			dirs[n_dirs++] = file_name;
 			continue;
 		}
 
@@ -375,57 +406,72 @@ void remove_data_files_and_list(pkg_t * pkg)
 			}
 		}
 
-		if (!conf->noaction) {
-			opkg_msg(INFO, "Deleting %s.\n", file_name);
-			unlink(file_name);
-		} else
+		if (!conf->noaction)
+			files[n_files++] = file_name;
+		else
 			opkg_msg(INFO, "Not deleting %s. (noaction)\n",
 				 file_name);
 
 		file_hash_remove(file_name);
 	}
 
-	/* Remove empty directories */
-	if (!conf->noaction) {
-		do {
-			removed_a_dir = 0;
-			for (iter = str_list_first(&installed_dirs); iter;
-			     iter = str_list_next(&installed_dirs, iter)) {
-				file_name = (char *)iter->data;
-
-				if (rmdir(file_name) == 0) {
-					opkg_msg(INFO, "Deleting %s.\n",
-						 file_name);
-					removed_a_dir = 1;
-					str_list_remove(&installed_dirs, &iter);
-				}
-			}
-		} while (removed_a_dir);
-	}
+	/* sorted paths put siblings next to each other, so one held
+	 * dirfd serves a whole directory's worth of unlinkat() calls
+	 * instead of a full path walk per file */
+	qsort(files, n_files, sizeof(files[0]), path_cmp);
 
-	pkg_free_installed_files(pkg);
-	pkg_remove_installed_files_list(pkg);
+	for (f = 0; f < n_files; f++) {
+		char *base = strrchr(files[f], '/');
+		size_t dlen;
 
-	/* Don't print warning for dirs that are provided by other packages */
-	for (iter = str_list_first(&installed_dirs); iter;
-	     iter = str_list_next(&installed_dirs, iter)) {
-		file_name = (char *)iter->data;
+		opkg_msg(INFO, "Deleting %s.\n", files[f]);
 
-		owner = file_hash_get_file_owner(file_name);
-		if (owner) {
-			free(iter->data);
-			iter->data = NULL;
-			str_list_remove(&installed_dirs, &iter);
+		if (base == NULL || base == files[f]) {
+			unlink(files[f]);
+			continue;
 		}
+
+		dlen = base - files[f];
+		base++;
+
+		if (dfd < 0 || dlen != held_len
+		    || strncmp(files[f], held_dir, dlen)) {
+			char saved = files[f][dlen];
+
+			if (dfd >= 0)
+				close(dfd);
+			files[f][dlen] = '\0';
+			dfd = open(files[f], O_RDONLY | O_DIRECTORY);
+			files[f][dlen] = saved;
+			held_dir = files[f];
+			held_len = dlen;
+		}
+
+		if (dfd >= 0)
+			unlinkat(dfd, base, 0);
+		else
+			unlink(files[f]);
 	}
 
-	/* cleanup */
-	while (!void_list_empty(&installed_dirs)) {
-		iter = str_list_pop(&installed_dirs);
-		free(iter->data);
-		free(iter);
+	if (dfd >= 0)
+		close(dfd);
+
+	/* children sort after their parent, so one descending walk
+	 * prunes emptied directories bottom-up; dirs that are still
+	 * populated (or provided by other packages) just stay */
+	if (!conf->noaction) {
+		qsort(dirs, n_dirs, sizeof(dirs[0]), path_cmp_desc);
+
+		for (f = 0; f < n_dirs; f++)
+			if (rmdir(dirs[f]) == 0)
+				opkg_msg(INFO, "Deleting %s.\n", dirs[f]);
 	}
-	str_list_deinit(&installed_dirs);
+
+	free(files);
+	free(dirs);
+
+	pkg_free_installed_files(pkg);
+	pkg_remove_installed_files_list(pkg);
 }
 
 void remove_maintainer_scripts(pkg_t * pkg)
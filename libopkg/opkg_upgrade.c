@@ -101,6 +101,46 @@ pkg_hash_check_installed_pkg_helper(const char *pkg_name, void *entry,
 	}
 }
 
+/*
+ * Cheap upgradability screen. Returns 0 when the package can be ruled
+ * out without the full candidate resolution: no feed entry of the same
+ * name is newer, nothing replaces it and no other provider is in play.
+ * The resolver keeps the final say for the few that pass, so holds,
+ * arch priorities and replacements behave exactly as before.
+ */
+static int pkg_may_be_upgradable(pkg_t * old)
+{
+	abstract_pkg_t *ab = old->parent;
+	pkg_vec_t *vec;
+	int i;
+
+	if (!ab)
+		return 1;
+
+	if (ab->replaced_by && ab->replaced_by->len)
+		return 1;
+
+	if (ab->provided_by && ab->provided_by->len > 1)
+		return 1;
+
+	vec = ab->pkgs;
+	if (!vec)
+		return 0;
+
+	for (i = 0; i < vec->len; i++) {
+		pkg_t *candidate = vec->pkgs[i];
+
+		if (candidate == old)
+			continue;
+		if (pkg_get_arch_priority(candidate) <= 0)
+			continue;
+		if (pkg_compare_versions(old, candidate) < 0)
+			return 1;
+	}
+
+	return 0;
+}
+
 struct active_list *prepare_upgrade_list(void)
 {
 	struct active_list *head = active_list_head_new();
@@ -118,6 +158,13 @@ struct active_list *prepare_upgrade_list(void)
 		int cmp;
 
 		old = node->pkg;
+
+		/* one version-compare pass over the same-name bucket
+		 * rules out the common fully-up-to-date case without
+		 * resolving providers for every installed package */
+		if (!pkg_may_be_upgradable(old))
+			continue;
+
 		new =
 		    pkg_hash_fetch_best_installation_candidate_by_name(old->
 								       name);
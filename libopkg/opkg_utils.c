@@ -16,6 +16,8 @@
 */
 
 #include <ctype.h>
+#include <fnmatch.h>
+#include <string.h>
 #include <sys/statvfs.h>
 
 #include "libbb/libbb.h"
@@ -72,3 +74,86 @@ int line_is_blank(const char *line)
 	}
 	return 1;
 }
+
+void glob_query_compile(struct glob_query *q, const char *pattern, int flags)
+{
+	const char *p = pattern, *run, *best_run = NULL;
+	size_t len, best_len = 0;
+	int meta = 0;
+
+	q->pattern = pattern;
+	q->literal = NULL;
+	q->exact = 0;
+	q->flags = flags;
+
+	/* with case folding (or any other flag) in play the shortcuts
+	 * below don't hold; leave everything to fnmatch */
+	if (flags)
+		return;
+
+	while (*p) {
+		if (*p == '\\') {
+			/* the escaped character is literal, but keeping
+			 * it out of the run is still correct */
+			meta = 1;
+			p++;
+			if (*p)
+				p++;
+			continue;
+		}
+		if (*p == '*' || *p == '?') {
+			meta = 1;
+			p++;
+			continue;
+		}
+		if (*p == '[') {
+			const char *close = strchr(p + 1, ']');
+
+			/* a ']' right after the bracket is a member */
+			if (close == p + 1)
+				close = strchr(p + 2, ']');
+			meta = 1;
+			if (!close)
+				break;
+			p = close + 1;
+			continue;
+		}
+
+		run = p;
+		while (*p && *p != '*' && *p != '?' && *p != '['
+		       && *p != '\\')
+			p++;
+		len = p - run;
+		if (len > best_len) {
+			best_len = len;
+			best_run = run;
+		}
+	}
+
+	if (!meta) {
+		q->exact = 1;
+		return;
+	}
+
+	if (best_len)
+		q->literal = xstrndup(best_run, best_len);
+}
+
+int glob_query_match(struct glob_query *q, const char *str)
+{
+	if (q->exact)
+		return strcmp(q->pattern, str) == 0;
+
+	/* every match must contain the literal run; a substring scan
+	 * rejects most candidates far cheaper than fnmatch */
+	if (q->literal && !strstr(str, q->literal))
+		return 0;
+
+	return fnmatch(q->pattern, str, q->flags) == 0;
+}
+
+void glob_query_free(struct glob_query *q)
+{
+	free(q->literal);
+	q->literal = NULL;
+}
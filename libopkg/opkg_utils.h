@@ -22,4 +22,21 @@ unsigned long get_available_kbytes(char *filesystem);
 char *trim_xstrdup(const char *line);
 int line_is_blank(const char *line);
 
+/*
+ * Compiled glob query. The pattern is analyzed once: a pattern without
+ * metacharacters is matched by plain comparison, and otherwise its
+ * longest literal run is remembered so candidates can be rejected with
+ * a substring scan before paying for a full fnmatch.
+ */
+struct glob_query {
+	const char *pattern;
+	char *literal;
+	int exact;
+	int flags;
+};
+
+void glob_query_compile(struct glob_query *q, const char *pattern, int flags);
+int glob_query_match(struct glob_query *q, const char *str);
+void glob_query_free(struct glob_query *q);
+
 #endif
@@ -31,6 +31,18 @@ int is_field(const char *type, const char *line)
 	return 0;
 }
 
+/*
+ * Exact field-name match against a line whose name length (offset of
+ * the colon) has already been determined, so mismatched candidates are
+ * rejected on length alone.
+ */
+int is_fieldn(const char *type, const char *line, size_t name_len)
+{
+	size_t type_len = strlen(type);
+
+	return type_len == name_len && memcmp(line, type, type_len) == 0;
+}
+
 char *parse_simple(const char *type, const char *line)
 {
 	char *field = trim_xstrdup(line + strlen(type) + 1);
@@ -41,6 +53,32 @@ char *parse_simple(const char *type, const char *line)
 	return field;
 }
 
+/* as parse_simple(), but a trimmed view into the line itself; len is 0
+ * when the field value is empty */
+struct str_slice parse_slice(const char *type, const char *line)
+{
+	struct str_slice sl;
+	const char *s = line + strlen(type) + 1;
+	const char *e;
+
+	while (isspace(*s))
+		s++;
+
+	e = s + strlen(s);
+	while (e > s && isspace(e[-1]))
+		e--;
+
+	sl.p = s;
+	sl.len = e - s;
+
+	return sl;
+}
+
+int slice_eq(const struct str_slice *sl, const char *str)
+{
+	return strlen(str) == sl->len && memcmp(sl->p, str, sl->len) == 0;
+}
+
 /*
  * Parse a comma separated string into an array.
  */
@@ -18,8 +18,22 @@
 #ifndef PARSE_UTIL_H
 #define PARSE_UTIL_H
 
+/*
+ * Trimmed (pointer, length) view into the line being parsed. Field
+ * parsers pass these around instead of strdup'ing a temporary that is
+ * consumed and freed straight away; an allocation happens only when a
+ * value is actually retained in the pkg_t.
+ */
+struct str_slice {
+	const char *p;
+	size_t len;
+};
+
 int is_field(const char *type, const char *line);
+int is_fieldn(const char *type, const char *line, size_t name_len);
 char *parse_simple(const char *type, const char *line);
+struct str_slice parse_slice(const char *type, const char *line);
+int slice_eq(const struct str_slice *sl, const char *str);
 char **parse_list(const char *raw, unsigned int *count, const char sep,
 		  int skip_field);
 
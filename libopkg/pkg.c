@@ -22,7 +22,9 @@
 #include <libgen.h>
 
 #include "pkg.h"
+#include "arena.h"
 
+#include "pkg_hash.h"
 #include "pkg_parse.h"
 #include "pkg_extract.h"
 #include "opkg_message.h"
@@ -33,6 +35,8 @@
 #include "file_util.h"
 #include "xsystem.h"
 #include "opkg_conf.h"
+#include "opkg_profile.h"
+#include "filelist_index.h"
 
 typedef struct enum_map enum_map_t;
 struct enum_map {
@@ -85,7 +89,10 @@ static void pkg_init(pkg_t * pkg)
 
 	pkg->arch_index = 0;
 
-	blob_buf_init(&pkg->blob, 0);
+	pkg->field_present = 0;
+	pkg->field_used = 0;
+	pkg->field_cap = 0;
+	pkg->field_data = NULL;
 }
 
 pkg_t *pkg_new(void)
@@ -98,49 +105,132 @@ pkg_t *pkg_new(void)
 	return pkg;
 }
 
+pkg_t *pkg_new_arena(struct arena *arena)
+{
+	pkg_t *pkg;
+
+	pkg = arena_calloc(arena, sizeof(pkg_t));
+	pkg_init(pkg);
+	pkg->from_arena = 1;
+
+	return pkg;
+}
+
+void pkg_free(pkg_t * pkg)
+{
+	pkg_deinit(pkg);
+
+	if (!pkg->from_arena)
+		free(pkg);
+}
+
+/* each packed value is preceded by its length and padded to an 8-byte
+ * boundary, so pointers stored with pkg_set_ptr() can be dereferenced
+ * in place */
+#define PKG_FIELD_HDR		8
+#define PKG_FIELD_ALIGN(n)	(((n) + 7) & ~(uint32_t)7)
+
+static char *pkg_field_entry(const pkg_t *pkg, int id)
+{
+	uint32_t bit = 1U << id;
+
+	if (!(pkg->field_present & bit))
+		return NULL;
+
+	return pkg->field_data
+	    + pkg->field_off[__builtin_popcount(pkg->field_present
+						& (bit - 1))];
+}
+
 void *pkg_set_raw(pkg_t *pkg, int id, const void *val, size_t len)
 {
-	int rem;
-	struct blob_attr *cur;
-
-	blob_for_each_attr(cur, pkg->blob.head, rem) {
-		if (blob_id(cur) == id) {
-			if (blob_len(cur) < len) {
-				fprintf(stderr, "ERROR: truncating field %d <%p> to %d byte",
-				        id, val, blob_len(cur));
-			}
-			memcpy(blob_data(cur), val, blob_len(cur));
-			return blob_data(cur);
+	uint32_t need;
+	char *entry;
+	int idx, n;
+
+	entry = pkg_field_entry(pkg, id);
+	if (entry) {
+		uint32_t cur_len = *(uint32_t *) entry;
+
+		if (cur_len < len) {
+			fprintf(stderr, "ERROR: truncating field %d <%p> to %d byte",
+			        id, val, (int)cur_len);
+			len = cur_len;
 		}
+		memcpy(entry + PKG_FIELD_HDR, val, len);
+		return entry + PKG_FIELD_HDR;
 	}
 
-	cur = blob_put(&pkg->blob, id, val, len);
-	return cur ? blob_data(cur) : NULL;
+	need = PKG_FIELD_ALIGN(PKG_FIELD_HDR + len);
+	if (pkg->field_used + need > pkg->field_cap) {
+		uint32_t cap = pkg->field_cap ? pkg->field_cap : 128;
+
+		while (pkg->field_used + need > cap)
+			cap *= 2;
+		pkg->field_data = xrealloc(pkg->field_data, cap);
+		pkg->field_cap = cap;
+	}
+
+	/* keep the offset table packed in field-id order */
+	idx = __builtin_popcount(pkg->field_present & ((1U << id) - 1));
+	n = __builtin_popcount(pkg->field_present);
+	memmove(&pkg->field_off[idx + 1], &pkg->field_off[idx],
+		(n - idx) * sizeof(pkg->field_off[0]));
+	pkg->field_off[idx] = pkg->field_used;
+	pkg->field_present |= 1U << id;
+
+	entry = pkg->field_data + pkg->field_used;
+	*(uint32_t *) entry = len;
+	memcpy(entry + PKG_FIELD_HDR, val, len);
+	pkg->field_used += need;
+
+	return entry + PKG_FIELD_HDR;
 }
 
 void *pkg_get_raw(const pkg_t * pkg, int id)
 {
-	int rem;
-	struct blob_attr *cur;
+	char *entry = pkg_field_entry(pkg, id);
 
-	blob_for_each_attr(cur, pkg->blob.head, rem)
-		if (blob_id(cur) == id)
-			return blob_data(cur);
+	return entry ? entry + PKG_FIELD_HDR : NULL;
+}
 
-	return NULL;
+/* Fields whose values are drawn from a small shared vocabulary
+ * (sections, priorities, maintainer strings, version components) are
+ * stored as interned atoms instead of per-pkg copies. */
+static int pkg_string_field_is_shared(int id)
+{
+	switch (id) {
+	case PKG_MAINTAINER:
+	case PKG_PRIORITY:
+	case PKG_SOURCE:
+	case PKG_SECTION:
+	case PKG_TAGS:
+	case PKG_VERSION:
+	case PKG_REVISION:
+		return 1;
+	}
+
+	return 0;
 }
 
 char *pkg_set_string(pkg_t *pkg, int id, const char *s)
 {
-	size_t len;
+	if (!s)
+		return NULL;
+
+	return pkg_set_string_len(pkg, id, s, strlen(s));
+}
+
+/* slice variant, so parsers can store a substring of the input line
+ * without cutting a NUL-terminated temporary first */
+char *pkg_set_string_len(pkg_t *pkg, int id, const char *s, size_t len)
+{
 	char *p;
 
 	if (!s)
 		return NULL;
 
-	len = strlen(s);
-
-	while (isspace(*s)) {
+	while (len > 0 && isspace(*s)) {
 		s++;
 		len--;
 	}
@@ -151,45 +241,43 @@ char *pkg_set_string(pkg_t *pkg, int id, const char *s)
 	if (!len)
 		return NULL;
 
+	if (pkg_string_field_is_shared(id)) {
+		p = (char *)hash_table_intern_key_len(&conf->str_hash, s, len);
+		pkg_set_ptr(pkg, id, p);
+		return p;
+	}
+
 	p = pkg_set_raw(pkg, id, s, len + 1);
 	p[len] = 0;
 
 	return p;
 }
 
-char *pkg_get_architecture(const pkg_t *pkg)
+char *pkg_get_string(const pkg_t *pkg, int id)
 {
-	nv_pair_list_elt_t *l;
-	int n = 1;
+	if (pkg_string_field_is_shared(id))
+		return pkg_get_ptr(pkg, id);
 
-	list_for_each_entry(l, &conf->arch_list.head, node) {
-		nv_pair_t *nv = (nv_pair_t *) l->data;
-		if (n++ == pkg->arch_index)
-			return nv->name;
-	}
+	return pkg_get_raw(pkg, id);
+}
 
-	return NULL;
+/* arch_index selects a slot of the flat table opkg_conf_load() built
+ * from arch_list; slot 0 holds NULL / priority 0 for unknown arches */
+char *pkg_get_architecture(const pkg_t *pkg)
+{
+	return conf->arch_names[pkg->arch_index];
 }
 
 char *pkg_set_architecture(pkg_t *pkg, const char *architecture, ssize_t len)
 {
-	nv_pair_list_elt_t *l;
-	int n = 1;
-
-	list_for_each_entry(l, &conf->arch_list.head, node) {
-		nv_pair_t *nv = (nv_pair_t *) l->data;
-
-		if (!strncmp(nv->name, architecture, len) && nv->name[len] == '\0') {
-			if (n >= 8) {
-				opkg_msg(ERROR, "Internal error: too many different architectures\n");
-				break;
-			}
+	int n;
 
+	for (n = 1; n <= conf->n_arches; n++) {
+		if (!strncmp(conf->arch_names[n], architecture, len)
+		    && conf->arch_names[n][len] == '\0') {
 			pkg->arch_index = n;
-			return nv->name;
+			return conf->arch_names[n];
 		}
-
-		n++;
 	}
 
 	pkg->arch_index = 0;
@@ -198,16 +286,7 @@ char *pkg_set_architecture(pkg_t *pkg, const char *architecture, ssize_t len)
 
 int pkg_get_arch_priority(const pkg_t *pkg)
 {
-	nv_pair_list_elt_t *l;
-	int n = 1;
-
-	list_for_each_entry(l, &conf->arch_list.head, node) {
-		nv_pair_t *nv = (nv_pair_t *) l->data;
-		if (n++ == pkg->arch_index)
-			return strtol(nv->value, NULL, 0);
-	}
-
-	return 0;
+	return conf->arch_priorities[pkg->arch_index];
 }
 
 char *pkg_get_md5(const pkg_t *pkg)
@@ -253,29 +332,17 @@ char *pkg_set_sha256(pkg_t *pkg, const char *cksum)
 }
 
 
-static void compound_depend_deinit(compound_depend_t * depends)
-{
-	int i;
-	for (i = 0; i < depends->possibility_count; i++) {
-		depend_t *d;
-		d = depends->possibilities[i];
-		free(d->version);
-		free(d);
-	}
-	free(depends->possibilities);
-}
-
 void pkg_deinit(pkg_t * pkg)
 {
-	int rem;
-	struct blob_attr *cur;
-	compound_depend_t *deps, *dep;
 	void *ptr;
 
-	if (pkg->name)
-		free(pkg->name);
+	/* interned in conf->str_hash, not owned by the pkg */
 	pkg->name = NULL;
 
+	free(pkg->version_cmpkey);
+	pkg->version_cmpkey = NULL;
+	pkg->version_cmpkey_len = 0;
+
 	/* owned by opkg_conf_t */
 	pkg->dest = NULL;
 	/* owned by opkg_conf_t */
@@ -285,57 +352,26 @@ void pkg_deinit(pkg_t * pkg)
 	pkg->state_flag = SF_OK;
 	pkg->state_status = SS_NOT_INSTALLED;
 
-	blob_for_each_attr(cur, pkg->blob.head, rem) {
-		switch (blob_id(cur)) {
-		case PKG_DEPENDS:
-		case PKG_CONFLICTS:
-			deps = pkg_get_ptr(pkg, blob_id(cur));
-
-			if (deps) {
-				for (dep = deps; dep->type; dep++)
-					compound_depend_deinit(dep);
+	/* PKG_DEPENDS/PKG_CONFLICTS graph nodes live in the depend
+	 * arena and are freed with the pkg hash */
 
-				free(deps);
-			}
-
-			pkg_set_ptr(pkg, blob_id(cur), NULL);
-			break;
+	free(pkg_get_ptr(pkg, PKG_REPLACES));
+	free(pkg_get_ptr(pkg, PKG_PROVIDES));
 
-		case PKG_REPLACES:
-		case PKG_PROVIDES:
-			ptr = pkg_get_ptr(pkg, blob_id(cur));
-
-			if (ptr)
-				free(ptr);
-
-			pkg_set_ptr(pkg, blob_id(cur), NULL);
-			break;
-
-		case PKG_CONFFILES:
-			ptr = pkg_get_ptr(pkg, blob_id(cur));
-
-			if (ptr) {
-				conffile_list_deinit(ptr);
-				free(ptr);
-			}
-
-			pkg_set_ptr(pkg, blob_id(cur), NULL);
-			break;
-		case PKG_ALTERNATIVES:
-			ptr = pkg_get_ptr(pkg, blob_id(cur));
-
-			if (ptr) {
-				struct pkg_alternatives *pkg_alts = ptr;
+	ptr = pkg_get_ptr(pkg, PKG_CONFFILES);
+	if (ptr) {
+		conffile_list_deinit(ptr);
+		free(ptr);
+	}
 
-				while (pkg_alts->nalts)
-					free(pkg_alts->alts[--pkg_alts->nalts]);
-				free(pkg_alts->alts);
-				free(pkg_alts);
-			}
+	ptr = pkg_get_ptr(pkg, PKG_ALTERNATIVES);
+	if (ptr) {
+		struct pkg_alternatives *pkg_alts = ptr;
 
-			pkg_set_ptr(pkg, blob_id(cur), NULL);
-			break;
-		}
+		while (pkg_alts->nalts)
+			free(pkg_alts->alts[--pkg_alts->nalts]);
+		free(pkg_alts->alts);
+		free(pkg_alts);
 	}
 
 	//conffile_list_deinit(&pkg->conffiles);
@@ -347,7 +383,11 @@ void pkg_deinit(pkg_t * pkg)
 	pkg_free_installed_files(pkg);
 	pkg->essential = 0;
 
-	blob_buf_free(&pkg->blob);
+	free(pkg->field_data);
+	pkg->field_data = NULL;
+	pkg->field_present = 0;
+	pkg->field_used = 0;
+	pkg->field_cap = 0;
 }
 
 int pkg_init_from_file(pkg_t * pkg, const char *filename)
@@ -461,6 +501,8 @@ int pkg_merge(pkg_t * oldpkg, pkg_t * newpkg)
 		pkg_set_ptr(newpkg, PKG_REPLACES, NULL);
 	}
 
+	int old_from_feed = pkg_get_string(oldpkg, PKG_FILENAME) != NULL;
+
 	if (!pkg_get_string(oldpkg, PKG_FILENAME))
 		pkg_set_string(oldpkg, PKG_FILENAME, pkg_get_string(newpkg, PKG_FILENAME));
 	if (!pkg_get_string(oldpkg, PKG_LOCAL_FILENAME))
@@ -469,7 +511,15 @@ int pkg_merge(pkg_t * oldpkg, pkg_t * newpkg)
 		pkg_set_string(oldpkg, PKG_TMP_UNPACK_DIR, pkg_get_string(newpkg, PKG_TMP_UNPACK_DIR));
 	if (!pkg_get_md5(oldpkg))
 		pkg_set_md5(oldpkg, pkg_get_md5(newpkg));
-	if (!pkg_get_sha256(oldpkg))
+	/* A status stanza may carry the SHA256sum recorded at install
+	 * time (it keys the delta base in the download cache), but only
+	 * a feed stanza - recognizable by its Filename - says what the
+	 * downloadable archive is supposed to hash to. Letting the
+	 * status copy shadow the feed's would reject a republished
+	 * archive of the same version on every future install. */
+	if (!pkg_get_sha256(oldpkg)
+	    || (!old_from_feed && pkg_get_string(newpkg, PKG_FILENAME)
+		&& pkg_get_sha256(newpkg)))
 		pkg_set_sha256(oldpkg, pkg_get_sha256(newpkg));
 	if (!pkg_get_int(oldpkg, PKG_SIZE))
 		pkg_set_int(oldpkg, PKG_SIZE, pkg_get_int(newpkg, PKG_SIZE));
@@ -518,6 +568,24 @@ abstract_pkg_t *abstract_pkg_new(void)
 	return ab_pkg;
 }
 
+/*
+ * Abstract packages are nodes of the dependency graph; carving them
+ * and their provided_by vectors out of the graph's arena keeps the
+ * structures the resolver chases through adjacent in memory instead
+ * of scattered across the heap in parse order.
+ */
+abstract_pkg_t *abstract_pkg_new_arena(struct arena *arena)
+{
+	abstract_pkg_t *ab_pkg;
+
+	ab_pkg = arena_calloc(arena, sizeof(abstract_pkg_t));
+	ab_pkg->provided_by = abstract_pkg_vec_alloc_arena(arena);
+	ab_pkg->state_status = SS_NOT_INSTALLED;
+	ab_pkg->from_arena = 1;
+
+	return ab_pkg;
+}
+
 static const char *pkg_state_want_to_str(pkg_state_want_t sw)
 {
 	int i;
@@ -607,7 +675,7 @@ pkg_state_flag_t pkg_state_flag_from_str(const char *str)
 	return sf;
 }
 
-static const char *pkg_state_status_to_str(pkg_state_status_t ss)
+const char *pkg_state_status_to_str(pkg_state_status_t ss)
 {
 	int i;
 
@@ -635,7 +703,19 @@ pkg_state_status_t pkg_state_status_from_str(const char *str)
 	return SS_NOT_INSTALLED;
 }
 
-void pkg_formatted_field(FILE * fp, pkg_t * pkg, const char *field)
+/*
+ * Runtime status transitions go through here so the materialized
+ * installed view in pkg_hash.c tracks membership changes as they
+ * happen. Packages not yet inserted into the hash (parsing, merge)
+ * may keep writing the field directly.
+ */
+void pkg_set_state_status(pkg_t * pkg, pkg_state_status_t status)
+{
+	pkg_hash_note_status_change(pkg, status);
+	pkg->state_status = status;
+}
+
+static void pkg_format_field(struct strbuf *sb, pkg_t * pkg, const char *field)
 {
 	int i, j;
 	char *str;
@@ -658,22 +738,22 @@ void pkg_formatted_field(FILE * fp, pkg_t * pkg, const char *field)
 				struct pkg_alternative *alt;
 
 				alt = pkg_alts->alts[0];
-				fprintf(fp, "Alternatives: %d:%s:%s", alt->prio, alt->path, alt->altpath);
+				strbuf_printf(sb, "Alternatives: %d:%s:%s", alt->prio, alt->path, alt->altpath);
 				for (i = 1; i < pkg_alts->nalts; i++) {
 					alt = pkg_alts->alts[i];
-					fprintf(fp, ", %d:%s:%s", alt->prio, alt->path, alt->altpath);
+					strbuf_printf(sb, ", %d:%s:%s", alt->prio, alt->path, alt->altpath);
 				}
-				fputs("\n", fp);
+				strbuf_printf(sb, "\n");
 			}
 		} else if (strcasecmp(field, "Architecture") == 0) {
 			p = pkg_get_architecture(pkg);
 			if (p) {
-				fprintf(fp, "Architecture: %s\n",
-					p);
+				strbuf_printf(sb, "Architecture: %s\n",
+					      p);
 			}
 		} else if (strcasecmp(field, "Auto-Installed") == 0) {
 			if (pkg->auto_installed)
-				fprintf(fp, "Auto-Installed: yes\n");
+				strbuf_printf(sb, "Auto-Installed: yes\n");
 		} else {
 			goto UNKNOWN_FMT_FIELD;
 		}
@@ -686,39 +766,44 @@ void pkg_formatted_field(FILE * fp, pkg_t * pkg, const char *field)
 
 			cl = pkg_get_ptr(pkg, PKG_CONFFILES);
 
-			if (!cl || nv_pair_list_empty(cl))
+			if (!cl || conffile_list_empty(cl))
 				return;
 
-			fprintf(fp, "Conffiles:\n");
-			for (iter = nv_pair_list_first(cl); iter;
-			     iter = nv_pair_list_next(cl, iter)) {
-				if (((conffile_t *) iter->data)->name
-				    && ((conffile_t *) iter->data)->value) {
-					fprintf(fp, " %s %s\n",
-						((conffile_t *) iter->data)->
-						name,
-						((conffile_t *) iter->data)->
-						value);
-				}
+			strbuf_printf(sb, "Conffiles:\n");
+			for (iter = conffile_list_first(cl); iter;
+			     iter = conffile_list_next(cl, iter)) {
+				conffile_t *cf = (conffile_t *) iter->data;
+
+				if (!cf->name || !cf->value)
+					continue;
+
+				/* persist the stat cache when primed */
+				if (cf->mtime && cf->size)
+					strbuf_printf(sb, " %s %s %lu %lu\n",
+						      cf->name, cf->value,
+						      cf->mtime, cf->size);
+				else
+					strbuf_printf(sb, " %s %s\n",
+						      cf->name, cf->value);
 			}
 		} else if (strcasecmp(field, "Conflicts") == 0) {
 			struct depend *cdep;
 			compound_depend_t *deps, *dep;
 			deps = pkg_get_ptr(pkg, PKG_CONFLICTS);
 			if (deps) {
-				fprintf(fp, "Conflicts:");
+				strbuf_printf(sb, "Conflicts:");
 				for (i = 0, dep = deps; dep->type; dep++, i++) {
 					cdep = dep->possibilities[0];
-					fprintf(fp, "%s %s", i == 0 ? "" : ",",
-						cdep->pkg->name);
+					strbuf_printf(sb, "%s %s", i == 0 ? "" : ",",
+						      cdep->pkg->name);
 					if (cdep->version) {
-						fprintf(fp, " (%s%s)",
-							constraint_to_str(cdep->
-									  constraint),
-							cdep->version);
+						strbuf_printf(sb, " (%s%s)",
+							      constraint_to_str(cdep->
+									        constraint),
+							      cdep->version);
 					}
 				}
-				fprintf(fp, "\n");
+				strbuf_printf(sb, "\n");
 			}
 		} else {
 			goto UNKNOWN_FMT_FIELD;
@@ -729,23 +814,23 @@ void pkg_formatted_field(FILE * fp, pkg_t * pkg, const char *field)
 		if (strcasecmp(field, "Depends") == 0) {
 			dep = pkg_get_depends(pkg, DEPEND);
 			if (dep) {
-				fprintf(fp, "Depends:");
+				strbuf_printf(sb, "Depends:");
 				for (i = 0, j = 0; dep && dep->type; i++, dep++) {
 					if (dep->type != DEPEND)
 						continue;
 					str = pkg_depend_str(pkg, i);
-					fprintf(fp, "%s %s", j == 0 ? "" : ",",
-						str);
+					strbuf_printf(sb, "%s %s", j == 0 ? "" : ",",
+						      str);
 					free(str);
 					j++;
 				}
-				fprintf(fp, "\n");
+				strbuf_printf(sb, "\n");
 			}
 		} else if (strcasecmp(field, "Description") == 0) {
 			p = pkg_get_string(pkg, PKG_DESCRIPTION);
 			if (p) {
-				fprintf(fp, "Description: %s\n",
-					p);
+				strbuf_printf(sb, "Description: %s\n",
+					      p);
 			}
 		} else {
 			goto UNKNOWN_FMT_FIELD;
@@ -754,26 +839,26 @@ void pkg_formatted_field(FILE * fp, pkg_t * pkg, const char *field)
 	case 'e':
 	case 'E':
 		if (pkg->essential) {
-			fprintf(fp, "Essential: yes\n");
+			strbuf_printf(sb, "Essential: yes\n");
 		}
 		break;
 	case 'f':
 	case 'F':
 		p = pkg_get_string(pkg, PKG_FILENAME);
 		if (p) {
-			fprintf(fp, "Filename: %s\n", p);
+			strbuf_printf(sb, "Filename: %s\n", p);
 		}
 		break;
 	case 'i':
 	case 'I':
 		if (strcasecmp(field, "Installed-Size") == 0) {
-			fprintf(fp, "Installed-Size: %lu\n",
-				(unsigned long) pkg_get_int(pkg, PKG_INSTALLED_SIZE));
+			strbuf_printf(sb, "Installed-Size: %lu\n",
+				      (unsigned long) pkg_get_int(pkg, PKG_INSTALLED_SIZE));
 		} else if (strcasecmp(field, "Installed-Time") == 0) {
 			i = pkg_get_int(pkg, PKG_INSTALLED_TIME);
 			if (i) {
-				fprintf(fp, "Installed-Time: %lu\n",
-					(unsigned long) i);
+				strbuf_printf(sb, "Installed-Time: %lu\n",
+					      (unsigned long) i);
 			}
 		}
 		break;
@@ -782,12 +867,12 @@ void pkg_formatted_field(FILE * fp, pkg_t * pkg, const char *field)
 		if (strcasecmp(field, "Maintainer") == 0) {
 			p = pkg_get_string(pkg, PKG_MAINTAINER);
 			if (p) {
-				fprintf(fp, "Maintainer: %s\n", p);
+				strbuf_printf(sb, "Maintainer: %s\n", p);
 			}
 		} else if (strcasecmp(field, "MD5sum") == 0) {
 			p = pkg_get_md5(pkg);
 			if (p) {
-				fprintf(fp, "MD5Sum: %s\n", p);
+				strbuf_printf(sb, "MD5Sum: %s\n", p);
 			}
 		} else {
 			goto UNKNOWN_FMT_FIELD;
@@ -796,18 +881,18 @@ void pkg_formatted_field(FILE * fp, pkg_t * pkg, const char *field)
 	case 'p':
 	case 'P':
 		if (strcasecmp(field, "Package") == 0) {
-			fprintf(fp, "Package: %s\n", pkg->name);
+			strbuf_printf(sb, "Package: %s\n", pkg->name);
 		} else if (strcasecmp(field, "Priority") == 0) {
-			fprintf(fp, "Priority: %s\n", pkg_get_string(pkg, PKG_PRIORITY));
+			strbuf_printf(sb, "Priority: %s\n", pkg_get_string(pkg, PKG_PRIORITY));
 		} else if (strcasecmp(field, "Provides") == 0) {
 			ab_pkg = pkg_get_ptr(pkg, PKG_PROVIDES);
 			if (ab_pkg && ab_pkg[0] && ab_pkg[1]) {
-				fprintf(fp, "Provides:");
+				strbuf_printf(sb, "Provides:");
 				for (i = 1; ab_pkg[i]; i++) {
-					fprintf(fp, "%s %s", i == 1 ? "" : ",",
-						ab_pkg[i]->name);
+					strbuf_printf(sb, "%s %s", i == 1 ? "" : ",",
+						      ab_pkg[i]->name);
 				}
-				fprintf(fp, "\n");
+				strbuf_printf(sb, "\n");
 			}
 		} else {
 			goto UNKNOWN_FMT_FIELD;
@@ -818,27 +903,27 @@ void pkg_formatted_field(FILE * fp, pkg_t * pkg, const char *field)
 		if (strcasecmp(field, "Replaces") == 0) {
 			ab_pkg = pkg_get_ptr(pkg, PKG_REPLACES);
 			if (ab_pkg && ab_pkg[0]) {
-				fprintf(fp, "Replaces:");
+				strbuf_printf(sb, "Replaces:");
 				for (i = 0; ab_pkg[i]; i++) {
-					fprintf(fp, "%s %s", i == 0 ? "" : ",",
-						ab_pkg[i]->name);
+					strbuf_printf(sb, "%s %s", i == 0 ? "" : ",",
+						      ab_pkg[i]->name);
 				}
-				fprintf(fp, "\n");
+				strbuf_printf(sb, "\n");
 			}
 		} else if (strcasecmp(field, "Recommends") == 0) {
 			dep = pkg_get_depends(pkg, RECOMMEND);
 			if (dep) {
-				fprintf(fp, "Recommends:");
+				strbuf_printf(sb, "Recommends:");
 				for (j = 0, i = 0; dep && dep->type; i++, dep++) {
 					if (dep->type != RECOMMEND)
 						continue;
 					str = pkg_depend_str(pkg, i);
-					fprintf(fp, "%s %s", j == 0 ? "" : ",",
-						str);
+					strbuf_printf(sb, "%s %s", j == 0 ? "" : ",",
+						      str);
 					free(str);
 					j++;
 				}
-				fprintf(fp, "\n");
+				strbuf_printf(sb, "\n");
 			}
 		} else {
 			goto UNKNOWN_FMT_FIELD;
@@ -849,44 +934,45 @@ void pkg_formatted_field(FILE * fp, pkg_t * pkg, const char *field)
 		if (strcasecmp(field, "Section") == 0) {
 			p = pkg_get_string(pkg, PKG_SECTION);
 			if (p) {
-				fprintf(fp, "Section: %s\n", p);
+				strbuf_printf(sb, "Section: %s\n", p);
 			}
 		} else if (strcasecmp(field, "SHA256sum") == 0) {
-			p = pkg_get_string(pkg, PKG_SHA256SUM);
+			/* stored as raw bytes; print the hex form */
+			p = pkg_get_sha256(pkg);
 			if (p) {
-				fprintf(fp, "SHA256sum: %s\n", p);
+				strbuf_printf(sb, "SHA256sum: %s\n", p);
 			}
 		} else if (strcasecmp(field, "Size") == 0) {
 			i = pkg_get_int(pkg, PKG_SIZE);
 			if (i) {
-				fprintf(fp, "Size: %lu\n", (unsigned long) i);
+				strbuf_printf(sb, "Size: %lu\n", (unsigned long) i);
 			}
 		} else if (strcasecmp(field, "Source") == 0) {
 			p = pkg_get_string(pkg, PKG_SOURCE);
 			if (p) {
-				fprintf(fp, "Source: %s\n", p);
+				strbuf_printf(sb, "Source: %s\n", p);
 			}
 		} else if (strcasecmp(field, "Status") == 0) {
 			char *pflag = pkg_state_flag_to_str(pkg->state_flag);
-			fprintf(fp, "Status: %s %s %s\n",
-				pkg_state_want_to_str(pkg->state_want),
-				pflag,
-				pkg_state_status_to_str(pkg->state_status));
+			strbuf_printf(sb, "Status: %s %s %s\n",
+				      pkg_state_want_to_str(pkg->state_want),
+				      pflag,
+				      pkg_state_status_to_str(pkg->state_status));
 			free(pflag);
 		} else if (strcasecmp(field, "Suggests") == 0) {
 			dep = pkg_get_depends(pkg, SUGGEST);
 			if (dep) {
-				fprintf(fp, "Suggests:");
+				strbuf_printf(sb, "Suggests:");
 				for (j = 0, i = 0; dep && dep->type; i++, dep++) {
 					if (dep->type != SUGGEST)
 						continue;
 					str = pkg_depend_str(pkg, i);
-					fprintf(fp, "%s %s", j == 0 ? "" : ",",
-						str);
+					strbuf_printf(sb, "%s %s", j == 0 ? "" : ",",
+						      str);
 					free(str);
 					j++;
 				}
-				fprintf(fp, "\n");
+				strbuf_printf(sb, "\n");
 			}
 		} else {
 			goto UNKNOWN_FMT_FIELD;
@@ -897,18 +983,19 @@ void pkg_formatted_field(FILE * fp, pkg_t * pkg, const char *field)
 		if (strcasecmp(field, "Tags") == 0) {
 			p = pkg_get_string(pkg, PKG_TAGS);
 			if (p) {
-				fprintf(fp, "Tags: %s\n", p);
+				strbuf_printf(sb, "Tags: %s\n", p);
 			}
 		}
 		break;
 	case 'v':
 	case 'V':
 		{
-			char *version = pkg_version_str_alloc(pkg);
+			char vbuf[PKG_VERSION_STR_MAX];
+			char *version = pkg_version_str_r(pkg, vbuf,
+							  sizeof(vbuf));
 			if (version == NULL)
 				return;
-			fprintf(fp, "Version: %s\n", version);
-			free(version);
+			strbuf_printf(sb, "Version: %s\n", version);
 		}
 		break;
 	default:
@@ -921,54 +1008,83 @@ UNKNOWN_FMT_FIELD:
 	opkg_msg(ERROR, "Internal error: field=%s\n", field);
 }
 
+void pkg_formatted_field(FILE * fp, pkg_t * pkg, const char *field)
+{
+	struct strbuf sb = { NULL, 0, 0 };
+
+	pkg_format_field(&sb, pkg, field);
+	if (sb.len)
+		fwrite(sb.buf, 1, sb.len, fp);
+	strbuf_free(&sb);
+}
+
+/* the stanza is assembled in memory and handed to stdio in one piece,
+   so writing many of them in a row issues large writes instead of one
+   small one per field */
 void pkg_formatted_info(FILE * fp, pkg_t * pkg)
 {
-	pkg_formatted_field(fp, pkg, "Package");
-	pkg_formatted_field(fp, pkg, "Version");
-	pkg_formatted_field(fp, pkg, "Depends");
-	pkg_formatted_field(fp, pkg, "Recommends");
-	pkg_formatted_field(fp, pkg, "Suggests");
-	pkg_formatted_field(fp, pkg, "Provides");
-	pkg_formatted_field(fp, pkg, "Replaces");
-	pkg_formatted_field(fp, pkg, "Conflicts");
-	pkg_formatted_field(fp, pkg, "Status");
-	pkg_formatted_field(fp, pkg, "Section");
-	pkg_formatted_field(fp, pkg, "Essential");
-	pkg_formatted_field(fp, pkg, "Architecture");
-	pkg_formatted_field(fp, pkg, "Maintainer");
-	pkg_formatted_field(fp, pkg, "MD5sum");
-	pkg_formatted_field(fp, pkg, "Size");
-	pkg_formatted_field(fp, pkg, "Filename");
-	pkg_formatted_field(fp, pkg, "Conffiles");
-	pkg_formatted_field(fp, pkg, "Source");
-	pkg_formatted_field(fp, pkg, "Description");
-	pkg_formatted_field(fp, pkg, "Installed-Time");
-	pkg_formatted_field(fp, pkg, "Tags");
-	fputs("\n", fp);
+	struct strbuf sb = { NULL, 0, 0 };
+
+	pkg_format_field(&sb, pkg, "Package");
+	pkg_format_field(&sb, pkg, "Version");
+	pkg_format_field(&sb, pkg, "Depends");
+	pkg_format_field(&sb, pkg, "Recommends");
+	pkg_format_field(&sb, pkg, "Suggests");
+	pkg_format_field(&sb, pkg, "Provides");
+	pkg_format_field(&sb, pkg, "Replaces");
+	pkg_format_field(&sb, pkg, "Conflicts");
+	pkg_format_field(&sb, pkg, "Status");
+	pkg_format_field(&sb, pkg, "Section");
+	pkg_format_field(&sb, pkg, "Essential");
+	pkg_format_field(&sb, pkg, "Architecture");
+	pkg_format_field(&sb, pkg, "Maintainer");
+	pkg_format_field(&sb, pkg, "MD5sum");
+	pkg_format_field(&sb, pkg, "Size");
+	pkg_format_field(&sb, pkg, "Filename");
+	pkg_format_field(&sb, pkg, "Conffiles");
+	pkg_format_field(&sb, pkg, "Source");
+	pkg_format_field(&sb, pkg, "Description");
+	pkg_format_field(&sb, pkg, "Installed-Time");
+	pkg_format_field(&sb, pkg, "Tags");
+	strbuf_printf(&sb, "\n");
+	fwrite(sb.buf, 1, sb.len, fp);
+	strbuf_free(&sb);
 }
 
 void pkg_print_status(pkg_t * pkg, FILE * file)
 {
+	struct strbuf sb = { NULL, 0, 0 };
+
 	if (pkg == NULL) {
 		return;
 	}
 
-	pkg_formatted_field(file, pkg, "Package");
-	pkg_formatted_field(file, pkg, "Version");
-	pkg_formatted_field(file, pkg, "Depends");
-	pkg_formatted_field(file, pkg, "Recommends");
-	pkg_formatted_field(file, pkg, "Suggests");
-	pkg_formatted_field(file, pkg, "Provides");
-	pkg_formatted_field(file, pkg, "Replaces");
-	pkg_formatted_field(file, pkg, "Conflicts");
-	pkg_formatted_field(file, pkg, "Status");
-	pkg_formatted_field(file, pkg, "Essential");
-	pkg_formatted_field(file, pkg, "Architecture");
-	pkg_formatted_field(file, pkg, "Conffiles");
-	pkg_formatted_field(file, pkg, "Installed-Time");
-	pkg_formatted_field(file, pkg, "Auto-Installed");
-	pkg_formatted_field(file, pkg, "Alternatives");
-	fputs("\n", file);
+	pkg_format_field(&sb, pkg, "Package");
+	pkg_format_field(&sb, pkg, "Version");
+	pkg_format_field(&sb, pkg, "Depends");
+	pkg_format_field(&sb, pkg, "Recommends");
+	pkg_format_field(&sb, pkg, "Suggests");
+	pkg_format_field(&sb, pkg, "Provides");
+	pkg_format_field(&sb, pkg, "Replaces");
+	pkg_format_field(&sb, pkg, "Conflicts");
+	pkg_format_field(&sb, pkg, "Status");
+	pkg_format_field(&sb, pkg, "Essential");
+	pkg_format_field(&sb, pkg, "Architecture");
+	/* the archive checksum keys the content-addressed download
+	 * cache, where it locates the base for future delta upgrades;
+	 * for stanzas without content on disk (e.g. a leftover
+	 * want-install record) it would only shadow the feed's checksum
+	 * on the next load */
+	if (pkg->state_status == SS_INSTALLED
+	    || pkg->state_status == SS_UNPACKED)
+		pkg_format_field(&sb, pkg, "SHA256sum");
+	pkg_format_field(&sb, pkg, "Conffiles");
+	pkg_format_field(&sb, pkg, "Installed-Time");
+	pkg_format_field(&sb, pkg, "Auto-Installed");
+	pkg_format_field(&sb, pkg, "Alternatives");
+	strbuf_printf(&sb, "\n");
+	fwrite(sb.buf, 1, sb.len, file);
+	strbuf_free(&sb);
 }
 
 /*
@@ -1023,16 +1139,124 @@ static int verrevcmp(const char *val, const char *ref)
 	return 0;
 }
 
+/*
+ * Encoding of the precomputed version comparison key: a byte string
+ * whose plain memcmp order equals the epoch/version/revision order
+ * computed by verrevcmp() above.
+ *
+ *   0x01		'~' (must sort before end of component)
+ *   0x02		terminator
+ *   0x03		version/revision separator
+ *   0x04 + n		digit run of n significant digits, digits follow
+ *   'A'..'z'		letters as themselves
+ *   0x80 | c		any other character
+ *
+ * A digit-run token is emitted after every non-digit run, even an
+ * empty one, so textually different but equal versions ("1.0" vs
+ * "1.") encode identically. Digit runs longer than VERKEY_MAX_DIGITS
+ * would collide with the letter range and make the version fall back
+ * to verrevcmp().
+ */
+#define VERKEY_TILDE	0x01
+#define VERKEY_END	0x02
+#define VERKEY_SEP	0x03
+#define VERKEY_DIGITS	0x04
+#define VERKEY_MAX_DIGITS	('A' - VERKEY_DIGITS - 1)
+
+static int verkey_append(const char *s, unsigned char *key, unsigned int *len)
+{
+	const char *p = s ? s : "";
+	const char *d;
+	unsigned int n;
+
+	while (1) {
+		while (*p && !isdigit(*p)) {
+			unsigned char c = *p++;
+
+			if (c == '~')
+				key[(*len)++] = VERKEY_TILDE;
+			else if (isalpha(c))
+				key[(*len)++] = c;
+			else
+				key[(*len)++] = c | 0x80;
+		}
+
+		while (*p == '0')
+			p++;
+		for (d = p; isdigit(*p); p++)
+			;
+		n = p - d;
+
+		if (n > VERKEY_MAX_DIGITS)
+			return -1;
+
+		key[(*len)++] = VERKEY_DIGITS + n;
+		memcpy(key + *len, d, n);
+		*len += n;
+
+		if (!*p)
+			return 0;
+	}
+}
+
+static void pkg_version_cmpkey_build(pkg_t * pkg)
+{
+	const char *version = pkg_get_string(pkg, PKG_VERSION);
+	const char *revision = pkg_get_string(pkg, PKG_REVISION);
+	char epoch_str[16];
+	unsigned char *key;
+	unsigned int len = 0;
+
+	sprintf(epoch_str, "%u", (unsigned int)pkg_get_int(pkg, PKG_EPOCH));
+
+	key = xmalloc(2 * (strlen(epoch_str) + (version ? strlen(version) : 0)
+			   + (revision ? strlen(revision) : 0)) + 8);
+
+	if (verkey_append(epoch_str, key, &len) ||
+	    verkey_append(version, key, &len) ||
+	    (key[len++] = VERKEY_SEP, verkey_append(revision, key, &len))) {
+		/* unencodable; remember that and use verrevcmp() */
+		free(key);
+		pkg->version_cmpkey = NULL;
+		pkg->version_cmpkey_len = 1;
+		return;
+	}
+
+	key[len++] = VERKEY_END;
+	pkg->version_cmpkey = (char *)key;
+	pkg->version_cmpkey_len = len;
+}
+
 int pkg_compare_versions(const pkg_t * pkg, const pkg_t * ref_pkg)
 {
-	unsigned int epoch1 = (unsigned int) pkg_get_int(pkg, PKG_EPOCH);
-	unsigned int epoch2 = (unsigned int) pkg_get_int(ref_pkg, PKG_EPOCH);
-	char *revision1 = pkg_get_string(pkg, PKG_REVISION);
-	char *revision2 = pkg_get_string(ref_pkg, PKG_REVISION);
-	const char *version1 = pkg_get_string(pkg, PKG_VERSION);
-	const char *version2 = pkg_get_string(ref_pkg, PKG_VERSION);
+	pkg_t *p1 = (pkg_t *) pkg;	/* cast to cache the lazy key */
+	pkg_t *p2 = (pkg_t *) ref_pkg;
+	unsigned int epoch1, epoch2, min_len;
+	char *revision1, *revision2;
+	const char *version1, *version2;
 	int r;
 
+	if (!p1->version_cmpkey_len)
+		pkg_version_cmpkey_build(p1);
+	if (!p2->version_cmpkey_len)
+		pkg_version_cmpkey_build(p2);
+
+	if (p1->version_cmpkey && p2->version_cmpkey) {
+		/* the terminator byte appears only at the end, so two
+		 * keys matching over min_len bytes are identical */
+		min_len = p1->version_cmpkey_len < p2->version_cmpkey_len
+		    ? p1->version_cmpkey_len : p2->version_cmpkey_len;
+		r = memcmp(p1->version_cmpkey, p2->version_cmpkey, min_len);
+		return r > 0 ? 1 : r < 0 ? -1 : 0;
+	}
+
+	epoch1 = (unsigned int) pkg_get_int(pkg, PKG_EPOCH);
+	epoch2 = (unsigned int) pkg_get_int(ref_pkg, PKG_EPOCH);
+	revision1 = pkg_get_string(pkg, PKG_REVISION);
+	revision2 = pkg_get_string(ref_pkg, PKG_REVISION);
+	version1 = pkg_get_string(pkg, PKG_VERSION);
+	version2 = pkg_get_string(ref_pkg, PKG_VERSION);
+
 	if (epoch1 > epoch2) {
 		return 1;
 	}
@@ -1157,14 +1381,49 @@ char *pkg_version_str_alloc(pkg_t * pkg)
 	return version;
 }
 
+/*
+ * Non-allocating variant of pkg_version_str_alloc(): formats the joined
+ * version into the caller's buffer. Versions rarely exceed a couple of
+ * dozen bytes, so a PKG_VERSION_STR_MAX stack buffer avoids a malloc/free
+ * pair on every formatted line; oversized versions are truncated. Returns
+ * NULL when the package has no version, like the allocating variant.
+ */
+char *pkg_version_str_r(pkg_t * pkg, char *buf, size_t len)
+{
+	const char *verstr, *revptr;
+	unsigned int epoch = (unsigned int) pkg_get_int(pkg, PKG_EPOCH);
+
+	verstr = pkg_get_string(pkg, PKG_VERSION);
+	if (!verstr)
+		return NULL;
+
+	revptr = pkg_get_string(pkg, PKG_REVISION);
+
+	if (epoch) {
+		if (revptr)
+			snprintf(buf, len, "%d:%s-%s", epoch, verstr, revptr);
+		else
+			snprintf(buf, len, "%d:%s", epoch, verstr);
+	} else {
+		if (revptr)
+			snprintf(buf, len, "%s-%s", verstr, revptr);
+		else
+			snprintf(buf, len, "%s", verstr);
+	}
+
+	return buf;
+}
+
 /*
  * XXX: this should be broken into two functions
  */
-str_list_t *pkg_get_installed_files(pkg_t * pkg)
+str_vec_t *pkg_get_installed_files(pkg_t * pkg)
 {
-	int err, fd;
+	int err;
 	char *list_file_name = NULL;
 	FILE *list_file = NULL;
+	char *list_buf = NULL;
+	size_t list_buf_len = 0;
 	char *line;
 	char *installed_file_name;
 	unsigned int rootdirlen = 0;
@@ -1177,7 +1436,7 @@ str_list_t *pkg_get_installed_files(pkg_t * pkg)
 		return pkg->installed_files;
 	}
 
-	pkg->installed_files = str_list_alloc();
+	pkg->installed_files = str_vec_alloc();
 
 	/*
 	 * For installed packages, look at the package.list file in the database.
@@ -1194,41 +1453,35 @@ str_list_t *pkg_get_installed_files(pkg_t * pkg)
 		if (!local_filename) {
 			return pkg->installed_files;
 		}
-		/* XXX: CLEANUP: Maybe rewrite this to avoid using a temporary
-		   file. In other words, change deb_extract so that it can
-		   simply return the file list as a char *[] rather than
-		   insisting on writing it to a FILE * as it does now. */
-		sprintf_alloc(&list_file_name, "%s/%s.list.XXXXXX",
-			      conf->tmp_dir, pkg->name);
-		fd = mkstemp(list_file_name);
-		if (fd == -1) {
-			opkg_perror(ERROR, "Failed to make temp file %s.",
-				    list_file_name);
-			free(list_file_name);
-			return pkg->installed_files;
-		}
-		list_file = fdopen(fd, "r+");
+		/* the names go through an in-memory stream instead of a
+		   temp file in tmp_dir */
+		list_file = open_memstream(&list_buf, &list_buf_len);
 		if (list_file == NULL) {
-			opkg_perror(ERROR, "Failed to fdopen temp file %s.",
-				    list_file_name);
-			close(fd);
-			unlink(list_file_name);
-			free(list_file_name);
+			opkg_perror(ERROR, "Failed to open memory stream");
 			return pkg->installed_files;
 		}
 		err = pkg_extract_data_file_names_to_stream(pkg, list_file);
+		fclose(list_file);
 		if (err) {
 			opkg_msg(ERROR, "Error extracting file list from %s.\n",
 				 local_filename);
-			fclose(list_file);
-			unlink(list_file_name);
-			free(list_file_name);
-			str_list_deinit(pkg->installed_files);
+			free(list_buf);
+			str_vec_free(pkg->installed_files);
 			pkg->installed_files = NULL;
 			return NULL;
 		}
-		rewind(list_file);
+		list_file = fmemopen(list_buf, list_buf_len, "r");
+		if (list_file == NULL) {
+			opkg_perror(ERROR, "Failed to reopen file list buffer");
+			free(list_buf);
+			return pkg->installed_files;
+		}
 	} else {
+		/* the consolidated ownership index spares opening one
+		   .list file per package when it is fresh */
+		if (filelist_index_pkg_files(pkg, pkg->installed_files) == 0)
+			return pkg->installed_files;
+
 		sprintf_alloc(&list_file_name, "%s/%s.list",
 			      pkg->dest->info_dir, pkg->name);
 		list_file = fopen(list_file_name, "r");
@@ -1273,17 +1526,13 @@ str_list_t *pkg_get_installed_files(pkg_t * pkg)
 					      file_name);
 			}
 		}
-		str_list_append(pkg->installed_files, installed_file_name);
+		str_vec_append(pkg->installed_files, installed_file_name);
 		free(installed_file_name);
 		free(line);
 	}
 
 	fclose(list_file);
-
-	if (list_from_package) {
-		unlink(list_file_name);
-		free(list_file_name);
-	}
+	free(list_buf);
 
 	return pkg->installed_files;
 }
@@ -1300,10 +1549,7 @@ void pkg_free_installed_files(pkg_t * pkg)
 	if (pkg->installed_files_ref_cnt > 0)
 		return;
 
-	if (pkg->installed_files) {
-		str_list_purge(pkg->installed_files);
-	}
-
+	str_vec_free(pkg->installed_files);
 	pkg->installed_files = NULL;
 }
 
@@ -1322,26 +1568,17 @@ void pkg_remove_installed_files_list(pkg_t * pkg)
 
 conffile_t *pkg_get_conffile(pkg_t * pkg, const char *file_name)
 {
-	conffile_list_elt_t *iter;
 	conffile_list_t *cl;
-	conffile_t *conffile;
 
 	if (pkg == NULL) {
 		return NULL;
 	}
 
 	cl = pkg_get_ptr(pkg, PKG_CONFFILES);
+	if (cl == NULL)
+		return NULL;
 
-	for (iter = cl ? nv_pair_list_first(cl) : NULL; iter;
-	     iter = nv_pair_list_next(cl, iter)) {
-		conffile = (conffile_t *) iter->data;
-
-		if (strcmp(conffile->name, file_name) == 0) {
-			return conffile;
-		}
-	}
-
-	return NULL;
+	return conffile_list_lookup(cl, file_name);
 }
 
 int pkg_run_script(pkg_t * pkg, const char *script, const char *args)
@@ -1350,6 +1587,8 @@ int pkg_run_script(pkg_t * pkg, const char *script, const char *args)
 	char *path;
 	char *cmd;
 	char *tmp_unpack_dir;
+	const char *root_dir;
+	const char *upgrade;
 
 	if (conf->noaction)
 		return 0;
@@ -1387,26 +1626,26 @@ int pkg_run_script(pkg_t * pkg, const char *script, const char *args)
 
 	opkg_msg(INFO, "Running script %s.\n", path);
 
-	setenv("PKG_ROOT",
-	       pkg->dest ? pkg->dest->root_dir : conf->default_dest->root_dir,
-	       1);
+	root_dir = pkg->dest ? pkg->dest->root_dir : conf->default_dest->root_dir;
+	upgrade = pkg->is_upgrade ? "1" : "0";
 
-	if (pkg->is_upgrade)
-		setenv("PKG_UPGRADE", "1", 1);
-	else
-		setenv("PKG_UPGRADE", "0", 1);
+	setenv("PKG_ROOT", root_dir, 1);
+	setenv("PKG_UPGRADE", upgrade, 1);
 
 	if (!file_exists(path)) {
 		free(path);
 		return 0;
 	}
 
-	sprintf_alloc(&cmd, "%s %s", path, args);
+	/* the transaction shell was spawned before these setenv calls
+	   could take effect there, so the values ride along with the
+	   command itself */
+	sprintf_alloc(&cmd, "export PKG_ROOT='%s' PKG_UPGRADE=%s\n%s %s",
+		      root_dir, upgrade, path, args);
 	free(path);
-	{
-		const char *argv[] = { "/bin/sh", "-c", cmd, NULL };
-		err = xsystem(argv);
-	}
+	opkg_profile_begin(PROFILE_SCRIPTS);
+	err = xsystem_shell(cmd);
+	opkg_profile_end(PROFILE_SCRIPTS);
 	free(cmd);
 
 	if (err) {
@@ -1421,59 +1660,63 @@ int pkg_run_script(pkg_t * pkg, const char *script, const char *args)
 
 int pkg_arch_supported(pkg_t * pkg)
 {
-	nv_pair_list_elt_t *l;
 	char *architecture = pkg_get_architecture(pkg);
 
 	if (!architecture)
 		return 1;
 
-	list_for_each_entry(l, &conf->arch_list.head, node) {
-		nv_pair_t *nv = (nv_pair_t *) l->data;
-		if (strcmp(nv->name, architecture) == 0) {
-			opkg_msg(DEBUG,
-				 "Arch %s (priority %s) supported for pkg %s.\n",
-				 nv->name, nv->value, pkg->name);
-			return 1;
-		}
-	}
-
-	opkg_msg(DEBUG, "Arch %s unsupported for pkg %s.\n",
-		 architecture, pkg->name);
-	return 0;
+	/* a name in the flat table is a supported one by construction */
+	opkg_msg(DEBUG, "Arch %s (priority %d) supported for pkg %s.\n",
+		 architecture, pkg_get_arch_priority(pkg), pkg->name);
+	return 1;
 }
 
 void pkg_info_preinstall_check(void)
 {
 	int i;
-	pkg_vec_t *installed_pkgs = pkg_vec_alloc();
+	pkg_vec_t *installed_pkgs;
+	pkg_dest_list_elt_t *dest_iter;
+	pkg_dest_t *dest;
 
 	/* update the file owner data structure */
 	opkg_msg(INFO, "Updating file owner list.\n");
-	pkg_hash_fetch_all_installed(installed_pkgs);
-	for (i = 0; i < installed_pkgs->len; i++) {
-		pkg_t *pkg = installed_pkgs->pkgs[i];
-		str_list_t *installed_files = pkg_get_installed_files(pkg);	/* this causes installed_files to be cached */
-		str_list_elt_t *iter, *niter;
-		if (installed_files == NULL) {
-			opkg_msg(ERROR, "Failed to determine installed "
-				 "files for pkg %s.\n", pkg->name);
-			break;
-		}
-		for (iter = str_list_first(installed_files), niter =
-		     str_list_next(installed_files, iter); iter;
-		     iter = niter, niter =
-		     str_list_next(installed_files, iter)) {
-			char *installed_file = (char *)iter->data;
-			file_hash_set_file_owner(installed_file, pkg);
+	installed_pkgs = pkg_hash_fetch_all_installed_cached();
+
+	list_for_each_entry(dest_iter, &conf->pkg_dest_list.head, node) {
+		dest = (pkg_dest_t *) dest_iter->data;
+
+		/* a fresh ownership index replaces the .list scan */
+		if (filelist_index_load(dest) == 0)
+			continue;
+
+		for (i = 0; i < installed_pkgs->len; i++) {
+			pkg_t *pkg = installed_pkgs->pkgs[i];
+			str_vec_t *installed_files;
+			unsigned int f;
+
+			if (pkg->dest != dest)
+				continue;
+
+			installed_files = pkg_get_installed_files(pkg);	/* this causes installed_files to be cached */
+			if (installed_files == NULL) {
+				opkg_msg(ERROR, "Failed to determine installed "
+					 "files for pkg %s.\n", pkg->name);
+				break;
+			}
+			for (f = 0; f < installed_files->len; f++)
+				file_hash_set_file_owner(
+				    installed_files->strs[f], pkg);
+			pkg_free_installed_files(pkg);
 		}
-		pkg_free_installed_files(pkg);
+
+		if (!conf->noaction)
+			filelist_index_write(dest);
 	}
-	pkg_vec_free(installed_pkgs);
 }
 
 struct pkg_write_filelist_data {
 	pkg_t *pkg;
-	FILE *stream;
+	struct strbuf *sb;
 };
 
 static void
@@ -1482,41 +1725,69 @@ pkg_write_filelist_helper(const char *key, void *entry_, void *data_)
 	struct pkg_write_filelist_data *data = data_;
 	pkg_t *entry = entry_;
 	if (entry == data->pkg) {
-		fprintf(data->stream, "%s\n", key);
+		strbuf_printf(data->sb, "%s\n", key);
 	}
 }
 
 int pkg_write_filelist(pkg_t * pkg)
 {
 	struct pkg_write_filelist_data data;
+	struct strbuf sb = { NULL, 0, 0 };
+	struct file_map old;
 	char *list_file_name;
+	FILE *fp;
+	int changed = 1, err = 0;
 
 	sprintf_alloc(&list_file_name, "%s/%s.list",
 		      pkg->dest->info_dir, pkg->name);
 
-	opkg_msg(INFO, "Creating %s file for pkg %s.\n",
-		 list_file_name, pkg->name);
+	data.pkg = pkg;
+	data.sb = &sb;
+	hash_table_foreach(&conf->file_hash, pkg_write_filelist_helper, &data);
 
-	data.stream = fopen(list_file_name, "w");
-	if (!data.stream) {
-		opkg_perror(ERROR, "Failed to open %s", list_file_name);
-		free(list_file_name);
-		return -1;
+	/* upgrades often ship the very same file list; comparing against
+	   the one on disk spares rewriting an unchanged file */
+	if (file_map_open(&old, list_file_name) == 0) {
+		changed = old.len != sb.len
+		    || (sb.len && memcmp(old.base, sb.buf, sb.len) != 0);
+		file_map_close(&old);
 	}
 
-	data.pkg = pkg;
-	hash_table_foreach(&conf->file_hash, pkg_write_filelist_helper, &data);
-	fclose(data.stream);
+	if (changed) {
+		opkg_msg(INFO, "Creating %s file for pkg %s.\n",
+			 list_file_name, pkg->name);
+
+		fp = fopen(list_file_name, "w");
+		if (!fp) {
+			opkg_perror(ERROR, "Failed to open %s",
+				    list_file_name);
+			err = -1;
+		} else {
+			if (sb.len && fwrite(sb.buf, 1, sb.len, fp) != sb.len)
+				err = -1;
+			if (fclose(fp) == EOF)
+				err = -1;
+			if (err)
+				opkg_perror(ERROR, "Failed to write %s",
+					    list_file_name);
+		}
+	} else {
+		opkg_msg(DEBUG, "File list of pkg %s is unchanged.\n",
+			 pkg->name);
+	}
+
+	strbuf_free(&sb);
 	free(list_file_name);
 
-	pkg->state_flag &= ~SF_FILELIST_CHANGED;
+	if (!err)
+		pkg->state_flag &= ~SF_FILELIST_CHANGED;
 
-	return 0;
+	return err;
 }
 
 int pkg_write_changed_filelists(void)
 {
-	pkg_vec_t *installed_pkgs = pkg_vec_alloc();
+	pkg_vec_t *installed_pkgs;
 	int i, err, ret = 0;
 
 	if (conf->noaction)
@@ -1524,7 +1795,7 @@ int pkg_write_changed_filelists(void)
 
 	opkg_msg(INFO, "Saving changed filelists.\n");
 
-	pkg_hash_fetch_all_installed(installed_pkgs);
+	installed_pkgs = pkg_hash_fetch_all_installed_cached();
 	for (i = 0; i < installed_pkgs->len; i++) {
 		pkg_t *pkg = installed_pkgs->pkgs[i];
 		if (pkg->state_flag & SF_FILELIST_CHANGED) {
@@ -1534,7 +1805,5 @@ int pkg_write_changed_filelists(void)
 		}
 	}
 
-	pkg_vec_free(installed_pkgs);
-
 	return ret;
 }
@@ -19,10 +19,11 @@
 #define PKG_H
 
 #include <sys/types.h>
-#include <libubox/blob.h>
+#include <stdint.h>
 
 #include "pkg_vec.h"
 #include "str_list.h"
+#include "str_vec.h"
 #include "active_list.h"
 #include "pkg_src.h"
 #include "pkg_dest.h"
@@ -30,6 +31,7 @@
 #include "conffile_list.h"
 
 struct opkg_conf;
+struct arena;
 
 #ifndef ARRAY_SIZE
 #define ARRAY_SIZE(array) sizeof(array) / sizeof((array)[0])
@@ -101,6 +103,7 @@ enum pkg_fields {
 	PKG_CONFLICTS,
 	PKG_CONFFILES,
 	PKG_ALTERNATIVES,
+	__PKG_FIELD_MAX,
 };
 
 struct abstract_pkg {
@@ -111,10 +114,11 @@ struct abstract_pkg {
 	pkg_state_flag_t state_flag;
 
 	/* XXX: This should be abstract_pkg_vec_t for consistency. */
-	struct abstract_pkg **depended_upon_by;
+	abstract_pkg_vec_t *depended_upon_by;
 
 	abstract_pkg_vec_t *provided_by;
 	abstract_pkg_vec_t *replaced_by;
+	int from_arena;
 };
 
 #include "pkg_depends.h"
@@ -168,13 +172,20 @@ struct pkg {
 	abstract_pkg_t *parent;
 
 	/* As pointer for lazy evaluation */
-	str_list_t *installed_files;
+	str_vec_t *installed_files;
 	/* XXX: CLEANUP: I'd like to perhaps come up with a better
 	   mechanism to avoid the problem here, (which is that the
 	   installed_files list was being freed from an inner loop while
 	   still being used within an outer loop. */
 	int installed_files_ref_cnt;
 
+	/* lazily built byte string whose memcmp order equals the
+	 * epoch/version/revision comparison order; len 0 means not
+	 * built yet, a NULL key with nonzero len means the version
+	 * cannot be encoded and verrevcmp() must be used instead */
+	char *version_cmpkey;
+	unsigned int version_cmpkey_len;
+
 	unsigned int essential:1;
 /* Adding this flag, to "force" opkg to choose a "provided_by_hand" package, if there are multiple choice */
 	unsigned int provided_by_hand:1;
@@ -184,13 +195,30 @@ struct pkg {
 	unsigned int auto_installed:1;
 	unsigned int is_upgrade:1;
 
+	/* the download path already matched the archive against the
+	 * sha256 advertised by the feed, as the bytes arrived */
+	unsigned int checksum_verified:1;
+
 	unsigned int arch_index:3;
 
-	struct blob_buf blob;
+	/* allocated from the pkg hash arena; do not free() individually */
+	unsigned int from_arena:1;
+
+	/* dynamic fields: a fixed-order presence bitmap plus offsets
+	 * into one packed buffer. A lookup indexes the offset table by
+	 * the popcount of the lower presence bits, see pkg_get_raw();
+	 * the buffer grows in doubling steps, not once per field. */
+	uint32_t field_present;
+	uint32_t field_used;
+	uint32_t field_cap;
+	uint32_t field_off[__PKG_FIELD_MAX];
+	char *field_data;
 };
 
 pkg_t *pkg_new(void);
+pkg_t *pkg_new_arena(struct arena *arena);
 void pkg_deinit(pkg_t * pkg);
+void pkg_free(pkg_t * pkg);
 int pkg_init_from_file(pkg_t * pkg, const char *filename);
 
 void *pkg_set_raw(pkg_t *pkg, int id, const void *val, size_t len);
@@ -209,11 +237,8 @@ static inline int pkg_get_int(const pkg_t *pkg, int id)
 }
 
 char *pkg_set_string(pkg_t *pkg, int id, const char *s);
-
-static inline char *pkg_get_string(const pkg_t *pkg, int id)
-{
-	return (char *) pkg_get_raw(pkg, id);
-}
+char *pkg_set_string_len(pkg_t *pkg, int id, const char *s, size_t len);
+char *pkg_get_string(const pkg_t *pkg, int id);
 
 static inline void * pkg_set_ptr(pkg_t *pkg, int id, void *ptr)
 {
@@ -238,6 +263,7 @@ char *pkg_get_sha256(const pkg_t *pkg);
 char *pkg_set_sha256(pkg_t *pkg, const char *cksum);
 
 abstract_pkg_t *abstract_pkg_new(void);
+abstract_pkg_t *abstract_pkg_new_arena(struct arena *arena);
 
 /*
  * merges fields from newpkg into oldpkg.
@@ -245,7 +271,11 @@ abstract_pkg_t *abstract_pkg_new(void);
  */
 int pkg_merge(pkg_t * oldpkg, pkg_t * newpkg);
 
+/* large enough for any sane epoch:version-revision triple */
+#define PKG_VERSION_STR_MAX 80
+
 char *pkg_version_str_alloc(pkg_t * pkg);
+char *pkg_version_str_r(pkg_t * pkg, char *buf, size_t len);
 
 int pkg_compare_versions(const pkg_t *pkg, const pkg_t *ref_pkg);
 int pkg_name_version_and_architecture_compare(const void *a, const void *b);
@@ -255,7 +285,7 @@ void pkg_formatted_info(FILE * fp, pkg_t * pkg);
 void pkg_formatted_field(FILE * fp, pkg_t * pkg, const char *field);
 
 void pkg_print_status(pkg_t * pkg, FILE * file);
-str_list_t *pkg_get_installed_files(pkg_t * pkg);
+str_vec_t *pkg_get_installed_files(pkg_t * pkg);
 void pkg_free_installed_files(pkg_t * pkg);
 void pkg_remove_installed_files_list(pkg_t * pkg);
 conffile_t *pkg_get_conffile(pkg_t * pkg, const char *file_name);
@@ -265,6 +295,8 @@ int pkg_run_script(pkg_t * pkg, const char *script, const char *args);
 pkg_state_want_t pkg_state_want_from_str(char *str);
 pkg_state_flag_t pkg_state_flag_from_str(const char *str);
 pkg_state_status_t pkg_state_status_from_str(const char *str);
+void pkg_set_state_status(pkg_t * pkg, pkg_state_status_t status);
+const char *pkg_state_status_to_str(pkg_state_status_t ss);
 
 int pkg_version_satisfied(pkg_t * it, pkg_t * ref, const char *op);
 
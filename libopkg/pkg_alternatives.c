@@ -39,58 +39,52 @@ static const struct alternative_provider providers[] = {
 	},
 };
 
-static const char *pkg_alternatives_check_providers(const char *path)
+/*
+ * Provider file lists are loaded from disk, so the caller hands in a
+ * cache spanning one pkg_alternatives_update() run; a package with
+ * dozens of orphaned links then reads each provider's list once
+ * instead of once per link.
+ */
+static const char *pkg_alternatives_check_providers(const char *path,
+						    pkg_t **provider_pkgs,
+						    str_vec_t **provider_files)
 {
-	pkg_t *pkg;
-	str_list_t *files;
-	str_list_elt_t *iter;
+	str_vec_t *files;
+	unsigned int f;
 	int i;
 
 	for (i = 0; i < ARRAY_SIZE(providers); i++) {
-		pkg = pkg_hash_fetch_installed_by_name(providers[i].name);
-		if (!pkg) {
-			continue;
+		if (!provider_pkgs[i]) {
+			provider_pkgs[i] =
+			    pkg_hash_fetch_installed_by_name(providers[i].name);
+			if (!provider_pkgs[i])
+				continue;
+			provider_files[i] =
+			    pkg_get_installed_files(provider_pkgs[i]);
 		}
-		files = pkg_get_installed_files(pkg);
-		for (iter = str_list_first(files); iter; iter = str_list_next(files, iter)) {
-			if (!strcmp(path, (char *)(iter->data))) {
-				pkg_free_installed_files(pkg);
+
+		files = provider_files[i];
+		if (!files)
+			continue;
+
+		for (f = 0; f < files->len; f++) {
+			if (!strcmp(path, files->strs[f]))
 				return providers[i].altpath;
-			}
 		}
-		pkg_free_installed_files(pkg);
 	}
 	return NULL;
 }
 
-static int pkg_alternatives_update_path(pkg_t *pkg, const pkg_vec_t *installed, const char *path)
+static int pkg_alternatives_apply(pkg_t *the_pkg,
+				  struct pkg_alternative *the_alt,
+				  const char *path,
+				  pkg_t **provider_pkgs,
+				  str_vec_t **provider_files)
 {
-	struct pkg_alternatives *pkg_alts;
-	struct pkg_alternative *the_alt = NULL;
-	pkg_t *the_pkg = pkg;
-	int i, j;
 	int r;
 	char *path_in_dest;
 	const char *target_path = NULL;
 
-	for (i = 0; i < installed->len; i++) {
-		pkg_t *pkg = installed->pkgs[i];
-		pkg_alts = pkg_get_ptr(pkg, PKG_ALTERNATIVES);
-		if (!pkg_alts)
-			continue;
-
-		for (j = 0; j < pkg_alts->nalts; j++) {
-			struct pkg_alternative *alt = pkg_alts->alts[j];
-
-			if (strcmp(path, alt->path))
-				continue;
-			if (!the_alt || the_alt->prio < alt->prio) {
-				the_pkg = pkg;
-				the_alt = alt;
-			}
-		}
-	}
-
 	/* path is assumed to be an absolute one */
 	sprintf_alloc(&path_in_dest, "%s%s", the_pkg->dest->root_dir, &path[1]);
 	if (!path_in_dest)
@@ -99,7 +93,9 @@ static int pkg_alternatives_update_path(pkg_t *pkg, const pkg_vec_t *installed,
 	if (the_alt) {
 		target_path = the_alt->altpath;
 	} else {
-		target_path = pkg_alternatives_check_providers(path);
+		target_path = pkg_alternatives_check_providers(path,
+							       provider_pkgs,
+							       provider_files);
 	}
 
 	if (target_path) {
@@ -155,22 +151,63 @@ out:
 int pkg_alternatives_update(pkg_t * pkg)
 {
 	int r = 0;
-	int i;
+	int i, j, k;
 	struct pkg_alternatives *pkg_alts;
-	struct pkg_alternative *alt = NULL;
-	pkg_vec_t *installed;
+	struct pkg_alternative **winner_alt;
+	pkg_t **winner_pkg;
+	pkg_t *provider_pkgs[ARRAY_SIZE(providers)] = { NULL };
+	str_vec_t *provider_files[ARRAY_SIZE(providers)] = { NULL };
+	const pkg_vec_t *installed;
 
 	pkg_alts = pkg_get_ptr(pkg, PKG_ALTERNATIVES);
 	if (!pkg_alts)
 		return 0;
 
-	installed = pkg_vec_alloc();
-	pkg_hash_fetch_all_installed(installed);
-	for (i = 0; i < pkg_alts->nalts; i++) {
-		alt = pkg_alts->alts[i];
-		r |= pkg_alternatives_update_path(pkg, installed, alt->path);
+	/* One pass over the installed set resolves the winner for every
+	 * link this package carries; the per-link rescan it replaces was
+	 * O(links * installed packages * their links). The vector is
+	 * borrowed from the hash cache, so it must not be freed here. */
+	winner_alt = xcalloc(pkg_alts->nalts, sizeof(*winner_alt));
+	winner_pkg = xcalloc(pkg_alts->nalts, sizeof(*winner_pkg));
+
+	installed = pkg_hash_fetch_all_installed_cached();
+	for (i = 0; i < installed->len; i++) {
+		pkg_t *other = installed->pkgs[i];
+		struct pkg_alternatives *other_alts =
+		    pkg_get_ptr(other, PKG_ALTERNATIVES);
+
+		if (!other_alts)
+			continue;
+
+		for (j = 0; j < other_alts->nalts; j++) {
+			struct pkg_alternative *alt = other_alts->alts[j];
+
+			for (k = 0; k < pkg_alts->nalts; k++) {
+				if (strcmp(alt->path, pkg_alts->alts[k]->path))
+					continue;
+				if (!winner_alt[k]
+				    || winner_alt[k]->prio < alt->prio) {
+					winner_pkg[k] = other;
+					winner_alt[k] = alt;
+				}
+				break;
+			}
+		}
 	}
-	pkg_vec_free(installed);
+
+	for (k = 0; k < pkg_alts->nalts; k++) {
+		r |= pkg_alternatives_apply(winner_pkg[k] ? winner_pkg[k] : pkg,
+					    winner_alt[k],
+					    pkg_alts->alts[k]->path,
+					    provider_pkgs, provider_files);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(providers); i++)
+		if (provider_pkgs[i])
+			pkg_free_installed_files(provider_pkgs[i]);
+
+	free(winner_alt);
+	free(winner_pkg);
 
 	return r;
 }
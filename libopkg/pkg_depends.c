@@ -24,8 +24,94 @@
 #include "opkg_message.h"
 #include "pkg_parse.h"
 #include "hash_table.h"
+#include "arena.h"
 #include "libbb/libbb.h"
 
+/*
+ * All depend_t, compound_depend_t and possibility arrays are carved out
+ * of one arena whose lifetime matches the pkg hash: the dependency
+ * graph of every known package is built once while feeds load and only
+ * goes away when the hash does, so freeing it node by node in
+ * pkg_deinit() was pure overhead. As a side effect the graph is laid
+ * out contiguously in parse order, which is also traversal order.
+ * The abstract_pkg_t nodes and their provided_by/replaced_by/
+ * depended_upon_by vectors live here too (see pkg_depends_arena()),
+ * so a resolver walk stays within the arena's slabs instead of
+ * chasing pointers all over the heap.
+ */
+static __thread arena_t depend_arena;
+
+void pkg_depends_init(void)
+{
+	arena_init(&depend_arena, "depend-arena", 64 * 1024);
+}
+
+/* the graph arena, for the pkg_hash code that creates graph nodes */
+struct arena *pkg_depends_arena(void)
+{
+	return &depend_arena;
+}
+
+/*
+ * Compound dependencies already proven satisfied by an installed
+ * package, keyed on the compound_depend_t address (stable, it lives in
+ * the depend arena). Installing a package can only satisfy more
+ * dependencies, never fewer, so a positive verdict stays valid until
+ * something is removed or replaced; the remove and upgrade paths call
+ * pkg_depends_state_flush() at those points.
+ */
+static __thread hash_table_t satisfied_cache;
+
+void pkg_depends_state_flush(void)
+{
+	hash_table_deinit(&satisfied_cache);
+}
+
+static int satisfied_cache_check(compound_depend_t * dep)
+{
+	char key[24];
+
+	if (!satisfied_cache.entries)
+		return 0;
+
+	snprintf(key, sizeof(key), "%p", (void *)dep);
+	return hash_table_get(&satisfied_cache, key) != NULL;
+}
+
+static void satisfied_cache_note(compound_depend_t * dep)
+{
+	char key[24];
+
+	if (!satisfied_cache.entries)
+		hash_table_init("satisfied-deps", &satisfied_cache, 64);
+
+	snprintf(key, sizeof(key), "%p", (void *)dep);
+	hash_table_insert(&satisfied_cache, key, dep);
+}
+
+/* parsed constraint versions owned by version_constraints_satisfied();
+ * collected here because the depend_t's referencing them live in the
+ * arena and are never torn down individually */
+static __thread pkg_vec_t *constraint_pkgs;
+
+void pkg_depends_deinit(void)
+{
+	unsigned int i;
+
+	pkg_depends_state_flush();
+
+	if (constraint_pkgs) {
+		for (i = 0; i < constraint_pkgs->len; i++) {
+			pkg_deinit(constraint_pkgs->pkgs[i]);
+			free(constraint_pkgs->pkgs[i]);
+		}
+		pkg_vec_free(constraint_pkgs);
+		constraint_pkgs = NULL;
+	}
+
+	arena_deinit(&depend_arena);
+}
+
 static int parseDepends(compound_depend_t * compound_depend, char *depend_str, enum depend_type type);
 static depend_t *depend_init(void);
 static char **add_unresolved_dep(pkg_t * pkg, char **the_lost, int ref_ndx);
@@ -163,6 +249,11 @@ pkg_hash_fetch_unsatisfied_dependencies(pkg_t * pkg, pkg_vec_t * unsatisfied,
 			continue;
 		}
 
+		/* this dependency may have been proven satisfied by an
+		 * earlier pass over the tree */
+		if (satisfied_cache_check(compound_depend))
+			continue;
+
 		/* foreach possible satisfier, look for installed package  */
 		for (j = 0; j < compound_depend->possibility_count; j++) {
 			/* foreach provided_by, which includes the abstract_pkg itself */
@@ -181,6 +272,7 @@ pkg_hash_fetch_unsatisfied_dependencies(pkg_t * pkg, pkg_vec_t * unsatisfied,
 			}
 			opkg_msg(DEBUG, "satisfying_pkg=%p\n", satisfying_pkg);
 			if (satisfying_pkg != NULL) {
+				satisfied_cache_note(compound_depend);
 				found = 1;
 				break;
 			}
@@ -366,20 +458,25 @@ pkg_vec_t *pkg_hash_fetch_conflicts(pkg_t * pkg)
 
 int version_constraints_satisfied(depend_t * depends, pkg_t * pkg)
 {
-	pkg_t *temp;
 	int comparison;
 
 	if (depends->constraint == NONE)
 		return 1;
 
-	temp = pkg_new();
-
-	parse_version(temp, depends->version);
-
-	comparison = pkg_compare_versions(pkg, temp);
+	/* Parse the constraint version once per depend_t. It used to be
+	 * parsed into a throwaway pkg on every call, which made each
+	 * check pay for version splitting and comparison-key building;
+	 * candidate selection runs this for every version of a name. */
+	if (!depends->constraint_pkg) {
+		depends->constraint_pkg = pkg_new();
+		parse_version(depends->constraint_pkg, depends->version);
+
+		if (!constraint_pkgs)
+			constraint_pkgs = pkg_vec_alloc();
+		pkg_vec_insert(constraint_pkgs, depends->constraint_pkg);
+	}
 
-	pkg_deinit(temp);
-	free(temp);
+	comparison = pkg_compare_versions(pkg, depends->constraint_pkg);
 
 	if ((depends->constraint == EARLIER) && (comparison < 0))
 		return 1;
@@ -440,6 +537,43 @@ static int is_pkg_in_pkg_vec(pkg_vec_t * vec, pkg_t * pkg)
 	return 0;
 }
 
+/**
+ * pkg_provides_abstract returns 1 if apkg is among pkg's provides,
+ * including the implicit self-provide, and 0 otherwise. The provide
+ * list keeps everything after the self-provide sorted by name, so the
+ * lookup binary searches instead of walking the whole list; abstract
+ * packages are interned by name, so a name match is a pointer match.
+ */
+int pkg_provides_abstract(pkg_t * pkg, abstract_pkg_t * apkg)
+{
+	abstract_pkg_t **provides = pkg_get_ptr(pkg, PKG_PROVIDES);
+	int lo, hi, mid, cmp;
+
+	if (!provides || !provides[0])
+		return 0;
+
+	if (provides[0] == apkg)
+		return 1;
+
+	lo = 1;
+	hi = 1;
+	while (provides[hi])
+		hi++;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		cmp = strcmp(apkg->name, provides[mid]->name);
+		if (cmp == 0)
+			return 1;
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return 0;
+}
+
 /**
  * pkg_replaces returns 1 if pkg->replaces contains one of replacee's provides and 0
  * otherwise.
@@ -447,13 +581,11 @@ static int is_pkg_in_pkg_vec(pkg_vec_t * vec, pkg_t * pkg)
 int pkg_replaces(pkg_t * pkg, pkg_t * replacee)
 {
 	abstract_pkg_t **replaces = pkg_get_ptr(pkg, PKG_REPLACES);
-	abstract_pkg_t **provides = pkg_get_ptr(replacee, PKG_PROVIDES);
-	abstract_pkg_t **r, **p;
+	abstract_pkg_t **r;
 
 	for (r = replaces; r && *r; r++)
-		for (p = provides; p && *p; p++)
-			if (*r == *p)
-				return 1;
+		if (pkg_provides_abstract(replacee, *r))
+			return 1;
 
 	return 0;
 }
@@ -483,13 +615,12 @@ int pkg_conflicts(pkg_t * pkg, pkg_t * conflictee)
 {
 	int i, j;
 	compound_depend_t *conflicts;
-	abstract_pkg_t **provider;
 
 	for (conflicts = pkg_get_ptr(pkg, PKG_CONFLICTS), i = 0; conflicts && conflicts[i].type; i++)
 		for (j = 0; j < conflicts[i].possibility_count; j++)
-			for (provider = pkg_get_ptr(conflictee, PKG_PROVIDES); provider && *provider; provider++)
-				if (conflicts[i].possibilities[j]->pkg == *provider)
-					return 1;
+			if (pkg_provides_abstract(conflictee,
+						  conflicts[i].possibilities[j]->pkg))
+				return 1;
 
 	return 0;
 }
@@ -583,8 +714,7 @@ abstract_pkg_t **init_providelist(pkg_t *pkg, int *count)
 		if (!ab_pkg->pkgs)
 			ab_pkg->pkgs = pkg_vec_alloc();
 
-		if (!abstract_pkg_vec_contains(ab_pkg->provided_by, ab_pkg))
-			abstract_pkg_vec_insert(ab_pkg->provided_by, ab_pkg);
+		abstract_pkg_vec_insert_sorted(ab_pkg->provided_by, ab_pkg);
 
 		provides[0] = ab_pkg;
 		provides[1] = NULL;
@@ -614,15 +744,18 @@ abstract_pkg_t **init_providelist(pkg_t *pkg, int *count)
 
 void parse_providelist(pkg_t *pkg, char *list)
 {
-	int count = 0;
+	int count = 0, i;
 	char *item, *tok;
 	abstract_pkg_t *ab_pkg, *provided_abpkg, **tmp, **provides;
+	enum xalloc_tag old_tag = xalloc_tag_set(XALLOC_TAG_DEPENDS);
 
 	provides = init_providelist(pkg, &count);
 	ab_pkg = ensure_abstract_pkg_by_name(pkg->name);
 
-	if (!provides || !ab_pkg)
+	if (!provides || !ab_pkg) {
+		xalloc_tag_set(old_tag);
 		return;
+	}
 
 	for (item = strtok_r(list, ", ", &tok); item;
 	     count++, item = strtok_r(NULL, ", ", &tok)) {
@@ -641,16 +774,25 @@ void parse_providelist(pkg_t *pkg, char *list)
 			}
 		}
 
-		if (!abstract_pkg_vec_contains(provided_abpkg->provided_by, ab_pkg))
-			abstract_pkg_vec_insert(provided_abpkg->provided_by, ab_pkg);
+		abstract_pkg_vec_insert_sorted(provided_abpkg->provided_by,
+					       ab_pkg);
 
 		provides = tmp;
-		provides[count - 1] = provided_abpkg;
+
+		/* keep everything after the implicit self-provide sorted
+		 * by name so pkg_provides_abstract() can binary search */
+		for (i = count - 1;
+		     i > 1 && strcmp(provides[i - 1]->name,
+				     provided_abpkg->name) > 0; i--)
+			provides[i] = provides[i - 1];
+		provides[i] = provided_abpkg;
 	}
 
 	provides[count - 1] = NULL;
 
 	pkg_set_ptr(pkg, PKG_PROVIDES, provides);
+
+	xalloc_tag_set(old_tag);
 }
 
 void parse_replacelist(pkg_t *pkg, char *list)
@@ -658,13 +800,14 @@ void parse_replacelist(pkg_t *pkg, char *list)
 	int count;
 	char *item, *tok;
 	abstract_pkg_t *ab_pkg, *old_abpkg, **tmp, **replaces = NULL;
+	enum xalloc_tag old_tag = xalloc_tag_set(XALLOC_TAG_DEPENDS);
 
 	ab_pkg = ensure_abstract_pkg_by_name(pkg->name);
 
 	if (!ab_pkg->pkgs)
 		ab_pkg->pkgs = pkg_vec_alloc();
 
-	abstract_pkg_vec_insert(ab_pkg->provided_by, ab_pkg);
+	abstract_pkg_vec_insert_sorted(ab_pkg->provided_by, ab_pkg);
 
 	for (count = 1, item = strtok_r(list, ", ", &tok); item;
 	     count++, item = strtok_r(NULL, ", ", &tok)) {
@@ -684,26 +827,30 @@ void parse_replacelist(pkg_t *pkg, char *list)
 		}
 
 		if (!old_abpkg->replaced_by)
-			old_abpkg->replaced_by = abstract_pkg_vec_alloc();
+			old_abpkg->replaced_by =
+			    abstract_pkg_vec_alloc_arena(&depend_arena);
 
 		/* if a package pkg both replaces and conflicts old_abpkg,
 		 * then add it to the replaced_by vector so that old_abpkg
 		 * will be upgraded to ab_pkg automatically */
-		if (pkg_conflicts_abstract(pkg, old_abpkg)) {
-			if (!abstract_pkg_vec_contains(old_abpkg->replaced_by, ab_pkg))
-				abstract_pkg_vec_insert(old_abpkg->replaced_by, ab_pkg);
-		}
+		if (pkg_conflicts_abstract(pkg, old_abpkg))
+			abstract_pkg_vec_insert_sorted(old_abpkg->replaced_by,
+						       ab_pkg);
 
 		replaces = tmp;
 		replaces[count - 1] = old_abpkg;
 	}
 
-	if (!replaces)
+	if (!replaces) {
+		xalloc_tag_set(old_tag);
 		return;
+	}
 
 	replaces[count - 1] = NULL;
 
 	pkg_set_ptr(pkg, PKG_REPLACES, replaces);
+
+	xalloc_tag_set(old_tag);
 }
 
 void buildProvides(abstract_pkg_t * ab_pkg, pkg_t * pkg)
@@ -785,9 +932,11 @@ void buildReplaces(abstract_pkg_t * ab_pkg, pkg_t * pkg)
 
 void parse_deplist(pkg_t *pkg, enum depend_type type, char *list)
 {
-	int id, count;
+	int id, count, extra;
 	char *item, *tok;
+	const char *p;
 	compound_depend_t *tmp, *deps;
+	enum xalloc_tag old_tag;
 
 	switch (type)
 	{
@@ -807,28 +956,36 @@ void parse_deplist(pkg_t *pkg, enum depend_type type, char *list)
 		return;
 	}
 
+	old_tag = xalloc_tag_set(XALLOC_TAG_DEPENDS);
+
 	deps = pkg_get_ptr(pkg, id);
 
 	for (tmp = deps, count = 1; tmp && tmp->type; tmp++)
 		count++;
 
-	for (item = strtok_r(list, ",", &tok); item; item = strtok_r(NULL, ",", &tok), count++) {
-		tmp = realloc(deps, sizeof(compound_depend_t) * (count + 1));
+	/* upper bound on new entries; empty tokens just leave spare
+	 * zeroed terminator slots */
+	for (p = list, extra = 1; *p; p++)
+		if (*p == ',')
+			extra++;
 
-		if (!tmp)
-			break;
+	/* the arena cannot grow an allocation in place, so take a fresh
+	 * zeroed array and copy the entries parsed from earlier fields;
+	 * the old array stays in the arena until it is torn down */
+	tmp = arena_calloc(&depend_arena,
+			   sizeof(compound_depend_t) * (count + extra));
 
-		deps = tmp;
+	if (deps)
+		memcpy(tmp, deps, sizeof(compound_depend_t) * (count - 1));
 
-		memset(deps + count - 1, 0, sizeof(compound_depend_t));
-		parseDepends(deps + count - 1, item, type);
-	}
+	deps = tmp;
 
-	if (!deps)
-		return;
+	for (item = strtok_r(list, ",", &tok); item; item = strtok_r(NULL, ",", &tok), count++)
+		parseDepends(deps + count - 1, item, type);
 
-	memset(deps + count - 1, 0, sizeof(compound_depend_t));
 	pkg_set_ptr(pkg, id, deps);
+
+	xalloc_tag_set(old_tag);
 }
 
 void buildDepends(pkg_t * pkg)
@@ -969,10 +1126,8 @@ char *pkg_depend_str(pkg_t * pkg, int idx)
 void buildDependedUponBy(pkg_t * pkg, abstract_pkg_t * ab_pkg)
 {
 	compound_depend_t *depends;
-	int othercount;
 	int j;
 	abstract_pkg_t *ab_depend;
-	abstract_pkg_t **temp;
 
 	for (depends = pkg_get_ptr(pkg, PKG_DEPENDS); depends && depends->type; depends++) {
 		if (depends->type != PREDEPEND
@@ -980,34 +1135,21 @@ void buildDependedUponBy(pkg_t * pkg, abstract_pkg_t * ab_pkg)
 			continue;
 		for (j = 0; j < depends->possibility_count; j++) {
 			ab_depend = depends->possibilities[j]->pkg;
-			if (!ab_depend->depended_upon_by) {
+			if (!ab_depend->depended_upon_by)
 				ab_depend->depended_upon_by =
-				    xcalloc(1, sizeof(abstract_pkg_t *));
-			}
-
-			temp = ab_depend->depended_upon_by;
-			othercount = 1;
-			while (*temp) {
-				temp++;
-				othercount++;
-			}
-			*temp = ab_pkg;
+				    abstract_pkg_vec_alloc_arena(
+							&depend_arena);
 
-			ab_depend->depended_upon_by =
-			    xrealloc(ab_depend->depended_upon_by,
-				     (othercount +
-				      1) * sizeof(abstract_pkg_t *));
-
-			/* the array may have been moved by realloc */
-			temp = ab_depend->depended_upon_by + othercount;
-			*temp = NULL;
+			abstract_pkg_vec_insert_sorted(ab_depend->
+						       depended_upon_by,
+						       ab_pkg);
 		}
 	}
 }
 
 static depend_t *depend_init(void)
 {
-	depend_t *d = xcalloc(1, sizeof(depend_t));
+	depend_t *d = arena_calloc(&depend_arena, sizeof(depend_t));
 	d->constraint = NONE;
 	d->version = NULL;
 	d->pkg = NULL;
@@ -1017,22 +1159,25 @@ static depend_t *depend_init(void)
 
 static int parseDepends(compound_depend_t * compound_depend, char *depend_str, enum depend_type type)
 {
-	int i;
+	int i, alts;
+	size_t vlen;
+	const char *p;
 	char *depend, *name, *vstr, *rest, *tok = NULL;
-	depend_t **possibilities = NULL, **tmp;
+	depend_t **possibilities;
 
 	compound_depend->type = type;
 
+	/* upper bound on alternatives, so the array never grows */
+	for (p = depend_str, alts = 1; *p; p++)
+		if (*p == '|')
+			alts++;
+
+	possibilities = arena_calloc(&depend_arena, sizeof(depend_t *) * alts);
+
 	for (i = 0, depend = strtok_r(depend_str, "|", &tok); depend; i++, depend = strtok_r(NULL, "|", &tok)) {
 		name = strtok(depend, " ");
 		rest = strtok(NULL, "\n");
 
-		tmp = realloc(possibilities, sizeof(tmp) * (i + 1));
-
-		if (!tmp)
-			return -1;
-
-		possibilities = tmp;
 		possibilities[i] = depend_init();
 		possibilities[i]->pkg = ensure_abstract_pkg_by_name(name);
 
@@ -1064,7 +1209,13 @@ static int parseDepends(compound_depend_t * compound_depend, char *depend_str, e
 				vstr++;
 			}
 
-			possibilities[i]->version = trim_xstrdup(vstr);
+			while (isspace(*vstr))
+				vstr++;
+			vlen = strlen(vstr);
+			while (vlen > 0 && isspace(vstr[vlen - 1]))
+				vlen--;
+			possibilities[i]->version =
+			    arena_strndup(&depend_arena, vstr, vlen);
 			rest = strtok(NULL, " ");
 		}
 		else {
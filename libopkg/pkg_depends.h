@@ -46,6 +46,10 @@ struct depend {
 	version_constraint_t constraint;
 	char *version;
 	abstract_pkg_t *pkg;
+	/* `version' parsed into a throwaway pkg on first use, so
+	 * repeated constraint checks reuse its comparison key instead
+	 * of reparsing; see version_constraints_satisfied() */
+	pkg_t *constraint_pkg;
 };
 typedef struct depend depend_t;
 
@@ -56,6 +60,13 @@ struct compound_depend {
 };
 typedef struct compound_depend compound_depend_t;
 
+struct arena;
+
+void pkg_depends_init(void);
+struct arena *pkg_depends_arena(void);
+void pkg_depends_deinit(void);
+void pkg_depends_state_flush(void);
+
 void buildProvides(abstract_pkg_t * ab_pkg, pkg_t * pkg);
 void buildConflicts(pkg_t * pkg);
 void buildReplaces(abstract_pkg_t * ab_pkg, pkg_t * pkg);
@@ -67,6 +78,12 @@ abstract_pkg_t **init_providelist(pkg_t *pkg, int *count);
 void parse_providelist(pkg_t *pkg, char *list);
 void parse_replacelist(pkg_t *pkg, char *list);
 
+/**
+ * pkg_provides_abstract returns 1 if apkg is among pkg's provides
+ * (including the implicit self-provide) and 0 otherwise.
+ */
+int pkg_provides_abstract(pkg_t * pkg, abstract_pkg_t * apkg);
+
 /**
  * pkg_replaces returns 1 if pkg->replaces contains one of replacee's provides and 0
  * otherwise.
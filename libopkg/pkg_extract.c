@@ -66,6 +66,51 @@ int pkg_extract_data_files_to_dir(pkg_t * pkg, const char *dir)
 	return err;
 }
 
+struct deb_session *pkg_extract_begin(pkg_t * pkg)
+{
+	return deb_session_open(pkg_get_string(pkg, PKG_LOCAL_FILENAME));
+}
+
+int
+pkg_extract_session_control_files(struct deb_session *s, const char *dir,
+				  const char *prefix)
+{
+	int err;
+	char *dir_with_prefix;
+
+	if (deb_session_member(s, "control.tar"))
+		return -1;
+
+	sprintf_alloc(&dir_with_prefix, "%s/%s", dir, prefix);
+
+	deb_session_extract(s, stderr,
+			    extract_all_to_fs | extract_preserve_date
+			    | extract_unconditional, dir_with_prefix, NULL,
+			    &err);
+
+	free(dir_with_prefix);
+	return err;
+}
+
+int pkg_extract_session_data_files(struct deb_session *s, const char *dir)
+{
+	int err;
+
+	if (deb_session_member(s, "data.tar"))
+		return -1;
+
+	deb_session_extract(s, stderr,
+			    extract_all_to_fs | extract_preserve_date
+			    | extract_unconditional, dir, NULL, &err);
+
+	return err;
+}
+
+void pkg_extract_end(struct deb_session *s)
+{
+	deb_session_close(s);
+}
+
 int pkg_extract_data_file_names_to_stream(pkg_t * pkg, FILE * stream)
 {
 	int err;
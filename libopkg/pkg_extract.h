@@ -20,6 +20,8 @@
 
 #include "pkg.h"
 
+struct deb_session;
+
 int pkg_extract_control_file_to_stream(pkg_t * pkg, FILE * stream);
 int pkg_extract_control_files_to_dir(pkg_t * pkg, const char *dir);
 int pkg_extract_control_files_to_dir_with_prefix(pkg_t * pkg,
@@ -28,4 +30,17 @@ int pkg_extract_control_files_to_dir_with_prefix(pkg_t * pkg,
 int pkg_extract_data_files_to_dir(pkg_t * pkg, const char *dir);
 int pkg_extract_data_file_names_to_stream(pkg_t * pkg, FILE * file);
 
+/*
+ * Extraction session: the archive is opened and the outer stream
+ * decompressed once, and control and data members are consumed in
+ * that order out of the same pass. The one-shot helpers above each
+ * pay for a full outer scan, so callers needing several members of
+ * the same package should prefer a session.
+ */
+struct deb_session *pkg_extract_begin(pkg_t * pkg);
+int pkg_extract_session_control_files(struct deb_session *s,
+				      const char *dir, const char *prefix);
+int pkg_extract_session_data_files(struct deb_session *s, const char *dir);
+void pkg_extract_end(struct deb_session *s);
+
 #endif
@@ -16,24 +16,53 @@
 */
 
 #include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "hash_table.h"
+#include "arena.h"
 #include "pkg.h"
 #include "opkg_message.h"
 #include "pkg_vec.h"
 #include "pkg_hash.h"
+#include "opkg_cmd.h"
 #include "parse_util.h"
 #include "pkg_parse.h"
 #include "opkg_utils.h"
 #include "sprintf_alloc.h"
 #include "file_util.h"
+#include "pkg_index.h"
+#include "opkg_profile.h"
 #include "libbb/libbb.h"
 #include "libbb/gzip.h"
 
+/*
+ * Backing store for the pkg_t structs created while loading feeds and
+ * status files. They all live exactly as long as the pkg hash, so they
+ * are carved out of one arena instead of being malloc'd one by one.
+ */
+static __thread arena_t pkg_arena;
+
+/*
+ * Canonical "all available" / "all installed" vectors, lent out to
+ * query paths so each fnmatch pass over the hash doesn't allocate and
+ * fill a fresh vector. They are refilled in place (the buffers are
+ * kept) whenever the hash contents or package states have changed
+ * since they were last built.
+ */
+static __thread pkg_vec_t *all_available_vec;
+static __thread pkg_vec_t *all_installed_vec;
+static __thread int all_available_valid, all_installed_valid;
+static __thread int fetch_cache_gen;
+
+static void feed_jobs_free(void);
+
 void pkg_hash_init(void)
 {
 	hash_table_init("pkg-hash", &conf->pkg_hash,
 			OPKG_CONF_DEFAULT_HASH_LEN);
+	arena_init(&pkg_arena, "pkg-arena", 64 * 1024);
+	pkg_depends_init();
 }
 
 static void free_pkgs(const char *key, void *entry, void *data)
@@ -49,33 +78,44 @@ static void free_pkgs(const char *key, void *entry, void *data)
 
 	if (ab_pkg->pkgs) {
 		for (i = 0; i < ab_pkg->pkgs->len; i++) {
-			pkg_deinit(ab_pkg->pkgs->pkgs[i]);
-			free(ab_pkg->pkgs->pkgs[i]);
+			pkg_free(ab_pkg->pkgs->pkgs[i]);
 		}
 	}
 
+	/* the node, its name and its graph vectors are carved out of the
+	 * depend arena; only the heap-grown element arrays need freeing */
 	abstract_pkg_vec_free(ab_pkg->provided_by);
 	abstract_pkg_vec_free(ab_pkg->replaced_by);
 	pkg_vec_free(ab_pkg->pkgs);
-	free(ab_pkg->depended_upon_by);
-	free(ab_pkg->name);
-	free(ab_pkg);
+	abstract_pkg_vec_free(ab_pkg->depended_upon_by);
+	if (!ab_pkg->from_arena) {
+		free(ab_pkg->name);
+		free(ab_pkg);
+	}
 }
 
 void pkg_hash_deinit(void)
 {
 	hash_table_foreach(&conf->pkg_hash, free_pkgs, NULL);
 	hash_table_deinit(&conf->pkg_hash);
+	pkg_hash_candidate_cache_flush();
+	pkg_vec_free(all_available_vec);
+	pkg_vec_free(all_installed_vec);
+	all_available_vec = NULL;
+	all_installed_vec = NULL;
+	arena_deinit(&pkg_arena);
+	pkg_depends_deinit();
+	feed_jobs_free();
 }
 
 int dist_hash_add_from_file(const char *lists_dir, pkg_src_t * dist)
 {
-	nv_pair_list_elt_t *l;
 	char *list_file, *subname;
+	int n;
 
-	list_for_each_entry(l, &conf->arch_list.head, node) {
-		nv_pair_t *nv = (nv_pair_t *) l->data;
-		sprintf_alloc(&subname, "%s-%s", dist->name, nv->name);
+	for (n = 1; n <= conf->n_arches; n++) {
+		sprintf_alloc(&subname, "%s-%s", dist->name,
+			      conf->arch_names[n]);
 		sprintf_alloc(&list_file, "%s/%s", lists_dir, subname);
 
 		if (file_exists(list_file)) {
@@ -93,32 +133,43 @@ int dist_hash_add_from_file(const char *lists_dir, pkg_src_t * dist)
 	return 0;
 }
 
-int
-pkg_hash_add_from_file(const char *file_name,
-		       pkg_src_t * src, pkg_dest_t * dest, int is_status_file, int state_flags)
+/*
+ * Validate a freshly parsed pkg and insert it into the hash. Takes
+ * ownership of the pkg, which is freed unless it gets inserted.
+ */
+static void pkg_hash_check_insert(pkg_t * pkg, int is_status_file)
+{
+	if (!(pkg->state_flag & SF_NEED_DETAIL)) {
+		//opkg_msg(DEBUG, "Package %s is unrelated, ignoring.\n", pkg->name);
+		pkg_free(pkg);
+		return;
+	}
+
+	if (!pkg_get_architecture(pkg) || !pkg_get_arch_priority(pkg)) {
+		char vbuf[PKG_VERSION_STR_MAX];
+		opkg_msg(NOTICE, "Package %s version %s has no "
+			 "valid architecture, ignoring.\n",
+			 pkg->name, pkg_version_str_r(pkg, vbuf,
+						      sizeof(vbuf)));
+		return;
+	}
+
+	hash_insert_pkg(pkg, is_status_file);
+}
+
+static int
+pkg_hash_add_from_stream(FILE * fp, pkg_src_t * src, pkg_dest_t * dest,
+			 int is_status_file, int state_flags)
 {
 	pkg_t *pkg;
-	FILE *fp;
 	char *buf;
 	const size_t len = 4096;
 	int ret = 0;
-	struct gzip_handle zh;
-
-	if (src && src->gzip) {
-		fp = gzip_fdopen(&zh, file_name);
-	} else {
-		fp = fopen(file_name, "r");
-	}
-
-	if (fp == NULL) {
-		opkg_perror(ERROR, "Failed to open %s", file_name);
-		return -1;
-	}
 
 	buf = xmalloc(len);
 
 	do {
-		pkg = pkg_new();
+		pkg = pkg_new_arena(&pkg_arena);
 		pkg->src = src;
 		pkg->dest = dest;
 		pkg->state_flag |= state_flags;
@@ -132,8 +183,7 @@ pkg_hash_add_from_file(const char *file_name,
 		}
 
 		if (ret) {
-			pkg_deinit(pkg);
-			free(pkg);
+			pkg_free(pkg);
 			if (ret == -1)
 				break;
 			if (ret == 1)
@@ -142,27 +192,138 @@ pkg_hash_add_from_file(const char *file_name,
 			continue;
 		}
 
-		if (!(pkg->state_flag & SF_NEED_DETAIL)) {
-			//opkg_msg(DEBUG, "Package %s is unrelated, ignoring.\n", pkg->name);
-			pkg_deinit(pkg);
-			free(pkg);
+		pkg_hash_check_insert(pkg, is_status_file);
+
+	} while (!feof(fp));
+
+	free(buf);
+
+	return ret;
+}
+
+/*
+ * Parse an uncompressed feed straight out of a private memory mapping,
+ * so loading is bounded by page-cache reads instead of per-line stdio
+ * copies.
+ */
+static int
+pkg_hash_add_from_buf(char *buf, size_t len, pkg_src_t * src,
+		      pkg_dest_t * dest, int is_status_file, int state_flags)
+{
+	pkg_t *pkg;
+	char *p = buf;
+	char *end = buf + len;
+	int ret = 0;
+
+	while (p < end) {
+		pkg = pkg_new_arena(&pkg_arena);
+		pkg->src = src;
+		pkg->dest = dest;
+		pkg->state_flag |= state_flags;
+
+		ret = pkg_parse_from_map(pkg, &p, end, 0);
+
+		if (pkg->name == NULL) {
+			/* probably just a blank line */
+			pkg_free(pkg);
 			continue;
 		}
 
-		if (!pkg_get_architecture(pkg) || !pkg_get_arch_priority(pkg)) {
-			char *version_str = pkg_version_str_alloc(pkg);
-			opkg_msg(NOTICE, "Package %s version %s has no "
-				 "valid architecture, ignoring.\n",
-				 pkg->name, version_str);
-			free(version_str);
+		if (ret) {
+			pkg_free(pkg);
+			break;
+		}
+
+		pkg_hash_check_insert(pkg, is_status_file);
+	}
+
+	return ret;
+}
+
+/*
+ * Load a feed from its pre-parsed binary index. Stanzas for packages
+ * nobody asked details for are skipped without being parsed at all,
+ * which is where most of the time used to go.
+ */
+static int
+pkg_hash_add_from_index(struct pkg_index *idx, unsigned char *done,
+			pkg_src_t * src, int state_flags)
+{
+	pkg_t *pkg;
+	abstract_pkg_t *ab_pkg;
+	uint32_t i;
+	int ret = 0;
+
+	for (i = 0; i < idx->hdr->n_records; i++) {
+		struct pkg_index_record *rec = &idx->records[i];
+		char *p = idx->data + rec->stanza_off;
+		char *end = p + rec->stanza_len;
+
+		if (done[i])
 			continue;
+
+		if (!(state_flags & SF_NEED_DETAIL)) {
+			/* The parsed pkg would only survive
+			 * pkg_hash_check_insert() if its abstract package
+			 * has been flagged for details meanwhile.
+			 */
+			ab_pkg = abstract_pkg_fetch_by_name(idx->data +
+							    rec->name_off);
+			if (!ab_pkg || !(ab_pkg->state_flag & SF_NEED_DETAIL))
+				continue;
 		}
 
-		hash_insert_pkg(pkg, is_status_file);
+		done[i] = 1;
 
-	} while (!feof(fp));
+		pkg = pkg_new_arena(&pkg_arena);
+		pkg->src = src;
+		pkg->state_flag |= state_flags;
+
+		ret = pkg_parse_from_map(pkg, &p, end, 0);
+
+		if (ret || pkg->name == NULL) {
+			pkg_free(pkg);
+			if (ret)
+				break;
+			continue;
+		}
+
+		pkg_hash_check_insert(pkg, 0);
+	}
+
+	return ret;
+}
+
+int
+pkg_hash_add_from_file(const char *file_name,
+		       pkg_src_t * src, pkg_dest_t * dest, int is_status_file, int state_flags)
+{
+	FILE *fp;
+	int ret;
+	struct gzip_handle zh;
+	struct file_map fmap;
+
+	if (!(src && src->gzip) && file_map_open(&fmap, file_name) == 0) {
+		ret = pkg_hash_add_from_buf(fmap.base, fmap.len, src, dest,
+					    is_status_file, state_flags);
+		file_map_close(&fmap);
+		return ret;
+	}
+
+	if (src && src->gzip) {
+		fp = gzip_fdopen(&zh, file_name);
+	} else {
+		fp = fopen(file_name, "r");
+	}
+
+	if (fp == NULL) {
+		opkg_perror(ERROR, "Failed to open %s", file_name);
+		return -1;
+	}
+
+	ret = pkg_hash_add_from_stream(fp, src, dest, is_status_file,
+				       state_flags);
 
-	free(buf);
 	fclose(fp);
 
 	if (src && src->gzip)
@@ -172,60 +333,561 @@ pkg_hash_add_from_file(const char *file_name,
 }
 
 /*
- * Load in feed files from the cached "src" and/or "src/gz" locations.
+ * One feed being staged for loading. Worker threads only touch the
+ * staging members; the global pkg hash is filled in on the main thread
+ * since abstract package resolution happens during parsing.
  */
-int pkg_hash_load_feeds(int state_flags)
+/*
+ * Byte range of one stanza within a staged feed buffer. Stanzas are only
+ * parsed once somebody wants details for their package; the rest stay as
+ * untouched (name, offset, length) records.
+ */
+struct feed_stanza {
+	const char *name;	/* interned package name */
+	uint32_t off;
+	uint32_t len;
+	uint32_t done;
+};
+
+struct feed_load_job {
+	pkg_src_t *src;
+	char *list_file;
+
+	struct pkg_index idx;
+	int have_index;
+	unsigned char *idx_done;	/* per-record parsed flags */
+	char *text;		/* decompressed gzip feed */
+	size_t text_len;
+	struct file_map fmap;	/* mapped plain-text feed */
+	int have_map;
+
+	struct feed_stanza *stanzas;	/* stanza table for buffer feeds */
+	uint32_t n_stanzas;
+};
+
+struct feed_load_queue {
+	struct feed_load_job *jobs;
+	int n_jobs;
+	int next;
+	pthread_mutex_t lock;
+	opkg_conf_t *owner;	/* context of the thread that staged us */
+};
+
+/*
+ * Stage one feed: validate/map its binary index, or decompress
+ * respectively map and pre-fault the text list. All of this is I/O
+ * bound and independent of the other feeds.
+ */
+static void feed_load_stage(struct feed_load_job *job)
+{
+	volatile unsigned long sum = 0;
+	size_t i;
+
+	if (pkg_index_open(&job->idx, job->list_file) == 0) {
+		job->have_index = 1;
+		return;
+	}
+
+	if (job->src->gzip) {
+		job->text = pkg_index_read_list(job->list_file, job->src,
+						&job->text_len);
+		return;
+	}
+
+	if (file_map_open(&job->fmap, job->list_file) == 0) {
+		job->have_map = 1;
+
+		/* touch each page so the read from disk happens here,
+		 * concurrently, instead of during the serial merge */
+		for (i = 0; i < job->fmap.len; i += 4096)
+			sum += (unsigned char)job->fmap.base[i];
+		(void)sum;
+	}
+}
+
+static void *feed_load_worker(void *data)
+{
+	struct feed_load_queue *queue = data;
+	struct feed_load_job *job;
+
+	/* inherit the spawning thread's context binding */
+	conf = queue->owner;
+
+	while (1) {
+		pthread_mutex_lock(&queue->lock);
+		if (queue->next >= queue->n_jobs) {
+			pthread_mutex_unlock(&queue->lock);
+			break;
+		}
+		job = &queue->jobs[queue->next++];
+		pthread_mutex_unlock(&queue->lock);
+
+		feed_load_stage(job);
+	}
+
+	return NULL;
+}
+
+static char *feed_job_buf(struct feed_load_job *job, size_t *lenp)
+{
+	if (job->text) {
+		*lenp = job->text_len;
+		return job->text;
+	}
+
+	if (job->have_map) {
+		*lenp = job->fmap.len;
+		return job->fmap.base;
+	}
+
+	return NULL;
+}
+
+/*
+ * Record the (name, offset, length) of every stanza in a staged feed
+ * buffer. Runs on the main thread since it touches the string atom
+ * table.
+ */
+static void feed_scan_stanzas(struct feed_load_job *job)
+{
+	const char *p, *end, *stanza, *name;
+	struct feed_stanza *rec;
+	char *buf;
+	size_t len, name_len;
+	uint32_t n_alloc = 0;
+
+	buf = feed_job_buf(job, &len);
+	p = buf;
+	end = buf + len;
+
+	while ((stanza = pkg_index_next_stanza(&p, end)) != NULL) {
+		name = pkg_index_stanza_name(stanza, p, &name_len);
+		if (name == NULL || name_len == 0)
+			continue;
+
+		if (job->n_stanzas == n_alloc) {
+			n_alloc = n_alloc ? n_alloc * 2 : 1024;
+			job->stanzas = xrealloc(job->stanzas, n_alloc *
+						sizeof(job->stanzas[0]));
+		}
+
+		rec = &job->stanzas[job->n_stanzas++];
+		rec->name = hash_table_intern_key_len(&conf->str_hash, name,
+						      name_len);
+		rec->off = stanza - buf;
+		rec->len = p - stanza;
+		rec->done = 0;
+	}
+}
+
+/*
+ * Parse the stanzas of a staged feed buffer that somebody wants details
+ * for; the rest are skipped by name without being parsed. Parsing
+ * NUL-terminates lines in place, so each stanza is parsed at most once
+ * and then marked done.
+ */
+static int feed_merge_stanzas(struct feed_load_job *job, int state_flags)
+{
+	abstract_pkg_t *ab_pkg;
+	pkg_t *pkg;
+	char *buf, *p, *stanza_end;
+	size_t len;
+	uint32_t i;
+	int ret = 0;
+
+	buf = feed_job_buf(job, &len);
+
+	for (i = 0; i < job->n_stanzas; i++) {
+		struct feed_stanza *rec = &job->stanzas[i];
+
+		if (rec->done)
+			continue;
+
+		if (!(state_flags & SF_NEED_DETAIL)) {
+			ab_pkg = abstract_pkg_fetch_by_name(rec->name);
+			if (!ab_pkg || !(ab_pkg->state_flag & SF_NEED_DETAIL))
+				continue;
+		}
+
+		rec->done = 1;
+
+		p = buf + rec->off;
+		stanza_end = p + rec->len;
+
+		pkg = pkg_new_arena(&pkg_arena);
+		pkg->src = job->src;
+		pkg->state_flag |= state_flags;
+
+		ret = pkg_parse_from_map(pkg, &p, stanza_end, 0);
+
+		if (ret || pkg->name == NULL) {
+			pkg_free(pkg);
+			if (ret)
+				break;
+			continue;
+		}
+
+		pkg_hash_check_insert(pkg, 0);
+	}
+
+	return ret;
+}
+
+/*
+ * Staged feeds are kept around after the initial load so that later
+ * detail rounds (pkg_hash_load_package_details()) can parse individual
+ * stanzas from the recorded offsets instead of re-reading the feeds.
+ */
+static __thread struct feed_load_queue feeds;
+static __thread int feeds_staged;
+
+static void feed_jobs_free(void)
+{
+	int i;
+
+	for (i = 0; i < feeds.n_jobs; i++) {
+		struct feed_load_job *job = &feeds.jobs[i];
+
+		if (job->have_index)
+			pkg_index_close(&job->idx);
+		if (job->have_map)
+			file_map_close(&job->fmap);
+		free(job->idx_done);
+		free(job->stanzas);
+		free(job->text);
+		free(job->list_file);
+	}
+
+	free(feeds.jobs);
+	memset(&feeds, 0, sizeof(feeds));
+	feeds_staged = 0;
+}
+
+/*
+ * Stage all configured feeds: map their binary indexes or scan their
+ * text into per-stanza (name, offset, length) records. Only happens
+ * once; subsequent pkg_hash_load_feeds() calls reuse the staged state.
+ */
+static void feed_jobs_stage(void)
 {
 	pkg_src_list_elt_t *iter;
 	pkg_src_t *src;
-	char *list_file, *lists_dir;
-
-	opkg_msg(INFO, "\n");
+	char *lists_dir;
+	struct feed_load_job *job;
+	int i, n_threads;
 
 	lists_dir = conf->restrict_to_default_dest ?
 	    conf->default_dest->lists_dir : conf->lists_dir;
 
+	pthread_mutex_init(&feeds.lock, NULL);
+	feeds.owner = conf;
+
 	for (iter = void_list_first(&conf->pkg_src_list); iter;
 	     iter = void_list_next(&conf->pkg_src_list, iter)) {
+		char *list_file;
 
 		src = (pkg_src_t *) iter->data;
 
 		sprintf_alloc(&list_file, "%s/%s", lists_dir, src->name);
 
-		if (file_exists(list_file)) {
-			if (pkg_hash_add_from_file(list_file, src, NULL, 0, state_flags)) {
-				free(list_file);
+		if (!file_exists(list_file)) {
+			free(list_file);
+			continue;
+		}
+
+		feeds.jobs = xrealloc(feeds.jobs, (feeds.n_jobs + 1)
+				      * sizeof(feeds.jobs[0]));
+		job = &feeds.jobs[feeds.n_jobs++];
+		memset(job, 0, sizeof(*job));
+		job->src = src;
+		job->list_file = list_file;
+	}
+
+	if (conf->parallel_feed_load && feeds.n_jobs > 1) {
+		pthread_t threads[4];
+
+		n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (n_threads > feeds.n_jobs)
+			n_threads = feeds.n_jobs;
+		if (n_threads > 4)
+			n_threads = 4;
+
+		for (i = 0; i < n_threads; i++)
+			pthread_create(&threads[i], NULL, feed_load_worker,
+				       &feeds);
+		for (i = 0; i < n_threads; i++)
+			pthread_join(threads[i], NULL);
+	} else {
+		for (i = 0; i < feeds.n_jobs; i++)
+			feed_load_stage(&feeds.jobs[i]);
+	}
+
+	for (i = 0; i < feeds.n_jobs; i++) {
+		job = &feeds.jobs[i];
+
+		if (job->have_index)
+			job->idx_done = xcalloc(job->idx.hdr->n_records ?
+						job->idx.hdr->n_records : 1, 1);
+		else if (job->text || job->have_map)
+			feed_scan_stanzas(job);
+	}
+
+	feeds_staged = 1;
+}
+
+/*
+ * Load in feed files from the cached "src" and/or "src/gz" locations.
+ */
+int pkg_hash_load_feeds(int state_flags)
+{
+	struct feed_load_job *job;
+	int i, err = 0;
+
+	opkg_msg(INFO, "\n");
+
+	opkg_profile_begin(PROFILE_FEED_LOAD);
+
+	if (!feeds_staged)
+		feed_jobs_stage();
+
+	/* merge the staged feeds into the global hash, in feed order */
+	for (i = 0; i < feeds.n_jobs && err == 0; i++) {
+		job = &feeds.jobs[i];
+
+		if (job->have_index)
+			err = pkg_hash_add_from_index(&job->idx,
+						      job->idx_done,
+						      job->src, state_flags);
+		else if (job->text || job->have_map)
+			err = feed_merge_stanzas(job, state_flags);
+		else
+			err = pkg_hash_add_from_file(job->list_file,
+						     job->src, NULL, 0,
+						     state_flags);
+	}
+
+	opkg_profile_end(PROFILE_FEED_LOAD);
+
+	return err ? -1 : 0;
+}
+
+/*
+ * Load in status files from the configured "dest"s.
+ */
+/*
+ * Load one dest's installed packages from the binary status index. The
+ * stanza text is carried inside the index, mapped privately, so parsing
+ * can NUL-terminate in place just like the feed path; all strings are
+ * interned or copied by the parser, so the mapping need not outlive the
+ * load.
+ */
+static int pkg_hash_load_status_index(struct pkg_index *idx,
+				      pkg_dest_t * dest)
+{
+	struct pkg_index_record *rec;
+	pkg_t *pkg;
+	char *p, *stanza_end;
+	uint32_t i;
+	int ret;
+
+	for (i = 0; i < idx->hdr->n_records; i++) {
+		rec = &idx->records[i];
+		p = idx->data + rec->stanza_off;
+		stanza_end = p + rec->stanza_len;
+
+		pkg = pkg_new_arena(&pkg_arena);
+		pkg->dest = dest;
+		pkg->state_flag |= SF_NEED_DETAIL;
+
+		ret = pkg_parse_from_map(pkg, &p, stanza_end, 0);
+		if (ret || pkg->name == NULL) {
+			pkg_free(pkg);
+			if (ret)
 				return -1;
-			}
+			continue;
 		}
-		free(list_file);
+
+		pkg_hash_check_insert(pkg, 1);
 	}
 
 	return 0;
 }
 
 /*
- * Load in status files from the configured "dest"s.
+ * Per-dest staging for status loading, mirroring the feed staging
+ * above: destinations live on independent filesystems, so the I/O —
+ * validating/mapping the binary index, faulting in the text and
+ * journal — happens concurrently, and only the hash insertion runs
+ * serially afterwards.
  */
+struct status_load_job {
+	pkg_dest_t *dest;
+	struct pkg_index idx;
+	int have_index;
+	struct file_map fmap;
+	int have_map;
+	char *journal_name;
+	struct file_map jmap;
+	int have_jmap;
+};
+
+struct status_load_queue {
+	struct status_load_job *jobs;
+	int n_jobs;
+	int next;
+	pthread_mutex_t lock;
+	opkg_conf_t *owner;	/* context of the thread that staged us */
+};
+
+static void status_load_prefault(struct file_map *fmap, int *have_map,
+				 const char *file_name)
+{
+	volatile unsigned long sum = 0;
+	size_t i;
+
+	if (file_map_open(fmap, file_name))
+		return;
+
+	*have_map = 1;
+	for (i = 0; i < fmap->len; i += 4096)
+		sum += (unsigned char)fmap->base[i];
+	(void)sum;
+}
+
+static void status_load_stage(struct status_load_job *job)
+{
+	if (file_exists(job->dest->status_file_name)) {
+		/* the binary index written beside the status file
+		 * skips the text parse; it validates itself against
+		 * the status file's size/mtime and a failed open
+		 * falls back to the text */
+		if (pkg_index_open(&job->idx, job->dest->status_file_name) == 0)
+			job->have_index = 1;
+		else
+			status_load_prefault(&job->fmap, &job->have_map,
+					     job->dest->status_file_name);
+	}
+
+	if (file_exists(job->journal_name))
+		status_load_prefault(&job->jmap, &job->have_jmap,
+				     job->journal_name);
+}
+
+static void *status_load_worker(void *data)
+{
+	struct status_load_queue *queue = data;
+	struct status_load_job *job;
+
+	/* inherit the spawning thread's context binding */
+	conf = queue->owner;
+
+	while (1) {
+		pthread_mutex_lock(&queue->lock);
+		if (queue->next >= queue->n_jobs) {
+			pthread_mutex_unlock(&queue->lock);
+			break;
+		}
+		job = &queue->jobs[queue->next++];
+		pthread_mutex_unlock(&queue->lock);
+
+		status_load_stage(job);
+	}
+
+	return NULL;
+}
+
 int pkg_hash_load_status_files(void)
 {
 	pkg_dest_list_elt_t *iter;
 	pkg_dest_t *dest;
+	struct status_load_queue queue;
+	struct status_load_job *job;
+	int i, ret = 0;
 
 	opkg_msg(INFO, "\n");
 
+	opkg_profile_begin(PROFILE_STATUS_LOAD);
+
+	memset(&queue, 0, sizeof(queue));
+	pthread_mutex_init(&queue.lock, NULL);
+	queue.owner = conf;
+
 	for (iter = void_list_first(&conf->pkg_dest_list); iter;
 	     iter = void_list_next(&conf->pkg_dest_list, iter)) {
 
 		dest = (pkg_dest_t *) iter->data;
 
-		if (file_exists(dest->status_file_name)) {
+		queue.jobs = xrealloc(queue.jobs, (queue.n_jobs + 1)
+				      * sizeof(queue.jobs[0]));
+		job = &queue.jobs[queue.n_jobs++];
+		memset(job, 0, sizeof(*job));
+		job->dest = dest;
+		sprintf_alloc(&job->journal_name, "%s.journal",
+			      dest->status_file_name);
+	}
+
+	if (queue.n_jobs > 1) {
+		pthread_t threads[4];
+		int n_threads;
+
+		n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (n_threads > queue.n_jobs)
+			n_threads = queue.n_jobs;
+		if (n_threads > 4)
+			n_threads = 4;
+
+		for (i = 0; i < n_threads; i++)
+			pthread_create(&threads[i], NULL, status_load_worker,
+				       &queue);
+		for (i = 0; i < n_threads; i++)
+			pthread_join(threads[i], NULL);
+	} else {
+		for (i = 0; i < queue.n_jobs; i++)
+			status_load_stage(&queue.jobs[i]);
+	}
+
+	/* serial merge: the package hash is not safe for concurrent
+	 * insertion, but the pages are warm now */
+	for (i = 0; i < queue.n_jobs; i++) {
+		job = &queue.jobs[i];
+
+		if (!ret && job->have_index) {
+			if (pkg_hash_load_status_index(&job->idx, job->dest))
+				ret = -1;
+		} else if (!ret
+			   && file_exists(job->dest->status_file_name)) {
 			if (pkg_hash_add_from_file
-			    (dest->status_file_name, NULL, dest, 1, SF_NEED_DETAIL))
-				return -1;
+			    (job->dest->status_file_name, NULL, job->dest, 1,
+			     SF_NEED_DETAIL))
+				ret = -1;
+		}
+
+		/* stanzas appended since the last compaction; replaying
+		 * them after the main file makes the newest entry win
+		 * through the status-merge path */
+		if (!ret && file_exists(job->journal_name)) {
+			if (pkg_hash_add_from_file
+			    (job->journal_name, NULL, job->dest, 1,
+			     SF_NEED_DETAIL))
+				ret = -1;
 		}
+
+		if (job->have_index)
+			pkg_index_close(&job->idx);
+		if (job->have_map)
+			file_map_close(&job->fmap);
+		if (job->have_jmap)
+			file_map_close(&job->jmap);
+		free(job->journal_name);
 	}
 
+	free(queue.jobs);
+
+	if (ret)
+		return ret;
+
+	opkg_profile_end(PROFILE_STATUS_LOAD);
+
 	return 0;
 }
 
@@ -269,7 +931,26 @@ int pkg_hash_load_package_details(void)
 	return 0;
 }
 
-pkg_t *pkg_hash_fetch_best_installation_candidate(abstract_pkg_t * apkg,
+/*
+ * Memo for best-installation-candidate lookups. Within one transaction
+ * the resolver asks about the same hot abstract packages dozens of
+ * times with identical constraints, and the answer only changes when
+ * some package's status flags flip; the install/remove paths call
+ * pkg_hash_candidate_cache_flush() whenever they do that.
+ */
+static __thread hash_table_t candidate_cache;
+static char candidate_cache_negative;	/* cached "no candidate" marker */
+static __thread int candidate_cache_gen;
+
+void pkg_hash_candidate_cache_flush(void)
+{
+	hash_table_deinit(&candidate_cache);
+	all_available_valid = 0;
+	all_installed_valid = 0;
+}
+
+static pkg_t *pkg_hash_fetch_best_installation_candidate_real(
+						  abstract_pkg_t * apkg,
 						  int (*constraint_fcn) (pkg_t *
 									 pkg,
 									 void
@@ -496,6 +1177,50 @@ pkg_t *pkg_hash_fetch_best_installation_candidate(abstract_pkg_t * apkg,
 	return NULL;
 }
 
+pkg_t *pkg_hash_fetch_best_installation_candidate(abstract_pkg_t * apkg,
+						  int (*constraint_fcn) (pkg_t *
+									 pkg,
+									 void
+									 *cdata),
+						  void *cdata, int quiet)
+{
+	char key[80];
+	void *hit;
+	pkg_t *pkg;
+
+	/* quiet also gates the arch-priority fallback, so it is part
+	 * of the key, as are the constraint and its closure data */
+	snprintf(key, sizeof(key), "%p.%p.%p.%d", (void *)apkg,
+		 (void *)constraint_fcn, cdata, quiet);
+
+	/* every install/remove/flag step bumps opkg_state_changed
+	 * before it flips any package state, so a stale generation
+	 * means the cached answers may no longer hold */
+	if (opkg_state_changed != candidate_cache_gen) {
+		pkg_hash_candidate_cache_flush();
+		candidate_cache_gen = opkg_state_changed;
+	}
+
+	if (!candidate_cache.entries)
+		hash_table_init("candidate-cache", &candidate_cache, 64);
+
+	hit = hash_table_get(&candidate_cache, key);
+	if (hit)
+		return hit == (void *)&candidate_cache_negative ? NULL : hit;
+
+	opkg_profile_begin(PROFILE_RESOLVE);
+	pkg = pkg_hash_fetch_best_installation_candidate_real(apkg,
+							      constraint_fcn,
+							      cdata, quiet);
+	opkg_profile_end(PROFILE_RESOLVE);
+
+	hash_table_insert(&candidate_cache, key,
+			  pkg ? (void *)pkg
+			      : (void *)&candidate_cache_negative);
+
+	return pkg;
+}
+
 static int pkg_name_constraint_fcn(pkg_t * pkg, void *cdata)
 {
 	const char *name = (const char *)cdata;
@@ -544,18 +1269,17 @@ pkg_t *pkg_hash_fetch_by_name_version(const char *pkg_name, const char *version)
 {
 	pkg_vec_t *vec;
 	int i;
+	char vbuf[PKG_VERSION_STR_MAX];
 	char *version_str = NULL;
 
 	if (!(vec = pkg_vec_fetch_by_name(pkg_name)))
 		return NULL;
 
 	for (i = 0; i < vec->len; i++) {
-		version_str = pkg_version_str_alloc(vec->pkgs[i]);
-		if (!strcmp(version_str, version)) {
-			free(version_str);
+		version_str = pkg_version_str_r(vec->pkgs[i], vbuf,
+						sizeof(vbuf));
+		if (version_str && !strcmp(version_str, version))
 			break;
-		}
-		free(version_str);
 	}
 
 	if (i == vec->len)
@@ -626,6 +1350,35 @@ void pkg_hash_fetch_available(pkg_vec_t * all)
 			   all);
 }
 
+/* every install/remove/flag step bumps opkg_state_changed, which
+ * doubles as the staleness check for the borrowed vectors */
+static void fetch_cache_check_gen(void)
+{
+	/* the installed view is not tied to the generation: status
+	 * transitions keep it current through
+	 * pkg_hash_note_status_change() */
+	if (opkg_state_changed != fetch_cache_gen) {
+		all_available_valid = 0;
+		fetch_cache_gen = opkg_state_changed;
+	}
+}
+
+pkg_vec_t *pkg_hash_fetch_available_cached(void)
+{
+	fetch_cache_check_gen();
+
+	if (!all_available_vec)
+		all_available_vec = pkg_vec_alloc();
+
+	if (!all_available_valid) {
+		pkg_vec_clear(all_available_vec);
+		pkg_hash_fetch_available(all_available_vec);
+		all_available_valid = 1;
+	}
+
+	return all_available_vec;
+}
+
 static void
 pkg_hash_fetch_all_installed_helper(const char *pkg_name, void *entry,
 				    void *data)
@@ -652,6 +1405,177 @@ void pkg_hash_fetch_all_installed(pkg_vec_t * all)
 			   all);
 }
 
+pkg_vec_t *pkg_hash_fetch_all_installed_cached(void)
+{
+	if (!all_installed_vec)
+		all_installed_vec = pkg_vec_alloc();
+
+	if (!all_installed_valid) {
+		pkg_vec_clear(all_installed_vec);
+		pkg_hash_fetch_all_installed(all_installed_vec);
+		all_installed_valid = 1;
+	}
+
+	return all_installed_vec;
+}
+
+/*
+ * Status transitions funnel through pkg_set_state_status(), which
+ * reports them here so the installed view above can be patched in
+ * place instead of being rebuilt by a whole-hash scan. This is what
+ * keeps it valid across opkg_state_changed bumps: those track exactly
+ * the transitions reported to this function, while additions and
+ * removals of packages invalidate the view wholesale through
+ * pkg_hash_candidate_cache_flush().
+ */
+void pkg_hash_note_status_change(pkg_t * pkg, pkg_state_status_t new_status)
+{
+	unsigned int i;
+	int was, is;
+
+	if (!all_installed_valid)
+		return;
+
+	was = pkg->state_status == SS_INSTALLED
+	    || pkg->state_status == SS_UNPACKED;
+	is = new_status == SS_INSTALLED || new_status == SS_UNPACKED;
+
+	if (was == is)
+		return;
+
+	if (is) {
+		pkg_vec_insert(all_installed_vec, pkg);
+		return;
+	}
+
+	for (i = 0; i < all_installed_vec->len; i++) {
+		if (all_installed_vec->pkgs[i] != pkg)
+			continue;
+		memmove(&all_installed_vec->pkgs[i],
+			&all_installed_vec->pkgs[i + 1],
+			(all_installed_vec->len - i - 1) *
+			sizeof(all_installed_vec->pkgs[0]));
+		all_installed_vec->len--;
+		return;
+	}
+}
+
+/*
+ * Low-memory mode: once the install set is ordered, feed candidates
+ * outside the transaction only hold memory through the download and
+ * extract phases. Drop them in one walk over the hash. The pkg_t
+ * structs themselves are arena-carved and stay behind, but the packed
+ * field blob and dependency arrays each one owns are returned to the
+ * allocator, which is where nearly all of the per-package footprint
+ * lives. The abstract package graph is left intact so provider and
+ * conflict lookups against the remaining packages keep working.
+ */
+static void pkg_hash_prune_helper(const char *pkg_name, void *entry,
+				  void *data)
+{
+	abstract_pkg_t *ab_pkg = (abstract_pkg_t *) entry;
+	pkg_vec_t *vec = ab_pkg->pkgs;
+	unsigned int i, kept = 0;
+	pkg_t *pkg;
+
+	if (!vec)
+		return;
+
+	for (i = 0; i < vec->len; i++) {
+		pkg = vec->pkgs[i];
+
+		if ((pkg->state_flag & SF_MARKED)
+		    || pkg->state_status != SS_NOT_INSTALLED
+		    || pkg->state_want == SW_INSTALL) {
+			vec->pkgs[kept++] = pkg;
+			continue;
+		}
+
+		(*(unsigned int *)data)++;
+		pkg_free(pkg);
+	}
+
+	vec->len = kept;
+}
+
+void pkg_hash_prune_to_transaction(pkg_vec_t * keep)
+{
+	unsigned int i, dropped = 0;
+
+	for (i = 0; i < keep->len; i++)
+		keep->pkgs[i]->state_flag |= SF_MARKED;
+
+	hash_table_foreach(&conf->pkg_hash, pkg_hash_prune_helper, &dropped);
+
+	for (i = 0; i < keep->len; i++)
+		keep->pkgs[i]->state_flag &= ~SF_MARKED;
+
+	/* cached candidate and all-available/installed vectors may
+	 * reference pruned packages */
+	pkg_hash_candidate_cache_flush();
+
+	opkg_msg(DEBUG, "Dropped %u non-transaction packages.\n", dropped);
+}
+
+struct ab_pkg_gather {
+	abstract_pkg_t **pkgs;
+	unsigned int len, alloc;
+};
+
+static void
+pkg_hash_gather_names_helper(const char *pkg_name, void *entry, void *data)
+{
+	struct ab_pkg_gather *gather = data;
+
+	if (gather->len == gather->alloc) {
+		gather->alloc = gather->alloc ? gather->alloc * 2 : 1024;
+		gather->pkgs = xrealloc(gather->pkgs,
+					gather->alloc *
+					sizeof(gather->pkgs[0]));
+	}
+
+	gather->pkgs[gather->len++] = entry;
+}
+
+static int ab_pkg_name_cmp(const void *a, const void *b)
+{
+	const abstract_pkg_t *const *pa = a, *const *pb = b;
+
+	return strcmp((*pa)->name, (*pb)->name);
+}
+
+/*
+ * Visit every package in ascending name order. Only the per-name
+ * abstract packages are collected and sorted, which stays small next
+ * to a vector of every version of every package, and the callback
+ * starts running as soon as the name index is ready instead of after
+ * full materialization.
+ */
+void pkg_hash_foreach_by_name(void (*f) (pkg_t * pkg, void *data), void *data)
+{
+	struct ab_pkg_gather gather;
+	unsigned int i;
+	int j;
+
+	memset(&gather, 0, sizeof(gather));
+	hash_table_foreach(&conf->pkg_hash, pkg_hash_gather_names_helper,
+			   &gather);
+	qsort(gather.pkgs, gather.len, sizeof(gather.pkgs[0]),
+	      ab_pkg_name_cmp);
+
+	for (i = 0; i < gather.len; i++) {
+		pkg_vec_t *pkg_vec = gather.pkgs[i]->pkgs;
+
+		if (!pkg_vec)
+			continue;
+
+		for (j = 0; j < pkg_vec->len; j++)
+			f(pkg_vec->pkgs[j], data);
+	}
+
+	free(gather.pkgs);
+}
+
 /*
  * This assumes that the abstract pkg doesn't exist.
  */
@@ -659,9 +1583,10 @@ static abstract_pkg_t *add_new_abstract_pkg_by_name(const char *pkg_name)
 {
 	abstract_pkg_t *ab_pkg;
 
-	ab_pkg = abstract_pkg_new();
+	ab_pkg = abstract_pkg_new_arena(pkg_depends_arena());
 
-	ab_pkg->name = xstrdup(pkg_name);
+	ab_pkg->name = arena_strndup(pkg_depends_arena(), pkg_name,
+				     strlen(pkg_name));
 	hash_table_insert(&conf->pkg_hash, pkg_name, ab_pkg);
 
 	return ab_pkg;
@@ -680,6 +1605,10 @@ abstract_pkg_t *ensure_abstract_pkg_by_name(const char *pkg_name)
 void hash_insert_pkg(pkg_t * pkg, int set_status)
 {
 	abstract_pkg_t *ab_pkg;
+	enum xalloc_tag old_tag;
+
+	/* a new package can change any cached candidate answer */
+	pkg_hash_candidate_cache_flush();
 
 	ab_pkg = ensure_abstract_pkg_by_name(pkg->name);
 	if (!ab_pkg->pkgs)
@@ -691,6 +1620,9 @@ void hash_insert_pkg(pkg_t * pkg, int set_status)
 		ab_pkg->state_status = SS_UNPACKED;
 	}
 
+	opkg_profile_begin(PROFILE_DEPENDS_BUILD);
+	old_tag = xalloc_tag_set(XALLOC_TAG_DEPENDS);
+
 	buildDepends(pkg);
 
 	buildProvides(ab_pkg, pkg);
@@ -706,6 +1638,9 @@ void hash_insert_pkg(pkg_t * pkg, int set_status)
 
 	buildDependedUponBy(pkg, ab_pkg);
 
+	xalloc_tag_set(old_tag);
+	opkg_profile_end(PROFILE_DEPENDS_BUILD);
+
 	pkg_vec_insert_merge(ab_pkg->pkgs, pkg, set_status);
 	pkg->parent = ab_pkg;
 }
@@ -738,6 +1673,7 @@ pkg_t *file_hash_get_file_owner(const char *file_name)
 void file_hash_set_file_owner(const char *file_name, pkg_t * owning_pkg)
 {
 	pkg_t *old_owning_pkg;
+	enum xalloc_tag old_tag;
 	int file_name_len = strlen(file_name);
 
 	if (file_name[file_name_len - 1] == '/')
@@ -746,11 +1682,13 @@ void file_hash_set_file_owner(const char *file_name, pkg_t * owning_pkg)
 	file_name = strip_offline_root(file_name);
 
 	old_owning_pkg = hash_table_get(&conf->file_hash, file_name);
+	old_tag = xalloc_tag_set(XALLOC_TAG_FILE_HASH);
 	hash_table_insert(&conf->file_hash, file_name, owning_pkg);
+	xalloc_tag_set(old_tag);
 
 	if (old_owning_pkg) {
 		pkg_get_installed_files(old_owning_pkg);
-		str_list_remove_elt(old_owning_pkg->installed_files, file_name);
+		str_vec_remove_str(old_owning_pkg->installed_files, file_name);
 		pkg_free_installed_files(old_owning_pkg);
 
 		/* mark this package to have its filelist written */
@@ -28,6 +28,11 @@ void pkg_hash_deinit(void);
 
 void pkg_hash_fetch_available(pkg_vec_t * available);
 
+/* borrowed canonical vectors: valid until the next hash mutation or
+ * package state change, do not free (sorting in place is fine) */
+pkg_vec_t *pkg_hash_fetch_available_cached(void);
+pkg_vec_t *pkg_hash_fetch_all_installed_cached(void);
+
 int dist_hash_add_from_file(const char *file_name, pkg_src_t * dist);
 int pkg_hash_add_from_file(const char *file_name, pkg_src_t * src,
 			   pkg_dest_t * dest, int is_status_file, int state_flags);
@@ -44,8 +49,12 @@ static inline abstract_pkg_t *abstract_pkg_fetch_by_name(const char *pkg_name)
 
 abstract_pkg_t *ensure_abstract_pkg_by_name(const char *pkg_name);
 void pkg_hash_fetch_all_installed(pkg_vec_t * installed);
+void pkg_hash_foreach_by_name(void (*f) (pkg_t * pkg, void *data), void *data);
 pkg_t *pkg_hash_fetch_by_name_version(const char *pkg_name,
 				      const char *version);
+void pkg_hash_candidate_cache_flush(void);
+void pkg_hash_prune_to_transaction(pkg_vec_t * keep);
+void pkg_hash_note_status_change(pkg_t * pkg, pkg_state_status_t new_status);
 pkg_t *pkg_hash_fetch_best_installation_candidate(abstract_pkg_t * apkg,
 						  int (*constraint_fcn) (pkg_t *
 									 pkg,
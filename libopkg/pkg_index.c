@@ -0,0 +1,389 @@
+/* pkg_index.c - the opkg package management system
+
+   Copyright (C) 2009 Ubiq Technologies <graham.gower@gmail.com>
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "pkg_index.h"
+#include "hash_table.h"
+#include "opkg_message.h"
+#include "sprintf_alloc.h"
+#include "libbb/libbb.h"
+#include "libbb/gzip.h"
+
+/*
+ * Read the whole (possibly gzip-compressed) package list into memory.
+ */
+char *pkg_index_read_list(const char *list_file, pkg_src_t * src,
+			  size_t *lenp)
+{
+	FILE *fp;
+	struct gzip_handle zh;
+	struct stat st;
+	char *buf = NULL;
+	size_t len = 0, cap = 0;
+	ssize_t n;
+
+	if (src && src->gzip)
+		fp = gzip_fdopen(&zh, list_file);
+	else
+		fp = fopen(list_file, "r");
+
+	if (fp == NULL) {
+		opkg_perror(ERROR, "Failed to open %s", list_file);
+		return NULL;
+	}
+
+	/* Size the buffer from the file upfront: exactly for plain
+	 * lists, with a typical expansion factor for gzip ones, so the
+	 * usual case needs no realloc copying at all.
+	 */
+	if (stat(list_file, &st) == 0 && st.st_size > 0) {
+		cap = st.st_size;
+		if (src && src->gzip)
+			cap *= 4;
+		buf = xrealloc(buf, cap);
+	}
+
+	do {
+		if (len == cap) {
+			cap = cap ? cap * 2 : 65536;
+			buf = xrealloc(buf, cap);
+		}
+		n = fread(buf + len, 1, cap - len, fp);
+		len += n;
+	} while (n > 0);
+
+	fclose(fp);
+
+	if (src && src->gzip)
+		gzip_close(&zh);
+
+	*lenp = len;
+	return buf;
+}
+
+/*
+ * Advance *pp past leading blank lines and over the next stanza,
+ * including the blank line terminating it. Returns the stanza start, or
+ * NULL when the buffer is exhausted.
+ */
+const char *pkg_index_next_stanza(const char **pp, const char *end)
+{
+	const char *p = *pp, *stanza, *nl;
+
+	while (p < end && (*p == '\n' ||
+			   (*p == '\r' && p + 1 < end && p[1] == '\n')))
+		p = memchr(p, '\n', end - p) + 1;
+
+	if (p >= end) {
+		*pp = end;
+		return NULL;
+	}
+
+	stanza = p;
+
+	while (p < end) {
+		nl = memchr(p, '\n', end - p);
+		if (!nl) {
+			p = end;
+			break;
+		}
+		if (nl == p || (*p == '\r' && nl == p + 1)) {
+			p = nl + 1;
+			break;
+		}
+		p = nl + 1;
+	}
+
+	*pp = p;
+	return stanza;
+}
+
+const char *pkg_index_stanza_name(const char *stanza, const char *end,
+				  size_t *name_len)
+{
+	const char *p = stanza, *nl, *s, *e;
+
+	while (p < end) {
+		nl = memchr(p, '\n', end - p);
+		if (!nl)
+			nl = end;
+
+		if (nl - p > 8 && strncmp(p, "Package:", 8) == 0) {
+			s = p + 8;
+			while (s < nl && isspace(*s))
+				s++;
+			e = nl;
+			while (e > s && isspace(e[-1]))
+				e--;
+			*name_len = e - s;
+			return s;
+		}
+
+		p = nl + 1;
+	}
+
+	return NULL;
+}
+
+struct name_sort_entry {
+	const char *name;
+	uint32_t rec;
+};
+
+static int name_sort_entry_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct name_sort_entry *)a)->name,
+		      ((const struct name_sort_entry *)b)->name);
+}
+
+/*
+ * Build the binary index for a downloaded package list and move it into
+ * place atomically, so readers only ever see a complete index.
+ */
+int pkg_index_write(const char *list_file, pkg_src_t * src)
+{
+	struct pkg_index_header hdr;
+	struct pkg_index_record *records = NULL;
+	struct name_sort_entry *sorted = NULL;
+	struct stat st;
+	char *text, *names = NULL, *idx_file, *tmp_file;
+	const char *p, *end, *stanza, *name;
+	size_t text_len, name_len, names_len = 0, names_cap = 0;
+	uint32_t n_records = 0, n_alloc = 0, *name_idx = NULL, i;
+	FILE *fp;
+	int ret = -1;
+
+	if (stat(list_file, &st) == -1) {
+		opkg_perror(ERROR, "Failed to stat %s", list_file);
+		return -1;
+	}
+
+	text = pkg_index_read_list(list_file, src, &text_len);
+	if (text == NULL)
+		return -1;
+
+	p = text;
+	end = text + text_len;
+
+	while ((stanza = pkg_index_next_stanza(&p, end)) != NULL) {
+		name = pkg_index_stanza_name(stanza, p, &name_len);
+		if (name == NULL || name_len == 0)
+			continue;
+
+		if (n_records == n_alloc) {
+			n_alloc = n_alloc ? n_alloc * 2 : 1024;
+			records = xrealloc(records,
+					   n_alloc * sizeof(records[0]));
+		}
+
+		if (names_len + name_len + 1 > names_cap) {
+			names_cap = names_cap ? names_cap * 2 : 16384;
+			names = xrealloc(names, names_cap);
+		}
+
+		records[n_records].name_off = text_len + names_len;
+		records[n_records].name_len = name_len;
+		records[n_records].name_hash =
+		    hash_table_string_hash_len(name, name_len);
+		records[n_records].pad = 0;
+		records[n_records].stanza_off = stanza - text;
+		records[n_records].stanza_len = p - stanza;
+		n_records++;
+
+		memcpy(names + names_len, name, name_len);
+		names[names_len + name_len] = '\0';
+		names_len += name_len + 1;
+	}
+
+	/* build the sorted name table once the names buffer is final;
+	 * name_off counts from the start of the data area, which begins
+	 * with the stanza text */
+	if (n_records) {
+		sorted = xmalloc(n_records * sizeof(sorted[0]));
+		name_idx = xmalloc(n_records * sizeof(name_idx[0]));
+		for (i = 0; i < n_records; i++) {
+			sorted[i].name =
+			    names + (records[i].name_off - text_len);
+			sorted[i].rec = i;
+		}
+		qsort(sorted, n_records, sizeof(sorted[0]),
+		      name_sort_entry_cmp);
+		for (i = 0; i < n_records; i++)
+			name_idx[i] = sorted[i].rec;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = PKG_INDEX_MAGIC;
+	hdr.version = PKG_INDEX_VERSION;
+	hdr.src_size = st.st_size;
+	hdr.src_mtime = st.st_mtime;
+	hdr.n_records = n_records;
+
+	sprintf_alloc(&idx_file, "%s%s", list_file, PKG_INDEX_SUFFIX);
+	/* pid-unique staging name: concurrent opkg instances sharing a
+	 * lists dir (bulk provisioning) may rebuild the same index, and
+	 * each rename must publish a self-consistent file */
+	sprintf_alloc(&tmp_file, "%s.tmp.%d", idx_file, (int)getpid());
+
+	fp = fopen(tmp_file, "w");
+	if (fp == NULL) {
+		opkg_perror(ERROR, "Failed to open %s", tmp_file);
+		goto out;
+	}
+
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    (n_records &&
+	     fwrite(records, sizeof(records[0]), n_records, fp) != n_records)
+	    || (n_records &&
+		fwrite(name_idx, sizeof(name_idx[0]), n_records,
+		       fp) != n_records)
+	    || (text_len && fwrite(text, 1, text_len, fp) != text_len)
+	    || (names_len && fwrite(names, 1, names_len, fp) != names_len)
+	    || fclose(fp) == EOF) {
+		opkg_perror(ERROR, "Failed to write %s", tmp_file);
+		unlink(tmp_file);
+		goto out;
+	}
+
+	if (rename(tmp_file, idx_file) == -1) {
+		opkg_perror(ERROR, "Failed to rename %s to %s", tmp_file,
+			    idx_file);
+		unlink(tmp_file);
+		goto out;
+	}
+
+	opkg_msg(DEBUG, "Wrote feed index %s (%u packages).\n", idx_file,
+		 n_records);
+	ret = 0;
+
+out:
+	free(idx_file);
+	free(tmp_file);
+	free(records);
+	free(sorted);
+	free(name_idx);
+	free(names);
+	free(text);
+	return ret;
+}
+
+/*
+ * Map and validate the index belonging to a package list. Returns
+ * nonzero when the index is missing, stale or malformed, in which case
+ * the caller should fall back to parsing the text list.
+ */
+int pkg_index_open(struct pkg_index *idx, const char *list_file)
+{
+	struct stat st;
+	char *idx_file;
+	size_t min_len;
+	uint32_t i;
+	int err;
+
+	memset(idx, 0, sizeof(*idx));
+
+	if (stat(list_file, &st) == -1)
+		return -1;
+
+	sprintf_alloc(&idx_file, "%s%s", list_file, PKG_INDEX_SUFFIX);
+	err = file_map_open(&idx->map, idx_file);
+	free(idx_file);
+
+	if (err || idx->map.len < sizeof(struct pkg_index_header)) {
+		file_map_close(&idx->map);
+		return -1;
+	}
+
+	idx->hdr = (struct pkg_index_header *)idx->map.base;
+
+	if (idx->hdr->magic != PKG_INDEX_MAGIC ||
+	    idx->hdr->version != PKG_INDEX_VERSION ||
+	    idx->hdr->src_size != (uint64_t) st.st_size ||
+	    idx->hdr->src_mtime != (uint64_t) st.st_mtime)
+		goto stale;
+
+	min_len = sizeof(struct pkg_index_header) +
+	    (size_t) idx->hdr->n_records * (sizeof(struct pkg_index_record) +
+					    sizeof(uint32_t));
+	if (idx->map.len < min_len)
+		goto stale;
+
+	idx->records = (struct pkg_index_record *)
+	    (idx->map.base + sizeof(struct pkg_index_header));
+	idx->name_idx = (uint32_t *) (idx->records + idx->hdr->n_records);
+	idx->data = idx->map.base + min_len;
+	idx->data_len = idx->map.len - min_len;
+
+	for (i = 0; i < idx->hdr->n_records; i++) {
+		struct pkg_index_record *rec = &idx->records[i];
+
+		if ((size_t) rec->name_off + rec->name_len >= idx->data_len ||
+		    (size_t) rec->stanza_off + rec->stanza_len > idx->data_len
+		    || idx->data[rec->name_off + rec->name_len] != '\0'
+		    || idx->name_idx[i] >= idx->hdr->n_records)
+			goto stale;
+	}
+
+	return 0;
+
+stale:
+	opkg_msg(DEBUG, "Feed index for %s is stale or corrupt, "
+		 "falling back to text parsing.\n", list_file);
+	file_map_close(&idx->map);
+	memset(idx, 0, sizeof(*idx));
+	return -1;
+}
+
+void pkg_index_close(struct pkg_index *idx)
+{
+	file_map_close(&idx->map);
+	memset(idx, 0, sizeof(*idx));
+}
+
+/*
+ * Emit every package name with the given prefix, in sorted order.
+ * Binary search over the sorted name table finds the first name not
+ * below the prefix; the matches follow contiguously.
+ */
+void pkg_index_complete(struct pkg_index *idx, const char *prefix,
+			void (*emit) (const char *name, void *data),
+			void *data)
+{
+	size_t plen = strlen(prefix);
+	uint32_t lo = 0, hi = idx->hdr->n_records, mid;
+	const char *name;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		name = idx->data + idx->records[idx->name_idx[mid]].name_off;
+		if (strncmp(name, prefix, plen) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (; lo < idx->hdr->n_records; lo++) {
+		name = idx->data + idx->records[idx->name_idx[lo]].name_off;
+		if (strncmp(name, prefix, plen) != 0)
+			break;
+		emit(name, data);
+	}
+}
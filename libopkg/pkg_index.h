@@ -0,0 +1,81 @@
+/* pkg_index.h - the opkg package management system
+
+   Copyright (C) 2009 Ubiq Technologies <graham.gower@gmail.com>
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef PKG_INDEX_H
+#define PKG_INDEX_H
+
+#include <stdint.h>
+
+#include "file_util.h"
+#include "pkg_src.h"
+
+/*
+ * Binary pre-parsed feed index, written next to each downloaded package
+ * list by `opkg update` and mmapped on load instead of re-parsing the
+ * text feed. The file is self-contained: the record table carries one
+ * fixed-width entry per package stanza and the data area holds the
+ * NUL-terminated package names plus the uncompressed stanza text, so
+ * gzip-compressed feeds never have to be decompressed again. A table
+ * of record numbers sorted by package name follows the records, so
+ * name-prefix queries (shell completion) can binary search the index
+ * without parsing anything.
+ */
+
+#define PKG_INDEX_MAGIC		0x6b64694f	/* "Oidk" */
+#define PKG_INDEX_VERSION	3
+#define PKG_INDEX_SUFFIX	".idx"
+
+struct pkg_index_header {
+	uint32_t magic;
+	uint32_t version;
+	/* size/mtime of the package list this index was built from,
+	 * used to detect staleness */
+	uint64_t src_size;
+	uint64_t src_mtime;
+	uint32_t n_records;
+	uint32_t pad;
+};
+
+struct pkg_index_record {
+	uint32_t name_off;	/* NUL-terminated name in the data area */
+	uint32_t name_len;
+	uint32_t name_hash;	/* hash_table_string_hash() of the name */
+	uint32_t pad;
+	uint32_t stanza_off;	/* stanza text in the data area */
+	uint32_t stanza_len;
+};
+
+struct pkg_index {
+	struct file_map map;
+	struct pkg_index_header *hdr;
+	struct pkg_index_record *records;
+	uint32_t *name_idx;	/* record numbers sorted by name */
+	char *data;
+	size_t data_len;
+};
+
+char *pkg_index_read_list(const char *list_file, pkg_src_t * src,
+			  size_t *lenp);
+const char *pkg_index_next_stanza(const char **pp, const char *end);
+const char *pkg_index_stanza_name(const char *stanza, const char *end,
+				  size_t *name_len);
+int pkg_index_write(const char *list_file, pkg_src_t * src);
+int pkg_index_open(struct pkg_index *idx, const char *list_file);
+void pkg_index_close(struct pkg_index *idx);
+void pkg_index_complete(struct pkg_index *idx, const char *prefix,
+			void (*emit) (const char *name, void *data),
+			void *data);
+
+#endif
@@ -0,0 +1,178 @@
+/* pkg_order.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "pkg_order.h"
+#include "pkg_depends.h"
+#include "hash_table.h"
+#include "opkg_message.h"
+#include "libbb/libbb.h"
+
+struct pkg_edge {
+	int from;		/* the dependency; ordered first */
+	int to;			/* the dependent */
+};
+
+/*
+ * Append the installed and unpacked packages of pkgs to ordered so
+ * every package comes after its dependencies, using Kahn's algorithm
+ * over flat index arrays: one pass collects the dependency edges among
+ * the packages present, one counting sort turns them into adjacency
+ * lists, and the queue walk emits the order. No per-node allocation or
+ * recursion, so large transactions order in linear time.
+ *
+ * Dependency cycles are broken by appending the involved packages in
+ * their input order, which is what the old recursive reordering
+ * effectively did.
+ */
+static int pkg_vec_order(pkg_vec_t * pkgs, pkg_vec_t * ordered,
+			 int include_all)
+{
+	hash_table_t name_idx;
+	compound_depend_t *compound_depend;
+	abstract_pkg_t *abpkg, **providers;
+	pkg_t **nodes;
+	struct pkg_edge *edges = NULL;
+	int *in_degree, *adj_off, *adj, *cursor, *queue;
+	int n = 0, n_edges = 0, n_alloc = 0;
+	int i, k, l, from, head, tail;
+	intptr_t e;
+
+	nodes = xcalloc(pkgs->len ? pkgs->len : 1, sizeof(nodes[0]));
+
+	memset(&name_idx, 0, sizeof(name_idx));
+	hash_table_init("pkg-order", &name_idx, pkgs->len ? pkgs->len : 1);
+
+	/* node set: everything installed or unpacked; the name map
+	 * resolves dependency edges to the first package of a name,
+	 * mirroring how the configure reordering picked satisfiers */
+	for (i = 0; i < pkgs->len; i++) {
+		pkg_t *pkg = pkgs->pkgs[i];
+
+		if (!include_all && pkg->state_status == SS_NOT_INSTALLED)
+			continue;
+
+		nodes[n] = pkg;
+		if (!hash_table_get(&name_idx, pkg->name))
+			hash_table_insert(&name_idx, pkg->name,
+					  (void *)(intptr_t) (n + 1));
+		n++;
+	}
+
+	/* collect edges: for each dependency possibility, the first
+	 * provider present in the node set must be ordered first */
+	for (i = 0; i < n; i++) {
+		for (compound_depend = pkg_get_ptr(nodes[i], PKG_DEPENDS);
+		     compound_depend && compound_depend->type;
+		     compound_depend++) {
+			for (k = 0; k < compound_depend->possibility_count;
+			     k++) {
+				abpkg = compound_depend->possibilities[k]->pkg;
+				providers = abpkg->provided_by->pkgs;
+
+				for (l = 0; providers
+				     && l < abpkg->provided_by->len
+				     && providers[l]; l++) {
+					e = (intptr_t)
+					    hash_table_get(&name_idx,
+							   providers[l]->name);
+					if (!e)
+						continue;
+
+					from = e - 1;
+					if (from != i) {
+						if (n_edges == n_alloc) {
+							n_alloc = n_alloc ?
+							    n_alloc * 2 : 64;
+							edges = xrealloc(edges,
+							    n_alloc *
+							    sizeof(edges[0]));
+						}
+						edges[n_edges].from = from;
+						edges[n_edges].to = i;
+						n_edges++;
+					}
+					break;
+				}
+			}
+		}
+	}
+
+	/* counting sort of the edges into flat adjacency lists */
+	in_degree = xcalloc(n ? n : 1, sizeof(int));
+	adj_off = xcalloc(n + 1, sizeof(int));
+	cursor = xcalloc(n + 1, sizeof(int));
+	adj = xcalloc(n_edges ? n_edges : 1, sizeof(int));
+	queue = xcalloc(n ? n : 1, sizeof(int));
+
+	for (i = 0; i < n_edges; i++) {
+		in_degree[edges[i].to]++;
+		adj_off[edges[i].from + 1]++;
+	}
+	for (i = 0; i < n; i++) {
+		adj_off[i + 1] += adj_off[i];
+		cursor[i] = adj_off[i];
+	}
+	for (i = 0; i < n_edges; i++)
+		adj[cursor[edges[i].from]++] = edges[i].to;
+
+	head = tail = 0;
+	for (i = 0; i < n; i++)
+		if (in_degree[i] == 0)
+			queue[tail++] = i;
+
+	while (head < tail) {
+		i = queue[head++];
+		pkg_vec_insert(ordered, nodes[i]);
+		for (k = adj_off[i]; k < adj_off[i + 1]; k++)
+			if (--in_degree[adj[k]] == 0)
+				queue[tail++] = adj[k];
+	}
+
+	/* whatever was never enqueued sits on a dependency cycle */
+	for (i = 0; i < n; i++) {
+		if (in_degree[i] > 0) {
+			opkg_msg(DEBUG, "Dependency cycle involving pkg %s.\n",
+				 nodes[i]->name);
+			pkg_vec_insert(ordered, nodes[i]);
+		}
+	}
+
+	hash_table_deinit(&name_idx);
+	free(nodes);
+	free(edges);
+	free(in_degree);
+	free(adj_off);
+	free(cursor);
+	free(adj);
+	free(queue);
+
+	return 0;
+}
+
+int pkg_vec_order_by_depends(pkg_vec_t * pkgs, pkg_vec_t * ordered)
+{
+	return pkg_vec_order(pkgs, ordered, 0);
+}
+
+/*
+ * Same ordering, but over every package in pkgs regardless of status;
+ * used to sequence a computed install set before anything is unpacked.
+ */
+int pkg_vec_order_all_by_depends(pkg_vec_t * pkgs, pkg_vec_t * ordered)
+{
+	return pkg_vec_order(pkgs, ordered, 1);
+}
@@ -0,0 +1,23 @@
+/* pkg_order.h - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef PKG_ORDER_H
+#define PKG_ORDER_H
+
+#include "pkg.h"
+#include "pkg_vec.h"
+
+int pkg_vec_order_by_depends(pkg_vec_t * pkgs, pkg_vec_t * ordered);
+int pkg_vec_order_all_by_depends(pkg_vec_t * pkgs, pkg_vec_t * ordered);
+
+#endif
@@ -18,12 +18,16 @@
 
 #include <stdio.h>
 #include <ctype.h>
+#include <string.h>
 #include <unistd.h>
 
+#include <libubox/utils.h>
+
 #include "pkg.h"
 #include "opkg_utils.h"
 #include "pkg_parse.h"
 #include "pkg_depends.h"
+#include "opkg_profile.h"
 #include "libbb/libbb.h"
 
 #include "file_util.h"
@@ -47,9 +51,14 @@ static void parse_status(pkg_t * pkg, const char *sstr)
 static void parse_conffiles(pkg_t * pkg, const char *cstr)
 {
 	conffile_list_t *cl;
+	conffile_t *cf;
 	char file_name[1024], md5sum[85];
+	unsigned long mtime = 0, size = 0;
 
-	if (sscanf(cstr, "%1023s %84s", file_name, md5sum) != 2) {
+	/* the trailing stat cache columns are optional; lines written
+	   by older versions carry just the name and checksum */
+	if (sscanf(cstr, "%1023s %84s %lu %lu",
+		   file_name, md5sum, &mtime, &size) < 2) {
 		opkg_msg(ERROR, "Failed to parse Conffiles line for %s\n",
 			 pkg->name);
 		return;
@@ -57,17 +66,27 @@ static void parse_conffiles(pkg_t * pkg, const char *cstr)
 
 	cl = pkg_get_ptr(pkg, PKG_CONFFILES);
 
-	if (cl)
-		conffile_list_append(cl, file_name, md5sum);
+	if (cl) {
+		cf = conffile_list_append(cl, file_name, md5sum);
+		if (cf) {
+			cf->mtime = mtime;
+			cf->size = size;
+		}
+	}
 }
 
 int parse_version(pkg_t * pkg, const char *vstr)
 {
-	char *colon, *dup, *rev;
+	char *colon, *rev;
 
 	if (strncmp(vstr, "Version:", 8) == 0)
 		vstr += 8;
 
+	/* the comparison key caches the old version fields */
+	free(pkg->version_cmpkey);
+	pkg->version_cmpkey = NULL;
+	pkg->version_cmpkey_len = 0;
+
 	while (*vstr && isspace(*vstr))
 		vstr++;
 
@@ -82,17 +101,15 @@ int parse_version(pkg_t * pkg, const char *vstr)
 	}
 
 
-	dup = xstrdup(vstr);
-	rev = strrchr(dup, '-');
+	rev = strrchr(vstr, '-');
 
 	if (rev) {
-		*rev++ = '\0';
-		pkg_set_string(pkg, PKG_REVISION, rev);
+		pkg_set_string(pkg, PKG_REVISION, rev + 1);
+		pkg_set_string_len(pkg, PKG_VERSION, vstr, rev - vstr);
+	} else {
+		pkg_set_string(pkg, PKG_VERSION, vstr);
 	}
 
-	pkg_set_string(pkg, PKG_VERSION, dup);
-	free(dup);
-
 	return 0;
 }
 
@@ -189,15 +206,23 @@ static void parse_alternatives(pkg_t *pkg, char *list)
 	}
 }
 
+/* total control-file bytes run through pkg_parse_line() */
+__thread unsigned long long pkg_parse_bytes;
+
 int pkg_parse_line(void *ptr, char *line, uint mask)
 {
 	pkg_t *pkg = (pkg_t *) ptr;
 	abstract_pkg_t *ab_pkg = NULL;
 	conffile_list_t *cl;
+	const char *colon;
+	size_t field_len;
+	enum xalloc_tag old_tag = xalloc_tag_set(XALLOC_TAG_PARSER);
+
+	pkg_parse_bytes += strlen(line) + 1;
 
 	/* these flags are a bit hackish... */
-	static int reading_conffiles = 0, reading_description = 0;
-	static char *description = NULL;
+	static __thread int reading_conffiles = 0, reading_description = 0;
+	static __thread char *description = NULL;
 	int ret = 0;
 
 	/* Exclude globally masked fields. */
@@ -206,23 +231,30 @@ int pkg_parse_line(void *ptr, char *line, uint mask)
 	/* Flip the semantics of the mask. */
 	mask ^= PFM_ALL;
 
+	/* Field names end at the first colon; find it once (strchr uses
+	 * the platform's vectorized scanner) and match candidates by
+	 * exact length instead of strncmp'ing each of them over the
+	 * line. */
+	colon = strchr(line, ':');
+	field_len = colon ? (size_t) (colon - line) : 0;
+
 	switch (*line) {
 	case 'A':
-		if ((mask & PFM_ALTERNATIVES) && is_field("Alternatives", line))
+		if ((mask & PFM_ALTERNATIVES) && is_fieldn("Alternatives", line, field_len))
 			parse_alternatives(pkg, line + strlen("Alternatives") + 1);
-		else if ((mask & PFM_ARCHITECTURE) && is_field("Architecture", line))
+		else if ((mask & PFM_ARCHITECTURE) && is_fieldn("Architecture", line, field_len))
 			parse_architecture(pkg, line + strlen("Architecture") + 1);
 		else if ((mask & PFM_AUTO_INSTALLED)
-			   && is_field("Auto-Installed", line)) {
-			char *tmp = parse_simple("Auto-Installed", line);
-			if (strcmp(tmp, "yes") == 0)
+			   && is_fieldn("Auto-Installed", line, field_len)) {
+			struct str_slice sl =
+			    parse_slice("Auto-Installed", line);
+			if (slice_eq(&sl, "yes"))
 				pkg->auto_installed = 1;
-			free(tmp);
 		}
 		break;
 
 	case 'C':
-		if ((mask & PFM_CONFFILES) && is_field("Conffiles", line)) {
+		if ((mask & PFM_CONFFILES) && is_fieldn("Conffiles", line, field_len)) {
 			reading_conffiles = 1;
 			reading_description = 0;
 
@@ -232,55 +264,65 @@ int pkg_parse_line(void *ptr, char *line, uint mask)
 
 			goto dont_reset_flags;
 		} else if ((mask & PFM_CONFLICTS)
-			   && is_field("Conflicts", line))
+			   && is_fieldn("Conflicts", line, field_len))
 			parse_deplist(pkg, CONFLICTS, line + strlen("Conflicts") + 1);
 		break;
 
 	case 'D':
-		if ((mask & PFM_DESCRIPTION) && is_field("Description", line)) {
+		if ((mask & PFM_DESCRIPTION) && is_fieldn("Description", line, field_len)) {
 			description = parse_simple("Description", line);
 			reading_conffiles = 0;
 			reading_description = 1;
 			goto dont_reset_flags;
-		} else if ((mask & PFM_DEPENDS) && is_field("Depends", line))
+		} else if ((mask & PFM_DEPENDS) && is_fieldn("Depends", line, field_len))
 			parse_deplist(pkg, DEPEND, line + strlen("Depends") + 1);
 		break;
 
 	case 'E':
-		if ((mask & PFM_ESSENTIAL) && is_field("Essential", line)) {
-			char *tmp = parse_simple("Essential", line);
-			if (strcmp(tmp, "yes") == 0)
+		if ((mask & PFM_ESSENTIAL) && is_fieldn("Essential", line, field_len)) {
+			struct str_slice sl = parse_slice("Essential", line);
+			if (slice_eq(&sl, "yes"))
 				pkg->essential = 1;
-			free(tmp);
 		}
 		break;
 
 	case 'F':
-		if ((mask & PFM_FILENAME) && is_field("Filename", line))
+		if ((mask & PFM_FILENAME) && is_fieldn("Filename", line, field_len))
 			pkg_set_string(pkg, PKG_FILENAME, line + strlen("Filename") + 1);
 		break;
 
 	case 'I':
 		if ((mask & PFM_INSTALLED_SIZE)
-		    && is_field("Installed-Size", line)) {
+		    && is_fieldn("Installed-Size", line, field_len)) {
 			pkg_set_int(pkg, PKG_INSTALLED_SIZE, strtoul(line + strlen("Installed-Size") + 1, NULL, 0));
 		} else if ((mask & PFM_INSTALLED_TIME)
-			   && is_field("Installed-Time", line)) {
+			   && is_fieldn("Installed-Time", line, field_len)) {
 			pkg_set_int(pkg, PKG_INSTALLED_TIME, strtoul(line + strlen("Installed-Time") + 1, NULL, 0));
 		}
 		break;
 
 	case 'M':
-		if ((mask & PFM_MD5SUM) && (is_field("MD5sum:", line) || is_field("MD5Sum:", line)))
+		if ((mask & PFM_MD5SUM) && (is_fieldn("MD5sum", line, field_len) || is_fieldn("MD5Sum", line, field_len)))
 			pkg_set_md5(pkg, line + strlen("MD5sum") + 1);
 		else if ((mask & PFM_MAINTAINER)
-			 && is_field("Maintainer", line))
+			 && is_fieldn("Maintainer", line, field_len))
 			pkg_set_string(pkg, PKG_MAINTAINER, line + strlen("Maintainer") + 1);
 		break;
 
 	case 'P':
-		if ((mask & PFM_PACKAGE) && is_field("Package", line)) {
-			pkg->name = parse_simple("Package", line);
+		if ((mask & PFM_PACKAGE) && is_fieldn("Package", line, field_len)) {
+			struct str_slice name = parse_slice("Package", line);
+
+			/* one Package: field per stanza */
+			opkg_count_add(OPKG_COUNT_STANZAS_PARSED, 1);
+
+			if (name.len) {
+				/* interned; pkg_deinit() must not free it */
+				pkg->name = (char *)
+					hash_table_intern_key_len(&conf->str_hash,
+								  name.p,
+								  name.len);
+			}
 			ab_pkg = abstract_pkg_fetch_by_name(pkg->name);
 
 			if (ab_pkg && (ab_pkg->state_flag & SF_NEED_DETAIL)) {
@@ -290,44 +332,44 @@ int pkg_parse_line(void *ptr, char *line, uint mask)
 				}
 			}
 		}
-		else if ((mask & PFM_PRIORITY) && is_field("Priority", line))
+		else if ((mask & PFM_PRIORITY) && is_fieldn("Priority", line, field_len))
 			pkg_set_string(pkg, PKG_PRIORITY, line + strlen("Priority") + 1);
-		else if ((mask & PFM_PROVIDES) && is_field("Provides", line))
+		else if ((mask & PFM_PROVIDES) && is_fieldn("Provides", line, field_len))
 			parse_providelist(pkg, line + strlen("Provides") + 1);
 		else if ((mask & PFM_PRE_DEPENDS)
-			 && is_field("Pre-Depends", line))
+			 && is_fieldn("Pre-Depends", line, field_len))
 			parse_deplist(pkg, PREDEPEND, line + strlen("Pre-Depends") + 1);
 		break;
 
 	case 'R':
-		if ((mask & PFM_RECOMMENDS) && is_field("Recommends", line))
+		if ((mask & PFM_RECOMMENDS) && is_fieldn("Recommends", line, field_len))
 			parse_deplist(pkg, RECOMMEND, line + strlen("Recommends") + 1);
-		else if ((mask & PFM_REPLACES) && is_field("Replaces", line))
+		else if ((mask & PFM_REPLACES) && is_fieldn("Replaces", line, field_len))
 			parse_replacelist(pkg, line + strlen("Replaces") + 1);
 		break;
 
 	case 'S':
-		if ((mask & PFM_SECTION) && is_field("Section", line))
+		if ((mask & PFM_SECTION) && is_fieldn("Section", line, field_len))
 			pkg_set_string(pkg, PKG_SECTION, line + strlen("Section") + 1);
-		else if ((mask & PFM_SHA256SUM) && is_field("SHA256sum", line))
+		else if ((mask & PFM_SHA256SUM) && is_fieldn("SHA256sum", line, field_len))
 			pkg_set_sha256(pkg, line + strlen("SHA256sum") + 1);
-		else if ((mask & PFM_SIZE) && is_field("Size", line)) {
+		else if ((mask & PFM_SIZE) && is_fieldn("Size", line, field_len)) {
 			pkg_set_int(pkg, PKG_SIZE, strtoul(line + strlen("Size") + 1, NULL, 0));
-		} else if ((mask & PFM_SOURCE) && is_field("Source", line))
+		} else if ((mask & PFM_SOURCE) && is_fieldn("Source", line, field_len))
 			pkg_set_string(pkg, PKG_SOURCE, line + strlen("Source") + 1);
-		else if ((mask & PFM_STATUS) && is_field("Status", line))
+		else if ((mask & PFM_STATUS) && is_fieldn("Status", line, field_len))
 			parse_status(pkg, line);
-		else if ((mask & PFM_SUGGESTS) && is_field("Suggests", line))
+		else if ((mask & PFM_SUGGESTS) && is_fieldn("Suggests", line, field_len))
 			parse_deplist(pkg, SUGGEST, line + strlen("Suggests") + 1);
 		break;
 
 	case 'T':
-		if ((mask & PFM_TAGS) && is_field("Tags", line))
+		if ((mask & PFM_TAGS) && is_fieldn("Tags", line, field_len))
 			pkg_set_string(pkg, PKG_TAGS, line + strlen("Tags") + 1);
 		break;
 
 	case 'V':
-		if ((mask & PFM_VERSION) && is_field("Version", line))
+		if ((mask & PFM_VERSION) && is_fieldn("Version", line, field_len))
 			parse_version(pkg, line);
 		break;
 
@@ -369,9 +411,47 @@ int pkg_parse_line(void *ptr, char *line, uint mask)
 
 dont_reset_flags:
 
+	xalloc_tag_set(old_tag);
+
 	return ret;
 }
 
+/* Parse one package stanza from a memory-mapped feed. Lines are
+ * terminated in place (the mapping is private, see file_map_open()), so
+ * no per-line buffer shuffling or copying happens; *bufp is advanced
+ * past the consumed stanza. */
+int pkg_parse_from_map(pkg_t * pkg, char **bufp, char *end, uint mask)
+{
+	char *line, *nl;
+
+	while (*bufp < end) {
+		line = *bufp;
+		nl = memchr(line, '\n', end - line);
+
+		if (nl == NULL) {
+			/* Final line lacks a newline; it may extend to the
+			 * very end of the mapping, so terminate a copy
+			 * instead of the map itself.
+			 */
+			opkg_msg(ERROR, "Missing new line character"
+				 " at end of file!\n");
+			line = xstrndup(line, end - *bufp);
+			*bufp = end;
+			pkg_parse_line(pkg, line, mask);
+			free(line);
+			break;
+		}
+
+		*nl = '\0';
+		*bufp = nl + 1;
+
+		if (pkg_parse_line(pkg, line, mask))
+			break;
+	}
+
+	return 0;
+}
+
 int pkg_parse_from_stream(pkg_t * pkg, FILE * fp, uint mask)
 {
 	int ret;
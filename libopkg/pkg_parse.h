@@ -20,8 +20,12 @@
 
 #include "pkg.h"
 
+/* total control-file bytes run through pkg_parse_line() */
+extern __thread unsigned long long pkg_parse_bytes;
+
 int parse_version(pkg_t * pkg, const char *raw);
 int pkg_parse_from_stream(pkg_t * pkg, FILE * fp, uint mask);
+int pkg_parse_from_map(pkg_t * pkg, char **bufp, char *end, uint mask);
 int pkg_parse_line(void *ptr, char *line, uint mask);
 
 #define EXCESSIVE_LINE_LEN	(4096 << 8)
@@ -57,4 +61,11 @@ int pkg_parse_line(void *ptr, char *line, uint mask);
 
 #define PFM_ALL	(~(uint)0)
 
+/* The dependency-graph fields as one mask. Commands that only print
+ * package lists never consult the resolver, so they can skip parsing
+ * these lines and building the graph nodes altogether. */
+#define PFM_DEPS	(PFM_CONFLICTS | PFM_DEPENDS | PFM_PRE_DEPENDS | \
+			 PFM_PROVIDES | PFM_RECOMMENDS | PFM_REPLACES | \
+			 PFM_SUGGESTS)
+
 #endif
@@ -15,9 +15,19 @@
    General Public License for more details.
 */
 
+#include <limits.h>
+#include <time.h>
+
 #include "pkg_src.h"
+#include "opkg_conf.h"
+#include "opkg_message.h"
+#include "sprintf_alloc.h"
+#include "http_client.h"
 #include "libbb/libbb.h"
 
+/* probe results older than this are measured again */
+#define MIRROR_PROBE_MAX_AGE	(24 * 60 * 60)
+
 int pkg_src_init(pkg_src_t * src, const char *name, const char *base_url,
 		 const char *extra_data, int gzip)
 {
@@ -28,13 +38,180 @@ int pkg_src_init(pkg_src_t * src, const char *name, const char *base_url,
 		src->extra_data = xstrdup(extra_data);
 	else
 		src->extra_data = NULL;
+
+	src->mirrors = xmalloc(sizeof(src->mirrors[0]));
+	src->mirrors[0] = xstrdup(base_url);
+	src->n_mirrors = 1;
+	src->cur_mirror = 0;
+	src->probed = 0;
+
 	return 0;
 }
 
 void pkg_src_deinit(pkg_src_t * src)
 {
+	unsigned int i;
+
 	free(src->name);
 	free(src->value);
 	if (src->extra_data)
 		free(src->extra_data);
+
+	for (i = 0; i < src->n_mirrors; i++)
+		free(src->mirrors[i]);
+	free(src->mirrors);
+}
+
+int pkg_src_add_mirror(pkg_src_t * src, const char *url)
+{
+	unsigned int i;
+
+	for (i = 0; i < src->n_mirrors; i++)
+		if (strcmp(src->mirrors[i], url) == 0)
+			return -1;
+
+	src->mirrors = xrealloc(src->mirrors,
+				(src->n_mirrors + 1) *
+				sizeof(src->mirrors[0]));
+	src->mirrors[src->n_mirrors++] = xstrdup(url);
+
+	return 0;
+}
+
+/* rotate to the next mirror of the feed, for failover */
+int pkg_src_next_mirror(pkg_src_t * src)
+{
+	if (src->n_mirrors <= 1)
+		return -1;
+
+	src->cur_mirror = (src->cur_mirror + 1) % src->n_mirrors;
+	free(src->value);
+	src->value = xstrdup(src->mirrors[src->cur_mirror]);
+	opkg_msg(NOTICE, "Switching feed %s to mirror %s.\n",
+		 src->name, src->value);
+
+	return 0;
+}
+
+/*
+ * Probe results persist in <lists_dir>/mirrorspeed as
+ * "timestamp latency_ms url" lines, appended on each fresh probe; the
+ * newest fresh line for a url wins.
+ */
+static char *mirror_cache_file(void)
+{
+	char *path;
+
+	if (!conf->lists_dir)
+		return NULL;
+
+	sprintf_alloc(&path, "%s/mirrorspeed", conf->lists_dir);
+
+	return path;
+}
+
+static long mirror_cache_lookup(const char *url)
+{
+	char line[1024];
+	char *path = mirror_cache_file();
+	FILE *f;
+	long ts, ms, best = -1, best_ts = 0;
+	int off;
+	time_t now = time(NULL);
+
+	if (!path)
+		return -1;
+
+	f = fopen(path, "r");
+	free(path);
+	if (!f)
+		return -1;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%ld %ld %n", &ts, &ms, &off) != 2)
+			continue;
+
+		line[strcspn(line, "\n")] = '\0';
+
+		if (strcmp(line + off, url))
+			continue;
+		if (now - ts > MIRROR_PROBE_MAX_AGE)
+			continue;
+		if (ts >= best_ts) {
+			best_ts = ts;
+			best = ms;
+		}
+	}
+
+	fclose(f);
+
+	return best;
+}
+
+static void mirror_cache_store(const char *url, long ms)
+{
+	char *path = mirror_cache_file();
+	FILE *f;
+
+	if (!path)
+		return;
+
+	f = fopen(path, "a");
+	if (f) {
+		fprintf(f, "%ld %ld %s\n", (long)time(NULL), ms, url);
+		fclose(f);
+	}
+
+	free(path);
+}
+
+/*
+ * Rank the feed's mirrors by measured connect latency, fastest first,
+ * so src->value points at the best one. Measurements are cached
+ * between runs; a feed is probed at most once per run, and only when
+ * it actually has more than one mirror. Unreachable mirrors sort last
+ * but stay in the rotation for failover.
+ */
+void pkg_src_probe_mirrors(pkg_src_t * src)
+{
+	long *ms, m;
+	char *url;
+	unsigned int i, j;
+
+	if (src->probed || src->n_mirrors <= 1)
+		return;
+	src->probed = 1;
+
+	ms = xcalloc(src->n_mirrors, sizeof(ms[0]));
+
+	for (i = 0; i < src->n_mirrors; i++) {
+		ms[i] = mirror_cache_lookup(src->mirrors[i]);
+		if (ms[i] < 0) {
+			ms[i] = http_probe_latency(src->mirrors[i]);
+			if (ms[i] >= 0)
+				mirror_cache_store(src->mirrors[i], ms[i]);
+			else
+				ms[i] = LONG_MAX;
+		}
+		opkg_msg(DEBUG, "Mirror %s latency %ld ms.\n",
+			 src->mirrors[i], ms[i]);
+	}
+
+	/* insertion sort; feeds carry a handful of mirrors at most */
+	for (i = 1; i < src->n_mirrors; i++) {
+		m = ms[i];
+		url = src->mirrors[i];
+		for (j = i; j > 0 && ms[j - 1] > m; j--) {
+			ms[j] = ms[j - 1];
+			src->mirrors[j] = src->mirrors[j - 1];
+		}
+		ms[j] = m;
+		src->mirrors[j] = url;
+	}
+
+	free(ms);
+
+	src->cur_mirror = 0;
+	free(src->value);
+	src->value = xstrdup(src->mirrors[0]);
 }
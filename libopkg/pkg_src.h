@@ -22,13 +22,24 @@
 
 typedef struct {
 	char *name;
-	char *value;
+	char *value;		/* url of the currently selected mirror */
 	char *extra_data;
 	int gzip;
+
+	/* every url configured for this feed; value is a copy of
+	 * mirrors[cur_mirror] */
+	char **mirrors;
+	unsigned int n_mirrors;
+	unsigned int cur_mirror;
+	int probed;
 } pkg_src_t;
 
 int pkg_src_init(pkg_src_t * src, const char *name, const char *base_url,
 		 const char *extra_data, int gzip);
 void pkg_src_deinit(pkg_src_t * src);
 
+int pkg_src_add_mirror(pkg_src_t * src, const char *url);
+int pkg_src_next_mirror(pkg_src_t * src);
+void pkg_src_probe_mirrors(pkg_src_t * src);
+
 #endif
@@ -40,6 +40,20 @@ void pkg_src_list_deinit(pkg_src_list_t * list)
 	void_list_deinit((void_list_t *) list);
 }
 
+pkg_src_t *pkg_src_list_find(pkg_src_list_t * list, const char *name)
+{
+	pkg_src_list_elt_t *iter;
+	pkg_src_t *pkg_src;
+
+	list_for_each_entry(iter, &list->head, node) {
+		pkg_src = (pkg_src_t *) iter->data;
+		if (strcmp(pkg_src->name, name) == 0)
+			return pkg_src;
+	}
+
+	return NULL;
+}
+
 pkg_src_t *pkg_src_list_append(pkg_src_list_t * list,
 			       const char *name, const char *base_url,
 			       const char *extra_data, int gzip)
@@ -36,6 +36,7 @@ void pkg_src_list_elt_deinit(pkg_src_list_elt_t * elt);
 void pkg_src_list_init(pkg_src_list_t * list);
 void pkg_src_list_deinit(pkg_src_list_t * list);
 
+pkg_src_t *pkg_src_list_find(pkg_src_list_t * list, const char *name);
 pkg_src_t *pkg_src_list_append(pkg_src_list_t * list, const char *name,
 			       const char *root_dir, const char *extra_data,
 			       int gzip);
@@ -19,6 +19,7 @@
 #include <fnmatch.h>
 
 #include "pkg.h"
+#include "arena.h"
 #include "opkg_message.h"
 #include "libbb/libbb.h"
 
@@ -27,6 +28,7 @@ pkg_vec_t *pkg_vec_alloc(void)
 	pkg_vec_t *vec = xcalloc(1, sizeof(pkg_vec_t));
 	vec->pkgs = NULL;
 	vec->len = 0;
+	vec->cap = 0;
 
 	return vec;
 }
@@ -42,48 +44,81 @@ void pkg_vec_free(pkg_vec_t * vec)
 	free(vec);
 }
 
+/* drop the contents but keep the buffer, so a vector can be refilled
+ * without going through free/alloc again */
+void pkg_vec_clear(pkg_vec_t * vec)
+{
+	vec->len = 0;
+}
+
+static void pkg_vec_grow(pkg_vec_t * vec)
+{
+	if (vec->len < vec->cap)
+		return;
+
+	vec->cap = vec->cap ? vec->cap * 2 : 8;
+	vec->pkgs = xrealloc(vec->pkgs, vec->cap * sizeof(pkg_t *));
+}
+
+/* ordering maintained inside a per-name vector: version first, then
+ * architecture, so duplicates are exact matches and the merge point can
+ * be found by binary search */
+static int pkg_merge_compare(pkg_t * pkg, pkg_t * ref)
+{
+	int cmp = pkg_compare_versions(pkg, ref);
+
+	if (cmp)
+		return cmp;
+
+	return strcmp(pkg_get_architecture(pkg), pkg_get_architecture(ref));
+}
+
 /*
  * assumption: all names in a vector are identical
  * assumption: all version strings are trimmed,
  *             so identical versions have identical version strings,
  *             implying identical packages; let's marry these
+ *
+ * The vector is kept sorted by version and architecture; every insert
+ * goes through here, so a binary search finds either the duplicate to
+ * merge with or the slot to insert at. The old linear scan ran
+ * pkg_compare_versions() against every element and made feed loading
+ * quadratic in the number of versions per name.
  */
 void pkg_vec_insert_merge(pkg_vec_t * vec, pkg_t * pkg, int set_status)
 {
-	int i;
-	int found = 0;
+	int lo = 0, hi = vec->len, mid = 0, cmp = -1;
 	char *pkg_version = pkg_get_string(pkg, PKG_VERSION);
 	char *pkg_architecture = pkg_get_architecture(pkg);
-	char *vec_architecture;
-
-	/* look for a duplicate pkg by name, version, and architecture */
-	for (i = 0; i < vec->len; i++) {
-		vec_architecture = pkg_get_architecture(vec->pkgs[i]);
-
-		opkg_msg(DEBUG2, "%s %s arch=%s vs. %s %s arch=%s.\n",
-			 pkg->name, pkg_version, pkg_architecture,
-			 vec->pkgs[i]->name, pkg_get_string(vec->pkgs[i], PKG_VERSION),
-			 vec_architecture);
-		/* if the name,ver,arch matches, or the name matches and the
-		 * package is marked deinstall/hold  */
-		if ((!strcmp(pkg->name, vec->pkgs[i]->name))
-		    && ((pkg->state_want == SW_DEINSTALL
-			 && (pkg->state_flag & SF_HOLD))
-			|| ((pkg_compare_versions(pkg, vec->pkgs[i]) == 0)
-			    && (!strcmp(pkg_architecture, vec_architecture))))) {
-			found = 1;
-			opkg_msg(DEBUG2,
-				 "Duplicate for pkg=%s version=%s arch=%s.\n",
-				 pkg->name, pkg_version, pkg_architecture);
-			break;
+
+	if (vec->len && pkg->state_want == SW_DEINSTALL
+	    && (pkg->state_flag & SF_HOLD)) {
+		/* a deinstall/hold package overrides any version of the
+		 * same name, so it matches the first entry outright */
+		mid = 0;
+		cmp = 0;
+	} else {
+		while (lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			cmp = pkg_merge_compare(pkg, vec->pkgs[mid]);
+			if (cmp == 0)
+				break;
+			if (cmp < 0)
+				hi = mid;
+			else
+				lo = mid + 1;
 		}
 	}
 
-	/* we didn't find one, add it */
-	if (!found) {
+	/* we didn't find one, add it at the sorted position */
+	if (cmp != 0) {
 		opkg_msg(DEBUG2, "Adding new pkg=%s version=%s arch=%s.\n",
 			 pkg->name, pkg_version, pkg_architecture);
-		pkg_vec_insert(vec, pkg);
+		pkg_vec_grow(vec);
+		memmove(&vec->pkgs[lo + 1], &vec->pkgs[lo],
+			(vec->len - lo) * sizeof(pkg_t *));
+		vec->pkgs[lo] = pkg;
+		vec->len++;
 		return;
 	}
 
@@ -93,18 +128,17 @@ void pkg_vec_insert_merge(pkg_vec_t * vec, pkg_t * pkg, int set_status)
 	if (set_status) {
 		/* This is from the status file,
 		 * so need to merge with existing database */
-		pkg_merge(pkg, vec->pkgs[i]);
+		pkg_merge(pkg, vec->pkgs[mid]);
 	}
 
 	/* overwrite the old one */
-	pkg_deinit(vec->pkgs[i]);
-	free(vec->pkgs[i]);
-	vec->pkgs[i] = pkg;
+	pkg_free(vec->pkgs[mid]);
+	vec->pkgs[mid] = pkg;
 }
 
 void pkg_vec_insert(pkg_vec_t * vec, const pkg_t * pkg)
 {
-	vec->pkgs = xrealloc(vec->pkgs, (vec->len + 1) * sizeof(pkg_t *));
+	pkg_vec_grow(vec);
 	vec->pkgs[vec->len] = (pkg_t *) pkg;
 	vec->len++;
 }
@@ -172,12 +206,37 @@ abstract_pkg_vec_t *abstract_pkg_vec_alloc(void)
 	return vec;
 }
 
+/*
+ * Variant for vectors that are part of the dependency graph: the
+ * struct is carved out of the graph's arena so it sits next to the
+ * nodes referencing it. The element array still grows on the heap.
+ */
+abstract_pkg_vec_t *abstract_pkg_vec_alloc_arena(struct arena *arena)
+{
+	abstract_pkg_vec_t *vec;
+
+	vec = arena_calloc(arena, sizeof(abstract_pkg_vec_t));
+	vec->from_arena = 1;
+
+	return vec;
+}
+
 void abstract_pkg_vec_free(abstract_pkg_vec_t * vec)
 {
 	if (!vec)
 		return;
 	free(vec->pkgs);
-	free(vec);
+	if (!vec->from_arena)
+		free(vec);
+}
+
+static void abstract_pkg_vec_grow(abstract_pkg_vec_t * vec)
+{
+	if (vec->len < vec->cap)
+		return;
+
+	vec->cap = vec->cap ? vec->cap * 2 : 4;
+	vec->pkgs = xrealloc(vec->pkgs, vec->cap * sizeof(abstract_pkg_t *));
 }
 
 /*
@@ -185,12 +244,45 @@ void abstract_pkg_vec_free(abstract_pkg_vec_t * vec)
  */
 void abstract_pkg_vec_insert(abstract_pkg_vec_t * vec, abstract_pkg_t * pkg)
 {
-	vec->pkgs =
-	    xrealloc(vec->pkgs, (vec->len + 1) * sizeof(abstract_pkg_t *));
+	abstract_pkg_vec_grow(vec);
 	vec->pkgs[vec->len] = pkg;
 	vec->len++;
 }
 
+/*
+ * Sorted-set insert, keyed on the abstract package name. Duplicates
+ * are rejected by the binary search, so growing the provided_by or
+ * depended_upon_by set of a hot abstract package (everything depends
+ * on libc) costs O(log n) instead of a linear duplicate scan.
+ * Returns 1 if pkg was inserted, 0 if it was already present.
+ */
+int abstract_pkg_vec_insert_sorted(abstract_pkg_vec_t * vec,
+				   abstract_pkg_t * pkg)
+{
+	unsigned int lo = 0, hi = vec->len, mid;
+	int cmp;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		cmp = strcmp(pkg->name, vec->pkgs[mid]->name);
+
+		if (cmp == 0)
+			return 0;
+		else if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	abstract_pkg_vec_grow(vec);
+	memmove(&vec->pkgs[lo + 1], &vec->pkgs[lo],
+		(vec->len - lo) * sizeof(abstract_pkg_t *));
+	vec->pkgs[lo] = pkg;
+	vec->len++;
+
+	return 1;
+}
+
 abstract_pkg_t *abstract_pkg_vec_get(abstract_pkg_vec_t * vec, int i)
 {
 	if (vec->len > i)
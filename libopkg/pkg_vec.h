@@ -28,15 +28,21 @@ typedef struct abstract_pkg_vec abstract_pkg_vec_t;
 struct pkg_vec {
 	pkg_t **pkgs;
 	unsigned int len;
+	unsigned int cap;
 };
 
 struct abstract_pkg_vec {
 	abstract_pkg_t **pkgs;
 	unsigned int len;
+	unsigned int cap;
+	unsigned int from_arena;
 };
 
+struct arena;
+
 pkg_vec_t *pkg_vec_alloc(void);
 void pkg_vec_free(pkg_vec_t * vec);
+void pkg_vec_clear(pkg_vec_t * vec);
 
 void pkg_vec_insert_merge(pkg_vec_t * vec, pkg_t * pkg, int set_status);
 void pkg_vec_insert(pkg_vec_t * vec, const pkg_t * pkg);
@@ -49,8 +55,11 @@ int pkg_vec_clear_marks(pkg_vec_t * vec);
 int pkg_vec_mark_if_matches(pkg_vec_t * vec, const char *pattern);
 
 abstract_pkg_vec_t *abstract_pkg_vec_alloc(void);
+abstract_pkg_vec_t *abstract_pkg_vec_alloc_arena(struct arena *arena);
 void abstract_pkg_vec_free(abstract_pkg_vec_t * vec);
 void abstract_pkg_vec_insert(abstract_pkg_vec_t * vec, abstract_pkg_t * pkg);
+int abstract_pkg_vec_insert_sorted(abstract_pkg_vec_t * vec,
+				   abstract_pkg_t * pkg);
 abstract_pkg_t *abstract_pkg_vec_get(abstract_pkg_vec_t * vec, int i);
 int abstract_pkg_vec_contains(abstract_pkg_vec_t * vec, abstract_pkg_t * apkg);
 void abstract_pkg_vec_sort(abstract_pkg_vec_t * vec, compare_fcn_t compar);
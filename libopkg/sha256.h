@@ -81,4 +81,13 @@ extern int sha224_stream(FILE * stream, void *resblock);
 extern void *sha256_buffer(const char *buffer, size_t len, void *resblock);
 extern void *sha224_buffer(const char *buffer, size_t len, void *resblock);
 
+/* Compute SHA256 digests of N independent buffers, interleaving up to
+   SHA256_MULTI_LANES of them through SIMD lanes where the hardware
+   allows; equivalent to N sha256_buffer() calls otherwise.  Digest I
+   is written to the 32 bytes at RESBLOCKS[I].  */
+#define SHA256_MULTI_LANES 4
+extern void sha256_buffer_multi(const char *const buffers[],
+				const size_t lens[], int n,
+				unsigned char (*resblocks)[32]);
+
 #endif
@@ -45,3 +45,40 @@ void sprintf_alloc(char **str, const char *fmt, ...)
 		*str = xrealloc(*str, size);
 	}
 }
+
+void strbuf_printf(struct strbuf *sb, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	for (;;) {
+		va_start(ap, fmt);
+		n = vsnprintf(sb->buf + sb->len, sb->cap - sb->len, fmt, ap);
+		va_end(ap);
+
+		if (n < 0) {
+			fprintf(stderr, "%s: encountered an output or encoding"
+				" error during vsnprintf.\n", __FUNCTION__);
+			exit(EXIT_FAILURE);
+		}
+
+		if ((size_t) n < sb->cap - sb->len) {
+			sb->len += n;
+			break;
+		}
+
+		/* Truncated, try again with more space. */
+		if (sb->cap == 0)
+			sb->cap = 256;
+		while (sb->cap - sb->len <= (size_t) n)
+			sb->cap *= 2;
+		sb->buf = xrealloc(sb->buf, sb->cap);
+	}
+}
+
+void strbuf_free(struct strbuf *sb)
+{
+	free(sb->buf);
+	sb->buf = NULL;
+	sb->len = sb->cap = 0;
+}
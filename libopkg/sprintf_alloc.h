@@ -18,6 +18,23 @@
 #ifndef SPRINTF_ALLOC_H
 #define SPRINTF_ALLOC_H
 
+#include <stddef.h>
+
 void sprintf_alloc(char **str, const char *fmt, ...);
 
+/*
+ * Growable string buffer for assembling larger chunks of output (a
+ * status file stanza, say) in memory, so the result can be committed
+ * with a single write instead of one stdio call per field. Initialize
+ * to all zeroes; the buffer stays NUL-terminated.
+ */
+struct strbuf {
+	char *buf;
+	size_t len;
+	size_t cap;
+};
+
+void strbuf_printf(struct strbuf *sb, const char *fmt, ...);
+void strbuf_free(struct strbuf *sb);
+
 #endif
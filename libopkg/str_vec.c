@@ -0,0 +1,64 @@
+/* str_vec.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include <string.h>
+
+#include "str_vec.h"
+#include "libbb/libbb.h"
+
+str_vec_t *str_vec_alloc(void)
+{
+	str_vec_t *vec = xcalloc(1, sizeof(str_vec_t));
+
+	arena_init(&vec->arena, "str-vec", 16 * 1024);
+
+	return vec;
+}
+
+void str_vec_free(str_vec_t * vec)
+{
+	if (!vec)
+		return;
+
+	arena_deinit(&vec->arena);
+	free(vec->strs);
+	free(vec);
+}
+
+void str_vec_append(str_vec_t * vec, const char *str)
+{
+	if (vec->len == vec->cap) {
+		vec->cap = vec->cap ? vec->cap * 2 : 64;
+		vec->strs = xrealloc(vec->strs, vec->cap * sizeof(char *));
+	}
+
+	vec->strs[vec->len++] = arena_strndup(&vec->arena, str, strlen(str));
+}
+
+/*
+ * Drop the first entry equal to str, preserving order. The string
+ * bytes stay in the arena until the vector is freed.
+ */
+void str_vec_remove_str(str_vec_t * vec, const char *str)
+{
+	unsigned int i;
+
+	for (i = 0; i < vec->len; i++) {
+		if (strcmp(vec->strs[i], str) == 0) {
+			memmove(&vec->strs[i], &vec->strs[i + 1],
+				(vec->len - i - 1) * sizeof(char *));
+			vec->len--;
+			return;
+		}
+	}
+}
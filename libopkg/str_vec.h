@@ -0,0 +1,37 @@
+/* str_vec.h - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef STR_VEC_H
+#define STR_VEC_H
+
+#include "arena.h"
+
+/*
+ * Contiguous string vector: a capacity-doubling pointer array whose
+ * strings live in a private arena, so building and iterating large
+ * collections (package file lists) touches sequential memory instead
+ * of one malloc'd list node per entry.
+ */
+typedef struct str_vec {
+	char **strs;
+	unsigned int len;
+	unsigned int cap;
+	arena_t arena;
+} str_vec_t;
+
+str_vec_t *str_vec_alloc(void);
+void str_vec_free(str_vec_t * vec);
+void str_vec_append(str_vec_t * vec, const char *str);
+void str_vec_remove_str(str_vec_t * vec, const char *str);
+
+#endif
@@ -17,56 +17,259 @@
 
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "xsystem.h"
+#include "sprintf_alloc.h"
 #include "libbb/libbb.h"
 
-/* Like system(3), but with error messages printed if the fork fails
-   or if the child process dies due to an uncaught signal. Also, the
-   return value is a bit simpler:
+extern char **environ;
 
-   -1 if there was any problem
-   Otherwise, the 8-bit return value of the program ala WEXITSTATUS
-   as defined in <sys/wait.h>.
-*/
-int xsystem(const char *argv[])
+/*
+ * opkg launches the same few helpers (wget, opkg-key, /bin/sh) over
+ * and over, so the PATH walk execvp would redo on every spawn is done
+ * once per name and cached. posix_spawn also spares MMU-less targets
+ * the address-space games of fork.
+ */
+#define SPAWN_PATH_CACHE 8
+
+static __thread struct {
+	char *name;
+	char *path;
+} spawn_paths[SPAWN_PATH_CACHE];
+
+static const char *spawn_resolve(const char *name)
 {
-	int status;
+	const char *env, *p, *colon;
+	char *cand;
+	int i, len;
+
+	if (strchr(name, '/'))
+		return name;
+
+	for (i = 0; i < SPAWN_PATH_CACHE && spawn_paths[i].name; i++)
+		if (!strcmp(spawn_paths[i].name, name))
+			return spawn_paths[i].path;
+
+	env = getenv("PATH");
+	if (!env)
+		env = "/usr/sbin:/usr/bin:/sbin:/bin";
+
+	for (p = env; *p; p = *colon ? colon + 1 : colon) {
+		colon = strchr(p, ':');
+		if (!colon)
+			colon = p + strlen(p);
+		len = colon - p;
+
+		sprintf_alloc(&cand, "%.*s/%s", len, p, name);
+		if (access(cand, X_OK) == 0) {
+			if (i < SPAWN_PATH_CACHE) {
+				spawn_paths[i].name = xstrdup(name);
+				spawn_paths[i].path = cand;
+			}
+			return cand;
+		}
+		free(cand);
+	}
+
+	/* let posix_spawn report the lookup failure */
+	return name;
+}
+
+pid_t xspawn_fds(const char *argv[], const struct xspawn_fdpair *fds,
+		 int nfds)
+{
+	posix_spawn_file_actions_t actions;
 	pid_t pid;
+	int i, err;
+
+	posix_spawn_file_actions_init(&actions);
+	for (i = 0; i < nfds; i++) {
+		posix_spawn_file_actions_adddup2(&actions, fds[i].from,
+						 fds[i].to);
+		if (fds[i].from != fds[i].to)
+			posix_spawn_file_actions_addclose(&actions,
+							  fds[i].from);
+	}
 
-	pid = vfork();
+	err = posix_spawn(&pid, spawn_resolve(argv[0]), &actions, NULL,
+			  (char *const *)argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
 
-	switch (pid) {
-	case -1:
-		opkg_perror(ERROR, "%s: vfork", argv[0]);
+	if (err) {
+		opkg_msg(ERROR, "%s: posix_spawn: %s.\n", argv[0],
+			 strerror(err));
 		return -1;
-	case 0:
-		/* child */
-		execvp(argv[0], (char *const *)argv);
-		_exit(-1);
-	default:
-		/* parent */
-		break;
 	}
 
+	return pid;
+}
+
+pid_t xspawn(const char *argv[])
+{
+	return xspawn_fds(argv, NULL, 0);
+}
+
+int xspawn_wait(pid_t pid, const char *name)
+{
+	int status;
+
 	if (waitpid(pid, &status, 0) == -1) {
-		opkg_perror(ERROR, "%s: waitpid", argv[0]);
+		opkg_perror(ERROR, "%s: waitpid", name);
 		return -1;
 	}
 
 	if (WIFSIGNALED(status)) {
 		opkg_msg(ERROR, "%s: Child killed by signal %d.\n",
-			 argv[0], WTERMSIG(status));
+			 name, WTERMSIG(status));
 		return -1;
 	}
 
 	if (!WIFEXITED(status)) {
 		/* shouldn't happen */
 		opkg_msg(ERROR, "%s: Your system is broken: got status %d "
-			 "from waitpid.\n", argv[0], status);
+			 "from waitpid.\n", name, status);
 		return -1;
 	}
 
 	return WEXITSTATUS(status);
 }
+
+/* Like system(3), but with error messages printed if the spawn fails
+   or if the child process dies due to an uncaught signal. Also, the
+   return value is a bit simpler:
+
+   -1 if there was any problem
+   Otherwise, the 8-bit return value of the program ala WEXITSTATUS
+   as defined in <sys/wait.h>.
+*/
+int xsystem(const char *argv[])
+{
+	pid_t pid = xspawn(argv);
+
+	if (pid < 0)
+		return -1;
+
+	return xspawn_wait(pid, argv[0]);
+}
+
+/* One long-lived shell for a whole transaction's maintainer scripts.
+   Commands are fed through the shell's stdin and each is followed by
+   an echo of $? onto a dedicated status descriptor, so per-script
+   exit codes survive even though there is only one process. Spawning
+   a shell per script costs a vfork+exec and a profile re-read each
+   time, which dominates on MMU-less targets. */
+
+#define SHELL_STATUS_FD 9
+
+static __thread struct {
+	pid_t pid;
+	FILE *cmd;		/* our end of the shell's stdin */
+	FILE *status;		/* exit codes come back on this */
+} shell_session;
+
+static int xsystem_shell_open(void)
+{
+	const char *argv[] = { "/bin/sh", "-s", NULL };
+	struct xspawn_fdpair fds[] = {
+		{ -1, STDIN_FILENO },
+		{ -1, SHELL_STATUS_FD },
+	};
+	int cmd_pipe[2], status_pipe[2];
+
+	if (pipe(cmd_pipe) < 0)
+		return -1;
+
+	if (pipe(status_pipe) < 0) {
+		close(cmd_pipe[0]);
+		close(cmd_pipe[1]);
+		return -1;
+	}
+
+	/* our pipe ends must not survive into the shell, or it would
+	 * hold its own stdin open and never see EOF on teardown */
+	fcntl(cmd_pipe[1], F_SETFD, FD_CLOEXEC);
+	fcntl(status_pipe[0], F_SETFD, FD_CLOEXEC);
+
+	fds[0].from = cmd_pipe[0];
+	fds[1].from = status_pipe[1];
+
+	shell_session.pid = xspawn_fds(argv, fds, 2);
+	if (shell_session.pid < 0) {
+		close(cmd_pipe[0]);
+		close(cmd_pipe[1]);
+		close(status_pipe[0]);
+		close(status_pipe[1]);
+		shell_session.pid = 0;
+		return -1;
+	}
+
+	close(cmd_pipe[0]);
+	close(status_pipe[1]);
+
+	shell_session.cmd = fdopen(cmd_pipe[1], "w");
+	shell_session.status = fdopen(status_pipe[0], "r");
+
+	if (!shell_session.cmd || !shell_session.status) {
+		xsystem_shell_close();
+		return -1;
+	}
+
+	return 0;
+}
+
+void xsystem_shell_close(void)
+{
+	int status;
+
+	if (!shell_session.pid)
+		return;
+
+	if (shell_session.cmd)
+		fclose(shell_session.cmd);	/* EOF makes the shell exit */
+	if (shell_session.status)
+		fclose(shell_session.status);
+
+	waitpid(shell_session.pid, &status, 0);
+
+	memset(&shell_session, 0, sizeof(shell_session));
+}
+
+int xsystem_shell(const char *cmd)
+{
+	struct sigaction pipe_sa = {.sa_handler = SIG_IGN }, old_sa;
+	char line[16];
+	int ret = -1;
+
+	if (!shell_session.pid && xsystem_shell_open() < 0)
+		return -1;
+
+	/* a dying shell must not take us with it via SIGPIPE */
+	sigaction(SIGPIPE, &pipe_sa, &old_sa);
+
+	/* a subshell contains the command's exits and exports, and its
+	   stdin is redirected so scripts cannot eat the command stream */
+	fprintf(shell_session.cmd, "(\n%s\n) </dev/null\necho $? >&%d\n",
+		cmd, SHELL_STATUS_FD);
+	fflush(shell_session.cmd);
+
+	if (ferror(shell_session.cmd) ||
+	    fgets(line, sizeof(line), shell_session.status) == NULL) {
+		/* the shell is gone (killed, or a syntax error made it
+		   bail); a fresh one is spawned on the next call */
+		opkg_msg(ERROR, "Transaction shell exited unexpectedly.\n");
+		xsystem_shell_close();
+	} else {
+		ret = atoi(line);
+	}
+
+	sigaction(SIGPIPE, &old_sa, NULL);
+
+	return ret;
+}
@@ -18,6 +18,23 @@
 #ifndef XSYSTEM_H
 #define XSYSTEM_H
 
+#include <sys/types.h>
+
+/* child-side dup2(from, to); `from` is closed after duplication */
+struct xspawn_fdpair {
+	int from;
+	int to;
+};
+
+/* Spawn argv via posix_spawn without re-walking PATH (resolved paths
+   are cached per name). Returns the child's pid, or -1 with an error
+   message printed; reap with xspawn_wait() - immediately for the old
+   serial behaviour, or later so spawns overlap other work. */
+pid_t xspawn(const char *argv[]);
+pid_t xspawn_fds(const char *argv[], const struct xspawn_fdpair *fds,
+		 int nfds);
+int xspawn_wait(pid_t pid, const char *name);
+
 /* Like system(3), but with error messages printed if the fork fails
    or if the child process dies due to an uncaught signal. Also, the
    return value is a bit simpler:
@@ -28,4 +45,13 @@
 */
 int xsystem(const char *argv[]);
 
+/* Run a shell command inside one long-lived shell shared by the whole
+   transaction, avoiding a fork+exec per maintainer script. Returns the
+   command's exit status, or -1 if the shell could not be reached. The
+   command's stdin is /dev/null; output goes wherever ours does. */
+int xsystem_shell(const char *cmd);
+
+/* Tear the transaction shell down (a new one is spawned on demand). */
+void xsystem_shell_close(void);
+
 #endif
@@ -23,12 +23,23 @@
 #include <stdio.h>
 #include <getopt.h>
 #include <fnmatch.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 
 #include "opkg_conf.h"
 #include "opkg_cmd.h"
 #include "file_util.h"
 #include "opkg_message.h"
 #include "opkg_download.h"
+#include "pkg_hash.h"
+#include "opkg_profile.h"
+#include "sprintf_alloc.h"
 #include "../libbb/libbb.h"
 
 enum {
@@ -54,8 +65,17 @@ enum {
 	ARGS_OPT_FORCE_SIGNATURE,
 	ARGS_OPT_NO_CHECK_CERTIFICATE,
 	ARGS_OPT_SIZE,
+	ARGS_OPT_JSON,
+	ARGS_OPT_FIELDS,
+	ARGS_OPT_DAEMON,
+	ARGS_OPT_PROFILE,
+	ARGS_OPT_LOWMEM,
+	ARGS_OPT_ROOTS,
 };
 
+static int daemon_mode;
+static char *bulk_roots;
+
 static struct option long_options[] = {
 	{"query-all", 0, 0, 'A'},
 	{"autoremove", 0, 0, ARGS_OPT_AUTOREMOVE},
@@ -103,6 +123,12 @@ static struct option long_options[] = {
 	{"add-arch", 1, 0, ARGS_OPT_ADD_ARCH},
 	{"add-dest", 1, 0, ARGS_OPT_ADD_DEST},
 	{"size", 0, 0, ARGS_OPT_SIZE},
+	{"json", 0, 0, ARGS_OPT_JSON},
+	{"fields", 1, 0, ARGS_OPT_FIELDS},
+	{"lowmem", 0, 0, ARGS_OPT_LOWMEM},
+	{"roots", 1, 0, ARGS_OPT_ROOTS},
+	{"daemon", 0, 0, ARGS_OPT_DAEMON},
+	{"profile", 2, 0, ARGS_OPT_PROFILE},
 	{"test", 0, 0, ARGS_OPT_NOACTION},
 	{"tmp-dir", 1, 0, 't'},
 	{"tmp_dir", 1, 0, 't'},
@@ -220,6 +246,27 @@ static int args_parse(int argc, char *argv[])
 		case ARGS_OPT_SIZE:
 			conf->size = 1;
 			break;
+		case ARGS_OPT_JSON:
+			conf->json = 1;
+			break;
+		case ARGS_OPT_FIELDS:
+			conf->fields = xstrdup(optarg);
+			break;
+		case ARGS_OPT_LOWMEM:
+			conf->lowmem = 1;
+			break;
+		case ARGS_OPT_DAEMON:
+			daemon_mode = 1;
+			break;
+		case ARGS_OPT_ROOTS:
+			bulk_roots = xstrdup(optarg);
+			break;
+		case ARGS_OPT_PROFILE:
+			if (optarg && !strcmp(optarg, "json"))
+				conf->profile = 2;
+			else
+				conf->profile = 1;
+			break;
 		case ARGS_OPT_NOACTION:
 			conf->noaction = 1;
 			break;
@@ -243,7 +290,7 @@ static int args_parse(int argc, char *argv[])
 		}
 	}
 
-	if (!conf->conf_file && !conf->offline_root)
+	if (!conf->conf_file && !conf->offline_root && !bulk_roots)
 		conf->conf_file = xstrdup("/etc/opkg.conf");
 
 	if (parse_err)
@@ -252,6 +299,500 @@ static int args_parse(int argc, char *argv[])
 		return optind;
 }
 
+/*
+ * Bulk provisioning. `--roots a,b,c` runs the sub-command once per
+ * offline root in parallel child processes, bounded by core count.
+ * The expensive shared state lives on disk and is built once for all
+ * of them: with a shared --cache every archive downloads once, and
+ * with a shared lists dir (-l) the first child to touch a feed writes
+ * its index sidecar and the rest just map it, so the feeds are parsed
+ * once per machine instead of once per image. The exit status is the
+ * worst child's.
+ *
+ * The parent never returns from here; each child comes back with
+ * conf->offline_root pointed at its own root and runs the normal
+ * single-root path.
+ */
+static void bulk_fork(void)
+{
+	char *r, *next;
+	pid_t pid;
+	int n_running = 0, limit, status, worst = 0;
+
+	limit = sysconf(_SC_NPROCESSORS_ONLN);
+	if (limit < 1)
+		limit = 1;
+
+	for (r = bulk_roots; r && *r; r = next) {
+		next = strchr(r, ',');
+		if (next)
+			*next++ = '\0';
+		if (!*r)
+			continue;
+
+		if (n_running >= limit) {
+			if (wait(&status) > 0) {
+				n_running--;
+				if (WIFEXITED(status)
+				    && WEXITSTATUS(status) > worst)
+					worst = WEXITSTATUS(status);
+				if (WIFSIGNALED(status))
+					worst = 1;
+			}
+		}
+
+		pid = fork();
+		if (pid == -1) {
+			perror("opkg: fork");
+			exit(1);
+		}
+		if (pid == 0) {
+			free(conf->offline_root);
+			conf->offline_root = xstrdup(r);
+			free(bulk_roots);
+			bulk_roots = NULL;
+			return;
+		}
+		n_running++;
+	}
+
+	while (wait(&status) > 0) {
+		if (WIFEXITED(status) && WEXITSTATUS(status) > worst)
+			worst = WEXITSTATUS(status);
+		if (WIFSIGNALED(status))
+			worst = 1;
+	}
+
+	exit(worst);
+}
+
+/*
+ * Daemon mode. `opkg --daemon` loads the configuration, feeds and
+ * status files once and then serves forwarded command lines from a
+ * unix socket next to the lock file. Every other opkg invocation acts
+ * as a thin client: if the socket is connectable the command line and
+ * the caller's stdio descriptors are handed to the daemon and the
+ * exit status comes back over the socket, skipping all startup cost.
+ *
+ * Each request runs in a fork()ed child, so command side effects
+ * operate on a copy-on-write snapshot of the resident state. When the
+ * feeds or a status file change on disk - typically because a served
+ * install or remove rewrote the status - the daemon re-execs itself
+ * to rebuild the state before accepting the next request.
+ */
+
+#define DAEMON_MAX_REQUEST	8192
+#define DAEMON_STDIO_FDS	3
+
+struct daemon_watch {
+	char *path;
+	off_t size;
+	time_t mtime;
+};
+
+static struct daemon_watch *daemon_watches;
+static int daemon_n_watches;
+static char **daemon_argv;
+static char *daemon_sock_file;
+
+/* leave no stale socket behind; clients fall back instantly on ENOENT
+ * but retry for a while on a dead-but-present socket */
+static void daemon_sigterm_handler(int sig)
+{
+	unlink(daemon_sock_file);
+	_exit(128 + sig);
+}
+
+static char *daemon_socket_path(void)
+{
+	char *path;
+
+	if (conf->offline_root)
+		sprintf_alloc(&path, "%s/%s.sock", conf->offline_root,
+			      OPKGLOCKFILE);
+	else
+		sprintf_alloc(&path, "%s.sock", OPKGLOCKFILE);
+
+	return path;
+}
+
+static int daemon_client_run(int argc, char **argv)
+{
+	struct sockaddr_un sa;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char cbuf[CMSG_SPACE(DAEMON_STDIO_FDS * sizeof(int))];
+	char *path, *buf;
+	unsigned char status;
+	size_t len = 0;
+	ssize_t n;
+	int fd, i, tries;
+	int fds[DAEMON_STDIO_FDS] = { 0, 1, 2 };
+
+	path = daemon_socket_path();
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(sa.sun_path)) {
+		free(path);
+		return -1;
+	}
+	strcpy(sa.sun_path, path);
+	free(path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1)
+		return -1;
+
+	/* a refused connection while the socket file exists usually
+	 * means the daemon is re-execing to pick up new state; give it
+	 * a moment before falling back to a standalone run */
+	for (tries = 0;; tries++) {
+		if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) == 0)
+			break;
+		if (errno != ECONNREFUSED || tries >= 40) {
+			close(fd);
+			return -1;
+		}
+		usleep(50000);
+	}
+
+	for (i = 0; i < argc; i++)
+		len += strlen(argv[i]) + 1;
+
+	/* the daemon reads a request into a fixed buffer; refuse to send
+	 * anything bigger so the command still runs, just standalone */
+	if (len > DAEMON_MAX_REQUEST) {
+		opkg_msg(DEBUG, "Command line of %zu bytes exceeds the "
+			 "daemon request limit, running standalone.\n", len);
+		close(fd);
+		return -1;
+	}
+
+	buf = xmalloc(len);
+	len = 0;
+	for (i = 0; i < argc; i++) {
+		strcpy(buf + len, argv[i]);
+		len += strlen(argv[i]) + 1;
+	}
+
+	/* the stdio descriptors ride along with the command line, so
+	 * the daemon's worker writes straight to our terminal or pipe */
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(DAEMON_STDIO_FDS * sizeof(int));
+	memcpy(CMSG_DATA(cmsg), fds, DAEMON_STDIO_FDS * sizeof(int));
+
+	if (sendmsg(fd, &msg, 0) == -1) {
+		free(buf);
+		close(fd);
+		return -1;
+	}
+	free(buf);
+	shutdown(fd, SHUT_WR);
+
+	n = read(fd, &status, 1);
+	close(fd);
+	if (n != 1)
+		return -1;
+
+	return status;
+}
+
+static void daemon_watch_add(const char *path)
+{
+	struct daemon_watch *w;
+	struct stat st;
+
+	daemon_watches = xrealloc(daemon_watches, (daemon_n_watches + 1)
+				  * sizeof(daemon_watches[0]));
+	w = &daemon_watches[daemon_n_watches++];
+	w->path = xstrdup(path);
+	if (stat(path, &st) == 0) {
+		w->size = st.st_size;
+		w->mtime = st.st_mtime;
+	} else {
+		w->size = 0;
+		w->mtime = 0;
+	}
+}
+
+static void daemon_watch_init(void)
+{
+	pkg_src_list_elt_t *iter;
+	pkg_dest_list_elt_t *dest_iter;
+	pkg_src_t *src;
+	pkg_dest_t *dest;
+	char *lists_dir, *list_file;
+
+	lists_dir = conf->restrict_to_default_dest ?
+	    conf->default_dest->lists_dir : conf->lists_dir;
+
+	for (iter = void_list_first(&conf->pkg_src_list); iter;
+	     iter = void_list_next(&conf->pkg_src_list, iter)) {
+		src = (pkg_src_t *) iter->data;
+
+		sprintf_alloc(&list_file, "%s/%s", lists_dir, src->name);
+		daemon_watch_add(list_file);
+		free(list_file);
+	}
+
+	list_for_each_entry(dest_iter, &conf->pkg_dest_list.head, node) {
+		dest = (pkg_dest_t *) dest_iter->data;
+		daemon_watch_add(dest->status_file_name);
+	}
+}
+
+static int daemon_state_stale(void)
+{
+	struct daemon_watch *w;
+	struct stat st;
+	off_t size;
+	time_t mtime;
+	int i;
+
+	for (i = 0; i < daemon_n_watches; i++) {
+		w = &daemon_watches[i];
+		if (stat(w->path, &st) == 0) {
+			size = st.st_size;
+			mtime = st.st_mtime;
+		} else {
+			size = 0;
+			mtime = 0;
+		}
+		if (size != w->size || mtime != w->mtime)
+			return 1;
+	}
+
+	return 0;
+}
+
+static int daemon_listen(void)
+{
+	struct sockaddr_un sa;
+	char *path;
+	int fd;
+
+	path = daemon_socket_path();
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(sa.sun_path)) {
+		opkg_msg(ERROR, "Socket path %s too long.\n", path);
+		free(path);
+		return -1;
+	}
+	strcpy(sa.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		opkg_perror(ERROR, "Failed to create socket");
+		free(path);
+		return -1;
+	}
+
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) == -1 ||
+	    listen(fd, 8) == -1) {
+		opkg_perror(ERROR, "Failed to listen on %s", path);
+		close(fd);
+		free(path);
+		return -1;
+	}
+
+	opkg_msg(NOTICE, "Serving commands on %s.\n", path);
+	daemon_sock_file = path;
+	return fd;
+}
+
+/*
+ * Run one forwarded command line in this (forked) process. The full
+ * client argv is re-parsed so per-invocation flags (--json, --size,
+ * force options, verbosity) land in our copy-on-write conf.
+ */
+static void daemon_exec_request(char *buf, size_t len, int *fds)
+{
+	char **req_argv;
+	opkg_cmd_t *cmd;
+	size_t off;
+	int req_argc = 0, n_args = 0, opts, i, err;
+
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGINT, SIG_DFL);
+
+	for (i = 0; i < DAEMON_STDIO_FDS; i++)
+		dup2(fds[i], i);
+
+	/* a request cut short by the transport could end mid-string;
+	 * never walk past the received bytes */
+	if (len == 0 || buf[len - 1] != '\0') {
+		fprintf(stderr, "opkg: malformed forwarded command line\n");
+		exit(1);
+	}
+
+	for (off = 0; off < len; off += strlen(buf + off) + 1)
+		n_args++;
+	req_argv = xmalloc((n_args + 1) * sizeof(req_argv[0]));
+	for (off = 0; off < len; off += strlen(buf + off) + 1)
+		req_argv[req_argc++] = buf + off;
+	req_argv[req_argc] = NULL;
+
+	optind = 1;
+	opts = req_argc > 0 ? args_parse(req_argc, req_argv) : -1;
+	if (opts < 0 || opts >= req_argc) {
+		fprintf(stderr, "opkg: bad forwarded command line\n");
+		exit(1);
+	}
+
+	cmd = opkg_cmd_find(req_argv[opts]);
+	if (cmd == NULL) {
+		fprintf(stderr, "opkg: unknown sub-command %s\n",
+			req_argv[opts]);
+		exit(1);
+	}
+
+	if (cmd->requires_args && opts + 1 >= req_argc) {
+		fprintf(stderr,
+			"opkg: the ``%s'' command requires at least one argument\n",
+			req_argv[opts]);
+		exit(1);
+	}
+
+	conf->pfm = cmd->pfm;
+	err = opkg_cmd_exec(cmd, req_argc - opts - 1,
+			    (const char **)(req_argv + opts + 1));
+	opkg_profile_print();
+	exit(err ? 1 : 0);
+}
+
+static int daemon_run(void)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char cbuf[CMSG_SPACE(DAEMON_STDIO_FDS * sizeof(int))];
+	char buf[DAEMON_MAX_REQUEST];
+	unsigned char result;
+	char overflow;
+	size_t len;
+	ssize_t n;
+	pid_t pid;
+	int listen_fd, client, wstatus, i, n_fds;
+	int fds[DAEMON_STDIO_FDS];
+
+	listen_fd = daemon_listen();
+	if (listen_fd == -1)
+		return -1;
+
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGTERM, daemon_sigterm_handler);
+	signal(SIGINT, daemon_sigterm_handler);
+
+	for (;;) {
+		client = accept(listen_fd, NULL, NULL);
+		if (client == -1) {
+			if (errno == EINTR)
+				continue;
+			opkg_perror(ERROR, "accept failed");
+			break;
+		}
+
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = buf;
+		iov.iov_len = sizeof(buf);
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = cbuf;
+		msg.msg_controllen = sizeof(cbuf);
+
+		n = recvmsg(client, &msg, 0);
+		if (n <= 0) {
+			close(client);
+			continue;
+		}
+		len = n;
+
+		n_fds = 0;
+		cmsg = CMSG_FIRSTHDR(&msg);
+		if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_RIGHTS)
+			n_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		if (n_fds != DAEMON_STDIO_FDS) {
+			close(client);
+			continue;
+		}
+		memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+		/* the rest of the request, until the client shuts down
+		 * its writing end */
+		while (len < sizeof(buf) &&
+		       (n = read(client, buf + len, sizeof(buf) - len)) > 0)
+			len += n;
+
+		/* a request that overflows the buffer or ends mid-string
+		 * must not be served truncated; closing without a status
+		 * byte makes the client fall back to a standalone run */
+		if ((len == sizeof(buf) && read(client, &overflow, 1) > 0)
+		    || buf[len - 1] != '\0') {
+			opkg_msg(ERROR,
+				 "Dropping oversized request (%zu+ bytes).\n",
+				 len);
+			for (i = 0; i < DAEMON_STDIO_FDS; i++)
+				close(fds[i]);
+			close(client);
+			continue;
+		}
+
+		/* drain our own buffered messages before forking, or the
+		 * worker would flush them into the client's stream */
+		fflush(NULL);
+
+		pid = fork();
+		if (pid == 0) {
+			close(listen_fd);
+			close(client);
+			daemon_exec_request(buf, len, fds);
+		}
+
+		for (i = 0; i < DAEMON_STDIO_FDS; i++)
+			close(fds[i]);
+
+		result = 1;
+		if (pid > 0 && waitpid(pid, &wstatus, 0) == pid
+		    && WIFEXITED(wstatus))
+			result = WEXITSTATUS(wstatus);
+
+		if (write(client, &result, 1) != 1)
+			opkg_msg(DEBUG, "Client went away.\n");
+		close(client);
+
+		/* a served install, remove or update changed the feeds
+		 * or status on disk; rebuild the resident state from
+		 * scratch before touching the next request */
+		if (daemon_state_stale()) {
+			opkg_msg(INFO, "State changed, reloading.\n");
+			close(listen_fd);
+			if (conf->tmp_dir)
+				rm_r(conf->tmp_dir);
+			execv("/proc/self/exe", daemon_argv);
+			opkg_perror(ERROR, "Failed to re-exec");
+			return -1;
+		}
+	}
+
+	close(listen_fd);
+	return 0;
+}
+
 static void usage()
 {
 	printf("usage: opkg [options...] sub-command [arguments...]\n");
@@ -279,6 +820,8 @@ static void usage()
 	printf("\tsearch <file|regexp>	List package providing <file>\n");
 	printf
 	    ("\tfind <regexp>		List packages whose name or description matches <regexp>\n");
+	printf
+	    ("\tcomplete [prefix]	List package names starting with <prefix>\n");
 	printf("\tinfo [pkg|regexp]	Display all info for <pkg>\n");
 	printf("\tstatus [pkg|regexp]	Display all status for <pkg>\n");
 	printf
@@ -288,6 +831,8 @@ static void usage()
 	    ("\t                    compare versions using <= < > >= = << >>\n");
 	printf
 	    ("\tprint-architecture	List installable package architectures\n");
+	printf
+	    ("\tstats			Print hash table, allocator and parser statistics\n");
 	printf("\tdepends [-A] [pkgname|pat]+\n");
 	printf("\twhatdepends [-A] [pkgname|pat]+\n");
 	printf("\twhatdependsrec [-A] [pkgname|pat]+\n");
@@ -322,6 +867,10 @@ static void usage()
 	printf("				directory name in a pinch).\n");
 	printf("\t-o <dir>		Use <dir> as the root directory for\n");
 	printf("\t--offline-root <dir>	offline installation of packages.\n");
+	printf
+	    ("\t--roots <dir>[,<dir>...]	Run the command against each offline root\n");
+	printf
+	    ("				in parallel; share feeds with -l and --cache\n");
 	printf
 	    ("\t--add-arch <arch>:<prio>	Register architecture with given priority\n");
 	printf
@@ -349,6 +898,22 @@ static void usage()
 	    ("\t--nocase		Perform case insensitive pattern matching\n");
 	printf
 	    ("\t--size			Print package size when listing available packages\n");
+	printf
+	    ("\t--json			Print query results as a JSON array\n");
+	printf
+	    ("\t--fields <list>		Restrict --json output to the given\n");
+	printf
+	    ("\t			comma-separated fields (e.g. name,version,size)\n");
+	printf
+	    ("\t--lowmem		Release feed metadata not needed by the\n");
+	printf
+	    ("\t			transaction before downloading and unpacking\n");
+	printf
+	    ("\t--daemon		Stay resident and serve commands over a unix\n");
+	printf
+	    ("\t			socket; later invocations forward to it\n");
+	printf
+	    ("\t--profile[=json]	Print a per-phase timing summary on stderr\n");
 	printf("\t--force-removal-of-dependent-packages\n");
 	printf("\t			Remove package and all dependencies\n");
 	printf("\t--autoremove		Remove packages that were installed\n");
@@ -386,15 +951,51 @@ int main(int argc, char *argv[])
 
 	conf->verbosity = NOTICE;
 
+	daemon_argv = argv;
+
 	opts = args_parse(argc, argv);
-	if (opts == argc || opts < 0) {
+	if ((opts == argc && !daemon_mode) || opts < 0) {
 		fprintf(stderr, "opkg must have one sub-command argument\n");
 		usage();
 	}
 
+	if (daemon_mode) {
+		if (opts != argc) {
+			fprintf(stderr,
+				"opkg: --daemon takes no sub-command\n");
+			usage();
+		}
+
+		/* the mask excludes fields; keep everything, since any
+		 * served command may need any of them */
+		conf->pfm = 0;
+
+		if (opkg_conf_load())
+			goto err0;
+		if (pkg_hash_load_feeds(SF_NEED_DETAIL))
+			goto err1;
+		if (pkg_hash_load_status_files())
+			goto err1;
+
+		daemon_watch_init();
+		err = daemon_run();
+		goto err1;
+	}
+
 	cmd_name = argv[opts++];
 
+	/* parent forks one child per root and exits in there */
+	if (bulk_roots)
+		bulk_fork();
+
+	/* hand the command to a resident daemon when one is serving */
+	err = daemon_client_run(argc, argv);
+	if (err >= 0)
+		return err;
+	err = -1;
+
 	if (!strcmp(cmd_name, "install") ||
+	    !strcmp(cmd_name, "complete") ||
 	    !strcmp(cmd_name, "print-architecture") ||
 	    !strcmp(cmd_name, "print_architecture") ||
 	    !strcmp(cmd_name, "print-installation-architecture") ||
@@ -424,9 +1025,14 @@ int main(int argc, char *argv[])
 	}
 
 	conf->pfm = cmd->pfm;
+	conf->lock_shared = !cmd->write_lock;
 
-	if (opkg_conf_load())
+	opkg_profile_begin(PROFILE_CONF_LOAD);
+	err = opkg_conf_load();
+	opkg_profile_end(PROFILE_CONF_LOAD);
+	if (err)
 		goto err0;
+	err = -1;
 
 	if (!nocheckfordirorfile) {
 		if (!noreadfeedsfile) {
@@ -447,6 +1053,8 @@ int main(int argc, char *argv[])
 
 	err = opkg_cmd_exec(cmd, argc - opts, (const char **)(argv + opts));
 
+	opkg_profile_print();
+
 err1:
 	opkg_conf_deinit();
 
@@ -0,0 +1,387 @@
+/* bench_install.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+/*
+ * End-to-end install benchmark. Generates a corpus of .ipk packages,
+ * sets up a throwaway offline root (on /dev/shm when available, so the
+ * numbers measure the pipeline and not the disk) and drives the real
+ * install path: opkg_install_multiple_by_name() over the corpus,
+ * configure, status write-out. Reports packages/sec, bytes written,
+ * fsync calls and children reaped, so changes to the
+ * extract/script/status pipeline can be compared against fleet
+ * telemetry, e.g.:
+ *
+ *	bench_install 50 40 2048
+ *
+ * fsync/sync and waitpid are interposed at static link time to count
+ * syscalls; the real calls go through syscall(2).
+ */
+
+#define _GNU_SOURCE	/* syncfs */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include <libopkg/opkg_conf.h>
+#include <libopkg/opkg_cmd.h>
+#include <libopkg/opkg_install.h>
+#include <libopkg/opkg_configure.h>
+#include <libopkg/opkg_download.h>
+#include <libopkg/pkg.h>
+#include <libopkg/pkg_hash.h>
+#include <libopkg/pkg_vec.h>
+#include <libbb/libbb.h>
+
+/* --- syscall counters ------------------------------------------------ */
+
+static long n_fsync, n_sync, n_reaped;
+
+int fsync(int fd)
+{
+	n_fsync++;
+	return syscall(SYS_fsync, fd);
+}
+
+int fdatasync(int fd)
+{
+	n_fsync++;
+	return syscall(SYS_fdatasync, fd);
+}
+
+int syncfs(int fd)
+{
+	n_sync++;
+	return syscall(SYS_syncfs, fd);
+}
+
+pid_t waitpid(pid_t pid, int *status, int options)
+{
+	pid_t ret = syscall(SYS_wait4, pid, status, options, NULL);
+
+	if (ret > 0)
+		n_reaped++;
+	return ret;
+}
+
+/* --- minimal tar/gz writer ------------------------------------------- */
+
+static void tar_header(FILE * fp, const char *name, mode_t mode, char type,
+		       size_t size)
+{
+	char hdr[512];
+	unsigned int sum = 0;
+	int i;
+
+	memset(hdr, 0, sizeof(hdr));
+	snprintf(hdr, 100, "%s", name);
+	snprintf(hdr + 100, 8, "%07o", (unsigned int)mode);
+	snprintf(hdr + 108, 8, "%07o", 0);
+	snprintf(hdr + 116, 8, "%07o", 0);
+	snprintf(hdr + 124, 12, "%011lo", (unsigned long)size);
+	snprintf(hdr + 136, 12, "%011lo", (unsigned long)time(NULL));
+	memset(hdr + 148, ' ', 8);
+	hdr[156] = type;
+	memcpy(hdr + 257, "ustar  ", 8);
+
+	for (i = 0; i < 512; i++)
+		sum += (unsigned char)hdr[i];
+	snprintf(hdr + 148, 8, "%06o", sum);
+
+	fwrite(hdr, 1, sizeof(hdr), fp);
+}
+
+static void tar_file(FILE * fp, const char *name, mode_t mode,
+		     const char *data, size_t size)
+{
+	static const char pad[512];
+
+	tar_header(fp, name, mode, '0', size);
+	fwrite(data, 1, size, fp);
+	if (size % 512)
+		fwrite(pad, 1, 512 - size % 512, fp);
+}
+
+static void tar_end(FILE * fp)
+{
+	static const char pad[1024];
+
+	fwrite(pad, 1, sizeof(pad), fp);
+}
+
+static FILE *gzip_to(const char *path)
+{
+	char cmd[4096];
+
+	snprintf(cmd, sizeof(cmd), "gzip -1 -c > %s", path);
+	return popen(cmd, "w");
+}
+
+/* --- corpus generation ----------------------------------------------- */
+
+static char *slurp(const char *path, size_t *lenp)
+{
+	struct stat st;
+	char *buf;
+	FILE *fp = fopen(path, "r");
+
+	if (!fp || fstat(fileno(fp), &st)) {
+		perror(path);
+		exit(1);
+	}
+	buf = malloc(st.st_size);
+	if (fread(buf, 1, st.st_size, fp) != (size_t)st.st_size) {
+		perror(path);
+		exit(1);
+	}
+	fclose(fp);
+	*lenp = st.st_size;
+	return buf;
+}
+
+static void write_ipk(const char *root, int idx, int n_files, int file_size)
+{
+	char path[4096], name[256], control[512];
+	char *payload, *member;
+	size_t member_len;
+	FILE *fp;
+	int f, b;
+
+	/* control.tar.gz */
+	snprintf(path, sizeof(path), "%s/tmp/member.gz", root);
+	fp = gzip_to(path);
+	snprintf(control, sizeof(control),
+		 "Package: bench-data-%04d\n"
+		 "Version: 1.0-1\n"
+		 "Architecture: all\n"
+		 "Description: install benchmark corpus\n", idx);
+	tar_file(fp, "./control", 0644, control, strlen(control));
+	if (idx % 2 == 0)
+		tar_file(fp, "./postinst", 0755, "#!/bin/sh\nexit 0\n", 17);
+	tar_end(fp);
+	pclose(fp);
+	member = slurp(path, &member_len);
+
+	snprintf(path, sizeof(path), "%s/ipk/bench-data-%04d.ipk", root, idx);
+	fp = gzip_to(path);
+	tar_file(fp, "./debian-binary", 0644, "2.0\n", 4);
+	tar_file(fp, "./control.tar.gz", 0644, member, member_len);
+	free(member);
+
+	/* data.tar.gz */
+	snprintf(path, sizeof(path), "%s/tmp/member.gz", root);
+	{
+		FILE *dp = gzip_to(path);
+
+		tar_header(dp, "./usr/", 0755, '5', 0);
+		tar_header(dp, "./usr/lib/", 0755, '5', 0);
+		tar_header(dp, "./usr/lib/bench/", 0755, '5', 0);
+		snprintf(name, sizeof(name), "./usr/lib/bench/pkg%04d/", idx);
+		tar_header(dp, name, 0755, '5', 0);
+
+		payload = malloc(file_size);
+		for (f = 0; f < n_files; f++) {
+			/* half pattern, half pseudo-noise, so gzip has
+			 * something realistic to chew on */
+			for (b = 0; b < file_size; b++)
+				payload[b] = (b < file_size / 2)
+				    ? 'a' + (b % 23)
+				    : (char)(b * 2654435761u >> (f % 13));
+			snprintf(name, sizeof(name),
+				 "./usr/lib/bench/pkg%04d/file%04d", idx, f);
+			tar_file(dp, name, 0644, payload, file_size);
+		}
+		free(payload);
+		tar_end(dp);
+		pclose(dp);
+	}
+	member = slurp(path, &member_len);
+	tar_file(fp, "./data.tar.gz", 0644, member, member_len);
+	free(member);
+
+	tar_end(fp);
+	pclose(fp);
+}
+
+/* --- benchmark ------------------------------------------------------- */
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long long proc_io_wchar(void)
+{
+	char line[128];
+	long long val = 0;
+	FILE *fp = fopen("/proc/self/io", "r");
+
+	if (!fp)
+		return 0;
+	while (fgets(line, sizeof(line), fp))
+		if (sscanf(line, "wchar: %lld", &val) == 1)
+			break;
+	fclose(fp);
+	return val;
+}
+
+static void mkdir_p(const char *root, const char *sub)
+{
+	char path[4096], *p;
+
+	snprintf(path, sizeof(path), "%s/%s", root, sub);
+	for (p = path + strlen(root) + 1; *p; p++)
+		if (*p == '/') {
+			*p = '\0';
+			mkdir(path, 0755);
+			*p = '/';
+		}
+	mkdir(path, 0755);
+}
+
+static void configure_all(void)
+{
+	pkg_vec_t *all = pkg_vec_alloc();
+	pkg_t *pkg;
+	unsigned int i;
+
+	pkg_hash_fetch_available(all);
+	for (i = 0; i < all->len; i++) {
+		pkg = all->pkgs[i];
+		if (pkg->state_status == SS_UNPACKED
+		    && opkg_configure(pkg) == 0) {
+			pkg->state_status = SS_INSTALLED;
+			pkg->parent->state_status = SS_INSTALLED;
+		}
+	}
+	pkg_vec_free(all);
+}
+
+int main(int argc, char *argv[])
+{
+	char root[] = "/dev/shm/bench_install.XXXXXX";
+	char path[4096], cmd[4096];
+	char **names;
+	struct rusage ru;
+	double t0, t1;
+	long long w0, w1;
+	int i, err = 0;
+	int n_pkgs = 50, n_files = 40, file_size = 2048;
+	FILE *fp;
+
+	if (argc > 1)
+		n_pkgs = atoi(argv[1]);
+	if (argc > 2)
+		n_files = atoi(argv[2]);
+	if (argc > 3)
+		file_size = atoi(argv[3]);
+
+	if (n_pkgs <= 0 || n_files <= 0 || file_size <= 0) {
+		fprintf(stderr, "Usage: %s [n_pkgs] [files_per_pkg] [file_size]\n",
+			argv[0]);
+		return 1;
+	}
+
+	if (access("/dev/shm", W_OK) != 0)
+		memcpy(root, "/tmp/////", 9);
+
+	if (mkdtemp(root) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+
+	mkdir_p(root, "etc/opkg");
+	mkdir_p(root, "usr/lib/opkg/info");
+	mkdir_p(root, "usr/lib/opkg/lists");
+	mkdir_p(root, "var/lock");
+	mkdir_p(root, "tmp");
+	mkdir_p(root, "ipk");
+
+	snprintf(path, sizeof(path), "%s/usr/lib/opkg/status", root);
+	fclose(fopen(path, "w"));
+
+	snprintf(path, sizeof(path), "%s/etc/opkg/opkg.conf", root);
+	fp = fopen(path, "w");
+	fprintf(fp, "dest root /\narch all 100\n");
+	fclose(fp);
+
+	printf("generating %d packages (%d files x %d bytes each)...\n",
+	       n_pkgs, n_files, file_size);
+	for (i = 0; i < n_pkgs; i++)
+		write_ipk(root, i, n_files, file_size);
+
+	opkg_conf_init();
+	conf->conf_file = xstrdup(path);
+	conf->offline_root = xstrdup(root);
+	conf->force_postinstall = 1;	/* run the corpus postinsts */
+
+	if (opkg_conf_load()) {
+		fprintf(stderr, "Failed to load conf from %s\n", path);
+		return 1;
+	}
+	pkg_hash_init();
+	pkg_hash_load_status_files();
+
+	names = calloc(n_pkgs, sizeof(names[0]));
+	for (i = 0; i < n_pkgs; i++) {
+		snprintf(cmd, sizeof(cmd), "%s/ipk/bench-data-%04d.ipk",
+			 root, i);
+		if (opkg_prepare_url_for_install(cmd, &names[i])) {
+			fprintf(stderr, "Failed to stage %s\n", cmd);
+			return 1;
+		}
+	}
+
+	pkg_hash_load_package_details();
+	pkg_info_preinstall_check();
+
+	n_fsync = n_sync = n_reaped = 0;
+	w0 = proc_io_wchar();
+	t0 = now();
+
+	err = opkg_install_multiple_by_name(n_pkgs, names);
+	configure_all();
+	opkg_conf_write_status_files();
+	pkg_write_changed_filelists();
+
+	t1 = now();
+	w1 = proc_io_wchar();
+
+	getrusage(RUSAGE_SELF, &ru);
+
+	printf("root:          %s\n", root);
+	printf("packages:      %d (%d files each)  err=%d\n",
+	       n_pkgs, n_files, err);
+	printf("install:       %.3f sec, %.1f pkgs/sec, %.1f files/sec\n",
+	       t1 - t0, n_pkgs / (t1 - t0),
+	       (double)n_pkgs * n_files / (t1 - t0));
+	printf("bytes written: %.1f MiB (%.1f MiB/sec)\n",
+	       (w1 - w0) / 1048576.0, (w1 - w0) / 1048576.0 / (t1 - t0));
+	printf("fsync calls:   %ld (+%ld syncfs)\n", n_fsync, n_sync);
+	printf("children:      %ld reaped\n", n_reaped);
+	printf("peak RSS:      %ld KiB\n", ru.ru_maxrss);
+
+	opkg_conf_deinit();
+
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", root);
+	return system(cmd) ? 1 : (err ? 1 : 0);
+}
@@ -0,0 +1,132 @@
+/* bench_parse.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+/*
+ * Feed parsing / hash loading benchmark. Generates a synthetic package
+ * list with the requested number of stanzas, loads it through
+ * pkg_hash_add_from_file() and reports throughput plus memory use, so
+ * parser changes can be gated on measured numbers, e.g.:
+ *
+ *	bench_parse 10000
+ *	bench_parse 100000
+ *	bench_parse 500000
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include <libopkg/opkg_conf.h>
+#include <libopkg/pkg.h>
+#include <libopkg/pkg_hash.h>
+#include <libopkg/hash_table.h>
+#include <libopkg/nv_pair_list.h>
+
+static const char *sections[] = {
+	"base", "net", "utils", "libs", "kernel", "lang", "sound", "admin",
+};
+
+static void write_feed(FILE * fp, int n_stanzas)
+{
+	int i;
+
+	for (i = 0; i < n_stanzas; i++) {
+		fprintf(fp,
+			"Package: bench-pkg-%07d\n"
+			"Version: 1.%d-%d\n"
+			"Depends: libc, bench-pkg-%07d, libbench%d\n"
+			"Provides: virtual-bench-%d\n"
+			"Section: %s\n"
+			"Architecture: all\n"
+			"Installed-Size: %d\n"
+			"Filename: bench-pkg-%07d_1.%d-%d_all.ipk\n"
+			"Size: %d\n"
+			"Description: synthetic stanza %d for parser "
+			"benchmarking\n"
+			"\n",
+			i, i % 97, i % 7, (i * 31) % n_stanzas, i % 13,
+			i % 1024, sections[i % 8], 1000 + i % 9000, i, i % 97,
+			i % 7, 500 + i % 4500, i);
+	}
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+	char feed_file[] = "/tmp/bench_parse.XXXXXX";
+	struct rusage ru;
+	FILE *fp;
+	double t0, t1;
+	int fd, n_stanzas = 10000;
+
+	if (argc > 1)
+		n_stanzas = atoi(argv[1]);
+
+	if (n_stanzas <= 0) {
+		fprintf(stderr, "Usage: %s [n_stanzas]\n", argv[0]);
+		return 1;
+	}
+
+	fd = mkstemp(feed_file);
+	if (fd == -1) {
+		perror("mkstemp");
+		return 1;
+	}
+
+	fp = fdopen(fd, "w");
+	write_feed(fp, n_stanzas);
+	fclose(fp);
+
+	opkg_conf_init();
+	nv_pair_list_append(&conf->arch_list, "all", "1");
+	opkg_conf_flatten_arch_list();
+	hash_table_init("str-hash", &conf->str_hash,
+			OPKG_CONF_DEFAULT_HASH_LEN);
+	pkg_hash_init();
+
+	t0 = now();
+
+	if (pkg_hash_add_from_file(feed_file, NULL, NULL, 0, SF_NEED_DETAIL)) {
+		fprintf(stderr, "Failed to load %s\n", feed_file);
+		unlink(feed_file);
+		return 1;
+	}
+
+	t1 = now();
+
+	getrusage(RUSAGE_SELF, &ru);
+
+	printf("stanzas:      %d\n", n_stanzas);
+	printf("elapsed:      %.3f s\n", t1 - t0);
+	printf("stanzas/sec:  %.0f\n", n_stanzas / (t1 - t0));
+	printf("peak RSS:     %ld KiB\n", ru.ru_maxrss);
+	hash_print_stats(&conf->pkg_hash);
+	hash_print_stats(&conf->str_hash);
+
+	pkg_hash_deinit();
+	hash_table_deinit(&conf->str_hash);
+	nv_pair_list_deinit(&conf->arch_list);
+	unlink(feed_file);
+
+	return 0;
+}
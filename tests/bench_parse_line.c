@@ -0,0 +1,285 @@
+/* bench_parse_line.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+/*
+ * Parser micro-benchmark and fuzz entry point. Unlike libopkg_test
+ * this needs no conf file and no feeds: generated stanza corpora -
+ * normal, huge-field, many-version - are pushed straight through
+ * pkg_parse_line() and parse_version() with cycle-accurate timing and
+ * x*alloc counts, so parser changes can be profiled in isolation and
+ * gated on measured numbers, e.g.:
+ *
+ *	bench_parse_line                # all corpora
+ *	bench_parse_line huge 5000      # one corpus, 5000 stanzas
+ *	bench_parse_line - < corpus     # raw lines from a file; this is
+ *	                                # also the afl-style fuzz entry
+ */
+
+#define _GNU_SOURCE		/* asprintf */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <libbb/libbb.h>
+#include <libopkg/opkg_conf.h>
+#include <libopkg/pkg.h>
+#include <libopkg/pkg_parse.h>
+#include <libopkg/pkg_hash.h>
+#include <libopkg/hash_table.h>
+#include <libopkg/nv_pair_list.h>
+
+static unsigned long long cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned int lo, hi;
+
+	__asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((unsigned long long)hi << 32) | lo;
+#elif defined(__aarch64__)
+	unsigned long long v;
+
+	__asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(v));
+	return v;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* a typical feed stanza */
+static char *gen_normal(int i)
+{
+	char *s;
+
+	if (asprintf(&s,
+		     "Package: bench-pkg-%07d\n"
+		     "Version: 1.%d-%d\n"
+		     "Depends: libc, bench-pkg-%07d, libbench%d\n"
+		     "Provides: virtual-bench-%d\n"
+		     "Section: utils\n"
+		     "Architecture: all\n"
+		     "Installed-Size: %d\n"
+		     "Filename: bench-pkg-%07d_1.%d-%d_all.ipk\n"
+		     "Size: %d\n"
+		     "Description: synthetic stanza %d for parser "
+		     "benchmarking\n",
+		     i, i % 97, i % 7, i * 31, i % 13, i % 1024,
+		     1000 + i % 9000, i, i % 97, i % 7, 500 + i % 4500,
+		     i) < 0)
+		exit(1);
+
+	return s;
+}
+
+/* a kernel-metapackage shape: one Depends line around 10 KB long */
+static char *gen_huge(int i)
+{
+	char buf[64], *s;
+	int j, len = 0, cap = 16384;
+
+	s = malloc(cap);
+	len += sprintf(s, "Package: bench-meta-%07d\nVersion: %d.0-1\n"
+		       "Depends:", i, i % 9);
+
+	for (j = 0; j < 400; j++) {
+		int n = sprintf(buf, "%s kmod-bench-%03d (>= 4.19.%d-%d)",
+				j ? "," : "", j, (i + j) % 260, j % 9 + 1);
+		if (len + n + 32 > cap)
+			exit(1);
+		memcpy(s + len, buf, n + 1);
+		len += n;
+	}
+
+	len += sprintf(s + len, "\nArchitecture: all\n");
+	(void)len;
+
+	return s;
+}
+
+/* versioned constraints on every dependency, so parse_version and the
+   constraint parser dominate */
+static char *gen_versions(int i)
+{
+	char buf[96], *s;
+	int j, len = 0, cap = 32768;
+
+	s = malloc(cap);
+	len += sprintf(s, "Package: bench-ver-%07d\n"
+		       "Version: %d:%d.%d.%d.%d-r%d\nDepends:",
+		       i, i % 3, i % 9, i % 97, i % 997, i % 89, i % 23);
+
+	for (j = 0; j < 200; j++) {
+		int n = sprintf(buf,
+				"%s libver%03d (%s %d:%d.%d.%d-alpha%d)",
+				j ? "," : "", j,
+				(j % 3 == 0) ? ">=" : (j % 3 == 1) ? "<<" : "=",
+				j % 2, j % 8, (i + j) % 30, j % 12, j % 5);
+		if (len + n + 16 > cap)
+			exit(1);
+		memcpy(s + len, buf, n + 1);
+		len += n;
+	}
+
+	len += sprintf(s + len, "\n");
+	(void)len;
+
+	return s;
+}
+
+/* Feed one stanza through pkg_parse_line() the way the real loaders
+   do: line by line, on a mutable buffer, into a fresh pkg. */
+static unsigned long parse_stanza(char *stanza)
+{
+	pkg_t *pkg = pkg_new();
+	unsigned long n_lines = 0;
+	char *line = stanza, *nl;
+
+	while (line && *line) {
+		nl = strchr(line, '\n');
+		if (nl)
+			*nl = '\0';
+		pkg_parse_line(pkg, line, PFM_ALL);
+		n_lines++;
+		line = nl ? nl + 1 : NULL;
+	}
+
+	pkg_free(pkg);
+	return n_lines;
+}
+
+static void run_corpus(const char *name, char *(*gen)(int), int n_stanzas)
+{
+	unsigned long long c0, c1, a0, b0;
+	unsigned long n_lines = 0, n_bytes = 0;
+	double t0, t1;
+	char *stanza;
+	int i;
+
+	a0 = xalloc_count;
+	b0 = xalloc_bytes;
+	t0 = now();
+	c0 = cycles();
+
+	for (i = 0; i < n_stanzas; i++) {
+		stanza = gen(i);
+		n_bytes += strlen(stanza);
+		n_lines += parse_stanza(stanza);
+		free(stanza);
+	}
+
+	c1 = cycles();
+	t1 = now();
+
+	printf("%-14s %8d stanzas  %9.0f lines/s  %6.0f cyc/line  "
+	       "%5.1f allocs/stanza  %6.0f B/stanza  %.1f MB/s\n",
+	       name, n_stanzas, n_lines / (t1 - t0),
+	       (double)(c1 - c0) / n_lines,
+	       (double)(xalloc_count - a0) / n_stanzas,
+	       (double)(xalloc_bytes - b0) / n_stanzas,
+	       n_bytes / (t1 - t0) / 1e6);
+}
+
+static void run_parse_version(int n_versions)
+{
+	unsigned long long c0, c1;
+	char v[64];
+	double t0, t1;
+	pkg_t *pkg = NULL;
+	int i;
+
+	t0 = now();
+	c0 = cycles();
+
+	for (i = 0; i < n_versions; i++) {
+		if ((i & 255) == 0) {
+			if (pkg)
+				pkg_free(pkg);
+			pkg = pkg_new();
+		}
+		sprintf(v, "%d:%d.%d.%d.%d-alpha%d.r%d", i % 3, i % 9,
+			i % 97, i % 997, i % 89, i % 7, i % 23);
+		parse_version(pkg, v);
+	}
+
+	c1 = cycles();
+	t1 = now();
+	if (pkg)
+		pkg_free(pkg);
+
+	printf("%-14s %8d versions %9.0f versions/s  %6.0f cyc/version\n",
+	       "parse_version", n_versions, n_versions / (t1 - t0),
+	       (double)(c1 - c0) / n_versions);
+}
+
+/* raw lines from stdin; harmless on garbage, so a fuzzer can drive it */
+static int run_stdin(void)
+{
+	char line[EXCESSIVE_LINE_LEN];
+	pkg_t *pkg = pkg_new();
+	unsigned long n_lines = 0;
+
+	while (fgets(line, sizeof(line), stdin)) {
+		line[strcspn(line, "\n")] = '\0';
+		if (!line[0]) {
+			pkg_free(pkg);
+			pkg = pkg_new();
+			continue;
+		}
+		pkg_parse_line(pkg, line, PFM_ALL);
+		n_lines++;
+	}
+
+	pkg_free(pkg);
+	fprintf(stderr, "parsed %lu lines\n", n_lines);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *which = argc > 1 ? argv[1] : "all";
+	int n = argc > 2 ? atoi(argv[2]) : 0;
+
+	opkg_conf_init();
+	nv_pair_list_append(&conf->arch_list, "all", "1");
+	opkg_conf_flatten_arch_list();
+	hash_table_init("str-hash", &conf->str_hash,
+			OPKG_CONF_DEFAULT_HASH_LEN);
+	pkg_hash_init();
+
+	if (!strcmp(which, "-"))
+		return run_stdin();
+
+	if (!strcmp(which, "all") || !strcmp(which, "normal"))
+		run_corpus("normal", gen_normal, n ? n : 100000);
+	if (!strcmp(which, "all") || !strcmp(which, "huge"))
+		run_corpus("huge-field", gen_huge, n ? n : 2000);
+	if (!strcmp(which, "all") || !strcmp(which, "versions"))
+		run_corpus("many-version", gen_versions, n ? n : 5000);
+	if (!strcmp(which, "all") || !strcmp(which, "parse_version"))
+		run_parse_version(n ? n : 1000000);
+
+	return 0;
+}
@@ -0,0 +1,204 @@
+/* bench_resolve.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+/*
+ * Dependency-resolution benchmark. Loads a synthetic feed and then,
+ * for transactions of 10/100/1000 root packages, resolves the best
+ * installation candidate of every root and expands the dependency
+ * closure the same way the install worklist does, without unpacking
+ * anything. Reports resolved packages/sec per transaction size plus
+ * peak memory, so resolver changes (candidate memoization, worklist
+ * mode) can be gated on measured numbers, e.g.:
+ *
+ *	bench_resolve 50000
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include <libopkg/opkg_conf.h>
+#include <libopkg/pkg.h>
+#include <libopkg/pkg_hash.h>
+#include <libopkg/pkg_depends.h>
+#include <libopkg/pkg_vec.h>
+#include <libopkg/hash_table.h>
+#include <libopkg/nv_pair_list.h>
+
+static void write_feed(FILE * fp, int n_stanzas)
+{
+	int i;
+
+	for (i = 0; i < n_stanzas; i++) {
+		/* two in-feed dependencies with smaller indexes, so
+		 * closures are acyclic chains of varying depth, plus a
+		 * versioned constraint to exercise that path */
+		fprintf(fp,
+			"Package: bench-pkg-%07d\n"
+			"Version: 1.%d-%d\n",
+			i, i % 97, i % 7);
+
+		if (i > 1)
+			fprintf(fp,
+				"Depends: bench-pkg-%07d, bench-pkg-%07d (>= 1.0)\n",
+				i / 2, (i * 7) % i);
+
+		fprintf(fp,
+			"Architecture: all\n"
+			"Filename: bench-pkg-%07d_1.%d-%d_all.ipk\n"
+			"Size: %d\n"
+			"\n", i, i % 97, i % 7, 500 + i % 4500);
+	}
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Resolve one transaction of n_roots packages: fetch each root's best
+ * installation candidate, then expand the closure with the same
+ * worklist walk opkg_install_multiple_by_name() uses. Returns the
+ * closure size.
+ */
+static int resolve_transaction(int base, int n_roots, int n_stanzas)
+{
+	pkg_vec_t *closure = pkg_vec_alloc();
+	pkg_vec_t *depends;
+	pkg_t *pkg;
+	char name[32], **tmp, **unresolved;
+	unsigned int w;
+	int i, n;
+
+	for (i = 0; i < n_roots; i++) {
+		snprintf(name, sizeof(name), "bench-pkg-%07d",
+			 (base + i * 7919) % n_stanzas);
+
+		pkg = pkg_hash_fetch_best_installation_candidate_by_name(name);
+		if (!pkg)
+			continue;
+
+		if (!pkg_vec_contains(closure, pkg))
+			pkg_vec_insert(closure, pkg);
+	}
+
+	for (w = 0; w < closure->len; w++) {
+		depends = pkg_vec_alloc();
+		unresolved = NULL;
+		pkg_hash_fetch_unsatisfied_dependencies(closure->pkgs[w],
+							depends, &unresolved);
+
+		if (unresolved) {
+			for (tmp = unresolved; *tmp; tmp++)
+				free(*tmp);
+			free(unresolved);
+		}
+
+		for (i = 0; i < depends->len; i++)
+			if (!pkg_vec_contains(closure, depends->pkgs[i]))
+				pkg_vec_insert(closure, depends->pkgs[i]);
+
+		pkg_vec_free(depends);
+	}
+
+	n = closure->len;
+	pkg_vec_free(closure);
+
+	return n;
+}
+
+int main(int argc, char *argv[])
+{
+	static const int txn_sizes[] = { 10, 100, 1000 };
+	char feed_file[] = "/tmp/bench_resolve.XXXXXX";
+	struct rusage ru;
+	FILE *fp;
+	double t0, t1;
+	int fd, n_stanzas = 50000;
+	int resolved, rounds, base;
+	unsigned int s;
+
+	if (argc > 1)
+		n_stanzas = atoi(argv[1]);
+
+	if (n_stanzas <= 0) {
+		fprintf(stderr, "Usage: %s [n_stanzas]\n", argv[0]);
+		return 1;
+	}
+
+	fd = mkstemp(feed_file);
+	if (fd == -1) {
+		perror("mkstemp");
+		return 1;
+	}
+
+	fp = fdopen(fd, "w");
+	write_feed(fp, n_stanzas);
+	fclose(fp);
+
+	opkg_conf_init();
+	nv_pair_list_append(&conf->arch_list, "all", "1");
+	opkg_conf_flatten_arch_list();
+	hash_table_init("str-hash", &conf->str_hash,
+			OPKG_CONF_DEFAULT_HASH_LEN);
+	pkg_hash_init();
+
+	if (pkg_hash_add_from_file(feed_file, NULL, NULL, 0, SF_NEED_DETAIL)) {
+		fprintf(stderr, "Failed to load %s\n", feed_file);
+		unlink(feed_file);
+		return 1;
+	}
+
+	printf("stanzas:      %d\n", n_stanzas);
+
+	for (s = 0; s < sizeof(txn_sizes) / sizeof(txn_sizes[0]); s++) {
+		resolved = 0;
+
+		/* distinct roots per round so the timing covers cold
+		 * lookups, not just the memo caches */
+		rounds = n_stanzas / txn_sizes[s] / 2;
+		if (rounds < 1)
+			rounds = 1;
+		if (rounds > 50)
+			rounds = 50;
+
+		t0 = now();
+		for (base = 0; base < rounds; base++)
+			resolved += resolve_transaction(base * txn_sizes[s],
+							txn_sizes[s],
+							n_stanzas);
+		t1 = now();
+
+		printf("txn=%-5d rounds=%-3d resolved=%-7d %.0f resolutions/sec\n",
+		       txn_sizes[s], rounds, resolved,
+		       resolved / (t1 - t0));
+	}
+
+	getrusage(RUSAGE_SELF, &ru);
+	printf("peak RSS:     %ld KiB\n", ru.ru_maxrss);
+	hash_print_stats(&conf->pkg_hash);
+
+	pkg_hash_deinit();
+	hash_table_deinit(&conf->str_hash);
+	nv_pair_list_deinit(&conf->arch_list);
+	unlink(feed_file);
+
+	return 0;
+}
@@ -0,0 +1,145 @@
+/* opkg_delta_test.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <opkg_delta.h>
+
+static char *write_tmp(const char *buf, size_t len)
+{
+	char *name = strdup("/tmp/opkg_delta_test.XXXXXX");
+	int fd = mkstemp(name);
+	FILE *f;
+
+	if (fd < 0) {
+		perror("mkstemp");
+		exit(1);
+	}
+	f = fdopen(fd, "w");
+	if (fwrite(buf, 1, len, f) != len || fclose(f)) {
+		perror("write");
+		exit(1);
+	}
+	return name;
+}
+
+static char *read_all(const char *name, size_t * lenp)
+{
+	FILE *f = fopen(name, "r");
+	char *buf;
+	long len;
+
+	if (!f) {
+		perror(name);
+		exit(1);
+	}
+	fseek(f, 0, SEEK_END);
+	len = ftell(f);
+	rewind(f);
+	buf = malloc(len ? len : 1);
+	if (fread(buf, 1, len, f) != (size_t) len) {
+		perror(name);
+		exit(1);
+	}
+	fclose(f);
+	*lenp = len;
+	return buf;
+}
+
+static long file_size(const char *name)
+{
+	FILE *f = fopen(name, "r");
+	long len;
+
+	fseek(f, 0, SEEK_END);
+	len = ftell(f);
+	fclose(f);
+	return len;
+}
+
+/* round-trip: make a delta between two mostly-identical blobs, apply
+ * it, and require a byte-identical result that transferred less than
+ * the full new blob */
+int main(void)
+{
+	size_t base_len = 512 * 1024, got_len, i;
+	char *base_buf = malloc(base_len);
+	char *new_buf = malloc(base_len + 100);
+	size_t new_len;
+	char *base, *new, *delta, *out, *got;
+	int failed = 0;
+
+	srandom(42);
+	for (i = 0; i < base_len; i++)
+		base_buf[i] = random();
+
+	/* the "rebuilt" blob: a changed region in the middle, a few
+	 * inserted bytes, the rest untouched */
+	memcpy(new_buf, base_buf, base_len);
+	for (i = 100 * 1024; i < 110 * 1024; i++)
+		new_buf[i] = random();
+	memmove(new_buf + 300 * 1024 + 100, new_buf + 300 * 1024,
+		base_len - 300 * 1024);
+	for (i = 0; i < 100; i++)
+		new_buf[300 * 1024 + i] = random();
+	new_len = base_len + 100;
+
+	base = write_tmp(base_buf, base_len);
+	new = write_tmp(new_buf, new_len);
+	delta = write_tmp("", 0);
+	out = write_tmp("", 0);
+
+	if (opkg_delta_make(base, new, delta)) {
+		fprintf(stderr, "opkg_delta_make failed\n");
+		return 1;
+	}
+
+	if (opkg_delta_apply(base, delta, out)) {
+		fprintf(stderr, "opkg_delta_apply failed\n");
+		return 1;
+	}
+
+	got = read_all(out, &got_len);
+	if (got_len != new_len || memcmp(got, new_buf, new_len)) {
+		fprintf(stderr, "reconstructed file differs\n");
+		failed = 1;
+	}
+
+	if (file_size(delta) >= (long)new_len) {
+		fprintf(stderr, "delta (%ld bytes) not smaller than "
+			"target (%zu bytes)\n", file_size(delta), new_len);
+		failed = 1;
+	}
+
+	/* a truncated delta must fail cleanly and leave no output */
+	if (truncate(delta, file_size(delta) / 2)) {
+		perror("truncate");
+		return 1;
+	}
+	if (opkg_delta_apply(base, delta, out) == 0) {
+		fprintf(stderr, "apply of truncated delta succeeded\n");
+		failed = 1;
+	}
+
+	unlink(base);
+	unlink(new);
+	unlink(delta);
+	unlink(out);
+
+	if (!failed)
+		printf("delta round-trip ok\n");
+	return failed;
+}